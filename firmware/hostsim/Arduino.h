@@ -0,0 +1,117 @@
+#ifndef __HOSTSIM_ARDUINO_H
+#define __HOSTSIM_ARDUINO_H
+
+// Just enough of the Arduino core to build the driver on a Linux host.
+// Time is simulated, it only moves when the driver waits or clocks SPI.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <algorithm>
+#include <string>
+
+#define HIGH        (0x1)
+#define LOW         (0x0)
+#define INPUT       (0x0)
+#define OUTPUT      (0x1)
+
+#define LSBFIRST    (0)
+#define MSBFIRST    (1)
+
+#define DEC         (10)
+#define HEX         (16)
+#define BIN         (2)
+
+using std::min;
+using std::max;
+#define PROGMEM
+#define memcpy_P                    memcpy
+#define pgm_read_dword(addr)        (*(const uint32_t *)(addr))
+
+static inline size_t strlcpy(char * dst, const char * src, size_t size) {
+  size_t len = strlen(src);
+  if (size > 0) { size_t n = len < size - 1? len : size - 1; memcpy(dst, src, n); dst[n] = 0; }
+  return len;
+}
+
+#define constrain(amt, low, high)   ((amt) < (low)? (low) : ((amt) > (high)? (high) : (amt)))
+
+// Simulated clock
+uint64_t hostsim_now();
+void hostsim_elapse(uint64_t ns);
+
+// Daisy chain UART of a board, the host clocks bytes around the ring at the line rate
+size_t hostsim_uartwrite(uint8_t board, const uint8_t * data, size_t len);
+size_t hostsim_uartread(uint8_t board, uint8_t * data, size_t len);
+size_t hostsim_uartavailable(uint8_t board);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+uint32_t esp_random();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+
+// FreeRTOS, single threaded here so the bus lock never contends
+typedef void * SemaphoreHandle_t;
+#define portMAX_DELAY   (0xFFFFFFFF)
+static inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() { return (SemaphoreHandle_t)1; }
+static inline int xSemaphoreTakeRecursive(SemaphoreHandle_t m, uint32_t ticks) { return 1; }
+static inline int xSemaphoreGiveRecursive(SemaphoreHandle_t m) { return 1; }
+
+class String {
+public:
+  String(const char * s ="") : s(s == NULL? "" : s) {}
+  String(const std::string& s) : s(s) {}
+  String(long v) : s(std::to_string(v)) {}
+  const char * c_str() const { return s.c_str(); }
+  unsigned int length() const { return s.size(); }
+  long toInt() const { return strtol(s.c_str(), NULL, 10); }
+  float toFloat() const { return strtof(s.c_str(), NULL); }
+  bool equals(const char * o) const { return s == o; }
+  bool operator==(const char * o) const { return s == o; }
+  bool operator==(const String& o) const { return s == o.s; }
+  bool operator!=(const char * o) const { return s != o; }
+  String& operator+=(const char * o) { s += o; return *this; }
+  String& operator+=(const String& o) { s += o.s; return *this; }
+  String operator+(const char * o) const { return String(s + o); }
+private:
+  std::string s;
+};
+
+class EspClass {
+public:
+  uint32_t getCycleCount();
+  uint32_t getCpuFreqMHz();
+};
+extern EspClass ESP;
+
+// Console on the host binary, board.cpp puts it on the daisy chain like the real UART
+class HostSerial {
+public:
+  void begin(unsigned long baud) {}
+  void flush() {}
+  size_t write(uint8_t b) { return write(&b, 1); }
+  size_t write(const uint8_t * data, size_t len);
+  int available();
+  size_t readBytes(uint8_t * data, size_t len);
+  size_t print(const char * s);
+  size_t print(long v, int base =DEC);
+  size_t print(double v, int digits =2);
+  size_t println(const char * s);
+  size_t println(long v, int base =DEC);
+  size_t println(double v, int digits =2);
+  size_t println();
+  size_t printf(const char * fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+extern HostSerial Serial;
+
+#endif
@@ -0,0 +1,517 @@
+#ifndef __HOSTSIM_ARDUINOJSON_H
+#define __HOSTSIM_ARDUINOJSON_H
+
+// The part of the ArduinoJson 5 API the firmware uses, enough to run the command
+// queues, SETCONFIG and the lowcom replies on the host. Strings are always copied
+// into the buffer and the capacity of a StaticJsonBuffer is not enforced.
+
+#include <Arduino.h>
+#include <Print.h>
+#include <deque>
+#include <vector>
+#include <string>
+#include <type_traits>
+
+class JsonBuffer;
+class JsonObject;
+class JsonArray;
+class JsonVariant;
+
+template<typename T> struct JsonAs { typedef T type; };
+template<> struct JsonAs<JsonObject> { typedef JsonObject& type; };
+template<> struct JsonAs<JsonArray> { typedef JsonArray& type; };
+template<> struct JsonAs<JsonObject&> { typedef JsonObject& type; };
+template<> struct JsonAs<JsonArray&> { typedef JsonArray& type; };
+
+template<typename T, typename Enable = void> struct JsonConvert;
+
+class JsonVariant {
+public:
+  typedef enum { J_UNDEFINED, J_NULL, J_BOOL, J_INT, J_FLOAT, J_STRING, J_OBJECT, J_ARRAY } jtype;
+
+  JsonVariant() : type(J_UNDEFINED) { v.i = 0; }
+  JsonVariant(bool b) : type(J_BOOL) { v.i = b; }
+  JsonVariant(char i) : type(J_INT) { v.i = i; }
+  JsonVariant(signed char i) : type(J_INT) { v.i = i; }
+  JsonVariant(unsigned char i) : type(J_INT) { v.i = i; }
+  JsonVariant(short i) : type(J_INT) { v.i = i; }
+  JsonVariant(unsigned short i) : type(J_INT) { v.i = i; }
+  JsonVariant(int i) : type(J_INT) { v.i = i; }
+  JsonVariant(unsigned int i) : type(J_INT) { v.i = i; }
+  JsonVariant(long i) : type(J_INT) { v.i = i; }
+  JsonVariant(unsigned long i) : type(J_INT) { v.i = (long long)i; }
+  JsonVariant(long long i) : type(J_INT) { v.i = i; }
+  JsonVariant(float f) : type(J_FLOAT) { v.f = f; }
+  JsonVariant(double f) : type(J_FLOAT) { v.f = f; }
+  JsonVariant(const char * s) : type(s == NULL? J_NULL : J_STRING) { v.s = s; }
+  JsonVariant(const String& s) : type(J_STRING) { v.s = s.c_str(); }
+  JsonVariant(JsonObject& o) : type(J_OBJECT) { v.o = &o; }
+  JsonVariant(JsonArray& a) : type(J_ARRAY) { v.a = &a; }
+
+  template<typename T> typename JsonAs<T>::type as() const { return JsonConvert<T>::from(*this); }
+  template<typename T> bool is() const { return JsonConvert<T>::is(*this); }
+  bool success() const { return type != J_UNDEFINED; }
+
+  size_t printTo(Print& p) const;
+  size_t printTo(String& s) const;
+  size_t printTo(char * buf, size_t size) const;
+
+  long long asInteger() const {
+    switch (type) {
+      case J_BOOL: case J_INT:  return v.i;
+      case J_FLOAT:             return (long long)v.f;
+      case J_STRING:            return strtoll(v.s, NULL, 10);
+      default:                  return 0;
+    }
+  }
+  double asFloat() const {
+    switch (type) {
+      case J_BOOL: case J_INT:  return (double)v.i;
+      case J_FLOAT:             return v.f;
+      case J_STRING:            return strtod(v.s, NULL);
+      default:                  return 0.0;
+    }
+  }
+  bool asBool() const {
+    switch (type) {
+      case J_BOOL: case J_INT:  return v.i != 0;
+      case J_FLOAT:             return v.f != 0.0;
+      case J_STRING:            return strcmp(v.s, "true") == 0;
+      default:                  return false;
+    }
+  }
+  const char * asString() const { return type == J_STRING? v.s : NULL; }
+  String asText() const;
+  JsonObject& asObject() const;
+  JsonArray& asArray() const;
+
+  jtype type;
+  union {
+    long long i;
+    double f;
+    const char * s;
+    JsonObject * o;
+    JsonArray * a;
+  } v;
+};
+
+template<typename T> struct JsonConvert<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type> {
+  static T from(const JsonVariant& v) { return (T)v.asInteger(); }
+  static bool is(const JsonVariant& v) { return v.type == JsonVariant::J_INT; }
+};
+template<typename T> struct JsonConvert<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+  static T from(const JsonVariant& v) { return (T)v.asFloat(); }
+  static bool is(const JsonVariant& v) { return v.type == JsonVariant::J_INT || v.type == JsonVariant::J_FLOAT; }
+};
+template<> struct JsonConvert<bool> {
+  static bool from(const JsonVariant& v) { return v.asBool(); }
+  static bool is(const JsonVariant& v) { return v.type == JsonVariant::J_BOOL; }
+};
+template<> struct JsonConvert<const char *> {
+  static const char * from(const JsonVariant& v) { return v.asString(); }
+  static bool is(const JsonVariant& v) { return v.type == JsonVariant::J_STRING; }
+};
+template<> struct JsonConvert<char *> {
+  static char * from(const JsonVariant& v) { return (char *)v.asString(); }
+  static bool is(const JsonVariant& v) { return v.type == JsonVariant::J_STRING; }
+};
+template<> struct JsonConvert<String> {
+  static String from(const JsonVariant& v) { return v.asText(); }
+  static bool is(const JsonVariant& v) { return v.type == JsonVariant::J_STRING; }
+};
+template<> struct JsonConvert<JsonObject> {
+  static JsonObject& from(const JsonVariant& v) { return v.asObject(); }
+  static bool is(const JsonVariant& v) { return v.type == JsonVariant::J_OBJECT; }
+};
+template<> struct JsonConvert<JsonObject&> : JsonConvert<JsonObject> {};
+template<> struct JsonConvert<JsonArray> {
+  static JsonArray& from(const JsonVariant& v) { return v.asArray(); }
+  static bool is(const JsonVariant& v) { return v.type == JsonVariant::J_ARRAY; }
+};
+template<> struct JsonConvert<JsonArray&> : JsonConvert<JsonArray> {};
+
+class JsonPair {
+public:
+  const char * key;
+  JsonVariant value;
+};
+
+class JsonObjectSubscript;
+
+class JsonObject {
+public:
+  explicit JsonObject(JsonBuffer * buffer) : buffer(buffer) {}
+  static JsonObject& invalid() { static JsonObject o(NULL); return o; }
+
+  bool success() const { return buffer != NULL; }
+  size_t size() const { return kv.size(); }
+  JsonPair * begin() { return kv.data(); }
+  JsonPair * end() { return kv.data() + kv.size(); }
+
+  bool containsKey(const char * key) const { return find(key) != NULL; }
+  bool containsKey(const String& key) const { return containsKey(key.c_str()); }
+  JsonVariant lookup(const char * key) const { const JsonPair * p = find(key); return p != NULL? p->value : JsonVariant(); }
+
+  inline JsonObjectSubscript operator[](const char * key);
+  inline JsonObjectSubscript operator[](const String& key);
+  JsonVariant operator[](const char * key) const { return lookup(key); }
+
+  template<typename T> bool set(const char * key, const T& value) { return setvariant(key, JsonVariant(value)); }
+  template<typename T> typename JsonAs<T>::type get(const char * key) const { return lookup(key).as<T>(); }
+  bool setvariant(const char * key, JsonVariant value);
+  void remove(const char * key);
+
+  JsonArray& createNestedArray(const char * key);
+  JsonObject& createNestedObject(const char * key);
+
+  size_t printTo(Print& p) const;
+  size_t printTo(String& s) const { return JsonVariant(const_cast<JsonObject&>(*this)).printTo(s); }
+  size_t printTo(char * buf, size_t size) const { return JsonVariant(const_cast<JsonObject&>(*this)).printTo(buf, size); }
+  size_t measureLength() const;
+
+private:
+  const JsonPair * find(const char * key) const {
+    for (const JsonPair& p : kv) if (strcmp(p.key, key) == 0) return &p;
+    return NULL;
+  }
+
+  JsonBuffer * buffer;
+  std::vector<JsonPair> kv;
+};
+
+class JsonArray {
+public:
+  explicit JsonArray(JsonBuffer * buffer) : buffer(buffer) {}
+  static JsonArray& invalid() { static JsonArray a(NULL); return a; }
+
+  bool success() const { return buffer != NULL; }
+  size_t size() const { return items.size(); }
+  JsonVariant * begin() { return items.data(); }
+  JsonVariant * end() { return items.data() + items.size(); }
+  JsonVariant operator[](size_t i) const { return i < items.size()? items[i] : JsonVariant(); }
+
+  template<typename T> bool add(const T& value) { return addvariant(JsonVariant(value)); }
+  bool addvariant(JsonVariant value);
+  JsonObject& createNestedObject();
+  JsonArray& createNestedArray();
+
+  size_t printTo(Print& p) const;
+  size_t printTo(String& s) const { return JsonVariant(const_cast<JsonArray&>(*this)).printTo(s); }
+  size_t printTo(char * buf, size_t size) const { return JsonVariant(const_cast<JsonArray&>(*this)).printTo(buf, size); }
+  size_t measureLength() const;
+
+private:
+  JsonBuffer * buffer;
+  std::vector<JsonVariant> items;
+};
+
+class JsonObjectSubscript {
+public:
+  JsonObjectSubscript(JsonObject& object, const char * key) : object(object), key(key) {}
+
+  template<typename T> JsonObjectSubscript& operator=(const T& value) { object.set(key, value); return *this; }
+  template<typename T> typename JsonAs<T>::type as() const { return object.lookup(key).as<T>(); }
+  template<typename T> bool is() const { return object.lookup(key).is<T>(); }
+  bool success() const { return object.containsKey(key); }
+  size_t printTo(Print& p) const { return object.lookup(key).printTo(p); }
+  operator JsonVariant() const { return object.lookup(key); }
+  operator String() const { return as<String>(); }
+
+private:
+  JsonObject& object;
+  const char * key;
+};
+
+inline JsonObjectSubscript JsonObject::operator[](const char * key) { return JsonObjectSubscript(*this, key); }
+inline JsonObjectSubscript JsonObject::operator[](const String& key) { return JsonObjectSubscript(*this, key.c_str()); }
+
+class JsonBuffer {
+public:
+  virtual ~JsonBuffer() {}
+
+  JsonObject& createObject() { objects.emplace_back(this); return objects.back(); }
+  JsonArray& createArray() { arrays.emplace_back(this); return arrays.back(); }
+
+  JsonObject& parseObject(const char * json) {
+    JsonVariant v = parse(json);
+    return v.type == JsonVariant::J_OBJECT? *v.v.o : JsonObject::invalid();
+  }
+  JsonObject& parseObject(const String& json) { return parseObject(json.c_str()); }
+  JsonArray& parseArray(const char * json) {
+    JsonVariant v = parse(json);
+    return v.type == JsonVariant::J_ARRAY? *v.v.a : JsonArray::invalid();
+  }
+  JsonArray& parseArray(const String& json) { return parseArray(json.c_str()); }
+
+  // Undefined when the text isn't a single JSON value
+  JsonVariant parse(const char * json) {
+    if (json == NULL) return JsonVariant();
+    const char * p = json;
+    JsonVariant v;
+    if (!parsevalue(&p, &v, 0)) return JsonVariant();
+    skipspace(&p);
+    return *p == 0? v : JsonVariant();
+  }
+
+  const char * strdup(const char * s) {
+    strings.emplace_back(s);
+    return strings.back().c_str();
+  }
+
+  void clear() {
+    objects.clear();
+    arrays.clear();
+    strings.clear();
+  }
+
+private:
+  static void skipspace(const char ** p) { while (**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r') *p += 1; }
+
+  bool parsestring(const char ** p, const char ** out) {
+    if (**p != '"') return false;
+    std::string s;
+    for (const char * c = *p + 1; *c != 0; c++) {
+      if (*c == '"') {
+        *p = c + 1;
+        *out = strdup(s.c_str());
+        return true;
+      }
+      if (*c != '\\') { s += *c; continue; }
+      c += 1;
+      switch (*c) {
+        case '"': case '\\': case '/': s += *c; break;
+        case 'b': s += '\b'; break;
+        case 'f': s += '\f'; break;
+        case 'n': s += '\n'; break;
+        case 'r': s += '\r'; break;
+        case 't': s += '\t'; break;
+        case 'u': {
+          char hex[5] = {0};
+          for (int i = 0; i < 4; i++) { if (c[1] == 0) return false; hex[i] = *++c; }
+          s += (char)strtol(hex, NULL, 16);
+          break;
+        }
+        default: return false;
+      }
+    }
+    return false;
+  }
+
+  bool parsevalue(const char ** p, JsonVariant * out, int depth) {
+    if (depth > 32) return false;
+    skipspace(p);
+    const char * c = *p;
+    if (*c == '{') {
+      JsonObject& o = createObject();
+      *p += 1;
+      skipspace(p);
+      if (**p == '}') { *p += 1; *out = JsonVariant(o); return true; }
+      while (true) {
+        const char * key = NULL;
+        JsonVariant value;
+        skipspace(p);
+        if (!parsestring(p, &key)) return false;
+        skipspace(p);
+        if (**p != ':') return false;
+        *p += 1;
+        if (!parsevalue(p, &value, depth + 1)) return false;
+        o.setvariant(key, value);
+        skipspace(p);
+        if (**p == ',') { *p += 1; continue; }
+        if (**p == '}') { *p += 1; *out = JsonVariant(o); return true; }
+        return false;
+      }
+    }
+    if (*c == '[') {
+      JsonArray& a = createArray();
+      *p += 1;
+      skipspace(p);
+      if (**p == ']') { *p += 1; *out = JsonVariant(a); return true; }
+      while (true) {
+        JsonVariant value;
+        if (!parsevalue(p, &value, depth + 1)) return false;
+        a.addvariant(value);
+        skipspace(p);
+        if (**p == ',') { *p += 1; continue; }
+        if (**p == ']') { *p += 1; *out = JsonVariant(a); return true; }
+        return false;
+      }
+    }
+    if (*c == '"') {
+      const char * s = NULL;
+      if (!parsestring(p, &s)) return false;
+      *out = JsonVariant(s);
+      return true;
+    }
+    if (strncmp(c, "true", 4) == 0)   { *p += 4; *out = JsonVariant(true); return true; }
+    if (strncmp(c, "false", 5) == 0)  { *p += 5; *out = JsonVariant(false); return true; }
+    if (strncmp(c, "null", 4) == 0)   { *p += 4; *out = JsonVariant((const char *)NULL); return true; }
+
+    char * end = NULL;
+    double f = strtod(c, &end);
+    if (end == c) return false;
+    bool isfloat = false;
+    for (const char * d = c; d < end; d++) if (*d == '.' || *d == 'e' || *d == 'E') isfloat = true;
+    *out = isfloat? JsonVariant(f) : JsonVariant(strtoll(c, NULL, 10));
+    *p = end;
+    return true;
+  }
+
+  std::deque<JsonObject> objects;
+  std::deque<JsonArray> arrays;
+  std::deque<std::string> strings;
+};
+
+template<size_t N> class StaticJsonBuffer : public JsonBuffer {};
+class DynamicJsonBuffer : public JsonBuffer {
+public:
+  DynamicJsonBuffer(size_t size =0) {}
+};
+
+inline bool JsonObject::setvariant(const char * key, JsonVariant value) {
+  if (buffer == NULL) return false;
+  if (value.type == JsonVariant::J_STRING) value.v.s = buffer->strdup(value.v.s);
+  for (JsonPair& p : kv) {
+    if (strcmp(p.key, key) == 0) {
+      p.value = value;
+      return true;
+    }
+  }
+  kv.push_back({ buffer->strdup(key), value });
+  return true;
+}
+
+inline void JsonObject::remove(const char * key) {
+  for (size_t i = 0; i < kv.size(); i++) {
+    if (strcmp(kv[i].key, key) == 0) {
+      kv.erase(kv.begin() + i);
+      return;
+    }
+  }
+}
+
+inline JsonArray& JsonObject::createNestedArray(const char * key) {
+  if (buffer == NULL) return JsonArray::invalid();
+  JsonArray& a = buffer->createArray();
+  setvariant(key, JsonVariant(a));
+  return a;
+}
+
+inline JsonObject& JsonObject::createNestedObject(const char * key) {
+  if (buffer == NULL) return JsonObject::invalid();
+  JsonObject& o = buffer->createObject();
+  setvariant(key, JsonVariant(o));
+  return o;
+}
+
+inline bool JsonArray::addvariant(JsonVariant value) {
+  if (buffer == NULL) return false;
+  if (value.type == JsonVariant::J_STRING) value.v.s = buffer->strdup(value.v.s);
+  items.push_back(value);
+  return true;
+}
+
+inline JsonObject& JsonArray::createNestedObject() {
+  if (buffer == NULL) return JsonObject::invalid();
+  JsonObject& o = buffer->createObject();
+  items.push_back(JsonVariant(o));
+  return o;
+}
+
+inline JsonArray& JsonArray::createNestedArray() {
+  if (buffer == NULL) return JsonArray::invalid();
+  JsonArray& a = buffer->createArray();
+  items.push_back(JsonVariant(a));
+  return a;
+}
+
+static inline size_t json_printstring(Print& p, const char * s) {
+  size_t n = p.write('"');
+  for (; *s != 0; s++) {
+    switch (*s) {
+      case '"':   n += p.write("\\\""); break;
+      case '\\':  n += p.write("\\\\"); break;
+      case '\n':  n += p.write("\\n"); break;
+      case '\r':  n += p.write("\\r"); break;
+      case '\t':  n += p.write("\\t"); break;
+      default:    n += p.write((uint8_t)*s); break;
+    }
+  }
+  return n + p.write('"');
+}
+
+inline size_t JsonVariant::printTo(Print& p) const {
+  char num[32];
+  switch (type) {
+    case J_UNDEFINED:
+    case J_NULL:    return p.write("null");
+    case J_BOOL:    return p.write(v.i? "true" : "false");
+    case J_INT:     snprintf(num, sizeof(num), "%lld", v.i); return p.write(num);
+    case J_FLOAT:   snprintf(num, sizeof(num), "%.9g", v.f); return p.write(num);
+    case J_STRING:  return json_printstring(p, v.s);
+    case J_OBJECT:  return v.o->printTo(p);
+    case J_ARRAY:   return v.a->printTo(p);
+  }
+  return 0;
+}
+
+inline size_t JsonObject::printTo(Print& p) const {
+  size_t n = p.write('{');
+  for (size_t i = 0; i < kv.size(); i++) {
+    if (i > 0) n += p.write(',');
+    n += json_printstring(p, kv[i].key);
+    n += p.write(':');
+    n += kv[i].value.printTo(p);
+  }
+  return n + p.write('}');
+}
+
+inline size_t JsonArray::printTo(Print& p) const {
+  size_t n = p.write('[');
+  for (size_t i = 0; i < items.size(); i++) {
+    if (i > 0) n += p.write(',');
+    n += items[i].printTo(p);
+  }
+  return n + p.write(']');
+}
+
+class JsonStringPrint : public Print {
+public:
+  size_t write(uint8_t c) { s += (char)c; return 1; }
+  using Print::write;
+  std::string s;
+};
+
+inline size_t JsonVariant::printTo(String& s) const {
+  JsonStringPrint sp;
+  size_t n = printTo(sp);
+  s = String(sp.s.c_str());
+  return n;
+}
+
+inline size_t JsonVariant::printTo(char * buf, size_t size) const {
+  JsonStringPrint sp;
+  printTo(sp);
+  if (size > 0) {
+    size_t n = min(sp.s.size(), size - 1);
+    memcpy(buf, sp.s.data(), n);
+    buf[n] = 0;
+  }
+  return sp.s.size();
+}
+
+inline String JsonVariant::asText() const {
+  if (type == J_STRING) return String(v.s);
+  if (type == J_UNDEFINED || type == J_NULL) return String();
+  String s;
+  printTo(s);
+  return s;
+}
+
+inline JsonObject& JsonVariant::asObject() const { return type == J_OBJECT? *v.o : JsonObject::invalid(); }
+inline JsonArray& JsonVariant::asArray() const { return type == J_ARRAY? *v.a : JsonArray::invalid(); }
+
+inline size_t JsonObject::measureLength() const { JsonStringPrint sp; printTo(sp); return sp.s.size(); }
+inline size_t JsonArray::measureLength() const { JsonStringPrint sp; printTo(sp); return sp.s.size(); }
+
+#endif
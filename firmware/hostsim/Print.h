@@ -0,0 +1,21 @@
+#ifndef __HOSTSIM_PRINT_H
+#define __HOSTSIM_PRINT_H
+
+#include <Arduino.h>
+
+// Byte sink base class, the same overload set as the Arduino core
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t) = 0;
+  size_t write(const char * str) { return str == NULL? 0 : write((const uint8_t *)str, strlen(str)); }
+  virtual size_t write(const uint8_t * buffer, size_t size) { size_t n = 0; while (size--) n += write(*buffer++); return n; }
+  size_t write(const char * buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+  size_t print(const char * str) { return write(str); }
+  size_t print(long v) { char num[24]; snprintf(num, sizeof(num), "%ld", v); return write(num); }
+  size_t print(unsigned long v) { char num[24]; snprintf(num, sizeof(num), "%lu", v); return write(num); }
+  size_t print(int v) { return print((long)v); }
+  size_t print(unsigned int v) { return print((unsigned long)v); }
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef __HOSTSIM_SPI_H
+#define __HOSTSIM_SPI_H
+
+#include <Arduino.h>
+
+#define SPI_MODE0   (0)
+#define SPI_MODE1   (1)
+#define SPI_MODE2   (2)
+#define SPI_MODE3   (3)
+
+class SPISettings {
+public:
+  SPISettings(uint32_t clock, uint8_t order, uint8_t mode) : clock(clock) {}
+  uint32_t clock;
+};
+
+// Bytes go straight to the simulated daisy chain, clocked at the set frequency
+class SPIClass {
+public:
+  void begin() {}
+  void setFrequency(uint32_t freq) { this->freq = freq; }
+  void setDataMode(uint8_t mode) {}
+  void setBitOrder(uint8_t order) {}
+  void beginTransaction(SPISettings settings);
+  void endTransaction();
+  uint8_t transfer(uint8_t b);
+
+private:
+  uint32_t freq = 1000000;
+};
+extern SPIClass SPI;
+
+#endif
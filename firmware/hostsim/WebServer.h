@@ -0,0 +1,28 @@
+#ifndef __HOSTSIM_WEBSERVER_H
+#define __HOSTSIM_WEBSERVER_H
+
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+
+#define CONTENT_LENGTH_UNKNOWN  ((size_t)-1)
+
+// Nothing on the host serves HTTP, the response writers only need somewhere to send to.
+// Content is kept so hostsim can look at what a JsonStream put out and in which chunks.
+class WebServer {
+public:
+  WebServer(int port =80) {}
+  void setContentLength(size_t len) {}
+  void send(int code, const char * type ="", const char * content ="") {}
+  void sendContent(const String& content) { sendContent_P(content.c_str(), content.length()); }
+  void sendContent_P(const char * content, size_t len) {
+    body.append(content, len);
+    chunks.push_back(len);
+  }
+
+  std::string body;
+  std::vector<size_t> chunks;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef __HOSTSIM_WIFI_H
+#define __HOSTSIM_WIFI_H
+
+#include <Arduino.h>
+
+// lowcom's TCP sockets, board.cpp connects them to the scenario as byte queues
+class WiFiClient {
+public:
+  WiFiClient(int sock =-1) : sock(sock) {}
+  int available();
+  size_t read(uint8_t * data, size_t len);
+  size_t write(const uint8_t * data, size_t len);
+  uint8_t connected();
+  void stop();
+  void setNoDelay(bool nodelay) {}
+  operator bool() { return connected(); }
+
+private:
+  int sock;
+};
+
+class WiFiServer {
+public:
+  WiFiServer(uint16_t port) {}
+  void begin() {}
+  void setNoDelay(bool nodelay) {}
+  bool hasClient();
+  WiFiClient available();
+};
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef __HOSTSIM_WIRE_H
+#define __HOSTSIM_WIRE_H
+
+#include <Arduino.h>
+
+// I2C master shim, transactions go straight to the ECC508A model
+class TwoWire {
+public:
+  void begin(int sda =-1, int scl =-1, uint32_t freq =100000);
+  void beginTransmission(uint8_t addr);
+  size_t write(uint8_t b);
+  size_t write(const uint8_t * data, size_t len);
+  uint8_t endTransmission();
+  uint8_t requestFrom(int addr, size_t len);
+  int available();
+  int read();
+private:
+  uint32_t freq;
+  uint8_t buf[128];
+  size_t len;
+  size_t pos;
+};
+extern TwoWire Wire;
+
+#endif
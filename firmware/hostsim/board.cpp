@@ -0,0 +1,367 @@
+#include <stdarg.h>
+#include <deque>
+#include <string>
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_timer.h>
+
+#include "hostboard.h"
+#include "pssim.h"
+#include "eccsim.h"
+#include "wifistepper.h"
+#include "ecc508a.h"
+#include "powerstep01.h"
+
+// The parts of wifistepper.ino the firmware sources call into. Files live in memory
+// and there is no HTTP server, step clock player or capture task on the host.
+
+static const uint8_t board_key[32] = { 'h','o','s','t','b','o','a','r','d' };
+static uint8_t board_index = 0;
+
+queue_t queue[QS_SIZE];
+volatile id_t _id = ID_START;
+StaticJsonBuffer<2560> jsonbuf;
+volatile bool flag_reboot = false;
+
+config_t config;
+state_t state;
+sketch_t sketch;
+
+static std::string board_files[QS_SIZE];
+
+id_t nextid() { return _id++; }
+id_t currentid() { return _id; }
+
+unsigned long timesince(unsigned long t1, unsigned long t2) {
+  return (t1 <= t2)? (t2 - t1) : (ULONG_MAX - t1 + t2);
+}
+
+void seterror(uint8_t subsystem, id_t onid, int type, int8_t arg) {
+  if (!state.error.errored) {
+    state.error.when = millis();
+    state.error.subsystem = subsystem;
+    state.error.id = onid;
+    state.error.type = type;
+    state.error.arg = arg;
+
+    lowcom_senderror(&state.error);
+  }
+}
+
+void clearerror() {
+  memset(&state.error, 0, sizeof(error_state));
+}
+
+void core_lock() {}
+void core_unlock() {}
+
+bool wificfg_connect(wifi_mode mode, wifi_config * const cfg) {
+  state.wifi.mode = mode;
+  return true;
+}
+
+bool queuecfg_read(uint8_t qid) {
+  if (qid >= QS_SIZE || board_files[qid].empty()) return false;
+  JsonArray& arr = jsonbuf.parseArray(board_files[qid].c_str());
+  cmdq_empty(queue_get(qid), nextid());
+  cmdq_read(arr, 0, qid);
+  jsonbuf.clear();
+  return true;
+}
+
+bool queuecfg_write(uint8_t qid) {
+  if (qid >= QS_SIZE) return false;
+  JsonArray& arr = jsonbuf.createArray();
+  cmdq_write(arr, queue_get(qid));
+  String s;
+  arr.printTo(s);
+  board_files[qid] = s.c_str();
+  jsonbuf.clear();
+  return true;
+}
+
+bool queuecfg_reset(uint8_t qid) {
+  if (qid < QS_SIZE) board_files[qid].clear();
+  return true;
+}
+
+// Same sequence as wifistepper.ino
+void motorcfg_push(motor_config * cfg) {
+  ps_defer();
+  ps_setsync(SYNC_BUSY);
+  ps_setmode(cfg->mode);
+  ps_setstepsize(cfg->stepsize);
+  ps_setmaxspeed(cfg->maxspeed);
+  ps_setminspeed(cfg->minspeed, true);
+  ps_setaccel(cfg->accel);
+  ps_setdecel(cfg->decel);
+  ps_setfullstepspeed(cfg->fsspeed, cfg->fsboost);
+
+  ps_setslewrate(SR_520);
+
+  ps_setocd(cfg->ocd, cfg->ocdshutdown);
+  if (cfg->mode == MODE_CURRENT) {
+    ps_setktvals(cfg->mode, cfg->cm.kthold * MOTOR_RSENSE, cfg->cm.ktrun * MOTOR_RSENSE, cfg->cm.ktaccel * MOTOR_RSENSE, cfg->cm.ktdecel * MOTOR_RSENSE);
+    ps_cm_setswitchperiod(cfg->cm.switchperiod);
+    ps_cm_setpredict(cfg->cm.predict);
+    ps_cm_setctrltimes(cfg->cm.minon, cfg->cm.minoff, cfg->cm.fastoff, cfg->cm.faststep);
+    ps_cm_settqreg(false);
+  } else if (cfg->mode == MODE_VOLTAGE) {
+    ps_setktvals(cfg->mode, cfg->vm.kthold / 100.0, cfg->vm.ktrun / 100.0, cfg->vm.ktaccel / 100.0, cfg->vm.ktdecel / 100.0);
+    ps_vm_pwmfreq pwmfreq = ps_vm_pwmfreq2coeffs(MOTOR_CLOCK, cfg->vm.pwmfreq * 1000.0);
+    ps_vm_setpwmfreq(&pwmfreq);
+    ps_vm_setstall(cfg->vm.stall);
+    ps_vm_setbemf(cfg->vm.bemf_slopel, cfg->vm.bemf_speedco, cfg->vm.bemf_slopehacc, cfg->vm.bemf_slopehdec);
+    ps_vm_setvscomp(cfg->vm.volt_comp);
+  }
+
+  ps_setswmode(SW_USER);
+  ps_setclocksel(MOTOR_CLOCK);
+
+  ps_setalarmconfig(true, true, true, true);
+  ps_commit();
+
+  cmd_clearerror();
+}
+
+void motorcfg_write(motor_config * const cfg) {}
+
+bool stck_load(size_t offset, const uint8_t * data, size_t len) { return false; }
+bool stck_play(id_t id, ps_direction dir) { return false; }
+void stck_stop() {}
+
+// esp_timer, board_loop() runs the callbacks that came due since its last pass
+struct esp_timer {
+  esp_timer_create_args_t args;
+  bool running;
+  unsigned long due;
+};
+static std::deque<esp_timer> board_timers;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t * args, esp_timer_handle_t * handle) {
+  board_timers.push_back({ .args = *args, .running = false, .due = 0 });
+  *handle = &board_timers.back();
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+  timer->running = true;
+  timer->due = micros() + timeout_us;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  timer->running = false;
+  return ESP_OK;
+}
+
+static void board_runtimers() {
+  for (esp_timer& t : board_timers) {
+    if (!t.running || (long)(micros() - t.due) < 0) continue;
+    t.running = false;
+    t.args.callback(t.args.arg);
+  }
+}
+
+
+// Daisy chain UART
+HostSerial Serial;
+size_t HostSerial::write(const uint8_t * data, size_t len) { return hostsim_uartwrite(board_index, data, len); }
+int HostSerial::available() { return hostsim_uartavailable(board_index); }
+size_t HostSerial::readBytes(uint8_t * data, size_t len) { return hostsim_uartread(board_index, data, len); }
+size_t HostSerial::print(const char * s) { return write((const uint8_t *)s, strlen(s)); }
+size_t HostSerial::print(double v, int digits) { return printf("%.*f", digits, v); }
+size_t HostSerial::print(long v, int base) { return printf(base == HEX? "%lX" : "%ld", v); }
+size_t HostSerial::println(const char * s) { return print(s) + println(); }
+size_t HostSerial::println(long v, int base) { return print(v, base) + println(); }
+size_t HostSerial::println(double v, int digits) { return print(v, digits) + println(); }
+size_t HostSerial::println() { return print("\r\n"); }
+size_t HostSerial::printf(const char * fmt, ...) {
+  char buf[256];
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  return n > 0? print(buf) : 0;
+}
+
+
+// lowcom sockets, the scenario holds the client end
+static struct {
+  bool open, pending;
+  std::deque<uint8_t> rx, tx;
+} board_sock[HOSTBOARD_SOCKETS];
+
+int WiFiClient::available() { return sock >= 0? board_sock[sock].rx.size() : 0; }
+size_t WiFiClient::read(uint8_t * data, size_t len) {
+  size_t n = 0;
+  while (sock >= 0 && n < len && !board_sock[sock].rx.empty()) {
+    data[n++] = board_sock[sock].rx.front();
+    board_sock[sock].rx.pop_front();
+  }
+  return n;
+}
+size_t WiFiClient::write(const uint8_t * data, size_t len) {
+  if (sock < 0 || !board_sock[sock].open) return 0;
+  board_sock[sock].tx.insert(board_sock[sock].tx.end(), data, data + len);
+  return len;
+}
+uint8_t WiFiClient::connected() { return sock >= 0 && board_sock[sock].open; }
+void WiFiClient::stop() { if (sock >= 0) board_sock[sock].open = false; }
+
+bool WiFiServer::hasClient() {
+  for (int i = 0; i < HOSTBOARD_SOCKETS; i++) if (board_sock[i].pending) return true;
+  return false;
+}
+WiFiClient WiFiServer::available() {
+  for (int i = 0; i < HOSTBOARD_SOCKETS; i++) {
+    if (board_sock[i].pending) {
+      board_sock[i].pending = false;
+      return WiFiClient(i);
+    }
+  }
+  return WiFiClient();
+}
+
+static int board_connect() {
+  for (int i = 0; i < HOSTBOARD_SOCKETS; i++) {
+    if (!board_sock[i].open) {
+      board_sock[i].open = board_sock[i].pending = true;
+      board_sock[i].rx.clear();
+      board_sock[i].tx.clear();
+      return i;
+    }
+  }
+  return -1;
+}
+
+static size_t board_send(int sock, const uint8_t * data, size_t len) {
+  board_sock[sock].rx.insert(board_sock[sock].rx.end(), data, data + len);
+  return len;
+}
+
+static size_t board_recv(int sock, uint8_t * data, size_t len) {
+  size_t n = 0;
+  while (n < len && !board_sock[sock].tx.empty()) {
+    data[n++] = board_sock[sock].tx.front();
+    board_sock[sock].tx.pop_front();
+  }
+  return n;
+}
+
+static void board_close(int sock) {
+  board_sock[sock].open = board_sock[sock].pending = false;
+}
+
+static bool board_writequeue(uint8_t target, uint8_t q, uint8_t sourcequeue) {
+  return daisy_writequeue(target, q, nextid(), queue_get(sourcequeue));
+}
+
+static size_t board_batch(const uint8_t * data, size_t len, id_t * id, const char ** error) {
+  return cmdq_batch(data, len, id, error);
+}
+
+static bool board_tune(float resistance, float inductance, float ke, float current, float holdcurrent, float vs, float limit) {
+  return tune_start(nextid(), resistance, inductance, ke, current, holdcurrent, vs, limit, false);
+}
+
+
+static void board_defaults(bool master) {
+  memset(&config, 0, sizeof(config));
+  strcpy(config.service.hostname, "wsx100");
+  config.service.lowcom.enabled = true;
+  config.service.lowcom.std_enabled = true;
+  config.daisy.enabled = true;
+  config.daisy.master = master;
+
+  motor_config * m = &config.motor;
+  m->mode = MODE_CURRENT;
+  m->stepsize = STEP_16;
+  m->ocd = 500.0;
+  m->ocdshutdown = true;
+  m->maxspeed = 10000.0;
+  m->minspeed = 0.0;
+  m->accel = 1000.0;
+  m->decel = 1000.0;
+  m->fsspeed = 2000.0;
+  m->fsboost = false;
+  m->cm.kthold = m->cm.ktrun = m->cm.ktaccel = m->cm.ktdecel = 2.5;
+  m->cm.switchperiod = 44;
+  m->cm.predict = true;
+  m->cm.minon = 21;
+  m->cm.minoff = 21;
+  m->cm.fastoff = 4;
+  m->cm.faststep = 20;
+  m->vm.kthold = m->vm.ktrun = m->vm.ktaccel = m->vm.ktdecel = 15.0;
+  m->vm.pwmfreq = 23.4;
+  m->vm.stall = 750.0;
+  m->vm.volt_comp = false;
+  m->vm.bemf_slopel = 0.0375;
+  m->vm.bemf_speedco = 61.5072;
+  m->vm.bemf_slopehacc = 0.0615;
+  m->vm.bemf_slopehdec = 0.0615;
+  m->reverse = false;
+}
+
+static void board_setup(uint8_t index, bool master) {
+  board_index = index;
+  board_defaults(master);
+
+  cmd_init();
+  daisy_init();
+  eccsim_init(board_key);
+  ecc_init();
+  wificfg_connect(M_ACCESSPOINT, &config.wifi);
+  lowcom_init();
+
+  pssim_init(MOTOR_DEVICES);
+  ps_spiinit(MOTOR_DEVICES);
+  cmd_setconfig(Q0, nextid(), "");
+  cmdq_copy(Q0, nextid(), queue_get(1));
+}
+
+#define HANDLE_LOOPS()     ({ lowcom_loop(now); daisy_loop(now); ecc_loop(now); cmd_loop(now); tune_loop(now); })
+static void board_loop() {
+  board_runtimers();
+  unsigned long now = millis();
+  HANDLE_LOOPS();
+  HANDLE_LOOPS();
+  HANDLE_LOOPS();
+
+  cmd_update(now);
+  daisy_update(now);
+  lowcom_update(now);
+}
+
+static const hostboard_t board = {
+  .config = &config,
+  .state = &state,
+  .sketch = &sketch,
+  .queue = queue,
+  .setup = board_setup,
+  .loop = board_loop,
+  .step = pssim_step,
+  .connect = board_connect,
+  .send = board_send,
+  .recv = board_recv,
+  .close = board_close,
+  .writequeue = board_writequeue,
+  .batch = board_batch,
+  .tune = board_tune,
+  .setmotor = pssim_setmotor,
+  .setswitch = pssim_setswitch,
+  .setuvlo = pssim_setuvlo,
+  .setstop = pssim_setstop,
+  .getpos = pssim_getpos,
+  .getrotor = pssim_getrotor,
+  .getspeed = pssim_getspeed,
+  .getcurrent = pssim_getcurrent,
+  .isbusy = pssim_isbusy,
+  .ishiz = pssim_ishiz,
+  .getreg = pssim_getreg,
+};
+
+extern "C" const hostboard_t * hostboard() {
+  return &board;
+}
@@ -0,0 +1,235 @@
+#include <Arduino.h>
+
+#include "eccsim.h"
+#include "sha256.h"
+#include "ecc508a.h"
+
+#define ECCSIM_WAKEUS       (1500)
+#define ECCSIM_WATCHDOGUS   (1300000)
+
+#define OP_READ             (0x02)
+#define OP_WRITE            (0x12)
+#define OP_GENDIG           (0x15)
+#define OP_NONCE            (0x16)
+#define OP_LOCK             (0x17)
+#define OP_RANDOM           (0x1B)
+#define OP_SHA              (0x47)
+
+#define SHA_UPDATE          (0x01)
+#define SHA_HMACSTART       (0x04)
+#define SHA_HMACEND         (0x05)
+
+#define STATUS_OK           (0x00)
+#define STATUS_PARSE        (0x03)
+#define STATUS_EXEC         (0x0F)
+#define STATUS_CRC          (0xFF)
+
+typedef struct {
+  bool awake;
+  uint64_t wokeat;
+  uint64_t readyat;
+  uint8_t reply[35];
+  size_t replylen;
+  bool hmac;
+  union {
+    uint8_t bytes[128];
+    ecc_configzone_t bits;
+  } config;
+  uint8_t slots[16][32];
+  uint32_t exec_us[256];
+  uint8_t corrupt_op;
+  uint32_t corrupt_n;
+  eccsim_stats stats;
+} eccsim_device;
+
+static eccsim_device dev;
+static Sha256Class sha;
+
+static void eccsim_crc(const uint8_t * data, size_t len, uint8_t * crc) {
+  uint16_t reg = 0;
+  for (size_t i = 0; i < len; i++) {
+    for (uint8_t shift = 0x01; shift > 0x00; shift <<= 1) {
+      uint8_t bit = (data[i] & shift)? 1 : 0;
+      uint8_t top = reg >> 15;
+      reg <<= 1;
+      if (bit != top) reg ^= 0x8005;
+    }
+  }
+  crc[0] = reg & 0xFF;
+  crc[1] = reg >> 8;
+}
+
+static void eccsim_reply(uint8_t op, const uint8_t * data, size_t len) {
+  dev.replylen = len + 3;
+  dev.reply[0] = dev.replylen;
+  memcpy(&dev.reply[1], data, len);
+  eccsim_crc(dev.reply, len + 1, &dev.reply[len + 1]);
+  if (dev.corrupt_n > 0 && dev.corrupt_op == op) {
+    dev.reply[len + 2] ^= 0xFF;
+    dev.corrupt_n -= 1;
+    dev.stats.corrupted += 1;
+  }
+}
+
+static void eccsim_status(uint8_t op, uint8_t status) {
+  if (status != STATUS_OK) dev.stats.errors += 1;
+  eccsim_reply(op, &status, 1);
+}
+
+static void eccsim_watchdog() {
+  // The device sleeps itself a fixed time after waking, whatever it was doing
+  if (dev.awake && (hostsim_now() - dev.wokeat) / 1000 >= ECCSIM_WATCHDOGUS) {
+    dev.awake = false;
+    dev.hmac = false;
+    dev.stats.watchdogs += 1;
+  }
+}
+
+static void eccsim_execute(const uint8_t * p, size_t len) {
+  uint8_t crc[2];
+  if (len < 7 || p[0] != len) return;
+  eccsim_crc(p, len - 2, crc);
+  uint8_t op = p[1], param1 = p[2];
+  uint16_t param2 = p[3] | (p[4] << 8);
+  const uint8_t * data = &p[5];
+  size_t datalen = len - 7;
+
+  dev.stats.commands += 1;
+  dev.readyat = hostsim_now() + (uint64_t)dev.exec_us[op] * 1000;
+  if (crc[0] != p[len - 2] || crc[1] != p[len - 1]) {
+    eccsim_status(op, STATUS_CRC);
+    return;
+  }
+
+  switch (op) {
+    case OP_READ: {
+      uint8_t zone = param1 & 0x3;
+      if (zone == 0x0) eccsim_reply(op, &dev.config.bytes[(param2 >> 3) * 32 % sizeof(dev.config)], 32);
+      else if (zone == 0x2) eccsim_reply(op, dev.slots[(param2 >> 3) & 0xF], 32);
+      else eccsim_status(op, STATUS_PARSE);
+      break;
+    }
+    case OP_RANDOM: {
+      uint8_t r[32];
+      for (size_t i = 0; i < sizeof(r); i++) r[i] = rand();
+      eccsim_reply(op, r, sizeof(r));
+      break;
+    }
+    case OP_SHA: {
+      switch (param1 & 0x7) {
+        case SHA_HMACSTART:
+          sha.initHmac(dev.slots[param2 & 0xF], 32);
+          dev.hmac = true;
+          eccsim_status(op, STATUS_OK);
+          break;
+        case SHA_UPDATE:
+          if (!dev.hmac || datalen != 64) { eccsim_status(op, STATUS_EXEC); break; }
+          sha.update(data, datalen);
+          eccsim_status(op, STATUS_OK);
+          break;
+        case SHA_HMACEND:
+          if (!dev.hmac || datalen != (param2 & 0xFF) || datalen >= 64) { eccsim_status(op, STATUS_EXEC); break; }
+          sha.update(data, datalen);
+          eccsim_reply(op, sha.resultHmac(), 32);
+          dev.hmac = false;
+          dev.stats.hmacs += 1;
+          break;
+        default:
+          eccsim_status(op, STATUS_PARSE);
+          break;
+      }
+      break;
+    }
+    case OP_NONCE:
+    case OP_GENDIG:
+    case OP_WRITE:
+    case OP_LOCK:
+      // Provisioning is not modelled beyond the status reply
+      eccsim_status(op, STATUS_OK);
+      break;
+    default:
+      eccsim_status(op, STATUS_PARSE);
+      break;
+  }
+}
+
+void eccsim_init(const uint8_t * key) {
+  memset(&dev, 0, sizeof(dev));
+  dev.config.bits.sn_0 = 0x01;
+  dev.config.bits.sn_1 = 0x23;
+  dev.config.bits.sn_8 = 0xEE;
+  dev.config.bits.lockvalue = 0x00;
+  dev.config.bits.lockconfig = 0x00;
+  memcpy(dev.slots[0], ECC_VERSION, strlen(ECC_VERSION));
+  memcpy(dev.slots[2], key, 32);
+
+  // Between typical and maximum execution times from the datasheet
+  dev.exec_us[OP_READ] = 800;
+  dev.exec_us[OP_RANDOM] = 11000;
+  dev.exec_us[OP_SHA] = 4000;
+  dev.exec_us[OP_NONCE] = 4000;
+  dev.exec_us[OP_GENDIG] = 7000;
+  dev.exec_us[OP_WRITE] = 12000;
+  dev.exec_us[OP_LOCK] = 15000;
+}
+
+void eccsim_write(const uint8_t * data, size_t len) {
+  eccsim_watchdog();
+  if (!dev.awake) {
+    // Any traffic holds SDA low long enough to wake it, the bytes are lost
+    dev.awake = true;
+    dev.wokeat = hostsim_now();
+    dev.readyat = dev.wokeat + ECCSIM_WAKEUS * 1000;
+    dev.hmac = false;
+    uint8_t token = 0x11;
+    eccsim_reply(0, &token, 1);
+    dev.stats.wakes += 1;
+    return;
+  }
+  if (len == 0) return;
+
+  switch (data[0]) {
+    case 0x1:
+      dev.awake = false;
+      dev.hmac = false;
+      dev.stats.sleeps += 1;
+      break;
+    case 0x3:
+      if (hostsim_now() >= dev.readyat) eccsim_execute(&data[1], len - 1);
+      else dev.stats.nacks += 1;
+      break;
+  }
+}
+
+size_t eccsim_read(uint8_t * data, size_t len) {
+  eccsim_watchdog();
+  if (!dev.awake || hostsim_now() < dev.readyat || dev.replylen == 0) {
+    dev.stats.nacks += 1;
+    return 0;
+  }
+  size_t n = min(len, dev.replylen);
+  memcpy(data, dev.reply, n);
+  return n;
+}
+
+void eccsim_setexec(uint8_t opcode, uint32_t us) {
+  dev.exec_us[opcode] = us;
+}
+
+void eccsim_corrupt(uint8_t opcode, uint32_t replies) {
+  dev.corrupt_op = opcode;
+  dev.corrupt_n = replies;
+}
+
+bool eccsim_isawake() {
+  eccsim_watchdog();
+  return dev.awake;
+}
+
+eccsim_stats eccsim_getstats() {
+  return dev.stats;
+}
+
+void eccsim_clearstats() {
+  memset(&dev.stats, 0, sizeof(dev.stats));
+}
@@ -0,0 +1,36 @@
+#ifndef __ECCSIM_H
+#define __ECCSIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Command level ATECC508A model, sits on the I2C bus under the real crypto engine.
+// The device comes up locked with the version string in slot 0 and an HMAC key in slot 2.
+// Execution takes a fixed time per opcode, reads NACK until the reply is ready.
+
+typedef struct {
+  uint32_t wakes;
+  uint32_t sleeps;
+  uint32_t watchdogs;
+  uint32_t commands;
+  uint32_t hmacs;
+  uint32_t nacks;
+  uint32_t corrupted;
+  uint32_t errors;
+} eccsim_stats;
+
+void eccsim_init(const uint8_t * key);
+
+// Bus side, called from the Wire shim. Reads return the bytes the device acked.
+void eccsim_write(const uint8_t * data, size_t len);
+size_t eccsim_read(uint8_t * data, size_t len);
+
+// Test side
+void eccsim_setexec(uint8_t opcode, uint32_t us);
+void eccsim_corrupt(uint8_t opcode, uint32_t replies);
+bool eccsim_isawake();
+
+eccsim_stats eccsim_getstats();
+void eccsim_clearstats();
+
+#endif
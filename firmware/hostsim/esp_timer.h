@@ -0,0 +1,29 @@
+#ifndef __HOSTSIM_ESP_TIMER_H
+#define __HOSTSIM_ESP_TIMER_H
+
+#include <Arduino.h>
+
+// One shot esp_timer on the simulated clock. board.cpp runs due callbacks between passes
+// of loop(), where the core lock lets the esp_timer task in on the real board.
+
+typedef int esp_err_t;
+#define ESP_OK    (0)
+
+typedef enum {
+  ESP_TIMER_TASK,
+} esp_timer_dispatch_t;
+
+typedef struct {
+  void (*callback)(void * arg);
+  void * arg;
+  esp_timer_dispatch_t dispatch_method;
+  const char * name;
+} esp_timer_create_args_t;
+
+typedef struct esp_timer * esp_timer_handle_t;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t * args, esp_timer_handle_t * handle);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+
+#endif
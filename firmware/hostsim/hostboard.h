@@ -0,0 +1,54 @@
+#ifndef __HOSTBOARD_H
+#define __HOSTBOARD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pssim.h"
+#include "wifistepper.h"
+
+// A whole Wi-Fi Stepper built as board.so, command queues, daisy chain and lowcom included.
+// hostsim loads a private copy per board, so every board has its own firmware globals and
+// powerSTEP01 model. The copies share the simulated clock and the UART ring of the host.
+
+#define HOSTBOARD_SOCKETS   (2)
+
+typedef struct {
+  config_t * config;
+  state_t * state;
+  sketch_t * sketch;
+  queue_t * queue;
+
+  // setup() and one pass of loop() of the sketch
+  void (*setup)(uint8_t index, bool master);
+  void (*loop)();
+  void (*step)(uint64_t ns);
+
+  // lowcom client side of a socket
+  int (*connect)();
+  size_t (*send)(int sock, const uint8_t * data, size_t len);
+  size_t (*recv)(int sock, uint8_t * data, size_t len);
+  void (*close)(int sock);
+
+  // Firmware calls lowcom has no opcode for
+  bool (*writequeue)(uint8_t target, uint8_t q, uint8_t sourcequeue);
+  size_t (*batch)(const uint8_t * data, size_t len, id_t * id, const char ** error);
+  bool (*tune)(float resistance, float inductance, float ke, float current, float holdcurrent, float vs, float limit);
+
+  // Device model
+  void (*setmotor)(uint8_t device, const pssim_motor * m);
+  void (*setswitch)(uint8_t device, bool closed);
+  void (*setuvlo)(uint8_t device);
+  void (*setstop)(uint8_t device, bool enabled, int32_t pos);
+  int32_t (*getpos)(uint8_t device);
+  int32_t (*getrotor)(uint8_t device);
+  float (*getspeed)(uint8_t device);
+  float (*getcurrent)(uint8_t device);
+  bool (*isbusy)(uint8_t device);
+  bool (*ishiz)(uint8_t device);
+  uint32_t (*getreg)(uint8_t device, uint8_t param);
+} hostboard_t;
+
+extern "C" const hostboard_t * hostboard();
+
+#endif
@@ -0,0 +1,67 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include <Wire.h>
+
+#include "pssim.h"
+#include "eccsim.h"
+
+// GPIO, SPI and I2C of one board. Linked into hostsim and into every board.so,
+// each copy drives the device models linked next to it.
+
+#define HOST_GPIO_NS        (100)
+#define HOST_SPICALL_NS     (1000)
+#define HOST_SPITXN_NS      (2000)
+#define HOST_I2CCALL_NS     (20000)
+
+#define HOST_PIN_RST        (8)
+#define HOST_PIN_CS         (10)
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  hostsim_elapse(HOST_GPIO_NS);
+  if (pin == HOST_PIN_CS) pssim_cs(val);
+  else if (pin == HOST_PIN_RST && val == LOW) pssim_reset();
+}
+
+SPIClass SPI;
+void SPIClass::beginTransaction(SPISettings settings) {
+  freq = settings.clock;
+  hostsim_elapse(HOST_SPITXN_NS);
+}
+void SPIClass::endTransaction() {
+  hostsim_elapse(HOST_SPITXN_NS / 4);
+}
+uint8_t SPIClass::transfer(uint8_t b) {
+  hostsim_elapse(HOST_SPICALL_NS + 8000000000ULL / freq);
+  return pssim_transfer(b);
+}
+
+
+TwoWire Wire;
+void TwoWire::begin(int sda, int scl, uint32_t f) { freq = f; }
+void TwoWire::beginTransmission(uint8_t addr) { len = 0; }
+size_t TwoWire::write(uint8_t b) {
+  if (len >= sizeof(buf)) return 0;
+  buf[len++] = b;
+  return 1;
+}
+size_t TwoWire::write(const uint8_t * data, size_t n) {
+  size_t w = 0;
+  while (w < n && write(data[w])) w += 1;
+  return w;
+}
+uint8_t TwoWire::endTransmission() {
+  // Address byte plus data, nine clocks each
+  hostsim_elapse(HOST_I2CCALL_NS + (len + 1) * 9000000000ULL / freq);
+  eccsim_write(buf, len);
+  return 0;
+}
+uint8_t TwoWire::requestFrom(int addr, size_t n) {
+  len = eccsim_read(buf, min(n, sizeof(buf)));
+  pos = 0;
+  hostsim_elapse(HOST_I2CCALL_NS + (len + 1) * 9000000000ULL / freq);
+  return len;
+}
+int TwoWire::available() { return len - pos; }
+int TwoWire::read() { return pos < len? buf[pos++] : -1; }
@@ -0,0 +1,1526 @@
+// Runs the powerSTEP01 driver and the ECC508A crypto engine against device models on a Linux host,
+// then whole boards (command queues, daisy chain and lowcom) chained on a simulated UART ring.
+//
+//   cd firmware/hostsim
+//   make run
+//
+// Exits non-zero when a scenario check fails. Time is simulated, the
+// reported durations use rough ESP32 costs for GPIO, SPI, I2C and UART.
+
+#include <stdarg.h>
+#include <float.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <deque>
+#include <vector>
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <Wire.h>
+
+#include "pssim.h"
+#include "eccsim.h"
+#include "hostboard.h"
+#include "wifistepper.h"
+#include "ecc508a.h"
+#include "powerstep01.h"
+#include "powerstep01priv.h"
+#include "motortune.h"
+#include "sha256.h"
+#include "jsonstream.h"
+
+#define HOST_CPU_MHZ        (240)
+#define HOST_CCOUNT_NS      (5)
+#define HOST_LOOP_NS        (200000)
+
+#define HOST_BOARDS         (4)
+#define HOST_UARTBYTE_NS    (10000000000ULL / 115200)   // Start, 8 data and stop bit
+#define HOST_UARTFIFO       (128)                       // write() blocks once the TX FIFO is full
+#define HOST_UARTRXBUF      (256)                       // Arduino core RX buffer, overruns are lost
+
+
+static uint64_t host_ns = 0;
+static int host_failed = 0;
+
+#define check(cond, ...)    ({ if (!(cond)) { host_failed += 1; printf("  FAIL %s:%d ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); } })
+#define near(a, b, tol)     (fabs((double)(a) - (double)(b)) <= (tol))
+
+
+uint64_t hostsim_now() {
+  return host_ns;
+}
+
+static const hostboard_t * host_boards[HOST_BOARDS];
+static void * host_handles[HOST_BOARDS];
+static uint8_t host_nboards = 0;
+
+void hostsim_elapse(uint64_t ns) {
+  host_ns += ns;
+  pssim_step(ns);
+  for (uint8_t i = 0; i < host_nboards; i++) host_boards[i]->step(ns);
+}
+
+unsigned long millis() { return (unsigned long)(host_ns / 1000000); }
+unsigned long micros() { return (unsigned long)(host_ns / 1000); }
+void delay(unsigned long ms) { hostsim_elapse((uint64_t)ms * 1000000); }
+void delayMicroseconds(unsigned int us) { hostsim_elapse((uint64_t)us * 1000); }
+void yield() {}
+uint32_t esp_random() { return ((uint32_t)rand() << 16) ^ (uint32_t)rand(); }
+
+EspClass ESP;
+uint32_t EspClass::getCycleCount() {
+  // Spinning on the cycle counter burns time too
+  hostsim_elapse(HOST_CCOUNT_NS);
+  return (uint32_t)(host_ns * HOST_CPU_MHZ / 1000);
+}
+uint32_t EspClass::getCpuFreqMHz() { return HOST_CPU_MHZ; }
+
+HostSerial Serial;
+size_t HostSerial::print(const char * s) { return fputs(s, stdout) >= 0? strlen(s) : 0; }
+size_t HostSerial::print(double v, int digits) { return printf("%.*f", digits, v); }
+size_t HostSerial::print(long v, int base) {
+  if (base == HEX) return printf("%lX", v);
+  if (base != BIN) return printf("%ld", v);
+  char buf[33] = {};
+  int i = 32;
+  unsigned long u = (unsigned long)v;
+  do { buf[--i] = '0' + (u & 0x1); u >>= 1; } while (u != 0 && i > 0);
+  return print(&buf[i]);
+}
+size_t HostSerial::println(const char * s) { return print(s) + println(); }
+size_t HostSerial::println(long v, int base) { return print(v, base) + println(); }
+size_t HostSerial::println(double v, int digits) { return print(v, digits) + println(); }
+size_t HostSerial::println() { return print("\n"); }
+size_t HostSerial::printf(const char * fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int n = vprintf(fmt, args);
+  va_end(args);
+  return n > 0? n : 0;
+}
+
+// Just the firmware globals the crypto engine touches
+state_t state;
+sketch_t sketch;
+
+unsigned long timesince(unsigned long t1, unsigned long t2) {
+  return (t1 <= t2)? (t2 - t1) : (ULONG_MAX - t1 + t2);
+}
+
+
+// The daisy chain is a ring, each board's TX goes to the RX of the next one
+typedef struct {
+  std::deque<std::pair<uint64_t, uint8_t>> wire;    // Bytes on the line and when they arrive
+  std::deque<uint8_t> rx;
+  uint64_t busy, blocked;
+  uint32_t overruns;
+} host_uart;
+static host_uart host_uarts[HOST_BOARDS];
+
+// Line faults, a scenario may rewrite or drop (returns false) what a board writes
+static bool (*host_uartfault)(uint8_t board, uint8_t * data, size_t len) = NULL;
+
+size_t hostsim_uartwrite(uint8_t board, const uint8_t * data, size_t len) {
+  host_uart * u = &host_uarts[board];
+  std::vector<uint8_t> line(data, data + len);
+  bool sent = host_uartfault == NULL || host_uartfault(board, line.data(), len);
+  for (size_t i = 0; i < len; i++) {
+    u->busy = max(u->busy, host_ns) + HOST_UARTBYTE_NS;
+    if (sent) u->wire.push_back(std::make_pair(u->busy, line[i]));
+  }
+
+  // Whatever doesn't fit the FIFO is written out before returning. The other boards keep
+  // running meanwhile, so the writer sits out its loop instead of stopping the clock.
+  uint64_t fifo = HOST_UARTFIFO * HOST_UARTBYTE_NS;
+  if (u->busy > host_ns + fifo) u->blocked = u->busy - fifo;
+  return len;
+}
+
+static host_uart * host_uartrx(uint8_t board) {
+  host_uart * u = &host_uarts[(board + host_nboards - 1) % host_nboards];
+
+  // A board on its own has nothing on its RX pin
+  if (host_nboards == 1) u->wire.clear();
+  while (!u->wire.empty() && u->wire.front().first <= host_ns) {
+    if (u->rx.size() < HOST_UARTRXBUF)  u->rx.push_back(u->wire.front().second);
+    else                                u->overruns += 1;
+    u->wire.pop_front();
+  }
+  return u;
+}
+
+size_t hostsim_uartavailable(uint8_t board) {
+  return host_uartrx(board)->rx.size();
+}
+
+size_t hostsim_uartread(uint8_t board, uint8_t * data, size_t len) {
+  host_uart * u = host_uartrx(board);
+  size_t n = 0;
+  for (; n < len && !u->rx.empty(); n++) {
+    data[n] = u->rx.front();
+    u->rx.pop_front();
+  }
+  return n;
+}
+
+static std::string host_boardso = "board.so";
+
+// dlopen hands out the same copy for the same file, so every board gets a file of its own
+static const hostboard_t * host_addboard(bool master) {
+  char path[64];
+  static unsigned copies = 0;
+  snprintf(path, sizeof(path), "/tmp/hostsim-%d-%u.so", (int)getpid(), copies++);
+  FILE * in = fopen(host_boardso.c_str(), "rb"), * out = fopen(path, "wb");
+  if (in == NULL || out == NULL) {
+    check(false, "can't copy %s (run make)", host_boardso.c_str());
+    if (in != NULL) fclose(in);
+    if (out != NULL) fclose(out);
+    return NULL;
+  }
+  char buf[4096];
+  for (size_t n; (n = fread(buf, 1, sizeof(buf), in)) > 0; ) fwrite(buf, 1, n, out);
+  fclose(in);
+  fclose(out);
+
+  void * handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  unlink(path);
+  check(handle != NULL, "dlopen %s", dlerror());
+  if (handle == NULL) return NULL;
+
+  const hostboard_t * b = ((const hostboard_t * (*)())dlsym(handle, "hostboard"))();
+  uint8_t index = host_nboards;
+  host_uarts[index] = host_uart();
+  b->setup(index, master);
+  host_handles[index] = handle;
+  host_boards[index] = b;
+  host_nboards += 1;
+  return b;
+}
+
+static void host_dropboards() {
+  uint8_t n = host_nboards;
+  host_nboards = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    dlclose(host_handles[i]);
+    host_uarts[i] = host_uart();
+  }
+}
+
+// Boards take turns at loop(), time only moves while they wait or do I/O
+static void host_runboards(unsigned long ms) {
+  uint64_t end = host_ns + (uint64_t)ms * 1000000;
+  while (host_ns < end) {
+    for (uint8_t i = 0; i < host_nboards; i++) {
+      if (host_uarts[i].blocked <= host_ns) host_boards[i]->loop();
+    }
+    hostsim_elapse(HOST_LOOP_NS);
+  }
+}
+
+
+static void host_wait() {
+  delay(1);
+}
+
+static void host_begin(const char * name, uint8_t devices) {
+  printf("%s\n", name);
+  pssim_init(devices);
+  ps_spiinit(devices);
+  for (uint8_t d = 0; d < devices; d++) {
+    ps_select(d);
+    ps_getstatus(true);
+  }
+  ps_select(0);
+  pssim_clearstats();
+}
+
+static void scenario_registers() {
+  host_begin("registers", 1);
+
+  ps_setmaxspeed(1000.0);
+  check(pssim_getreg(0, PARAM_MAXSPEED) == 66, "maxspeed reg 0x%X", pssim_getreg(0, PARAM_MAXSPEED));
+  check(near(ps_getmaxspeed(), 1000.0, 15.26), "maxspeed %.1f", ps_getmaxspeed());
+
+  ps_setfullstepspeed(600.0, true);
+  ps_fullstepspeed fs = ps_getfullstepspeed();
+  check(near(fs.steps_per_sec, 600.0, 15.26) && fs.boost_mode, "fsspd %.1f boost %d", fs.steps_per_sec, fs.boost_mode);
+
+  ps_setstepsize(STEP_16);
+  check((pssim_getreg(0, PARAM_STEPMODE) & 0x7) == STEP_16, "stepmode 0x%X", pssim_getreg(0, PARAM_STEPMODE));
+
+  // Datasheet ACC unit is 14.55 steps/s^2 per LSB
+  ps_setaccel(1000.0);
+  printf("  accel 1000 steps/s^2 requested, chip runs %.0f steps/s^2\n", pssim_getreg(0, PARAM_ACC) * 14.5519152);
+
+  ps_setpos(-1234);
+  check(ps_getpos() == -1234 && pssim_getpos(0) == -1234, "pos %d", ps_getpos());
+  ps_setmark(0x1FFFFF);
+  check(ps_getmark() == 0x1FFFFF, "mark %d", ps_getmark());
+
+  pssim_setadc(0, 17);
+  check(ps_readadc() == 17, "adc %d", ps_readadc());
+  check(!ps_getstatus(true).alarms.command_error, "unexpected command error");
+}
+
+static void scenario_motion() {
+  host_begin("motion", 1);
+  ps_setstepsize(STEP_16);
+  ps_setmaxspeed(500.0);
+  ps_setaccel(1000.0);
+  ps_setdecel(1000.0);
+
+  // 200 full steps
+  uint64_t start = hostsim_now();
+  ps_move(FWD, 200 * 16);
+  ps_status st = ps_getstatus();
+  check(st.busy && st.movement == M_ACCEL && !st.hiz, "move busy %d movement %d", st.busy, st.movement);
+  ps_waitbusy(host_wait);
+  check(ps_getpos() == 3200, "move pos %d", ps_getpos());
+  check(ps_getstatus().movement == M_STOPPED, "move still moving");
+  printf("  move 200 steps took %.1fms\n", (hostsim_now() - start) / 1e6);
+
+  ps_goto(-800);
+  ps_waitbusy(host_wait);
+  check(ps_getpos() == -800, "goto pos %d", ps_getpos());
+  ps_gohome();
+  ps_waitbusy(host_wait);
+  check(ps_getpos() == 0, "gohome pos %d", ps_getpos());
+
+  // Run drops busy at speed
+  ps_run(REV, 300.0);
+  ps_waitbusy(host_wait);
+  st = ps_getstatus();
+  check(near(ps_getspeed(), 300.0, 0.1) && st.movement == M_CONSTSPEED && st.direction == REV, "run %.2f movement %d", ps_getspeed(), st.movement);
+  check(ps_getpos() < 0, "run pos %d", ps_getpos());
+
+  // Motion commands are refused while busy
+  ps_softstop();
+  ps_move(FWD, 100);
+  check(ps_getstatus(true).alarms.command_error, "move while busy accepted");
+  ps_waitbusy(host_wait);
+  check(!ps_isrunning() && !ps_ishiz(), "softstop running %d hiz %d", ps_isrunning(), ps_ishiz());
+
+  ps_softhiz();
+  ps_waitbusy(host_wait);
+  check(ps_ishiz(), "softhiz not in hiz");
+}
+
+static void scenario_switch() {
+  host_begin("switch", 1);
+  ps_setstepsize(STEP_16);
+  ps_setmaxspeed(800.0);
+  ps_setpos(5000);
+
+  ps_gountil(POS_RESET, REV, 200.0);
+  delay(100);
+  pssim_setswitch(0, true);
+  ps_status st = ps_getstatus(true);
+  check(st.user_switch && st.alarms.user_switch, "switch %d event %d", st.user_switch, st.alarms.user_switch);
+  ps_waitbusy(host_wait);
+  int32_t overshoot = ps_getpos();
+  check(overshoot < 0 && overshoot > -16 * 100, "gountil pos %d", overshoot);
+
+  ps_releasesw(POS_COPYMARK, FWD);
+  delay(50);
+  check(ps_isbusy(), "releasesw not busy");
+  pssim_setswitch(0, false);
+  ps_waitbusy(host_wait);
+  check(ps_getmark() == ps_getpos() && ps_getpos() > overshoot, "releasesw mark %d pos %d", ps_getmark(), ps_getpos());
+
+  // Default switch mode hard stops any motion
+  ps_run(FWD, 400.0);
+  delay(200);
+  pssim_setswitch(0, true);
+  check(!ps_isrunning(), "switch did not hard stop");
+  pssim_setswitch(0, false);
+}
+
+static void scenario_shadow() {
+  host_begin("shadow", 1);
+  ps_setstepsize(STEP_16);
+
+  // STEP_MODE only takes in HiZ, a rejected write must not stick in the shadow
+  ps_run(FWD, 100.0);
+  ps_setstepsize(STEP_4);
+  check(ps_getstepsize() == STEP_16, "stepsize %d read back before a status read", ps_getstepsize());
+  check(ps_getstatus(true).alarms.command_error, "stepmode write while running accepted");
+  check(ps_getstepsize() == STEP_16, "stepsize %d after rejected write", ps_getstepsize());
+  ps_hardhiz();
+
+  // A chip reset latches UVLO until GETSTATUS, the shadow is dropped once and refilled
+  pssim_reset();
+  check(ps_getstatus().alarms.undervoltage, "reset did not latch uvlo");
+  check(ps_getstepsize() == STEP_128, "stepsize %d after chip reset", ps_getstepsize());
+  ps_getstatus();
+  pssim_clearstats();
+  ps_getstepsize();
+  check(pssim_getstats().frames == 0, "latched uvlo dropped the shadow again");
+
+  // Deferred writes survive an invalidation and still go out
+  ps_defer();
+  ps_setstepsize(STEP_16);
+  ps_reset();
+  ps_commit();
+  check((pssim_getreg(0, PARAM_STEPMODE) & 0x7) == STEP_16, "deferred stepmode lost, chip holds 0x%x", pssim_getreg(0, PARAM_STEPMODE));
+  ps_getstatus(true);
+
+  pssim_clearstats();
+  ps_defer();
+  ps_setmaxspeed(700.0);
+  ps_setmaxspeed(900.0);
+  ps_setfullstepspeed(400.0);
+  ps_commit();
+  check(pssim_getstats().commands == 2, "deferred commands %u", pssim_getstats().commands);
+  check(near(ps_getmaxspeed(), 900.0, 15.26), "deferred maxspeed %.1f", ps_getmaxspeed());
+
+  pssim_clearstats();
+  ps_setmaxspeed(900.0);
+  check(pssim_getstats().frames == 0, "unchanged write went out");
+}
+
+static void scenario_chain() {
+  host_begin("chain", 3);
+  for (uint8_t d = 0; d < 3; d++) {
+    ps_select(d);
+    ps_setmaxspeed(500.0);
+  }
+
+  // Deferral belongs to the selected device, its neighbours still write through
+  uint32_t held = pssim_getreg(0, PARAM_MAXSPEED);
+  ps_select(0);
+  ps_defer();
+  ps_setmaxspeed(700.0);
+  ps_select(1);
+  ps_setmaxspeed(700.0);
+  check(pssim_getreg(1, PARAM_MAXSPEED) != held && pssim_getreg(0, PARAM_MAXSPEED) == held, "deferred maxspeed 0x%X 0x%X", pssim_getreg(0, PARAM_MAXSPEED), pssim_getreg(1, PARAM_MAXSPEED));
+  ps_select(0);
+  ps_commit();
+  check(pssim_getreg(0, PARAM_MAXSPEED) == pssim_getreg(1, PARAM_MAXSPEED), "committed maxspeed 0x%X", pssim_getreg(0, PARAM_MAXSPEED));
+
+  // UVLO on one device drops only that device's shadow
+  ps_status statuses[PS_MAXDEVICES];
+  for (uint8_t d = 0; d < 3; d++) {
+    ps_select(d);
+    ps_getstatus(true);
+  }
+  ps_select(0);
+  pssim_setuvlo(1);
+  ps_getstatuses(statuses);
+  check(statuses[1].alarms.undervoltage && !statuses[0].alarms.undervoltage, "uvlo %d %d", statuses[0].alarms.undervoltage, statuses[1].alarms.undervoltage);
+  pssim_clearstats();
+  ps_getmaxspeed();
+  check(pssim_getstats().frames == 0, "uvlo on device 1 dropped device 0's shadow");
+  ps_select(1);
+  ps_getmaxspeed();
+  check(pssim_getstats().frames > 0, "uvlo on device 1 kept its shadow");
+
+  pssim_clearstats();
+  ps_syncbegin();
+  ps_select(0);
+  ps_move(FWD, 1000);
+  ps_select(2);
+  ps_run(REV, 300.0);
+  ps_syncend();
+  check(pssim_getstats().frames == 4, "synced frames %u", pssim_getstats().frames);
+  check(pssim_isbusy(0) && !pssim_isbusy(1) && pssim_isbusy(2), "busy %d %d %d", pssim_isbusy(0), pssim_isbusy(1), pssim_isbusy(2));
+
+  delay(500);
+  for (uint8_t d = 0; d < 3; d++) {
+    ps_select(d);
+    // Device 2 keeps running while the read is clocked out
+    check(near(ps_getpos(), pssim_getpos(d), 64), "device %d pos %d model %d", d, ps_getpos(), pssim_getpos(d));
+  }
+  check(pssim_getpos(0) == 1000 && pssim_getpos(1) == 0 && pssim_getpos(2) < 0, "chain pos %d %d %d", pssim_getpos(0), pssim_getpos(1), pssim_getpos(2));
+
+  ps_select(2);
+  ps_snapshot snap = ps_getsnapshot();
+  check(snap.status.direction == REV && near(snap.stepss, 300.0, 0.1), "snapshot dir %d speed %.2f", snap.status.direction, snap.stepss);
+  pssim_clearstats();
+  snap = ps_getsnapshot(false);
+  check(pssim_getstats().frames == 13 && snap.mark == 0 && near(snap.pos, pssim_getpos(2), 64), "snapshot without mark frames %u pos %d", pssim_getstats().frames, snap.pos);
+
+  // The whole chain in the frames of one device
+  ps_snapshot snaps[PS_MAXDEVICES];
+  pssim_clearstats();
+  ps_getsnapshots(snaps);
+  check(pssim_getstats().frames == 17, "chain snapshot frames %u", pssim_getstats().frames);
+  for (uint8_t d = 0; d < 3; d++) {
+    check(near(snaps[d].pos, pssim_getpos(d), 64), "device %d snapshot pos %d model %d", d, snaps[d].pos, pssim_getpos(d));
+  }
+  check(snaps[1].status.hiz && snaps[2].status.direction == REV && near(snaps[2].stepss, 300.0, 0.1), "chain snapshot hiz %d dir %d speed %.2f", snaps[1].status.hiz, snaps[2].status.direction, snaps[2].stepss);
+}
+
+#define TUNE_LIMIT    (3000.0)
+
+static void scenario_tune() {
+  host_begin("tune", 1);
+  ps_setmode(MODE_VOLTAGE);
+  ps_setstepsize(STEP_16);
+  ps_setmaxspeed(TUNE_LIMIT);
+  ps_setaccel(2000.0);
+  ps_setdecel(2000.0);
+  ps_setfullstepspeed(TUNE_LIMIT);
+
+  // NEMA17 class motor, needs half its rated current to carry the load
+  pssim_motor motor = { .resistance = 1.65, .inductance = 4.1, .ke = 0.06, .vs = 12.0, .load = 0.6 };
+  pssim_setmotor(0, &motor);
+  mt_motor m = { .resistance = 1.65, .inductance = 4.1, .ke = 0.06, .current = 1.0, .holdcurrent = 0.6, .vs = 12.0 };
+
+  // AN4144 values land in the registers as computed
+  mt_vmparams p = mt_compute(&m);
+  check(near(p.ktrun, 13.75, 0.01) && near(p.speedco, 256.2, 0.1) && near(p.slopel, 0.125, 0.0001) && near(p.slopehacc, 0.1787, 0.0005),
+        "an4144 kt %.3f speedco %.2f slopel %.4f slopeh %.4f", p.ktrun, p.speedco, p.slopel, p.slopehacc);
+  ps_hardhiz();
+  ps_setktvals(MODE_VOLTAGE, p.kthold / 100.0, p.ktrun / 100.0, p.ktaccel / 100.0, p.ktdecel / 100.0);
+  ps_vm_setbemf(p.slopel, p.speedco, p.slopehacc, p.slopehdec);
+  check(pssim_getreg(0, PARAM_STSLP) == (uint32_t)round(p.slopel / BEMFSLOPE_COEFF) && pssim_getreg(0, PARAM_INTSPEED) == (uint32_t)round(p.speedco / BEMFSPEEDCO_COEFF),
+        "bemf regs stslp 0x%X intspeed 0x%X", pssim_getreg(0, PARAM_STSLP), pssim_getreg(0, PARAM_INTSPEED));
+  ps_softstop();
+  delay(10);
+  check(near(pssim_getcurrent(0), m.holdcurrent, 0.02), "hold current %.3fA", pssim_getcurrent(0));
+}
+
+// The float conversions the driver used before the fixed point codecs
+typedef struct {
+  const char * name;
+  const ps_codec * codec;
+  uint32_t (*encode)(float v);
+  float (*decode)(uint32_t r);
+} host_codec;
+
+#define __legacy(v, expr, mask)   ({ int r = (int)round(expr); (uint32_t)max(0, min(r, (int)(mask))); })
+static const host_codec host_codecs[] = {
+  { "speed", &PS_CODEC_SPEED, [](float v) -> uint32_t { return (uint32_t)round(constrain(v, 0.0, SPEED_MAX) / SPEED_COEFF); }, [](uint32_t r) { return (float)r * (float)SPEED_COEFF; } },
+  { "acc", &PS_CODEC_ACC, [](float v) { return __legacy(v, v * ACC_COEFF, ACC_MASK); }, [](uint32_t r) { return (float)((float)r / ACC_COEFF); } },
+  { "maxspeed", &PS_CODEC_MAXSPEED, [](float v) { return __legacy(v, v * MAXSPEED_COEFF, MAXSPEED_MASK); }, [](uint32_t r) { return (float)((float)r / MAXSPEED_COEFF); } },
+  { "minspeed", &PS_CODEC_MINSPEED, [](float v) { return __legacy(v, v * MINSPEED_COEFF, MINSPEED_MASK); }, [](uint32_t r) { return (float)((float)r / MINSPEED_COEFF); } },
+  { "fsspd", &PS_CODEC_FSSPD, [](float v) { return __legacy(v, v * FSSPD_COEFF - FSSPD_OFFSET, FSSPD_MASK); }, [](uint32_t r) { return (float)(((float)r + FSSPD_OFFSET) / FSSPD_COEFF); } },
+  { "ocdth", &PS_CODEC_OCDTH, [](float v) { return __legacy(v, v * OCDTH_COEFF, OCDTH_MASK); }, [](uint32_t r) { return (float)((float)r / OCDTH_COEFF); } },
+  { "ktval", &PS_CODEC_KTVAL, [](float v) { return __legacy(v, constrain(v, 0.0, 1.0) * (1.0 / KTVALS_COEFF), 0xFF); }, [](uint32_t r) { return (float)((float)r * KTVALS_COEFF); } },
+  { "bemfslope", &PS_CODEC_BEMFSLOPE, [](float v) { return __legacy(v, v / BEMFSLOPE_COEFF, BEMFSLOPE_MASK); }, [](uint32_t r) { return (float)((float)r * BEMFSLOPE_COEFF); } },
+  { "bemfspeedco", &PS_CODEC_BEMFSPEEDCO, [](float v) { return __legacy(v, v / BEMFSPEEDCO_COEFF, BEMFSPEEDCO_MASK); }, [](uint32_t r) { return (float)((float)r * BEMFSPEEDCO_COEFF); } },
+  { "stall", &PS_CODEC_STALL, [](float v) { return __legacy(v, (max(v, (float)STALL_OFFSET) - STALL_OFFSET) / STALL_COEFF, STALL_MASK); }, [](uint32_t r) { return (float)((float)r * STALL_COEFF + STALL_OFFSET); } },
+  { "minctrl", &PS_CODEC_MINCTRL, [](float v) { return __legacy(v, (max(v, (float)MINCTRL_OFFSET) - MINCTRL_OFFSET) / MINCTRL_COEFF, MINCTRL_MASK); }, [](uint32_t r) { return (float)((float)r * MINCTRL_COEFF + MINCTRL_OFFSET); } },
+  { "tfast", &PS_CODEC_TFAST, [](float v) { return __legacy(v, (max(v, (float)TFAST_OFFSET) - TFAST_OFFSET) / TFAST_COEFF, TFAST_MASK); }, [](uint32_t r) { return (float)((float)r * TFAST_COEFF + TFAST_OFFSET); } },
+  { "tsw", &PS_CODEC_TSW, [](float v) { return __legacy(v, v * CM_TSW_COEFF, CM_TSW_MASK); }, [](uint32_t r) { return (float)((float)r / CM_TSW_COEFF); } },
+};
+
+// Nested deeper than JSONSTREAM_MAXDEPTH, each level holds [level, next level, [], -level]
+#define JSONSTREAM_DEEP   (JSONSTREAM_MAXDEPTH + 8)
+
+static void scenario_jsonstream() {
+  printf("jsonstream\n");
+  WebServer server;
+  JsonStream js(server);
+  const char * quote = "say \"hi\" \\ \n\t\r\x01 end";
+  std::string longstr(JSONSTREAM_CHUNK + 100, 'x');
+
+  js.begin();
+  js.beginObject();
+  js.add("quote", quote);
+  js.beginArray("list");
+  for (long i = 0; i < 100; i++) js.add(NULL, i);
+  js.endArray();
+  js.add("long", longstr.c_str());
+  js.beginArray("empty");
+  js.endArray();
+  for (long d = 0; d < JSONSTREAM_DEEP; d++) {
+    js.beginArray(d == 0? "deep" : NULL);
+    js.add(NULL, d);
+  }
+  for (long d = JSONSTREAM_DEEP - 1; d >= 0; d--) {
+    js.beginArray();
+    js.endArray();
+    js.add(NULL, -d);
+    js.endArray();
+  }
+  js.add("after", true);
+  js.endObject();
+  js.end();
+
+  // Full chunks until the last, then the zero length terminator
+  size_t n = server.chunks.size();
+  bool full = n >= 3 && server.chunks[n - 1] == 0 && server.chunks[n - 2] <= JSONSTREAM_CHUNK;
+  for (size_t i = 0; i + 2 < n; i++) full &= server.chunks[i] == JSONSTREAM_CHUNK;
+  check(full, "%zu chunks for %zu bytes", n, server.body.size());
+  printf("  %zu bytes in %zu chunks\n", server.body.size(), n);
+
+  DynamicJsonBuffer buf;
+  JsonObject& root = buf.parseObject(server.body.c_str());
+  check(root.success(), "does not parse back: %s", server.body.c_str());
+  if (!root.success()) return;
+  check(strcmp(root["quote"].as<const char *>(), quote) == 0, "quote came back as %s", root["quote"].as<const char *>());
+  JsonArray& list = root["list"].as<JsonArray&>();
+  check(list.size() == 100 && list[99].as<long>() == 99, "list of %zu", list.size());
+  check(longstr == root["long"].as<const char *>(), "long string of %zu", strlen(root["long"].as<const char *>()));
+  check(root["empty"].as<JsonArray&>().size() == 0 && root["after"].as<bool>(), "empty or after");
+  JsonArray * level = &root["deep"].as<JsonArray&>();
+  for (long d = 0; d < JSONSTREAM_DEEP; d++) {
+    JsonArray& a = *level;
+    size_t size = d == JSONSTREAM_DEEP - 1? 3 : 4;
+    bool ok = a.size() == size && a[0].as<long>() == d && a[size - 2].as<JsonArray&>().size() == 0 && a[size - 1].as<long>() == -d;
+    check(ok, "deep level %ld has %zu entries", d, a.size());
+    if (!ok) break;
+    level = &a[1].as<JsonArray&>();
+  }
+}
+
+#define CODEC_SWEEP   (200000)
+
+static void scenario_codecs() {
+  printf("codecs\n");
+  for (size_t i = 0; i < sizeof(host_codecs) / sizeof(host_codec); i++) {
+    const host_codec * h = &host_codecs[i];
+    const ps_codec * c = h->codec;
+
+    // Every register value decodes the same and encodes back to itself
+    uint32_t bad = 0;
+    for (uint32_t r = 0; r <= c->mask; r++) {
+      float v = h->decode(r);
+      if (ps_encode(*c, v) != r || h->encode(v) != r || !near(ps_decode(*c, r), v, fabs(v) * 1e-6)) bad += 1;
+    }
+    check(bad == 0, "%s %u of %u register values do not round trip", h->name, bad, c->mask + 1);
+
+    // Inputs in between only differ from the old float path on a rounding tie
+    uint32_t ties = 0;
+    bad = 0;
+    for (uint32_t n = 0; n <= CODEC_SWEEP; n++) {
+      float v = (float)(c->vmax * 1.05 * n / CODEC_SWEEP);
+      if (ps_encode(*c, v) == h->encode(v)) continue;
+      double frac = (double)v * c->coeff - c->offset - floor((double)v * c->coeff - c->offset);
+      if (fabs(frac - 0.5) < 1e-5) ties += 1;
+      else bad += 1;
+    }
+    check(bad == 0, "%s %u sweep mismatches", h->name, bad);
+    if (ties > 0) printf("  %s: %u rounding ties differ\n", h->name, ties);
+  }
+
+  // Same pick as the search over frequencies, up to equally close candidates
+  const ps_clocksel clocks[] = { CLK_INT16, CLK_EXT8_XTAL, CLK_EXT24_OSC, CLK_EXT32_XTAL };
+  uint32_t bad = 0;
+  for (size_t i = 0; i < sizeof(clocks) / sizeof(ps_clocksel); i++) {
+    for (float f = 1000.0; f < 130000.0; f += 37.0) {
+      ps_vm_pwmfreq got = ps_vm_pwmfreq2coeffs(clocks[i], f);
+      float best = FLT_MAX;
+      for (uint8_t d = 0; d < 8; d++) for (uint8_t m = 0; m < 8; m++) {
+        ps_vm_pwmfreq cand = {.div = d, .mul = m};
+        best = min(best, (float)fabs(ps_vm_coeffs2pwmfreq(clocks[i], &cand) - f));
+      }
+      if (!near(fabs(ps_vm_coeffs2pwmfreq(clocks[i], &got) - f), best, max(best * 1e-4, 1e-2))) bad += 1;
+    }
+  }
+  check(bad == 0, "pwmfreq %u picks are not the closest", bad);
+}
+
+#define ECC_JOBS      (64)
+#define ECC_DATAOFF   (32)
+
+static const uint8_t ecc_key[32] = {
+  0x6b,0x65,0x79,0x20,0x69,0x6e,0x20,0x73,0x6c,0x6f,0x74,0x20,0x74,0x77,0x6f,0x00,
+  0x10,0x32,0x54,0x76,0x98,0xba,0xdc,0xfe,0xef,0xcd,0xab,0x89,0x67,0x45,0x23,0x01,
+};
+static uint8_t ecc_expect[ECC_JOBS][HASH_LENGTH];
+static uint32_t ecc_done = 0, ecc_bad = 0;
+
+// Replies land here the way lowcom gets them, meta carries the job number
+void lowcom_ecc_hmacend(uint8_t * sha, uint8_t * data, size_t datalen) {
+  uint32_t job;
+  memcpy(&job, data, sizeof(job));
+  if (memcmp(sha, ecc_expect[job % ECC_JOBS], HASH_LENGTH) != 0) ecc_bad += 1;
+  ecc_done += 1;
+}
+
+static void ecc_pass() {
+  ecc_loop(millis());
+  hostsim_elapse(HOST_LOOP_NS);
+}
+
+static bool ecc_idle(unsigned long timeout) {
+  unsigned long start = millis();
+  while (state.service.crypto.queue > 0 || state.service.crypto.arena > 0 || millis() == start) {
+    if (state.service.crypto.fault || timesince(start, millis()) > timeout) return false;
+    ecc_pass();
+  }
+  ecc_pass();
+  return !state.service.crypto.fault;
+}
+
+// Signs jobs of the given size, or random sizes up to a full lowcom packet when zero.
+// Returns simulated HMACs per second with the queue kept full.
+static double ecc_burst(uint32_t jobs, size_t size) {
+  static uint8_t packet[1024];
+  const uint32_t nonce = 0x5eed1e55;
+  uint8_t expect[HASH_LENGTH];
+  size_t len = 0;
+  ecc_done = ecc_bad = 0;
+  uint64_t start = hostsim_now();
+  for (uint32_t next = 0; ecc_done < jobs && !state.service.crypto.fault; ) {
+    while (next < jobs) {
+      if (len == 0) {
+        len = size > 0? size : ECC_DATAOFF + 1 + rand() % (sizeof(packet) - ECC_DATAOFF);
+        for (size_t i = 0; i < len; i++) packet[i] = rand();
+        Sha256.initHmac(ecc_key, sizeof(ecc_key));
+        Sha256.update((const uint8_t *)&nonce, sizeof(nonce));
+        Sha256.update(&packet[ECC_DATAOFF], len - ECC_DATAOFF);
+        memcpy(expect, Sha256.resultHmac(), HASH_LENGTH);
+      }
+
+      // Hold on to the packet until it fits
+      if (!ecc_lowcom_hmac(nonce, (uint8_t *)&next, sizeof(next), packet, ECC_DATAOFF, len)) break;
+      memcpy(ecc_expect[next % ECC_JOBS], expect, HASH_LENGTH);
+      next += 1;
+      len = 0;
+    }
+    ecc_pass();
+  }
+  return ecc_done * 1e9 / (hostsim_now() - start);
+}
+
+static void scenario_ecc() {
+  printf("ecc508a\n");
+  eccsim_init(ecc_key);
+  ecc_init();
+  check(ecc_idle(500), "init did not finish");
+  check(state.service.crypto.provisioned && state.service.crypto.available, "device not found locked with the right version");
+  check(state.service.crypto.rand_level == 32, "random pool holds %u words after init", state.service.crypto.rand_level);
+
+  // A reconnect storm drains the pool without waiting, nothing repeats
+  uint32_t storm[48];
+  uint32_t repeats = 0, fallbacks = state.service.crypto.rand_fallbacks;
+  for (size_t i = 0; i < 48; i++) {
+    storm[i] = ecc_random();
+    for (size_t j = 0; j < i; j++) if (storm[j] == storm[i]) repeats += 1;
+    check(storm[i] != 0, "hello %zu got no nonce", i);
+  }
+  check(repeats == 0, "%u nonces repeated", repeats);
+  check(state.service.crypto.rand_fallbacks - fallbacks == 16, "%u fallbacks, expected 16", state.service.crypto.rand_fallbacks - fallbacks);
+  check(ecc_idle(500) && state.service.crypto.rand_level == 32, "pool refilled to %u words", state.service.crypto.rand_level);
+
+  // Mixed sizes long enough to run into the watchdog several times
+  eccsim_clearstats();
+  double rate = ecc_burst(200, 0);
+  eccsim_stats es = eccsim_getstats();
+  check(!state.service.crypto.fault, "fault during burst (%u timeouts, %u short replies, %u watchdogs)", state.service.crypto.timeouts, state.service.crypto.short_replies, eccsim_getstats().watchdogs);
+  check(ecc_done == 200 && ecc_bad == 0, "%u of 200 hmacs back, %u wrong", ecc_done, ecc_bad);
+  check(es.watchdogs == 0, "device watchdog fired %u times", es.watchdogs);
+  check(es.errors == 0, "%u commands failed on the device", es.errors);
+  check(state.service.crypto.arena_max > 1024, "arena never held two large packets (max %u)", state.service.crypto.arena_max);
+  printf("  mixed sizes %.1f hmacs/s, %u wakes, %u busy polls, queue max %u, arena max %u\n",
+    rate, es.wakes, es.nacks, state.service.crypto.queue_max, state.service.crypto.arena_max);
+
+  // The device goes back to sleep once the queue drains
+  check(ecc_idle(500), "did not drain");
+  delay(60);
+  ecc_pass();
+  check(!eccsim_isawake(), "device left awake while idle");
+
+  // A reply with a bad checksum is retried, not a fault
+  uint32_t retries = state.service.crypto.retries;
+  eccsim_corrupt(0x1B, 1);
+  for (size_t i = 0; i < 17; i++) ecc_random();
+  check(ecc_idle(500), "fault after a corrupted reply");
+  check(state.service.crypto.retries == retries + 1, "%u retries counted, expected 1", state.service.crypto.retries - retries);
+
+  // Every reply landed in a histogram bin
+  const ecc_opstats_t * S;
+  for (size_t i = 0; (S = ecc_opstats(i)) != NULL; i++) {
+    uint32_t total = 0;
+    for (size_t b = 0; b < ECC_HISTBINS; b++) total += S->hist[b];
+    check(total == S->count, "%s histogram holds %u of %u", S->name, total, S->count);
+    if (S->count > 0) printf("  %-12s %6u replies %6u polls %u retries, max %uus\n", S->name, S->count, S->polls, S->retries, S->max_us);
+  }
+}
+
+static void scenario_eccbench() {
+  printf("bench ecc508a hmac (simulated)\n");
+  // Let the driver catch up on the time the other benches took before counting
+  ecc_idle(500);
+  const size_t sizes[] = { 48, 128, 256, 512, 1024 };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(size_t); i++) {
+    eccsim_clearstats();
+    double rate = ecc_burst(100, sizes[i]);
+    eccsim_stats es = eccsim_getstats();
+    check(ecc_done == 100 && ecc_bad == 0 && !state.service.crypto.fault, "%zu byte hmacs failed", sizes[i]);
+    // The device stays up across a burst, it only sleeps to stay clear of its watchdog
+    check(es.wakes < 25 && es.watchdogs == 0, "%zu byte burst took %u wakes, %u watchdogs", sizes[i], es.wakes, es.watchdogs);
+    printf("  %4zu byte packets %8.1f hmacs/s %4u wakes\n", sizes[i], rate, es.wakes);
+    check(ecc_idle(500), "did not drain after %zu byte burst", sizes[i]);
+  }
+}
+
+typedef struct {
+  const char * key;
+  size_t keylen;
+  const char * msg;
+  size_t repeat;
+  const char * digest;
+} host_shavector;
+
+// FIPS 180-2 examples and RFC 4231 cases 2 and 6
+static const host_shavector host_shavectors[] = {
+  { NULL, 0, "", 1, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+  { NULL, 0, "abc", 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+  { NULL, 0, "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+  { NULL, 0, "aaaaaaaaaa", 100000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+  { "Jefe", 4, "what do ya want for nothing?", 1, "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843" },
+  { "\xaa", 131, "Test Using Larger Than Block-Size Key - Hash Key First", 1, "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54" },
+};
+
+static bool sha_matches(const uint8_t * sha, const char * hex) {
+  char got[HASH_LENGTH * 2 + 1];
+  for (size_t i = 0; i < HASH_LENGTH; i++) sprintf(&got[i * 2], "%02x", sha[i]);
+  return strcmp(got, hex) == 0;
+}
+
+static void sha_begin(const host_shavector * v) {
+  if (v->key == NULL) {
+    Sha256.init();
+    return;
+  }
+  uint8_t key[256];
+  for (size_t i = 0; i < v->keylen; i++) key[i] = v->keylen > strlen(v->key)? (uint8_t)v->key[0] : (uint8_t)v->key[i];
+  Sha256.initHmac(key, v->keylen);
+}
+
+static void scenario_sha() {
+  printf("sha256\n");
+  for (size_t i = 0; i < sizeof(host_shavectors) / sizeof(host_shavector); i++) {
+    const host_shavector * v = &host_shavectors[i];
+    size_t len = strlen(v->msg);
+
+    // Block path
+    sha_begin(v);
+    for (size_t r = 0; r < v->repeat; r++) Sha256.update((const uint8_t *)v->msg, len);
+    check(sha_matches(v->key == NULL? Sha256.result() : Sha256.resultHmac(), v->digest), "vector %zu by update", i);
+
+    // Byte path
+    sha_begin(v);
+    for (size_t r = 0; r < v->repeat; r++) for (size_t b = 0; b < len; b++) Sha256.write((uint8_t)v->msg[b]);
+    check(sha_matches(v->key == NULL? Sha256.result() : Sha256.resultHmac(), v->digest), "vector %zu by write", i);
+  }
+
+  // Any split of the input gives the same digest
+  uint8_t data[300], a[HASH_LENGTH];
+  uint32_t bad = 0;
+  srand(43);
+  for (size_t n = 0; n < sizeof(data); n++) data[n] = rand();
+  for (size_t len = 0; len <= sizeof(data); len++) {
+    Sha256.init();
+    for (size_t b = 0; b < len; b++) Sha256.write(data[b]);
+    memcpy(a, Sha256.result(), HASH_LENGTH);
+
+    Sha256.init();
+    for (size_t off = 0; off < len; ) {
+      size_t part = min((size_t)(rand() % 130), len - off);
+      Sha256.update(&data[off], part);
+      off += part;
+    }
+    if (memcmp(a, Sha256.result(), HASH_LENGTH) != 0) bad += 1;
+  }
+  check(bad == 0, "%u split lengths disagree", bad);
+}
+
+static double host_wallclock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define SHABENCH_BYTES  (16 << 20)
+#define shabench(name, expr)  ({ \
+  double start = host_wallclock(); Sha256.init(); \
+  for (size_t off = 0; off < SHABENCH_BYTES; off += sizeof(block)) { expr; } \
+  Sha256.result(); \
+  printf("  %-24s %8.1fMB/s\n", (name), SHABENCH_BYTES / (host_wallclock() - start) / 1e6); \
+})
+
+static void scenario_shabench() {
+  printf("bench sha256 (host wall clock)\n");
+  uint8_t block[1024];
+  for (size_t i = 0; i < sizeof(block); i++) block[i] = i;
+  shabench("write per byte", ({ for (size_t b = 0; b < sizeof(block); b++) Sha256.write(block[b]); }));
+  shabench("update 1KB", Sha256.update(block, sizeof(block)));
+}
+
+// Main loop against back to back HTTP requests under the core lock, simulated time.
+// Handler costs are rough ESP32 figures, the send runs at the client's TCP rate.
+// library/python/loadtest.py measures the same worst gap on a device.
+typedef struct {
+  const char * name;
+  uint32_t locked_us;             // Request parsing plus the work that needs state
+  uint32_t wait_us;               // Waiting on the main loop (crypto/set)
+  uint32_t bytes;
+} host_handler;
+
+static const host_handler host_handlers[] = {
+  { "motor/state", 250, 0, 650 },
+  { "motor/get", 250, 0, 1250 },
+  { "queue/get", 400, 0, 4096 },
+  { "batch (16)", 800, 0, 450 },
+  { "capture/read", 300, 0, 24576 },
+  { "crypto/set", 300, 500000, 40 },
+};
+
+typedef enum { CL_INLINE, CL_HELD, CL_RELEASED } host_corelock;
+
+#define CL_DURATION_NS    (2000000000ULL)
+#define CL_HANDOFF_NS     (20000)         // loop() yields until a waiting handler owns the lock
+#define CL_REQUEST_NS     (2000000)       // Client round trip before its next request
+
+static uint32_t corelock_worst(const host_handler * h, host_corelock mode, uint32_t ns_perbyte) {
+  uint64_t send = (uint64_t)h->bytes * ns_perbyte, wait = (uint64_t)h->wait_us * 1000, locked = (uint64_t)h->locked_us * 1000;
+  uint64_t hold = mode == CL_RELEASED? locked : locked + wait + send;
+  uint64_t t = 0, next = 0, last = 0, worst = 0;
+  while (t < CL_DURATION_NS) {
+    if (mode != CL_INLINE && next <= t) {
+      // Handler took the lock first, the loop blocks until it lets go
+      t = max(t, next + hold);
+      next += locked + wait + send + CL_REQUEST_NS;
+      continue;
+    }
+
+    if (t > 0) worst = max(worst, t - last);
+    last = t;
+    uint64_t end = t + HOST_LOOP_NS;
+    if (mode == CL_INLINE) {
+      // handleClient() inside loop()
+      t = end + locked + wait + send;
+    } else if (next < end) {
+      // Handler queued behind this iteration, it gets the lock during the handoff
+      t = end + CL_HANDOFF_NS + hold;
+      next = end + locked + wait + send + CL_REQUEST_NS;
+    } else {
+      t = end;
+    }
+  }
+  return (uint32_t)(worst / 1000);
+}
+
+static void scenario_corelockbench() {
+  printf("bench core lock worst loop gap (simulated, inline / held / released)\n");
+  const struct { const char * name; uint32_t ns_perbyte; } links[] = { { "1MB/s", 1000 }, { "50KB/s", 20000 } };
+  for (size_t l = 0; l < sizeof(links) / sizeof(links[0]); l++) {
+    for (size_t i = 0; i < sizeof(host_handlers) / sizeof(host_handler); i++) {
+      const host_handler * h = &host_handlers[i];
+      uint32_t inl = corelock_worst(h, CL_INLINE, links[l].ns_perbyte);
+      uint32_t held = corelock_worst(h, CL_HELD, links[l].ns_perbyte);
+      uint32_t rel = corelock_worst(h, CL_RELEASED, links[l].ns_perbyte);
+      check(rel <= held && rel <= (HOST_LOOP_NS + CL_HANDOFF_NS) / 1000 + h->locked_us, "%s worst gap %uus with the lock released", h->name, rel);
+      printf("  %-7s %-14s %9uus %9uus %9uus\n", links[l].name, h->name, inl, held, rel);
+    }
+  }
+}
+
+#define BENCH_ITER    (1000)
+#define bench(name, expr)   ({ \
+  pssim_clearstats(); uint64_t start = hostsim_now(); \
+  for (int i = 0; i < BENCH_ITER; i++) { expr; } \
+  pssim_stats s = pssim_getstats(); \
+  printf("  %-24s %8.2fus %6.1f frames\n", (name), (hostsim_now() - start) / 1e3 / BENCH_ITER, (double)s.frames / BENCH_ITER); \
+})
+
+static void scenario_bench() {
+  host_begin("bench (per call, simulated)", 1);
+  bench("getpos", ps_getpos());
+  bench("getstatus", ps_getstatus());
+  bench("pos+speed+mark+adc+status", ({ ps_getstatus(); ps_getspeed(); ps_getpos(); ps_getmark(); ps_readadc(); }));
+  bench("getsnapshot", ps_getsnapshot());
+  bench("getsnapshot no mark", ps_getsnapshot(false));
+  bench("getmaxspeed (shadowed)", ps_getmaxspeed());
+  bench("setmaxspeed (unchanged)", ps_setmaxspeed(500.0));
+  bench("setmaxspeed (changed)", ps_setmaxspeed(i & 1? 500.0 : 600.0));
+
+  host_begin("bench 4 devices (per call, simulated)", 4);
+  bench("getpos", ps_getpos());
+  bench("getsnapshot x4", ({ for (uint8_t d = 0; d < 4; d++) { ps_select(d); ps_getsnapshot(); } }));
+  bench("getsnapshots", ({ ps_snapshot snaps[PS_MAXDEVICES]; ps_getsnapshots(snaps); }));
+  bench("run x4 unsynced", ({ for (uint8_t d = 0; d < 4; d++) { ps_select(d); ps_run(FWD, 100.0); } }));
+  bench("run x4 synced", ({ ps_syncbegin(); for (uint8_t d = 0; d < 4; d++) { ps_select(d); ps_run(FWD, 100.0); } ps_syncend(); }));
+}
+
+// lowcom as a client sees it, layouts mirror lowcom.cpp
+#define HOST_LCMAGIC1       (0xAE)
+#define HOST_LCMAGIC2       (0x7B11)
+#define HOST_LCERROR        (0x00)
+#define HOST_LCHELLO        (0x01)
+#define HOST_LCPING         (0x03)
+#define HOST_LCSTD          (0x04)
+#define HOST_LCNACK         (0x00)
+#define HOST_LCACK          (0x01)
+#define HOST_LCCMD          (0x02)
+#define HOST_LCREPLY        (0x03)
+
+#define HOST_OPESTOP        (0x00)
+#define HOST_OPCLEARERROR   (0x02)
+#define HOST_OPSETCONFIG    (0x06)
+#define HOST_OPGETSTATE     (0x08)
+#define HOST_OPARM          (0x09)
+#define HOST_OPFIRE         (0x0A)
+#define HOST_OPGETDAISY     (0x0B)
+#define HOST_OPRUN          (0x12)
+#define HOST_OPMOVE         (0x14)
+#define HOST_OPWAITMS       (0x23)
+#define HOST_OPHOMESTALL    (0x1D)
+
+typedef struct ispacked {
+  uint8_t magic1;
+  uint16_t magic2;
+  uint8_t type;
+} host_lcpreamble;
+
+typedef struct ispacked {
+  uint8_t opcode;
+  uint8_t subcode;
+  uint8_t target;
+  uint8_t queue;
+  uint16_t packetid;
+  uint16_t length;
+} host_lcheader;
+
+typedef struct {
+  const hostboard_t * board;
+  int sock;
+  uint16_t packetid;
+  std::string rx;
+} host_lcclient;
+
+static void host_lcwrite(host_lcclient * c, uint8_t type, const void * data, size_t len) {
+  uint8_t packet[sizeof(host_lcpreamble) + len];
+  host_lcpreamble * preamble = (host_lcpreamble *)packet;
+  *preamble = {.magic1 = HOST_LCMAGIC1, .magic2 = HOST_LCMAGIC2, .type = type};
+  memcpy(&preamble[1], data, len);
+  c->board->send(c->sock, packet, sizeof(packet));
+}
+
+static bool host_lcopen(host_lcclient * c, const hostboard_t * b) {
+  c->board = b;
+  c->sock = b->connect();
+  c->packetid = 0;
+  c->rx.clear();
+  host_lcwrite(c, HOST_LCHELLO, NULL, 0);
+
+  // The hello reply is only checked for its preamble, the payload is dropped with it
+  uint8_t buf[512];
+  for (int ms = 0; ms < 1000; ms++) {
+    host_runboards(1);
+    size_t n = b->recv(c->sock, buf, sizeof(buf));
+    if (n > 0) return n > sizeof(host_lcpreamble) && ((host_lcpreamble *)buf)->type == HOST_LCHELLO;
+  }
+  return false;
+}
+
+// Sends a STD command and runs the boards until its ack, nack or reply comes back
+static uint8_t host_lccmd(host_lcclient * c, uint8_t opcode, uint8_t target, uint8_t queue, const void * data, size_t len, std::string * reply = NULL) {
+  uint8_t packet[sizeof(host_lcheader) + len];
+  host_lcheader * header = (host_lcheader *)packet;
+  uint16_t packetid = ++c->packetid;
+  *header = {.opcode = opcode, .subcode = HOST_LCCMD, .target = target, .queue = queue, .packetid = packetid, .length = (uint16_t)len};
+  memcpy(&header[1], data, len);
+  host_lcwrite(c, HOST_LCPING, NULL, 0);
+  host_lcwrite(c, HOST_LCSTD, packet, sizeof(packet));
+
+  for (int ms = 0; ms < 1000; ms++) {
+    host_runboards(1);
+    uint8_t buf[512];
+    for (size_t n; (n = c->board->recv(c->sock, buf, sizeof(buf))) > 0; ) c->rx.append((const char *)buf, n);
+
+    while (c->rx.size() >= sizeof(host_lcpreamble)) {
+      const host_lcpreamble * p = (const host_lcpreamble *)c->rx.data();
+      size_t plen = sizeof(host_lcpreamble);
+      if (p->type == HOST_LCERROR) plen += sizeof(error_state);
+      if (p->type == HOST_LCSTD) {
+        if (c->rx.size() < plen + sizeof(host_lcheader)) break;
+        plen += sizeof(host_lcheader) + ((const host_lcheader *)&p[1])->length;
+      }
+      if (c->rx.size() < plen) break;
+
+      const host_lcheader * h = (const host_lcheader *)&p[1];
+      bool match = p->type == HOST_LCSTD && h->packetid == packetid;
+      uint8_t subcode = h->subcode;
+      if (match && reply != NULL) *reply = c->rx.substr(sizeof(host_lcpreamble) + sizeof(host_lcheader), h->length);
+      c->rx.erase(0, plen);
+      if (match) return subcode;
+    }
+  }
+  return 0xFF;
+}
+
+// Master plus slaves on the ring, returns the master once it counts them all
+static const hostboard_t * host_addchain(uint8_t slaves) {
+  const hostboard_t * master = host_addboard(true);
+  for (uint8_t i = 0; i < slaves; i++) host_addboard(false);
+  if (host_nboards != slaves + 1) {
+    host_dropboards();
+    return NULL;
+  }
+
+  uint64_t start = hostsim_now();
+  for (int ms = 0; ms < 3000 && !(master->state->daisy.active && master->state->daisy.slaves == slaves); ms += 10) host_runboards(10);
+  check(master->state->daisy.active && master->state->daisy.slaves == slaves, "daisy active %d slaves %u", master->state->daisy.active, master->state->daisy.slaves);
+  printf("  chain of %u slaves up after %.1fms\n", slaves, (hostsim_now() - start) / 1e6);
+  return master;
+}
+
+static void scenario_daisy() {
+  printf("daisy\n");
+  const hostboard_t * master = host_addchain(2);
+  if (master == NULL) return;
+  const hostboard_t * slave1 = host_boards[1], * slave2 = host_boards[2];
+
+  host_lcclient c;
+  check(host_lcopen(&c, master), "lowcom hello");
+
+  // Commands through lowcom, over the chain, into the command queue of the slave
+  cmd_run_t run = {.dir = FWD, .stepss = 300.0};
+  check(host_lccmd(&c, HOST_OPRUN, 2, 0, &run, sizeof(run)) == HOST_LCACK, "run not acked");
+  host_runboards(1500);
+  // The driver's SPEED coefficient is 0.015 against the chip's 0.0149
+  check(near(slave2->getspeed(0), 300.0, 3.0), "slave 2 speed %.2f", slave2->getspeed(0));
+  check(!slave1->isbusy(0) && !master->isbusy(0), "run reached the wrong board");
+
+  cmd_move_t move = {.dir = FWD, .microsteps = 3200};
+  check(host_lccmd(&c, HOST_OPMOVE, 1, 0, &move, sizeof(move)) == HOST_LCACK, "move not acked");
+  move = {.dir = REV, .microsteps = 1600};
+  check(host_lccmd(&c, HOST_OPMOVE, 0, 0, &move, sizeof(move)) == HOST_LCACK, "local move not acked");
+  host_runboards(2000);
+  check(slave1->getpos(0) == 3200, "slave 1 pos %d", slave1->getpos(0));
+  check(master->getpos(0) == -1600, "master pos %d", master->getpos(0));
+
+  // Slave state comes back to the master on the chain
+  host_runboards(500);
+  std::string reply;
+  DynamicJsonBuffer buf;
+  check(host_lccmd(&c, HOST_OPGETSTATE, 1, 0, NULL, 0, &reply) == HOST_LCREPLY, "getstate no reply");
+  JsonObject& st = buf.parseObject(reply.c_str());
+  check(st.success() && st["pos"].as<long>() == 3200 && !st["busy"].as<bool>(), "slave 1 state %s", reply.c_str());
+
+  cmd_stop_t stop = {.hiz = true, .soft = false};
+  check(host_lccmd(&c, HOST_OPESTOP, 2, 0, &stop, sizeof(stop)) == HOST_LCACK, "estop not acked");
+  host_runboards(200);
+  check(slave2->ishiz(0) && slave2->getspeed(0) == 0.0, "slave 2 estop hiz %d speed %.2f", slave2->ishiz(0), slave2->getspeed(0));
+
+  check(host_lccmd(&c, HOST_OPGETDAISY, 0, 0, NULL, 0, &reply) == HOST_LCREPLY, "getdaisy no reply");
+  JsonObject& link = buf.parseObject(reply.c_str());
+  check(link.success() && link["failures"].as<long>() == 0 && link["retransmits"].as<long>() == 0, "link %s", reply.c_str());
+  printf("  master link %s\n", reply.c_str());
+
+  // A slave cuts a frame through once its 13 byte header is in, a hop is that plus one pass of its loop
+  uint32_t header_us = 13 * HOST_UARTBYTE_NS / 1000, hop = link["hop_us"].as<unsigned long>();
+  check(hop >= header_us - 20 && hop <= header_us + HOST_LOOP_NS / 1000, "hop %uus, header takes %uus", hop, header_us);
+
+  // Every echo goes round the whole ring, only the turnaround against the ping just ahead of it belongs to the slave
+  for (uint8_t t = 1; t <= 2; t++) {
+    check(host_lccmd(&c, HOST_OPGETDAISY, t, 0, NULL, 0, &reply) == HOST_LCREPLY, "getdaisy %u no reply", t);
+    JsonObject& slave = buf.parseObject(reply.c_str());
+    uint32_t rtt = slave["ring_rtt_us"].as<unsigned long>(), turnaround = slave["turnaround_us"].as<unsigned long>();
+    check(slave.success() && turnaround > 0 && turnaround < rtt, "slave %u ring rtt %uus turnaround %uus", t, rtt, turnaround);
+    printf("  slave %u ring rtt %uus turnaround %uus\n", t, rtt, turnaround);
+  }
+
+  for (uint8_t i = 0; i < host_nboards; i++) {
+    check(host_uarts[i].overruns == 0, "board %u uart overruns %u", i, host_uarts[i].overruns);
+    check(host_boards[i]->state->error.subsystem == ESUB_UNK, "board %u error subsystem %u type %d", i, host_boards[i]->state->error.subsystem, host_boards[i]->state->error.type);
+  }
+
+  master->close(c.sock);
+  host_dropboards();
+}
+
+// Runs the boards until Q0 of the client's board drains or the time is up, pinging on the way
+static bool host_lcdrain(host_lcclient * c, unsigned long ms) {
+  const hostboard_t * b = c->board;
+  for (unsigned long t = 0; t < ms && (b->queue[0].len > 0 || b->isbusy(0)); t += 10) {
+    if (t % 1000 == 0) host_lcwrite(c, HOST_LCPING, NULL, 0);
+    host_runboards(10);
+  }
+  return b->queue[0].len == 0 && !b->isbusy(0);
+}
+
+static void scenario_homing() {
+  printf("homing\n");
+  const hostboard_t * b = host_addboard(true);
+  if (b == NULL) return;
+
+  host_lcclient c;
+  check(host_lcopen(&c, b), "lowcom hello");
+  const char * voltage = "{\"mode\":\"voltage\",\"vm_stall\":750}";
+  check(host_lccmd(&c, HOST_OPSETCONFIG, 0, 0, voltage, strlen(voltage) + 1) == HOST_LCACK, "setconfig not acked");
+  host_lcdrain(&c, 500);
+  uint32_t stallth = b->getreg(0, PARAM_STALLTH);
+  check(b->config->motor.mode == MODE_VOLTAGE && stallth == 23, "mode %d stall_th %u", b->config->motor.mode, stallth);
+
+  // End stop 4000 microsteps back, homing zeroes there and the queued move runs from it
+  pssim_motor motor = { .resistance = 1.65, .inductance = 4.1, .ke = 0.06, .vs = 12.0, .load = 0.0, .rdson = 0.2 };
+  b->setmotor(0, &motor);
+  b->setstop(0, true, -4000);
+  cmd_homestall_t home = {.dir = REV, .fast = 200.0, .slow = 50.0, .backoff = 800, .pos = 0};
+  cmd_move_t move = {.dir = FWD, .microsteps = 1600};
+  uint64_t start = hostsim_now();
+  check(host_lccmd(&c, HOST_OPHOMESTALL, 0, 0, &home, sizeof(home)) == HOST_LCACK, "homestall not acked");
+  check(host_lccmd(&c, HOST_OPMOVE, 0, 0, &move, sizeof(move)) == HOST_LCACK, "move not acked");
+  check(host_lcdrain(&c, 20000), "homing still running");
+  printf("  homed and moved in %.1fs\n", (hostsim_now() - start) / 1e9);
+  check(b->state->error.subsystem == ESUB_UNK, "homing error subsystem %u", b->state->error.subsystem);
+  check(b->getpos(0) == 1600 && abs(b->getrotor(0) - (-4000 + 1600)) <= 16, "pos %d rotor %d", b->getpos(0), b->getrotor(0));
+  check(b->getreg(0, PARAM_STALLTH) == stallth, "stall_th %u after homing", b->getreg(0, PARAM_STALLTH));
+
+  // Bridge drop over every threshold, the failure takes the move behind it along
+  motor.rdson = 40.0;
+  b->setmotor(0, &motor);
+  check(host_lccmd(&c, HOST_OPHOMESTALL, 0, 0, &home, sizeof(home)) == HOST_LCACK, "homestall not acked");
+  check(host_lccmd(&c, HOST_OPMOVE, 0, 0, &move, sizeof(move)) == HOST_LCACK, "move not acked");
+  int32_t pos = b->getpos(0);
+  check(host_lcdrain(&c, 20000), "failed homing still running");
+  check(b->state->error.subsystem == ESUB_CMD && b->state->error.type == ETYPE_MSG, "failed homing error subsystem %u type %d", b->state->error.subsystem, b->state->error.type);
+  check(abs(b->getpos(0) - pos) < 1600, "move ran after failed homing, pos %d from %d", b->getpos(0), pos);
+  check(b->getreg(0, PARAM_STALLTH) == stallth, "stall_th %u after failed homing", b->getreg(0, PARAM_STALLTH));
+  check(host_lccmd(&c, HOST_OPCLEARERROR, 0, 0, NULL, 0) == HOST_LCACK, "clearerror not acked");
+
+  // Estop in the middle of calibration
+  motor.rdson = 0.2;
+  b->setmotor(0, &motor);
+  check(host_lccmd(&c, HOST_OPHOMESTALL, 0, 0, &home, sizeof(home)) == HOST_LCACK, "homestall not acked");
+  host_runboards(300);
+  check(b->getreg(0, PARAM_STALLTH) != stallth, "not calibrating, stall_th %u", b->getreg(0, PARAM_STALLTH));
+  cmd_stop_t stop = {.hiz = false, .soft = false};
+  check(host_lccmd(&c, HOST_OPESTOP, 0, 0, &stop, sizeof(stop)) == HOST_LCACK, "estop not acked");
+  check(host_lcdrain(&c, 1000), "estop left the queue running");
+  check(b->getreg(0, PARAM_STALLTH) == stallth, "stall_th %u after estop", b->getreg(0, PARAM_STALLTH));
+
+  b->close(c.sock);
+  host_dropboards();
+}
+
+// Daisy frames on the line, header and chunk layout as in daisy.cpp
+#define HOST_DAISYMAGIC     (0xAB)
+#define HOST_DAISYHEAD      (13)
+#define HOST_DAISYCHUNK     (10)
+#define HOST_DAISYACK       (0x01)
+#define HOST_DAISYSYNC      (0x02)
+#define HOST_DAISYFIRE      (0x07)
+#define HOST_DAISYSTOP      (0x21)
+#define HOST_DAISYRUN       (0x22)
+#define HOST_DAISYWRITEQ    (0x39)
+
+static int host_corrupt = 0;
+static bool host_corruptchunk(uint8_t board, uint8_t * data, size_t len) {
+  for (size_t i = 0; board == 0 && host_corrupt > 0 && i + HOST_DAISYHEAD + HOST_DAISYCHUNK + 2 <= len; i++) {
+    uint8_t * h = &data[i];
+    if (h[0] != HOST_DAISYMAGIC || h[10] != HOST_DAISYWRITEQ || h[5] == 0) continue;
+
+    // Same byte sum, so only the CRC16 of the chunk can tell
+    h[HOST_DAISYHEAD + HOST_DAISYCHUNK] += 1;
+    h[HOST_DAISYHEAD + HOST_DAISYCHUNK + 1] -= 1;
+    host_corrupt -= 1;
+  }
+  return true;
+}
+
+static bool host_badopcode(uint8_t board, uint8_t * data, size_t len) {
+  for (size_t i = 0; board == 0 && host_corrupt > 0 && i + HOST_DAISYHEAD <= len; i++) {
+    uint8_t * h = &data[i];
+    if (h[0] != HOST_DAISYMAGIC || h[10] != HOST_DAISYRUN) continue;
+    h[10] = HOST_DAISYSTOP;
+    h[1] += HOST_DAISYSTOP - HOST_DAISYRUN;
+    host_corrupt -= 1;
+  }
+  return true;
+}
+
+// The cut through fire dies between slave 1 and slave 2
+static bool host_losefire(uint8_t board, uint8_t * data, size_t len) {
+  for (size_t i = 0; board == 1 && i + HOST_DAISYHEAD <= len; i++) {
+    if (data[i] == HOST_DAISYMAGIC && data[i + 10] == HOST_DAISYFIRE) data[i] = 0;
+  }
+  return true;
+}
+
+// Slave 2 still forwards, but what it answers itself never reaches the master
+static bool host_muteslave(uint8_t board, uint8_t * data, size_t len) {
+  for (size_t i = 0; board == 2 && i + HOST_DAISYHEAD <= len; i++) {
+    uint8_t * h = &data[i];
+    if (h[0] == HOST_DAISYMAGIC && h[3] == 0) h[0] = 0;
+  }
+  return true;
+}
+
+// Runs the board until its tune finishes, pinging on the way
+static bool host_tunedone(host_lcclient * c, unsigned long ms) {
+  const hostboard_t * b = c->board;
+  for (unsigned long t = 0; t < ms && b->state->tune.phase != TUNE_IDLE; t += 10) {
+    if (t % 1000 == 0) host_lcwrite(c, HOST_LCPING, NULL, 0);
+    host_runboards(10);
+  }
+  return b->state->tune.phase == TUNE_IDLE;
+}
+
+static void scenario_tunesweep() {
+  printf("tune sweep\n");
+  const hostboard_t * b = host_addboard(true);
+  if (b == NULL) return;
+
+  host_lcclient c;
+  check(host_lcopen(&c, b), "lowcom hello");
+  const char * voltage = "{\"mode\":\"voltage\",\"maxspeed\":3000,\"fsspeed\":3000,\"accel\":2000,\"decel\":2000}";
+  check(host_lccmd(&c, HOST_OPSETCONFIG, 0, 0, voltage, strlen(voltage) + 1) == HOST_LCACK, "setconfig not acked");
+  host_lcdrain(&c, 500);
+
+  // Same motor as the register checks, the firmware runs the whole sweep itself
+  pssim_motor motor = { .resistance = 1.65, .inductance = 4.1, .ke = 0.06, .vs = 12.0, .load = 0.6 };
+  b->setmotor(0, &motor);
+  uint64_t start = hostsim_now();
+  check(b->tune(1.65, 4.1, 0.06, 1.0, 0.6, 12.0, TUNE_LIMIT), "tune not started");
+  check(host_tunedone(&c, 180000), "tune still running in phase %u", b->state->tune.phase);
+  tune_state computed = b->state->tune;
+  printf("  AN4144 values hold %.0f steps/s after %u trials, boost %.4f, %.1fs\n", computed.held, computed.trials, computed.boost, (hostsim_now() - start) / 1e9);
+  check(computed.done && computed.boost == 0 && computed.held >= 500.0, "computed done %d holds %.0f boost %.4f", computed.done, computed.held, computed.boost);
+  check(near(b->config->motor.maxspeed, computed.maxspeed, 0.01) && near(computed.maxspeed, computed.held * MT_MARGIN, 0.01), "maxspeed %.0f tuned %.0f", b->config->motor.maxspeed, computed.maxspeed);
+  check(b->getreg(0, PARAM_STSLP) == (uint32_t)round(computed.slopel / BEMFSLOPE_COEFF), "stslp 0x%X for slope %.4f", b->getreg(0, PARAM_STSLP), computed.slopel);
+  check(b->ishiz(0) && b->state->error.subsystem == ESUB_UNK, "after tune hiz %d error subsystem %u", b->ishiz(0), b->state->error.subsystem);
+
+  // Unknown BEMF constant, the sweep has to find the slope itself
+  start = hostsim_now();
+  check(b->tune(1.65, 4.1, 0.0, 1.0, 0.6, 12.0, TUNE_LIMIT), "tune without ke not started");
+  check(host_tunedone(&c, 180000), "tune without ke still running in phase %u", b->state->tune.phase);
+  tune_state refined = b->state->tune;
+  printf("  without ke hold %.0f steps/s after %u trials, boost %.4f, %.1fs\n", refined.held, refined.trials, refined.boost, (hostsim_now() - start) / 1e9);
+  check(refined.done && refined.boost > 0 && refined.held >= computed.held * 0.75, "refined holds %.0f boost %.4f", refined.held, refined.boost);
+
+  // Holding estop mid sweep, the motor stays energized and the old config waits for the next HiZ
+  float maxspeed = b->config->motor.maxspeed;
+  check(b->tune(1.65, 4.1, 0.06, 1.0, 0.6, 12.0, TUNE_LIMIT), "tune not restarted");
+  host_runboards(2000);
+  cmd_stop_t stop = {.hiz = false, .soft = false};
+  check(host_lccmd(&c, HOST_OPESTOP, 0, 0, &stop, sizeof(stop)) == HOST_LCACK, "estop not acked");
+  host_runboards(500);
+  check(!b->ishiz(0) && b->state->tune.phase == TUNE_FINISH, "after holding estop hiz %d phase %u", b->ishiz(0), b->state->tune.phase);
+  for (int t = 0; t < 6; t++) {
+    host_lcwrite(&c, HOST_LCPING, NULL, 0);
+    host_runboards(1000);
+  }
+  check(!b->ishiz(0) && b->state->tune.phase == TUNE_FINISH, "hiz %d phase %u while held", b->ishiz(0), b->state->tune.phase);
+  stop.hiz = true;
+  check(host_lccmd(&c, HOST_OPESTOP, 0, 0, &stop, sizeof(stop)) == HOST_LCACK, "estop not acked");
+  host_runboards(500);
+  check(b->state->tune.phase == TUNE_IDLE && !b->state->tune.done && near(b->config->motor.maxspeed, maxspeed, 0.01), "phase %u done %d maxspeed %.0f of %.0f", b->state->tune.phase, b->state->tune.done, b->config->motor.maxspeed, maxspeed);
+
+  b->close(c.sock);
+  host_dropboards();
+}
+
+static void scenario_alarms() {
+  printf("alarms\n");
+  const hostboard_t * b = host_addboard(true);
+  if (b == NULL) return;
+
+  // Idle in HiZ the state backs off, an alarm still shows up within a status poll
+  host_runboards(1100);
+  check(b->state->motor.status.hiz && b->state->motor.sample_ms > 10, "hiz %d sample_ms %u", b->state->motor.status.hiz, b->state->motor.sample_ms);
+  check(b->state->error.subsystem == ESUB_UNK, "error subsystem %u before the dip", b->state->error.subsystem);
+  b->setuvlo(0);
+  uint64_t start = hostsim_now();
+  while (b->state->error.subsystem == ESUB_UNK && hostsim_now() - start < 1000000000ULL) host_runboards(1);
+  double latency = (hostsim_now() - start) / 1e6;
+  check(b->state->error.subsystem == ESUB_MOTOR && latency <= 20.0, "undervoltage seen after %.1fms, error subsystem %u", latency, b->state->error.subsystem);
+  printf("  undervoltage in hiz seen after %.1fms\n", latency);
+
+  host_dropboards();
+}
+
+// Queue opcodes of command.h, its CMD_ names clash with the chip commands
+#define HOST_CMDRUN         (0x02)
+#define HOST_CMDGOHOME      (0x40 | 0x08)
+#define HOST_CMDSETCONFIG   (0x80 | 0x0D)
+
+// Packed /api/batch record, target and queue then the command as it sits in a queue
+static size_t host_record(uint8_t * r, uint8_t target, uint8_t queue, uint8_t opcode, uint8_t device, const void * payload, size_t len) {
+  cmd_head_t head = {.id = 0, .opcode = opcode, .device = device};
+  r[0] = target;
+  r[1] = queue;
+  memcpy(&r[2], &head, sizeof(head));
+  memcpy(&r[2 + sizeof(head)], payload, len);
+  return 2 + sizeof(head) + len;
+}
+
+static void host_batch(const hostboard_t * b, const uint8_t * data, size_t len, size_t consume, const char * error) {
+  id_t id = 0;
+  const char * e = NULL;
+  size_t n = b->batch(data, len, &id, &e);
+  bool ok = n == consume && (error == NULL? e == NULL && id != 0 : e != NULL && strcmp(e, error) == 0 && id == 0);
+  check(ok, "batch of %zu consumed %zu id %u error %s, expected %zu %s", len, n, id, e != NULL? e : "none", consume, error != NULL? error : "none");
+}
+
+static void scenario_batch() {
+  printf("batch\n");
+  const hostboard_t * b = host_addboard(true);
+  if (b == NULL) return;
+
+  uint8_t data[128];
+  cmd_run_t run = {.dir = FWD, .stepss = 100.0};
+  size_t first = host_record(data, 0, 1, HOST_CMDRUN, 0, &run, sizeof(run));
+  size_t len = first + host_record(&data[first], 0, 1, HOST_CMDGOHOME, 0, NULL, 0);
+  host_batch(b, data, len, first, NULL);
+  host_batch(b, &data[first], len - first, len - first, NULL);
+  size_t queued = b->queue[1].len;
+  check(queued > 0, "queue 1 empty after two records");
+
+  // Short header or payload, and a config string that runs off the end
+  host_batch(b, data, 5, 0, "truncated record");
+  host_batch(b, data, first - 1, 0, "truncated record");
+  const char * cfg = "{\"mode\":\"voltage\"}";
+  len = host_record(data, 0, 1, HOST_CMDSETCONFIG, 0, cfg, strlen(cfg));
+  host_batch(b, data, len, 0, "truncated record");
+  len = host_record(data, 0, 1, HOST_CMDSETCONFIG, 0, cfg, strlen(cfg) + 1);
+  host_batch(b, data, len + 4, len, NULL);
+  queued = b->queue[1].len;
+
+  // Bad records are consumed whole when their length is known, and queue nothing
+  len = host_record(data, 0, 1, 0x7F, 0, &run, sizeof(run));
+  host_batch(b, data, len, 0, "unknown opcode");
+  len = host_record(data, 0, 1, HOST_CMDRUN, MOTOR_DEVICES, &run, sizeof(run));
+  host_batch(b, data, len, len, "invalid device");
+  // A lone board has no slaves to target
+  len = host_record(data, 5, 1, HOST_CMDRUN, 0, &run, sizeof(run));
+  host_batch(b, data, len, len, "failed to set target");
+  len = host_record(data, 0, QS_SIZE, HOST_CMDRUN, 0, &run, sizeof(run));
+  host_batch(b, data, len, len, "invalid queue");
+  check(b->queue[1].len == queued, "queue 1 grew to %zu from bad records", b->queue[1].len);
+
+  host_dropboards();
+}
+
+static void scenario_daisyfaults() {
+  printf("daisy faults\n");
+  const hostboard_t * master = host_addchain(2);
+  if (master == NULL) return;
+  const hostboard_t * slave1 = host_boards[1], * slave2 = host_boards[2];
+  host_lcclient c;
+  check(host_lcopen(&c, master), "lowcom hello");
+
+  // A program in the master's first storage queue
+  cmd_move_t move = {.dir = FWD, .microsteps = 800};
+  cmd_waitms_t wait = {.ms = 100};
+  for (int i = 0; i < 4; i++) {
+    check(host_lccmd(&c, HOST_OPMOVE, 0, 1, &move, sizeof(move)) == HOST_LCACK, "move not acked");
+    check(host_lccmd(&c, HOST_OPWAITMS, 0, 1, &wait, sizeof(wait)) == HOST_LCACK, "waitms not acked");
+  }
+  const queue_t * src = &master->queue[1];
+
+  // The first chunk fails its CRC on slave 1, the resend has to land
+  uint32_t retransmits = master->state->daisy.retransmits;
+  host_corrupt = 1;
+  host_uartfault = host_corruptchunk;
+  check(master->writequeue(1, 2, 1), "writequeue refused");
+  host_runboards(1000);
+  host_uartfault = NULL;
+  const queue_t * dst = &slave1->queue[2];
+  check(host_corrupt == 0 && master->state->daisy.retransmits > retransmits, "chunk not corrupted, retransmits %u", master->state->daisy.retransmits - retransmits);
+  check(dst->len == src->len && memcmp(dst->Q, src->Q, src->len) == 0, "slave 1 queue %u bytes of %u", (unsigned)dst->len, (unsigned)src->len);
+  check(master->state->daisy.failures == 0 && master->state->daisy.backlog == 0, "failures %u backlog %u", master->state->daisy.failures, master->state->daisy.backlog);
+
+  // RUN turned into a STOP on the way, the slave can't use it but still has to ack it
+  retransmits = master->state->daisy.retransmits;
+  host_corrupt = 1;
+  host_uartfault = host_badopcode;
+  cmd_run_t run = {.dir = FWD, .stepss = 100.0};
+  check(host_lccmd(&c, HOST_OPRUN, 1, 0, &run, sizeof(run)) == HOST_LCACK, "run not acked");
+  host_runboards(1000);
+  host_uartfault = NULL;
+  check(host_corrupt == 0 && slave1->state->error.subsystem == ESUB_DAISY, "slave 1 error subsystem %u", slave1->state->error.subsystem);
+  check(master->state->daisy.retransmits == retransmits && master->state->daisy.backlog == 0, "retransmits %u backlog %u", master->state->daisy.retransmits - retransmits, master->state->daisy.backlog);
+
+  // Armed start on every board, the second fire gets lost on the way to slave 2 and the resend starts it
+  cmd_stop_t stop = {.hiz = true, .soft = false};
+  cmd_run_t slow = {.dir = FWD, .stepss = 50.0};
+  for (int lose = 0; lose < 2; lose++) {
+    for (uint8_t t = 0; t < host_nboards; t++) {
+      uint8_t armqueue = 2;
+      check(host_lccmd(&c, HOST_OPESTOP, t, 0, &stop, sizeof(stop)) == HOST_LCACK, "estop %u not acked", t);
+      check(host_lccmd(&c, HOST_OPRUN, t, armqueue, &slow, sizeof(slow)) == HOST_LCACK, "queued run %u not acked", t);
+      check(host_lccmd(&c, HOST_OPARM, t, 0, &armqueue, sizeof(armqueue)) == HOST_LCACK, "arm %u not acked", t);
+    }
+    host_runboards(200);
+    check(master->ishiz(0) && slave1->ishiz(0) && slave2->ishiz(0), "moving before the fire");
+
+    host_uartfault = lose? host_losefire : NULL;
+    check(host_lccmd(&c, HOST_OPFIRE, 0, 0, NULL, 0) == HOST_LCACK, "fire not acked");
+    host_runboards(500);
+    host_uartfault = NULL;
+
+    id_t fire = master->state->daisy.fire_id;
+    check(!master->ishiz(0) && !slave1->ishiz(0) && !slave2->ishiz(0), "started master %d slave 1 %d slave 2 %d", !master->ishiz(0), !slave1->ishiz(0), !slave2->ishiz(0));
+    check(master->state->daisy.link.fire_id == fire && slave1->state->daisy.link.fire_id == fire, "fire id %u master %u slave 1 %u", fire, master->state->daisy.link.fire_id, slave1->state->daisy.link.fire_id);
+    check(slave2->state->daisy.link.fire_id == (lose? 0 : fire) && slave2->state->daisy.link.fires_missed == (uint32_t)lose, "slave 2 fire id %u missed %u", slave2->state->daisy.link.fire_id, slave2->state->daisy.link.fires_missed);
+
+    // Boards that caught the fire start together, give or take a loop pass for the timer and the hop estimate
+    unsigned long first = ULONG_MAX, last = 0;
+    for (uint8_t t = 0; t < host_nboards; t++) {
+      if (host_boards[t]->state->daisy.link.fire_id != fire) continue;
+      unsigned long started = host_boards[t]->sketch->motor.arm.at + host_boards[t]->state->daisy.link.fire_late_us;
+      first = min(first, started);
+      last = max(last, started);
+    }
+    check(last - first <= HOST_LOOP_NS / 1000 + 100, "fire %d starts %luus apart", lose, last - first);
+    printf("  fire %d starts %luus apart\n", lose, last - first);
+  }
+  for (uint8_t t = 0; t < host_nboards; t++) host_lccmd(&c, HOST_OPESTOP, t, 0, &stop, sizeof(stop));
+  host_runboards(200);
+
+  // Slave 2 goes mute, the master gives up on it after a few syncs instead of resyncing forever
+  host_uartfault = host_muteslave;
+  check(host_lccmd(&c, HOST_OPRUN, 2, 0, &run, sizeof(run)) == HOST_LCACK, "run not acked");
+  for (int t = 0; t < 20000 && master->state->daisy.backlog > 0; t += 100) {
+    host_lcwrite(&c, HOST_LCPING, NULL, 0);
+    host_runboards(100);
+  }
+  retransmits = master->state->daisy.retransmits;
+  uint32_t failures = master->state->daisy.failures;
+  host_runboards(2000);
+  check(master->state->daisy.backlog == 0 && master->state->daisy.retransmits == retransmits && master->state->daisy.failures == failures,
+      "backlog %u retransmits %u failures %u", master->state->daisy.backlog, master->state->daisy.retransmits - retransmits, master->state->daisy.failures - failures);
+  check(master->state->daisy.active && master->state->daisy.slaves == 2, "chain lost, active %d slaves %u", master->state->daisy.active, master->state->daisy.slaves);
+  printf("  mute slave dropped after %u failures\n", failures);
+
+  // Once it's heard from again it's back in the chain
+  host_uartfault = NULL;
+  host_runboards(500);
+  check(host_lccmd(&c, HOST_OPESTOP, 2, 0, &stop, sizeof(stop)) == HOST_LCACK, "estop not acked");
+  host_runboards(500);
+  check(slave2->ishiz(0) && master->state->daisy.backlog == 0 && master->state->daisy.failures == failures,
+      "slave 2 not readmitted, hiz %d backlog %u failures %u", slave2->ishiz(0), master->state->daisy.backlog, master->state->daisy.failures - failures);
+
+  master->close(c.sock);
+  host_dropboards();
+}
+
+int main(int argc, char ** argv) {
+  // board.so sits next to the binary unless HOSTSIM_BOARD says otherwise
+  const char * so = getenv("HOSTSIM_BOARD");
+  std::string self = argv[0];
+  host_boardso = so != NULL? so : self.substr(0, self.rfind('/') + 1) + "board.so";
+
+  scenario_sha();
+  scenario_codecs();
+  scenario_jsonstream();
+  scenario_registers();
+  scenario_motion();
+  scenario_switch();
+  scenario_shadow();
+  scenario_chain();
+  scenario_tune();
+  scenario_ecc();
+  scenario_bench();
+  scenario_shabench();
+  scenario_eccbench();
+  scenario_corelockbench();
+  scenario_daisy();
+  scenario_daisyfaults();
+  scenario_homing();
+  scenario_tunesweep();
+  scenario_alarms();
+  scenario_batch();
+
+  printf(host_failed == 0? "all passed\n" : "%d checks failed\n", host_failed);
+  return host_failed == 0? 0 : 1;
+}
@@ -0,0 +1,608 @@
+#include <Arduino.h>
+
+#include "pssim.h"
+#include "powerstep01.h"
+#include "powerstep01priv.h"
+
+// Datasheet units, the internal tick is 250ns
+#define SIM_TICK            (250e-9)
+#define SIM_SPEED_LSB       (1.0 / (268435456.0 * SIM_TICK))            // 2^-28 step/tick
+#define SIM_ACC_LSB         (1.0 / (1099511627776.0 * SIM_TICK * SIM_TICK)) // 2^-40 step/tick^2
+#define SIM_MAXSPEED_LSB    (1.0 / (262144.0 * SIM_TICK))               // 2^-18 step/tick
+#define SIM_MINSPEED_LSB    (1.0 / (16777216.0 * SIM_TICK))             // 2^-24 step/tick
+#define SIM_SLOPE_LSB       (0.000015)                                  // 0.0015% of Vs per step/s
+#define SIM_RELEASESPEED    (5.0)
+#define SIM_CREEPSPEED      (1.0)
+
+#define SIM_SPEED_MASK      (0x000FFFFF)
+#define SIM_STEP_NS         (50000)
+
+#define CONFIG_SWMODE       (1 << 4)
+
+typedef enum {
+  SIM_IDLE,
+  SIM_RUN,
+  SIM_POSITION,
+  SIM_UNTIL,
+  SIM_RELEASE,
+  SIM_STOP
+} sim_mode;
+
+// R: read only, WR: always writable, WS: only when stopped, WH: only in HiZ
+typedef enum {
+  SIM_R,
+  SIM_WR,
+  SIM_WS,
+  SIM_WH
+} sim_access;
+
+typedef struct {
+  uint8_t bits;
+  sim_access access;
+  uint32_t reset;
+} sim_reg;
+
+static const sim_reg sim_regs[MASK_PARAM + 1] = {
+  { 0,  SIM_R,  0x000000 },   // 0x00 NOP
+  { 22, SIM_WS, 0x000000 },   // ABS_POS
+  { 9,  SIM_WS, 0x000 },      // EL_POS
+  { 22, SIM_WR, 0x000000 },   // MARK
+  { 20, SIM_R,  0x00000 },    // SPEED
+  { 12, SIM_WS, 0x08A },      // ACC
+  { 12, SIM_WS, 0x08A },      // DEC
+  { 10, SIM_WR, 0x041 },      // MAX_SPEED
+  { 13, SIM_WS, 0x000 },      // MIN_SPEED
+  { 8,  SIM_WR, 0x29 },       // KVAL_HOLD / TVAL_HOLD
+  { 8,  SIM_WR, 0x29 },       // KVAL_RUN / TVAL_RUN
+  { 8,  SIM_WR, 0x29 },       // KVAL_ACC / TVAL_ACC
+  { 8,  SIM_WR, 0x29 },       // KVAL_DEC / TVAL_DEC
+  { 14, SIM_WH, 0x0408 },     // INT_SPEED
+  { 8,  SIM_WH, 0x19 },       // ST_SLP / T_FAST
+  { 8,  SIM_WH, 0x29 },       // FN_SLP_ACC / TON_MIN
+  { 8,  SIM_WH, 0x29 },       // FN_SLP_DEC / TOFF_MIN
+  { 4,  SIM_WR, 0x0 },        // K_THERM
+  { 5,  SIM_R,  0x00 },       // ADC_OUT
+  { 5,  SIM_WR, 0x08 },       // OCD_TH
+  { 5,  SIM_WR, 0x10 },       // STALL_TH
+  { 11, SIM_WR, 0x027 },      // FS_SPD
+  { 8,  SIM_WH, 0x07 },       // STEP_MODE
+  { 8,  SIM_WS, 0xFF },       // ALARM_EN
+  { 11, SIM_WH, 0x000 },      // GATECFG1
+  { 8,  SIM_WH, 0x00 },       // GATECFG2
+  { 16, SIM_WH, 0x2C88 },     // CONFIG
+  { 16, SIM_R,  0x0000 },     // STATUS
+};
+
+#define sim_len(param)      ((sim_regs[param].bits + 7) / 8)
+#define sim_mask(param)     ((1UL << sim_regs[param].bits) - 1)
+
+typedef struct {
+  uint32_t reg[MASK_PARAM + 1];
+
+  // Command decoder, arguments and responses are one byte per frame
+  uint8_t cmd;
+  uint8_t argc;
+  uint32_t arg;
+  uint8_t out[3];
+  uint8_t outlen;
+  uint8_t outpos;
+
+  // Motion, position in microsteps and speed in steps/s
+  sim_mode motion;
+  double pos;
+  double speed;
+  double target;
+  double target_speed;
+  uint8_t dir;
+  uint8_t act;
+  uint8_t movement;
+  bool softhiz;
+
+  bool hiz;
+  bool stckmod;
+  bool uvlo;
+  bool cmderr;
+  bool sw;
+  bool swevn;
+  uint8_t adc;
+
+  bool hasmotor;
+  pssim_motor motor;
+  double current;
+  bool stall;
+
+  // Mechanical end stop, the rotor stays on the side it started on while ABS_POS counts on
+  bool hasstop;
+  double stop;
+  int8_t stopside;
+  double rotor;
+  bool blocked;
+} sim_dev;
+
+static sim_dev D[PSSIM_MAXDEVICES];
+static uint8_t Dn = 1;
+
+// One shift register per device, device 0 on MOSI and the last device on MISO
+static uint8_t S[PSSIM_MAXDEVICES];
+static uint8_t Slen = 0;
+static bool Sactive = false;
+
+static uint64_t Tresidual = 0;
+static pssim_stats stats = {};
+
+
+static inline int32_t sim_sext22(uint32_t v) {
+  v &= ABSPOS_MASK;
+  return (v & 0x00200000)? (int32_t)(v | 0xFFC00000) : (int32_t)v;
+}
+
+static inline double sim_microsteps(sim_dev * d) { return (double)(1 << (d->reg[PARAM_STEPMODE] & 0x7)); }
+static inline double sim_acc(sim_dev * d) { return d->reg[PARAM_ACC] * SIM_ACC_LSB; }
+static inline double sim_dec(sim_dev * d) { return d->reg[PARAM_DEC] * SIM_ACC_LSB; }
+static inline double sim_maxspeed(sim_dev * d) { return d->reg[PARAM_MAXSPEED] * SIM_MAXSPEED_LSB; }
+static inline double sim_minspeed(sim_dev * d) { return (d->reg[PARAM_MINSPEED] & MINSPEED_MASK) * SIM_MINSPEED_LSB; }
+
+static inline bool sim_busy(sim_dev * d) {
+  // Run drops BUSY once the target speed is reached
+  if (d->motion == SIM_RUN) return d->speed != d->target_speed;
+  return d->motion != SIM_IDLE;
+}
+
+static void sim_resetdev(sim_dev * d) {
+  uint8_t adc = d->adc;
+  bool sw = d->sw, hasmotor = d->hasmotor, hasstop = d->hasstop;
+  pssim_motor motor = d->motor;
+  double stop = d->stop, rotor = d->rotor;
+  int8_t stopside = d->stopside;
+  memset(d, 0, sizeof(sim_dev));
+  d->hasmotor = hasmotor;
+  d->motor = motor;
+  d->hasstop = hasstop;
+  d->stop = stop;
+  d->stopside = stopside;
+  d->rotor = rotor;
+  for (uint8_t p = 0; p <= MASK_PARAM; p++) d->reg[p] = sim_regs[p].reset;
+  d->hiz = true;
+  d->uvlo = true;
+  d->dir = FWD;
+  d->adc = adc;
+  d->sw = sw;
+}
+
+static uint16_t sim_status(sim_dev * d) {
+  // UVLO, UVLO_ADC, OCD and STALL are active low
+  uint16_t s = 0xE400;
+  if (d->stall)       s &= ~0xC000;
+  if (!d->uvlo)       s |= 0x0200;
+  if (d->stckmod)     s |= 0x0100;
+  if (d->cmderr)      s |= 0x0080;
+  s |= (d->movement & 0x3) << 5;
+  if (d->dir)         s |= 0x0010;
+  if (d->swevn)       s |= 0x0008;
+  if (d->sw)          s |= 0x0004;
+  if (!sim_busy(d))   s |= 0x0002;
+  if (d->hiz)         s |= 0x0001;
+  return s;
+}
+
+static uint32_t sim_read(sim_dev * d, uint8_t param) {
+  switch (param) {
+    case PARAM_ABSPOS:  return (uint32_t)(int32_t)llround(d->pos) & ABSPOS_MASK;
+    case PARAM_SPEED:   return (uint32_t)llround(d->speed / SIM_SPEED_LSB) & SIM_SPEED_MASK;
+    case PARAM_ADCOUT:  return d->adc & sim_mask(PARAM_ADCOUT);
+    case PARAM_STATUS:  return sim_status(d);
+    default:            return d->reg[param];
+  }
+}
+
+static void sim_respond(sim_dev * d, uint32_t v, uint8_t len) {
+  for (uint8_t i = 0; i < len; i++) d->out[i] = (uint8_t)(v >> (8 * (len - 1 - i)));
+  d->outlen = len;
+  d->outpos = 0;
+}
+
+static void sim_error(sim_dev * d) {
+  d->cmderr = true;
+  stats.cmd_errors++;
+}
+
+static void sim_setparam(sim_dev * d, uint8_t param, uint32_t v) {
+  const sim_reg * r = &sim_regs[param];
+  bool stopped = d->motion == SIM_IDLE && d->speed == 0;
+  if (r->bits == 0 || r->access == SIM_R || (r->access == SIM_WS && !stopped) || (r->access == SIM_WH && !d->hiz)) {
+    sim_error(d);
+    return;
+  }
+
+  v &= sim_mask(param);
+  d->reg[param] = v;
+  if (param == PARAM_ABSPOS) d->pos = sim_sext22(v);
+}
+
+static void sim_start(sim_dev * d, sim_mode motion, uint8_t dir) {
+  d->motion = motion;
+  d->dir = dir;
+  if (d->speed == 0) d->movement = M_ACCEL;
+  d->hiz = false;
+  d->stckmod = false;
+  d->softhiz = false;
+}
+
+static void sim_position(sim_dev * d, int32_t delta) {
+  sim_start(d, SIM_POSITION, delta >= 0? FWD : REV);
+  d->target = d->pos + delta;
+}
+
+static void sim_goto(sim_dev * d, uint32_t abspos) {
+  // Shortest way around the 22 bit position
+  sim_position(d, sim_sext22(abspos - sim_read(d, PARAM_ABSPOS)));
+}
+
+static void sim_gotodir(sim_dev * d, uint32_t abspos, uint8_t dir) {
+  uint32_t cur = sim_read(d, PARAM_ABSPOS);
+  if (dir == FWD)   sim_position(d, (int32_t)((abspos - cur) & ABSPOS_MASK));
+  else              sim_position(d, -(int32_t)((cur - abspos) & ABSPOS_MASK));
+  d->dir = dir;
+}
+
+static void sim_action(sim_dev * d) {
+  if (d->act == POS_RESET)  d->pos = 0;
+  else                      d->reg[PARAM_MARK] = sim_read(d, PARAM_ABSPOS);
+}
+
+static void sim_hardstop(sim_dev * d, bool hiz) {
+  d->motion = SIM_IDLE;
+  d->speed = 0;
+  d->movement = M_STOPPED;
+  d->hiz = hiz;
+  d->softhiz = false;
+}
+
+static void sim_softstop(sim_dev * d, bool hiz) {
+  if (d->motion == SIM_IDLE && d->speed == 0) {
+    // Leaves HiZ without moving
+    d->hiz = hiz;
+    return;
+  }
+  d->motion = SIM_STOP;
+  d->softhiz = hiz;
+}
+
+static void sim_execute(sim_dev * d, uint8_t cmd, uint32_t arg) {
+  stats.commands++;
+  uint8_t dir = cmd & MASK_DIR;
+  bool busy = sim_busy(d);
+
+  if (cmd == CMD_NOP()) return;
+  if ((cmd & ~MASK_PARAM) == CMD_SETPARAM(0)) { sim_setparam(d, cmd & MASK_PARAM, arg); return; }
+  if ((cmd & ~MASK_PARAM) == CMD_GETPARAM(0)) {
+    uint8_t param = cmd & MASK_PARAM;
+    if (sim_regs[param].bits == 0) { sim_error(d); return; }
+    sim_respond(d, sim_read(d, param), sim_len(param));
+    return;
+  }
+
+  switch (cmd & ~MASK_DIR) {
+    case CMD_RUN(0): {
+      double spd = (arg & SIM_SPEED_MASK) * SIM_SPEED_LSB;
+      sim_start(d, SIM_RUN, dir);
+      d->target_speed = constrain(spd, sim_minspeed(d), sim_maxspeed(d));
+      return;
+    }
+    case CMD_STEPCLOCK(0): {
+      if (busy) { sim_error(d); return; }
+      sim_hardstop(d, false);
+      d->stckmod = true;
+      d->dir = dir;
+      return;
+    }
+    case CMD_MOVE(0): {
+      if (busy) { sim_error(d); return; }
+      int32_t n = (int32_t)(arg & ABSPOS_MASK);
+      sim_position(d, dir == FWD? n : -n);
+      return;
+    }
+    case CMD_GOTODIR(0): {
+      if (busy) { sim_error(d); return; }
+      sim_gotodir(d, arg, dir);
+      return;
+    }
+  }
+
+  switch (cmd & ~(MASK_DIR | (MASK_ACT << SHIFT_ACT))) {
+    case CMD_GOUNTIL(0, 0): {
+      double spd = (arg & SIM_SPEED_MASK) * SIM_SPEED_LSB;
+      sim_start(d, SIM_UNTIL, dir);
+      d->act = (cmd >> SHIFT_ACT) & MASK_ACT;
+      d->target_speed = min(spd, sim_maxspeed(d));
+      return;
+    }
+    case CMD_RELEASESW(0, 0): {
+      sim_start(d, SIM_RELEASE, dir);
+      d->act = (cmd >> SHIFT_ACT) & MASK_ACT;
+      d->target_speed = max(sim_minspeed(d), SIM_RELEASESPEED);
+      return;
+    }
+  }
+
+  switch (cmd) {
+    case CMD_GOTO():
+    case CMD_GOHOME():
+    case CMD_GOMARK(): {
+      if (busy) { sim_error(d); return; }
+      sim_goto(d, cmd == CMD_GOTO()? arg : (cmd == CMD_GOMARK()? d->reg[PARAM_MARK] : 0));
+      return;
+    }
+    case CMD_RESETPOS():      d->pos = 0; return;
+    case CMD_RESETDEVICE():   sim_resetdev(d); return;
+    case CMD_SOFTSTOP():      sim_softstop(d, false); return;
+    case CMD_HARDSTOP():      sim_hardstop(d, false); return;
+    case CMD_SOFTHIZ():       sim_softstop(d, true); return;
+    case CMD_HARDHIZ():       sim_hardstop(d, true); return;
+    case CMD_GETSTATUS(): {
+      sim_respond(d, sim_status(d), 2);
+      d->uvlo = false;
+      d->cmderr = false;
+      d->swevn = false;
+      d->stall = false;
+      return;
+    }
+  }
+
+  sim_error(d);
+}
+
+static uint8_t sim_arglen(uint8_t cmd) {
+  if (cmd == CMD_NOP()) return 0;
+  if ((cmd & ~MASK_PARAM) == CMD_SETPARAM(0)) return sim_len(cmd & MASK_PARAM);
+  switch (cmd & ~MASK_DIR) {
+    case CMD_RUN(0): case CMD_MOVE(0): case CMD_GOTODIR(0): return 3;
+  }
+  if ((cmd & ~(MASK_DIR | (MASK_ACT << SHIFT_ACT))) == CMD_GOUNTIL(0, 0)) return 3;
+  return cmd == CMD_GOTO()? 3 : 0;
+}
+
+static void sim_byte(sim_dev * d, uint8_t b) {
+  // Input is don't care while a response is clocked out
+  if (d->outpos < d->outlen) {
+    d->outpos += 1;
+    return;
+  }
+
+  if (d->argc > 0) {
+    d->arg = (d->arg << 8) | b;
+    if (--d->argc == 0) sim_execute(d, d->cmd, d->arg);
+    return;
+  }
+
+  d->cmd = b;
+  d->arg = 0;
+  d->argc = sim_arglen(b);
+  if (d->argc == 0) sim_execute(d, b, 0);
+}
+
+static void sim_motion(sim_dev * d, double dt) {
+  if (d->motion == SIM_IDLE) return;
+
+  double k = sim_microsteps(d);
+  double vmax = sim_maxspeed(d), vmin = sim_minspeed(d);
+  double v = d->speed, vt = 0;
+  switch (d->motion) {
+    case SIM_RUN:
+    case SIM_UNTIL:
+    case SIM_RELEASE: {
+      vt = d->target_speed;
+      break;
+    }
+    case SIM_POSITION: {
+      // Start braking once the stopping distance covers what is left
+      double left = fabs(d->target - d->pos) / k;
+      vt = (v * v) / (2.0 * sim_dec(d)) >= left? max(vmin, SIM_CREEPSPEED) : vmax;
+      break;
+    }
+    default: break;
+  }
+
+  if (v == 0 && vt > 0) v = min(vmin, vt);
+  if (v < vt)       { v = min(vt, v + sim_acc(d) * dt); d->movement = M_ACCEL; }
+  else if (v > vt)  { v = max(vt, v - sim_dec(d) * dt); d->movement = M_DECEL; }
+  else              { d->movement = v > 0? M_CONSTSPEED : M_STOPPED; }
+
+  double step = (d->speed + v) / 2.0 * dt * k;
+  d->speed = v;
+
+  switch (d->motion) {
+    case SIM_POSITION: {
+      double left = fabs(d->target - d->pos);
+      if (step >= left) {
+        d->pos = d->target;
+        sim_hardstop(d, false);
+        return;
+      }
+      break;
+    }
+    case SIM_RELEASE: {
+      if (!d->sw) {
+        sim_action(d);
+        sim_hardstop(d, false);
+        return;
+      }
+      break;
+    }
+    case SIM_STOP: {
+      if (v == 0) {
+        sim_hardstop(d, d->softhiz);
+        return;
+      }
+      break;
+    }
+    default: break;
+  }
+
+  d->pos += d->dir == FWD? step : -step;
+}
+
+static void sim_electrical(sim_dev * d) {
+  if (!d->hasmotor) return;
+  if (d->hiz) {
+    d->current = 0;
+    return;
+  }
+
+  // Amplitude is KVAL plus the BEMF compensation, clipped at the supply
+  const pssim_motor * m = &d->motor;
+  double s = d->speed;
+  uint8_t kval = d->movement == M_ACCEL? PARAM_KTVALACC : d->movement == M_DECEL? PARAM_KTVALDEC : s > 0? PARAM_KTVALRUN : PARAM_KTVALHOLD;
+  uint8_t fnslp = d->movement == M_DECEL? PARAM_FNSLPDEC : PARAM_FNSLPACC;
+  double intspeed = d->reg[PARAM_INTSPEED] * BEMFSPEEDCO_COEFF;
+  double k = d->reg[kval] / 256.0 + d->reg[PARAM_STSLP] * SIM_SLOPE_LSB * min(s, intspeed) + d->reg[fnslp] * SIM_SLOPE_LSB * max(0.0, s - intspeed);
+  double v = m->vs * min(k, 1.0);
+
+  // Four full steps per electrical period, |V| = |(R + jwL) I + E| with E in phase with RI.
+  // A rotor held by the end stop makes no BEMF.
+  double e = d->blocked? 0 : m->ke * s / 4.0;
+  double x = 2.0 * M_PI * (s / 4.0) * (m->inductance / 1000.0);
+  double z2 = m->resistance * m->resistance + x * x;
+  double disc = m->resistance * m->resistance * e * e - z2 * (e * e - v * v);
+  d->current = (v <= e || disc < 0)? 0 : (-m->resistance * e + sqrt(disc)) / z2;
+  if (s > 0 && d->current < m->load) d->stall = true;
+
+  // Voltage mode stall detection compares the bridge drop against STALL_TH
+  double stallth = (d->reg[PARAM_STALLTH] + 1) * 31.25;
+  if (s > 0 && m->rdson > 0 && d->current * m->rdson * 1000.0 > stallth) d->stall = true;
+}
+
+static void sim_rotor(sim_dev * d, double delta) {
+  if (!d->hasstop) return;
+  double r = d->rotor + delta;
+  d->blocked = d->stopside > 0? r < d->stop : r > d->stop;
+  d->rotor = d->blocked? d->stop : r;
+}
+
+void pssim_init(uint8_t devices) {
+  Dn = constrain(devices, 1, PSSIM_MAXDEVICES);
+  memset(D, 0, sizeof(D));
+  pssim_reset();
+  pssim_clearstats();
+}
+
+void pssim_reset() {
+  for (uint8_t i = 0; i < Dn; i++) sim_resetdev(&D[i]);
+  Slen = 0;
+  Sactive = false;
+}
+
+void pssim_cs(uint8_t level) {
+  if (level == 0) {
+    // Falling edge loads every device's pending response byte
+    for (uint8_t i = 0; i < Dn; i++) S[i] = D[i].outpos < D[i].outlen? D[i].out[D[i].outpos] : 0x00;
+    Slen = 0;
+    Sactive = true;
+    return;
+  }
+
+  if (!Sactive) return;
+  Sactive = false;
+  stats.frames += 1;
+
+  // Rising edge latches, a device that saw no fresh byte ignores the frame
+  for (uint8_t i = 0; i < Dn; i++) {
+    if (Slen > i) sim_byte(&D[i], S[i]);
+  }
+}
+
+uint8_t pssim_transfer(uint8_t b) {
+  stats.bytes += 1;
+  if (!Sactive) return 0xFF;
+
+  uint8_t miso = S[Dn - 1];
+  for (uint8_t i = Dn - 1; i > 0; i--) S[i] = S[i - 1];
+  S[0] = b;
+  Slen += 1;
+  return miso;
+}
+
+void pssim_step(uint64_t ns) {
+  Tresidual += ns;
+  while (Tresidual >= SIM_STEP_NS) {
+    Tresidual -= SIM_STEP_NS;
+    for (uint8_t i = 0; i < Dn; i++) {
+      double pos = D[i].pos;
+      sim_motion(&D[i], SIM_STEP_NS * 1e-9);
+      sim_rotor(&D[i], D[i].pos - pos);
+      sim_electrical(&D[i]);
+    }
+  }
+}
+
+void pssim_setswitch(uint8_t device, bool closed) {
+  sim_dev * d = &D[device];
+  if (closed && !d->sw) {
+    // Turn on event, hard stops everything unless the switch is in user mode
+    d->swevn = true;
+    if (d->motion == SIM_UNTIL) {
+      sim_action(d);
+      d->motion = SIM_STOP;
+    } else if (!(d->reg[PARAM_CONFIG] & CONFIG_SWMODE) && d->motion != SIM_RELEASE) {
+      sim_hardstop(d, false);
+    }
+  }
+  d->sw = closed;
+}
+
+void pssim_setadc(uint8_t device, uint8_t adc) {
+  D[device].adc = adc;
+}
+
+void pssim_setuvlo(uint8_t device) {
+  D[device].uvlo = true;
+}
+
+void pssim_setmotor(uint8_t device, const pssim_motor * m) {
+  D[device].hasmotor = m != NULL;
+  if (m != NULL) D[device].motor = *m;
+}
+
+void pssim_setstop(uint8_t device, bool enabled, int32_t pos) {
+  D[device].hasstop = enabled;
+  D[device].stop = pos;
+  D[device].rotor = pssim_getpos(device);
+  D[device].stopside = D[device].rotor >= D[device].stop? 1 : -1;
+  D[device].blocked = false;
+}
+
+int32_t pssim_getrotor(uint8_t device) {
+  return (int32_t)llround(D[device].rotor);
+}
+
+float pssim_getcurrent(uint8_t device) {
+  return (float)D[device].current;
+}
+
+uint32_t pssim_getreg(uint8_t device, uint8_t param) {
+  return sim_read(&D[device], param & MASK_PARAM);
+}
+
+int32_t pssim_getpos(uint8_t device) {
+  return sim_sext22(sim_read(&D[device], PARAM_ABSPOS));
+}
+
+float pssim_getspeed(uint8_t device) {
+  return (float)D[device].speed;
+}
+
+bool pssim_isbusy(uint8_t device) {
+  return sim_busy(&D[device]);
+}
+
+bool pssim_ishiz(uint8_t device) {
+  return D[device].hiz;
+}
+
+pssim_stats pssim_getstats() {
+  return stats;
+}
+
+void pssim_clearstats() {
+  memset(&stats, 0, sizeof(stats));
+}
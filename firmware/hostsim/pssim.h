@@ -0,0 +1,52 @@
+#ifndef __PSSIM_H
+#define __PSSIM_H
+
+#include <stdint.h>
+
+// Register level powerSTEP01 model, sits on the SPI bus under the real driver
+#define PSSIM_MAXDEVICES    (4)
+
+typedef struct {
+  uint32_t frames;
+  uint32_t bytes;
+  uint32_t commands;
+  uint32_t cmd_errors;
+} pssim_stats;
+
+// Two phase motor on the bridges, voltage mode only. Phase current comes from the
+// applied KVAL plus BEMF compensation against R, L and BEMF, the rotor stalls below load.
+typedef struct {
+  float resistance;     // Ohm
+  float inductance;     // mH
+  float ke;             // V/Hz electrical
+  float vs;             // V
+  float load;           // A
+  float rdson;          // Ohm, bridge drop for STALL_TH, 0 leaves stall detection out
+} pssim_motor;
+
+void pssim_init(uint8_t devices);
+void pssim_reset();
+
+// Bus side, called from the Arduino and SPI shims
+void pssim_cs(uint8_t level);
+uint8_t pssim_transfer(uint8_t b);
+void pssim_step(uint64_t ns);
+
+// Test side
+void pssim_setswitch(uint8_t device, bool closed);
+void pssim_setadc(uint8_t device, uint8_t adc);
+void pssim_setuvlo(uint8_t device);                                   // Supply dip, UVLO latched until GETSTATUS
+void pssim_setmotor(uint8_t device, const pssim_motor * m);
+void pssim_setstop(uint8_t device, bool enabled, int32_t pos);     // Rotor counts from ABS_POS at this call
+float pssim_getcurrent(uint8_t device);
+uint32_t pssim_getreg(uint8_t device, uint8_t param);
+int32_t pssim_getpos(uint8_t device);
+int32_t pssim_getrotor(uint8_t device);
+float pssim_getspeed(uint8_t device);
+bool pssim_isbusy(uint8_t device);
+bool pssim_ishiz(uint8_t device);
+
+pssim_stats pssim_getstats();
+void pssim_clearstats();
+
+#endif
@@ -0,0 +1,197 @@
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#include "powerstep01.h"
+#include "wifistepper.h"
+
+//#define CAP_DEBUG
+
+// Motion capture. A periodic esp_timer wakes a task that takes one batched snapshot
+// under the driver bus lock, so queue execution only ever waits for a single sample.
+
+#define CAP_SAMPLES     (2048)
+#define CAP_MINRATE     (1)
+#define CAP_MAXRATE     (2000)
+#define CAP_TASKPRIO    (3)             // Above loop(), bus lock priority inheritance covers the rest
+#define CAP_TASKSTACK   (2048)
+
+#define CAP_FBUSY       (0x01)
+#define CAP_FHIZ        (0x02)
+#define CAP_FFWD        (0x04)
+#define CAP_FMOVEMENT   (0x18)
+#define CAP_FSTEPCLOCK  (0x20)
+#define CAP_FSWITCH     (0x40)
+
+typedef struct ispacked {
+  uint32_t time_us;
+  int32_t pos;
+  float stepss;
+  uint8_t adc;
+  uint8_t flags;
+  uint16_t alarms;
+} cap_sample_t;
+
+static cap_sample_t cap_ring[CAP_SAMPLES];
+static uint16_t cap_head = 0;
+static uint16_t cap_length = CAP_SAMPLES;
+static uint32_t cap_tick = 0;
+static id_t cap_startcmd = 0;
+static esp_timer_handle_t cap_timer = NULL;
+static TaskHandle_t cap_task = NULL;
+static portMUX_TYPE cap_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Held for a whole sample, start, stop and read wait for one in flight to finish
+static SemaphoreHandle_t cap_lock = NULL;
+
+#ifdef CAP_DEBUG
+#define cap_debug(...)    Serial.printf(__VA_ARGS__)
+#else
+#define cap_debug(...)
+#endif
+
+static inline uint16_t cap_alarms(const ps_alarms& a) {
+  return (a.command_error << 0) | (a.overcurrent << 1) | (a.undervoltage << 2) | (a.thermal_shutdown << 3) |
+         (a.thermal_warning << 4) | (a.stall_detect << 5) | (a.user_switch << 6) | (a.adc_undervoltage << 7);
+}
+
+static bool cap_istriggered(const ps_snapshot& s) {
+  switch (state.capture.trigger) {
+    case CAP_TRIG_NOW:      return true;
+    case CAP_TRIG_COMMAND:  return state.command.this_command != cap_startcmd;
+    case CAP_TRIG_MOVE:     return s.status.busy || s.status.movement != M_STOPPED;
+    case CAP_TRIG_ALARM:    return cap_alarms(s.status.alarms) != 0;
+  }
+  return false;
+}
+
+static void cap_sample() {
+  unsigned long start = micros();
+
+  ps_lock();
+  uint32_t waited = micros() - start;
+  uint8_t selected = ps_selected();
+  ps_select(state.capture.device);
+  // Nothing here records the mark
+  ps_snapshot s = ps_getsnapshot(false);
+  ps_select(selected);
+  ps_unlock();
+
+  state.capture.lock_max_us = max(state.capture.lock_max_us, waited);
+  state.capture.sample_us = micros() - start;
+
+  if (!state.capture.triggered && cap_istriggered(s)) {
+    // Keep only the requested pre-trigger history
+    portENTER_CRITICAL(&cap_mux);
+    state.capture.triggered = true;
+    state.capture.trigger_us = start;
+    state.capture.count = min(state.capture.count, state.capture.pretrigger);
+    portEXIT_CRITICAL(&cap_mux);
+    cap_debug("CAP triggered (%u pre)\n", state.capture.count);
+  }
+
+  if (cap_tick++ % state.capture.decimate != 0) return;
+
+  cap_sample_t * c = &cap_ring[cap_head];
+  c->time_us = start;
+  c->pos = motorcfg_pos(s.pos);
+  c->stepss = s.stepss;
+  c->adc = s.adc;
+  c->flags = (s.status.busy? CAP_FBUSY : 0) | (s.status.hiz? CAP_FHIZ : 0) | (s.status.direction == FWD? CAP_FFWD : 0) |
+             ((s.status.movement << 3) & CAP_FMOVEMENT) | (s.status.step_clock? CAP_FSTEPCLOCK : 0) | (s.status.user_switch? CAP_FSWITCH : 0);
+  c->alarms = cap_alarms(s.status.alarms);
+
+  portENTER_CRITICAL(&cap_mux);
+  cap_head = (cap_head + 1) % CAP_SAMPLES;
+  if (state.capture.count < cap_length) state.capture.count += 1;
+  bool full = state.capture.triggered && state.capture.count == cap_length;
+  portEXIT_CRITICAL(&cap_mux);
+
+  if (full) {
+    esp_timer_stop(cap_timer);
+    state.capture.armed = false;
+    state.capture.done = true;
+    cap_debug("CAP done (%u samples)\n", state.capture.count);
+  }
+}
+
+static void cap_run(void * arg) {
+  while (true) {
+    uint32_t ticks = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (ticks > 1) state.capture.overruns += ticks - 1;
+    xSemaphoreTake(cap_lock, portMAX_DELAY);
+    if (state.capture.armed) cap_sample();
+    xSemaphoreGive(cap_lock);
+  }
+}
+
+static void cap_timertick(void * arg) {
+  xTaskNotifyGive(cap_task);
+}
+
+void cap_init() {
+  cap_lock = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(cap_run, "capture", CAP_TASKSTACK, NULL, CAP_TASKPRIO, &cap_task, 1);
+
+  esp_timer_create_args_t args;
+  memset(&args, 0, sizeof(esp_timer_create_args_t));
+  args.callback = cap_timertick;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "capture";
+  esp_timer_create(&args, &cap_timer);
+}
+
+bool cap_start(uint8_t device, uint16_t rate_hz, uint16_t decimate, uint8_t trigger, uint16_t samples, uint16_t pretrigger) {
+  if (device >= MOTOR_DEVICES || rate_hz < CAP_MINRATE || rate_hz > CAP_MAXRATE || decimate == 0 || trigger > CAP_TRIG_ALARM) return false;
+  xSemaphoreTake(cap_lock, portMAX_DELAY);
+  esp_timer_stop(cap_timer);
+
+  cap_head = 0;
+  cap_tick = 0;
+  cap_length = samples == 0? CAP_SAMPLES : min(samples, (uint16_t)CAP_SAMPLES);
+  cap_startcmd = state.command.this_command;
+  state.capture.device = device;
+  state.capture.rate_hz = rate_hz;
+  state.capture.decimate = decimate;
+  state.capture.trigger = trigger;
+  state.capture.pretrigger = min(pretrigger, cap_length);
+  state.capture.count = 0;
+  state.capture.triggered = false;
+  state.capture.done = false;
+  state.capture.trigger_us = 0;
+  state.capture.overruns = 0;
+  state.capture.sample_us = 0;
+  state.capture.lock_max_us = 0;
+  state.capture.armed = true;
+  esp_timer_start_periodic(cap_timer, 1000000UL / rate_hz);
+  xSemaphoreGive(cap_lock);
+  return true;
+}
+
+void cap_stop() {
+  xSemaphoreTake(cap_lock, portMAX_DELAY);
+  if (state.capture.armed) {
+    esp_timer_stop(cap_timer);
+    state.capture.armed = false;
+  }
+  xSemaphoreGive(cap_lock);
+}
+
+size_t cap_samplesize() {
+  return sizeof(cap_sample_t);
+}
+
+// Copy out samples oldest first, only once the capture has stopped
+size_t cap_read(size_t offset, uint8_t * out, size_t count) {
+  xSemaphoreTake(cap_lock, portMAX_DELAY);
+  if (state.capture.armed || offset >= state.capture.count) {
+    xSemaphoreGive(cap_lock);
+    return 0;
+  }
+  count = min(count, state.capture.count - offset);
+  size_t first = (cap_head + CAP_SAMPLES - state.capture.count + offset) % CAP_SAMPLES;
+  for (size_t i = 0; i < count; i++) {
+    memcpy(&out[i * sizeof(cap_sample_t)], &cap_ring[(first + i) % CAP_SAMPLES], sizeof(cap_sample_t));
+  }
+  xSemaphoreGive(cap_lock);
+  return count;
+}
@@ -1,4 +1,5 @@
 #include <Arduino.h>
+#include <esp_timer.h>
 
 #include "command.h"
 #include "powerstep01.h"
@@ -9,8 +10,15 @@
 extern StaticJsonBuffer<2560> jsonbuf;
 
 #define CTO_UPDATE      (10)
-
-#define Q0_SIZE       (1024)
+#define CTO_UPDATEIDLE  (50)
+#define CTO_UPDATEHIZ   (250)
+#define CTO_SAMPLERATE  (1000)
+#define CTO_HOMELEVEL   (50)
+#define CTO_HOMEPHASE   (30000)
+#define CMD_HOMEMARGIN  (2)
+#define CMD_HOMELEVELS  (32)            // STALL_TH, 31.25mV to 1V
+
+#define Q0_SIZE       (QS_MAXLEN)
 #define Q1_SIZE       (128)
 #define Q2_SIZE       (32)
 
@@ -38,17 +46,41 @@ void cmd_debug(id_t id, uint8_t opcode, const char * msg) {
 #define cmd_debug(...)
 #endif
 
-static void cmd_updatestatus(bool clearerrors) {
-  state.motor.status = ps_getstatus(clearerrors);
-  state.motor.status.direction = motorcfg_dir(state.motor.status.direction);
+// State of extra local devices, device 0 is state.motor
+static motor_state cmd_devstate[MOTOR_DEVICES];
+static uint8_t cmd_nextdevice = 0;
+
+motor_state * cmd_getstate(uint8_t device) {
+  return (device == 0 || device >= MOTOR_DEVICES)? &state.motor : &cmd_devstate[device];
 }
 
-static void cmd_updatestate() {
-  cmd_updatestatus(false);
-  state.motor.stepss = ps_getspeed();
-  state.motor.pos = motorcfg_pos(ps_getpos());
-  state.motor.mark = motorcfg_pos(ps_getmark());
-  state.motor.vin = (config.motor.mode != MODE_VOLTAGE || !config.motor.vm.volt_comp)? ((float)ps_readadc() * MOTOR_ADCCOEFF) : 0;
+void cmd_device(uint8_t device) {
+  cmd_nextdevice = device < MOTOR_DEVICES? device : 0;
+}
+
+static void cmd_updatestatus(uint8_t device, bool clearerrors) {
+  motor_state * st = cmd_getstate(device);
+  ps_select(device);
+  st->status = ps_getstatus(clearerrors);
+  st->status.direction = motorcfg_dir(st->status.direction);
+}
+
+static void cmd_updatestate(uint8_t device, const ps_snapshot& snap) {
+  motor_state * st = cmd_getstate(device);
+  st->status = snap.status;
+  st->status.direction = motorcfg_dir(st->status.direction);
+  st->stepss = snap.stepss;
+  st->pos = motorcfg_pos(snap.pos);
+  st->mark = motorcfg_pos(snap.mark);
+  st->vin = (config.motor.mode != MODE_VOLTAGE || !config.motor.vm.volt_comp)? ((float)snap.adc * MOTOR_ADCCOEFF) : 0;
+}
+
+static esp_timer_handle_t cmd_firetimer = NULL;
+
+// On the esp_timer task, the core lock keeps the loop and HTTP handlers out of the queues meanwhile
+static void cmd_firetick(void * arg) {
+  core_locked();
+  if (sketch.motor.arm.pending) cmd_loop(millis());
 }
 
 void cmd_init() {
@@ -57,28 +89,169 @@ void cmd_init() {
   for (size_t a = 0; a < Q0_NUM; a++) queue[i++] = { .len = 0, .maxlen = Q0_SIZE, .Q = __q0[a] };
   for (size_t a = 0; a < Q1_NUM; a++) queue[i++] = { .len = 0, .maxlen = Q1_SIZE, .Q = __q1[a] };
   for (size_t a = 0; a < Q2_NUM; a++) queue[i++] = { .len = 0, .maxlen = Q2_SIZE, .Q = __q2[a] };
+
+  esp_timer_create_args_t args;
+  memset(&args, 0, sizeof(esp_timer_create_args_t));
+  args.callback = cmd_firetick;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "fire";
+  esp_timer_create(&args, &cmd_firetimer);
+}
+
+static bool cmd_fireupdate() {
+  // Wait out the compensation delay, the fire timer runs a pass once it's up
+  if ((long)(sketch.motor.arm.at - micros()) > 0) return false;
+
+  // Armed queue goes into the execution queue
+  sketch.motor.arm.pending = false;
+  cmdq_copy(Q0, sketch.motor.arm.id, queue_get(sketch.motor.arm.queue));
+  state.daisy.link.fires += 1;
+  state.daisy.link.fire_late_us = timesince(sketch.motor.arm.at, micros());
+
+  // A start off the resent fire isn't lined up with the rest, keep it out of the skew
+  if (sketch.motor.arm.resent) state.daisy.link.fires_missed += 1;
+  state.daisy.link.fire_id = sketch.motor.arm.resent? 0 : sketch.motor.arm.fire;
+  return true;
 }
 
+static void cmd_execute(unsigned long now);
+
 void cmd_loop(unsigned long now) {
   state.command.this_command = 0;
   //ESP.wdtFeed();
 
+  if (sketch.motor.arm.pending) {
+    cmd_fireupdate();
+  }
+
+  // Commands for different devices run in the same pass latch together
+  ps_syncbegin();
+  cmd_execute(now);
+  ps_syncend();
+  ps_select(0);
+}
+
+static inline float cmd_homethreshold(uint8_t level) {
+  return (level + 1) * 31.25;
+}
+
+// Whatever was queued behind the homing expects a homed axis, so the queue goes with it
+static bool cmd_homefail(cmd_head_t * head) {
+  ps_hardstop();
+  seterror(ESUB_CMD, head->id, ETYPE_MSG);
+  cmdq_empty(Q0, head->id);
+  return false;
+}
+
+void cmd_homeabort() {
+  if (Q0->len == 0) return;
+  cmd_head_t * head = (cmd_head_t *)(Q0->Q);
+  sketch_homestall_t * sketch = (sketch_homestall_t *)&(Q0->Q[sizeof(cmd_head_t)]);
+  if (head->opcode != CMD_HOMESTALL || sketch->started == 0) return;
+
+  // Calibration leaves STALL_TH anywhere between its levels
+  uint8_t selected = ps_selected();
+  ps_select(head->device);
+  ps_vm_setstall(config.motor.vm.stall);
+  ps_select(selected);
+}
+
+static inline void cmd_homephase(sketch_homestall_t * sketch, uint8_t phase, unsigned long now) {
+  sketch->phase = phase;
+  sketch->step = HSTEP_ISSUE;
+  sketch->started = now;
+}
+
+// Stall homing, one step per pass. Stall flags are only trusted at constant speed, the
+// acceleration KVAL draws more current than cruising. Returns true once the command is done,
+// false while it runs or after a failure emptied the queue.
+static bool cmd_homestep(cmd_head_t * head, sketch_homestall_t * sketch, motor_state * st, unsigned long now) {
+  cmd_homestall_t * cmd = &sketch->cmd;
+  ps_direction toward = motorcfg_dir(cmd->dir), away = motorcfg_dir(cmd->dir == FWD? REV : FWD);
+  bool calibrating = sketch->phase == HOME_CALFAST || sketch->phase == HOME_CALSLOW;
+  float stepss = (sketch->phase == HOME_CALFAST || sketch->phase == HOME_APPROACH)? cmd->fast : cmd->slow;
+
+  if (config.motor.mode != MODE_VOLTAGE || timesince(sketch->started, now) > CTO_HOMEPHASE) return cmd_homefail(head);
+
+  switch (sketch->phase) {
+    case HOME_CALFAST:
+    case HOME_APPROACH:
+    case HOME_CALSLOW:
+    case HOME_REAPPROACH: {
+      if (sketch->step == HSTEP_ISSUE) {
+        if (st->status.busy) break;
+        // Calibration climbs from the lowest threshold while running away from the stop
+        if (calibrating) sketch->level = 0;
+        ps_vm_setstall(cmd_homethreshold(sketch->level));
+        ps_run(calibrating? away : toward, stepss);
+        sketch->step = HSTEP_RAMP;
+
+      } else if (sketch->step == HSTEP_RAMP) {
+        if (st->status.movement != M_CONSTSPEED) break;
+        cmd_updatestatus(head->device, true);
+        sketch->step = HSTEP_WATCH;
+        sketch->started = now;
+
+      } else if (calibrating) {
+        if (st->status.alarms.stall_detect) {
+          if ((sketch->level + 1) >= CMD_HOMELEVELS) return cmd_homefail(head);
+          sketch->level += 1;
+          ps_vm_setstall(cmd_homethreshold(sketch->level));
+          cmd_updatestatus(head->device, true);
+          sketch->started = now;
+        } else if (timesince(sketch->started, now) > CTO_HOMELEVEL) {
+          // Quiet at this level, leave some margin for the stop to stand out
+          sketch->level = min(sketch->level + CMD_HOMEMARGIN, CMD_HOMELEVELS - 1);
+          ps_softstop();
+          cmd_homephase(sketch, sketch->phase == HOME_CALFAST? HOME_APPROACH : HOME_REAPPROACH, now);
+        }
+
+      } else if (st->status.alarms.stall_detect) {
+        ps_hardstop();
+        cmd_homephase(sketch, sketch->phase == HOME_APPROACH? HOME_BACKOFF : HOME_SETPOS, now);
+      }
+      break;
+    }
+    case HOME_BACKOFF: {
+      if (st->status.busy) break;
+      if (sketch->step == HSTEP_ISSUE) {
+        ps_move(away, cmd->backoff);
+        sketch->step = HSTEP_RAMP;
+      } else {
+        cmd_homephase(sketch, HOME_CALSLOW, now);
+      }
+      break;
+    }
+    case HOME_SETPOS: {
+      if (st->status.busy) break;
+      ps_setpos(motorcfg_pos(cmd->pos));
+      ps_vm_setstall(config.motor.vm.stall);
+      cmd_updatestatus(head->device, true);
+      return true;
+    }
+  }
+  return false;
+}
+
+static void cmd_execute(unsigned long now) {
   while (Q0->len > 0) {
     cmd_head_t * head = (cmd_head_t *)(Q0->Q);
     void * Qcmd = (void *)&(Q0->Q[sizeof(cmd_head_t)]);
+    motor_state * st = cmd_getstate(head->device);
     
     state.command.this_command = head->id;
     size_t consume = sizeof(cmd_head_t);
 
     cmd_debug(head->id, head->opcode, "Try exec");
+    ps_select(head->device);
 
     // Check pre-conditions
     if (head->opcode & (QPRE_STATUS | QPRE_NOTBUSY | QPRE_STOPPED)) {
       sketch.motor.last.status = now;
-      cmd_updatestatus(false);
+      cmd_updatestatus(head->device, false);
 
-      if ((head->opcode & QPRE_NOTBUSY) && state.motor.status.busy) return;
-      if ((head->opcode & QPRE_STOPPED) && state.motor.status.movement != M_STOPPED) return;
+      if ((head->opcode & QPRE_NOTBUSY) && st->status.busy) return;
+      if ((head->opcode & QPRE_STOPPED) && st->status.movement != M_STOPPED) return;
     }
       
     switch (head->opcode) {
@@ -138,6 +311,13 @@ void cmd_loop(unsigned long now) {
         consume += sizeof(cmd_releasesw_t);
         break;
       }
+      case CMD_HOMESTALL: {
+        sketch_homestall_t * sketch = (sketch_homestall_t *)Qcmd;
+        if (sketch->started == 0) cmd_homephase(sketch, HOME_CALFAST, now);
+        if (!cmd_homestep(head, sketch, st, now)) return;
+        consume += sizeof(sketch_homestall_t);
+        break;
+      }
       case CMD_GOHOME: {
         ps_gohome();
         break;
@@ -204,7 +384,12 @@ void cmd_loop(unsigned long now) {
           save = root.containsKey("save") && root["save"].as<bool>();
           jsonbuf.clear();
         }
-        motorcfg_push(&config.motor);
+        // Motor config is shared by all local devices
+        for (uint8_t d = 0; d < MOTOR_DEVICES; d++) {
+          ps_select(d);
+          motorcfg_push(&config.motor);
+        }
+        ps_select(head->device);
         if (save) motorcfg_write(&config.motor);
         consume += ldata + 1;
         break;
@@ -218,7 +403,7 @@ void cmd_loop(unsigned long now) {
       }
       case CMD_WAITSWITCH: {
         cmd_waitsw_t * cmd = (cmd_waitsw_t *)Qcmd;
-        if (cmd->state != state.motor.status.user_switch) return;
+        if (cmd->state != st->status.user_switch) return;
         consume += sizeof(cmd_waitsw_t);
         break;
       }
@@ -251,25 +436,58 @@ void cmd_loop(unsigned long now) {
     state.command.last_command = head->id;
     state.command.last_completed = millis();
 
+    // Sample soon after anything that may start motion
+    state.motor.sample_ms = CTO_UPDATE;
+
     cmd_debug(head->id, head->opcode, "Exec complete");
     //ESP.wdtFeed();
   }
 }
 
 void cmd_update(unsigned long now) {
+  // Alarms are polled at the full rate in every state, only the rest of the state backs off
   if (timesince(sketch.motor.last.status, now) > CTO_UPDATE) {
     sketch.motor.last.status = now;
-    cmd_updatestatus(false);
-    
-    bool iserror = state.motor.status.alarms.command_error || state.motor.status.alarms.overcurrent || state.motor.status.alarms.undervoltage || state.motor.status.alarms.thermal_shutdown;
-    if (iserror) {
-      seterror(ESUB_MOTOR);
+
+    ps_snapshot snaps[PS_MAXDEVICES];
+    ps_status status[PS_MAXDEVICES];
+    bool sample = timesince(sketch.motor.last.state, now) > state.motor.sample_ms;
+    if (sample) {
+      sketch.motor.last.state = now;
+      sketch.motor.samples += 1;
+      ps_getsnapshots(snaps);
+    } else {
+      ps_getstatuses(status);
+    }
+
+    bool moving = false, hiz = true;
+    for (uint8_t d = 0; d < MOTOR_DEVICES; d++) {
+      motor_state * st = cmd_getstate(d);
+      if (sample) {
+        cmd_updatestate(d, snaps[d]);
+      } else {
+        st->status = status[d];
+        st->status.direction = motorcfg_dir(st->status.direction);
+      }
+      
+      bool iserror = st->status.alarms.command_error || st->status.alarms.overcurrent || st->status.alarms.undervoltage || st->status.alarms.thermal_shutdown;
+      if (iserror) {
+        seterror(ESUB_MOTOR);
+      }
+      moving |= st->status.busy || st->status.movement != M_STOPPED;
+      hiz &= st->status.hiz;
     }
+
+    // Sample fast while moving, back off when stopped and further in HiZ
+    if (moving)     state.motor.sample_ms = CTO_UPDATE;
+    else if (hiz)   state.motor.sample_ms = CTO_UPDATEHIZ;
+    else            state.motor.sample_ms = CTO_UPDATEIDLE;
   }
-  
-  if (timesince(sketch.motor.last.state, now) > CTO_UPDATE) {
-    sketch.motor.last.state = now;
-    cmd_updatestate();
+
+  if (timesince(sketch.motor.last.samplerate, now) >= CTO_SAMPLERATE) {
+    state.motor.sample_hz = (float)sketch.motor.samples * 1000.0 / (float)timesince(sketch.motor.last.samplerate, now);
+    sketch.motor.last.samplerate = now;
+    sketch.motor.samples = 0;
   }
 }
 
@@ -290,7 +508,7 @@ static void * cmd_alloc(queue_t * queue, id_t id, size_t len) {
 static void * cmd_alloc(queue_t * queue, id_t id, uint8_t opcode, size_t len) {
   cmd_head_t * cmd = (cmd_head_t *)cmd_alloc(queue, id, sizeof(cmd_head_t) + len);
   if (cmd == NULL) return NULL;
-  *cmd = { .id = id, .opcode = opcode };
+  *cmd = { .id = id, .opcode = opcode, .device = cmd_nextdevice };
   return &cmd[1];
 }
 
@@ -340,6 +558,12 @@ bool cmd_releasesw(queue_t * queue, id_t id, ps_posact action, ps_direction dir)
   return cmd != NULL;
 }
 
+bool cmd_homestall(queue_t * queue, id_t id, ps_direction dir, float fast, float slow, uint32_t backoff, int32_t pos) {
+  sketch_homestall_t * cmd = (sketch_homestall_t *)cmd_alloc(queue, id, CMD_HOMESTALL, sizeof(sketch_homestall_t));
+  if (cmd != NULL) *cmd = { .cmd = { .dir = dir, .fast = fast, .slow = slow, .backoff = backoff, .pos = pos }, .phase = HOME_CALFAST, .step = HSTEP_ISSUE, .level = 0, .started = 0 };
+  return cmd != NULL;
+}
+
 bool cmd_gohome(queue_t * queue, id_t id) {
   return cmd_alloc(queue, id, CMD_GOHOME, 0) != NULL;
 }
@@ -398,18 +622,63 @@ bool cmd_runqueue(queue_t * queue, id_t id, uint8_t targetqueue) {
 }
 
 bool cmd_estop(id_t id, bool hiz, bool soft) {
-  if (hiz) {
-    if (soft)   ps_softhiz();
-    else        ps_hardhiz();
-  } else {
-    if (soft)   ps_softstop();
-    else        ps_hardstop();
+  stck_stop();
+
+  // Stop every local device on the same CS edge
+  ps_syncbegin();
+  for (uint8_t d = 0; d < MOTOR_DEVICES; d++) {
+    ps_select(d);
+    if (hiz) {
+      if (soft)   ps_softhiz();
+      else        ps_hardhiz();
+    } else {
+      if (soft)   ps_softstop();
+      else        ps_hardstop();
+    }
   }
-  return cmdq_empty(Q0, id);
+  ps_syncend();
+  ps_select(0);
+  bool emptied = cmdq_empty(Q0, id);
+
+  // An aborted tune puts the previous config back once the motor is in HiZ, it doesn't override the stop
+  tune_stop(false);
+  return emptied;
 }
 
 void cmd_clearerror() {
-  cmd_updatestatus(true);
+  uint8_t selected = ps_selected();
+  for (uint8_t d = 0; d < MOTOR_DEVICES; d++) {
+    cmd_updatestatus(d, true);
+  }
+  ps_select(selected);
+}
+
+bool cmd_arm(id_t id, uint8_t armqueue, uint32_t delay_us) {
+  if (armqueue == 0 || queue_get(armqueue) == NULL) {
+    seterror(ESUB_CMD, id, ETYPE_NOQUEUE);
+    return false;
+  }
+  sketch.motor.arm.armed = true;
+  sketch.motor.arm.pending = false;
+  sketch.motor.arm.queue = armqueue;
+  sketch.motor.arm.id = id;
+  sketch.motor.arm.delay_us = delay_us;
+  return true;
+}
+
+bool cmd_fire(id_t fire, unsigned long when, bool resent) {
+  if (!sketch.motor.arm.armed) return false;
+  sketch.motor.arm.armed = false;
+  sketch.motor.arm.pending = true;
+  sketch.motor.arm.fire = fire;
+  sketch.motor.arm.resent = resent;
+  sketch.motor.arm.at = when + sketch.motor.arm.delay_us;
+
+  // Called from daisy, lowcom and http, a loop pass that comes by after the delay starts it first
+  long remaining = (long)(sketch.motor.arm.at - micros());
+  esp_timer_stop(cmd_firetimer);
+  esp_timer_start_once(cmd_firetimer, remaining > 0? remaining : 0);
+  return true;
 }
 
 bool cmdq_copy(queue_t * queue, id_t id, queue_t * src) {
@@ -27,10 +27,33 @@
 #define CMD_WAITMS      (QPRE_NONE | 0x10)
 #define CMD_WAITSWITCH  (QPRE_STATUS | 0x11)
 #define CMD_RUNQUEUE    (QPRE_NONE | 0x12)
+#define CMD_HOMESTALL   (QPRE_STATUS | 0x13)
+
+#define HOME_CALFAST    (0x0)
+#define HOME_APPROACH   (0x1)
+#define HOME_BACKOFF    (0x2)
+#define HOME_CALSLOW    (0x3)
+#define HOME_REAPPROACH (0x4)
+#define HOME_SETPOS     (0x5)
+
+#define HSTEP_ISSUE     (0x0)
+#define HSTEP_RAMP      (0x1)
+#define HSTEP_WATCH     (0x2)
 
 typedef struct ispacked {
   uint32_t ms;
   unsigned int started;
 } sketch_waitms_t;
 
-#endif
+typedef struct ispacked {
+  cmd_homestall_t cmd;
+  uint8_t phase;
+  uint8_t step;
+  uint8_t level;
+  unsigned int started;
+} sketch_homestall_t;
+
+// Puts STALL_TH back when a stall homing at the head of Q0 is dropped
+void cmd_homeabort();
+
+#endif
@@ -2,65 +2,96 @@
 
 #include "command.h"
 #include "wifistepper.h"
+#include "jsonstream.h"
 
-static void cmdq_parse(JsonObject& entry, id_t id, uint8_t target, uint8_t queue) {
-  if (!entry.containsKey("type")) return;
+// Issue one command entry, returning its id or 0 with *error set
+static id_t cmdq_parse(JsonObject& entry, id_t id, uint8_t target, uint8_t queue, const char ** error) {
+  if (!entry.containsKey("type")) {
+    *error = "type must be specified";
+    return 0;
+  }
+  if (m_islocal(target) && entry.containsKey("device")) {
+    // Entries read back from a local queue name the chip they were queued for
+    uint8_t device = entry["device"].as<uint8_t>();
+    if (device >= MOTOR_DEVICES) {
+      *error = "invalid device";
+      return 0;
+    }
+    target = m_target(device);
+  }
   if (id == 0) id = nextid();
   
+  bool ok = false;
   String type = entry["type"].as<String>();
   if (type == "estop") {
-    m_estop(target, id, entry["hiz"].as<bool>(), entry["soft"].as<bool>());
+    ok = m_estop(target, id, entry["hiz"].as<bool>(), entry["soft"].as<bool>());
   } else if (type == "clearerror") {
-    m_clearerror(target, id);
+    ok = m_clearerror(target, id);
   } else if (type == "setconfig") {
-    m_setconfig(target, queue, id, entry["config"].as<char *>());
+    ok = m_setconfig(target, queue, id, entry["config"].as<char *>());
   } else if (type == "runqueue") {
-    m_runqueue(target, queue, id, entry["targetqueue"].as<uint8_t>());
+    ok = m_runqueue(target, queue, id, entry["targetqueue"].as<uint8_t>());
   } else if (type == "stop") {
-    m_stop(target, queue, id, entry["hiz"].as<bool>(), entry["soft"].as<bool>());
+    ok = m_stop(target, queue, id, entry["hiz"].as<bool>(), entry["soft"].as<bool>());
   } else if (type == "run") {
-    m_run(target, queue, id, parse_direction(entry["dir"].as<String>(), FWD), entry["stepss"].as<float>());
+    ok = m_run(target, queue, id, parse_direction(entry["dir"].as<String>(), FWD), entry["stepss"].as<float>());
   } else if (type == "stepclock") {
-    m_stepclock(target, queue, id, parse_direction(entry["dir"].as<String>(), FWD));
+    ok = m_stepclock(target, queue, id, parse_direction(entry["dir"].as<String>(), FWD));
   } else if (type == "move") {
-    m_move(target, queue, id, parse_direction(entry["dir"].as<String>(), FWD), entry["microsteps"].as<uint32_t>());
+    ok = m_move(target, queue, id, parse_direction(entry["dir"].as<String>(), FWD), entry["microsteps"].as<uint32_t>());
   } else if (type == "goto") {
-    m_goto(target, queue, id, entry["pos"].as<int32_t>(), entry["hasdir"].as<bool>(), parse_direction(entry["dir"].as<String>(), FWD));
+    ok = m_goto(target, queue, id, entry["pos"].as<int32_t>(), entry["hasdir"].as<bool>(), parse_direction(entry["dir"].as<String>(), FWD));
   } else if (type == "gountil") {
-    m_gountil(target, queue, id, parse_action(entry["action"].as<String>(), POS_RESET), parse_direction(entry["dir"].as<String>(), FWD), entry["stepss"].as<float>());
+    ok = m_gountil(target, queue, id, parse_action(entry["action"].as<String>(), POS_RESET), parse_direction(entry["dir"].as<String>(), FWD), entry["stepss"].as<float>());
   } else if (type == "releasesw") {
-    m_releasesw(target, queue, id, parse_action(entry["action"].as<String>(), POS_RESET), parse_direction(entry["dir"].as<String>(), FWD));
+    ok = m_releasesw(target, queue, id, parse_action(entry["action"].as<String>(), POS_RESET), parse_direction(entry["dir"].as<String>(), FWD));
+  } else if (type == "homestall") {
+    ok = m_homestall(target, queue, id, parse_direction(entry["dir"].as<String>(), REV), entry["fast"].as<float>(), entry["slow"].as<float>(), entry["backoff"].as<uint32_t>(), entry["pos"].as<int32_t>());
   } else if (type == "gohome") {
-    m_gohome(target, queue, id);
+    ok = m_gohome(target, queue, id);
   } else if (type == "gomark") {
-    m_gomark(target, queue, id);
+    ok = m_gomark(target, queue, id);
   } else if (type == "resetpos") {
-    m_resetpos(target, queue, id);
+    ok = m_resetpos(target, queue, id);
   } else if (type == "setpos") {
-    m_setpos(target, queue, id, entry["pos"].as<int32_t>());
+    ok = m_setpos(target, queue, id, entry["pos"].as<int32_t>());
   } else if (type == "setmark") {
-    m_setmark(target, queue, id, entry["mark"].as<int32_t>());
+    ok = m_setmark(target, queue, id, entry["mark"].as<int32_t>());
   } else if (type == "waitbusy") {
-    m_waitbusy(target, queue, id);
+    ok = m_waitbusy(target, queue, id);
   } else if (type == "waitrunning") {
-    m_waitrunning(target, queue, id);
+    ok = m_waitrunning(target, queue, id);
   } else if (type == "waitms") {
-    m_waitms(target, queue, id, entry["ms"].as<uint32_t>());
+    ok = m_waitms(target, queue, id, entry["ms"].as<uint32_t>());
   } else if (type == "waitswitch") {
-    m_waitswitch(target, queue, id, entry["state"].as<bool>());
+    ok = m_waitswitch(target, queue, id, entry["state"].as<bool>());
   } else if (type == "emptyqueue") {
-    m_emptyqueue(target, queue, id);
+    ok = m_emptyqueue(target, queue, id);
   } else if (type == "savequeue") {
-    m_savequeue(target, queue, id);
+    ok = m_savequeue(target, queue, id);
   } else if (type == "loadqueue") {
-    m_loadqueue(target, queue, id);
+    ok = m_loadqueue(target, queue, id);
   } else if (type == "copyqueue") {
-    m_copyqueue(target, queue, id, entry["sourcequeue"].as<uint8_t>());
+    ok = m_copyqueue(target, queue, id, entry["sourcequeue"].as<uint8_t>());
+  } else {
+    *error = "unknown command type";
+    return 0;
   }
+
+  if (!ok) {
+    *error = "command rejected";
+    return 0;
+  }
+  return id;
+}
+
+static id_t cmdq_parse(JsonObject& entry, uint8_t target, uint8_t queue, const char ** error) {
+  return cmdq_parse(entry, entry.containsKey("id")? entry["id"].as<id_t>() : 0, target, queue, error);
 }
 
 static void cmdq_parse(JsonObject& entry, uint8_t target, uint8_t queue) {
-  cmdq_parse(entry, entry.containsKey("id")? entry["id"].as<id_t>() : 0, target, queue);
+  const char * error = NULL;
+  cmdq_parse(entry, target, queue, &error);
 }
 
 size_t cmdq_serialize(JsonObject& entry, cmd_head_t * head) {
@@ -68,12 +99,13 @@ size_t cmdq_serialize(JsonObject& entry, cmd_head_t * head) {
   size_t consume = sizeof(cmd_head_t);
 
   entry["id"] = head->id;
+  entry["device"] = head->device;
   switch (head->opcode) {
     case CMD_SETCONFIG: {
-      const char * data = (const char *)data;
-      size_t ldata = strlen(data);
+      const char * cfg = (const char *)data;
+      size_t ldata = strlen(cfg);
       entry["type"] = "setconfig";
-      entry["config"] = data;
+      entry["config"] = cfg;
       consume += ldata + 1;
       break;
     }
@@ -141,6 +173,17 @@ size_t cmdq_serialize(JsonObject& entry, cmd_head_t * head) {
       consume += sizeof(cmd_releasesw_t);
       break;
     }
+    case CMD_HOMESTALL: {
+      sketch_homestall_t * sketch = (sketch_homestall_t *)data;
+      entry["type"] = "homestall";
+      entry["dir"] = json_serialize(sketch->cmd.dir);
+      entry["fast"] = sketch->cmd.fast;
+      entry["slow"] = sketch->cmd.slow;
+      entry["backoff"] = sketch->cmd.backoff;
+      entry["pos"] = sketch->cmd.pos;
+      consume += sizeof(sketch_homestall_t);
+      break;
+    }
     case CMD_GOHOME: {
       entry["type"] = "gohome";
       break;
@@ -219,6 +262,96 @@ void cmdq_read(JsonArray& arr) {
 }
 
 
+static bool cmdq_checktarget(uint8_t target, uint8_t queue, const char ** error) {
+  if (!m_islocal(target) && (!config.daisy.enabled || !config.daisy.master || !state.daisy.active)) {
+    *error = "failed to set target";
+    return false;
+  }
+  if (!m_islocal(target) && target > state.daisy.slaves) {
+    *error = "invalid target";
+    return false;
+  }
+  if (queue >= QS_SIZE) {
+    *error = "invalid queue";
+    return false;
+  }
+  return true;
+}
+
+id_t cmdq_batch(JsonObject& entry, const char ** error) {
+  uint8_t target = entry["target"].as<uint8_t>();
+  uint8_t queue = entry["queue"].as<uint8_t>();
+  if (!cmdq_checktarget(target, queue, error)) return 0;
+  return cmdq_parse(entry, target, queue, error);
+}
+
+// Packed batch record, the command is laid out exactly as it is stored in a queue.
+// head.device picks the chip for a local target.
+typedef struct ispacked {
+  uint8_t target;
+  uint8_t queue;
+  cmd_head_t head;
+} cmdq_record_t;
+
+// Payload bytes that follow a cmd_head_t, -1 for opcodes that can't be queued
+static int cmdq_payloadsize(uint8_t opcode, const uint8_t * data, size_t len) {
+  switch (opcode) {
+    case CMD_SETCONFIG: {
+      const uint8_t * end = (const uint8_t *)memchr(data, 0, len);
+      return end != NULL? (end - data) + 1 : len + 1;
+    }
+    case CMD_RUNQUEUE:    return sizeof(cmd_runqueue_t);
+    case CMD_STOP:        return sizeof(cmd_stop_t);
+    case CMD_RUN:         return sizeof(cmd_run_t);
+    case CMD_STEPCLK:     return sizeof(cmd_stepclk_t);
+    case CMD_MOVE:        return sizeof(cmd_move_t);
+    case CMD_GOTO:        return sizeof(cmd_goto_t);
+    case CMD_GOUNTIL:     return sizeof(cmd_gountil_t);
+    case CMD_RELEASESW:   return sizeof(cmd_releasesw_t);
+    case CMD_HOMESTALL:   return sizeof(sketch_homestall_t);
+    case CMD_SETPOS:
+    case CMD_SETMARK:     return sizeof(cmd_setpos_t);
+    case CMD_WAITMS:      return sizeof(sketch_waitms_t);
+    case CMD_WAITSWITCH:  return sizeof(cmd_waitsw_t);
+    case CMD_GOHOME:
+    case CMD_GOMARK:
+    case CMD_RESETPOS:
+    case CMD_WAITBUSY:
+    case CMD_WAITRUNNING: return 0;
+  }
+  return -1;
+}
+
+size_t cmdq_batch(const uint8_t * data, size_t len, id_t * id, const char ** error) {
+  *id = 0;
+  if (len < sizeof(cmdq_record_t)) {
+    *error = "truncated record";
+    return 0;
+  }
+
+  // Check the payload fits before cmdq_serialize reads it
+  cmdq_record_t * record = (cmdq_record_t *)data;
+  int payload = cmdq_payloadsize(record->head.opcode, &data[sizeof(cmdq_record_t)], len - sizeof(cmdq_record_t));
+  if (payload < 0) {
+    *error = "unknown opcode";
+    return 0;
+  }
+  size_t consume = sizeof(cmdq_record_t) + payload;
+  if (consume > len) {
+    *error = "truncated record";
+    return 0;
+  }
+
+  StaticJsonBuffer<JSONSTREAM_ENTRY> entrybuf;
+  JsonObject& entry = entrybuf.createObject();
+  cmdq_serialize(entry, &record->head);
+
+  if (cmdq_checktarget(record->target, record->queue, error)) {
+    *id = cmdq_parse(entry, record->head.id, record->target, record->queue, error);
+  }
+  return consume;
+}
+
 void cmdq_write(JsonArray& arr, queue_t * queue) {
   size_t index = 0;
   while (index < queue->len) {
@@ -228,14 +361,26 @@ void cmdq_write(JsonArray& arr, queue_t * queue) {
   }
 }
 
+void cmdq_write(JsonStream& js, queue_t * queue) {
+  size_t index = 0;
+  while (index < queue->len) {
+    StaticJsonBuffer<JSONSTREAM_ENTRY> entrybuf;
+    JsonObject& entry = entrybuf.createObject();
+    cmd_head_t * head = (cmd_head_t *)&(queue->Q[index]);
+    index += cmdq_serialize(entry, head);
+    js.add(entry);
+  }
+}
+
 
 bool cmdq_empty(queue_t * queue, id_t id) {
   if (queue == NULL) {
     seterror(ESUB_CMD, id, ETYPE_NOQUEUE);
     return false;
   }
+  if (queue == Q0) cmd_homeabort();
   queue->len = 0;
   return true;
 }
 
-
+
@@ -3,6 +3,7 @@
 #include "wifistepper.h"
 
 #define D_BAUDRATE      (115200)
+#define D_BYTEUS        (10000000UL / D_BAUDRATE)
 
 #define B_SIZE          (2048)
 #define B_MAGIC         (0xAB)
@@ -17,6 +18,9 @@
 #define CMD_STATE       (CP_DAISY | 0x04)
 #define CMD_CLEARERROR  (CP_DAISY | 0x05)
 #define CMD_WIFI        (CP_DAISY | 0x06)
+#define CMD_FIRE        (CP_DAISY | 0x07)
+#define CMD_ECHO        (CP_DAISY | 0x08)
+#define CMD_REFIRE      (CP_DAISY | 0x09)
 
 #define CMD_STOP        (CP_MOTOR | 0x01)
 #define CMD_RUN         (CP_MOTOR | 0x02)
@@ -41,12 +45,22 @@
 #define CMD_SAVEQUEUE   (CP_MOTOR | 0x15)
 #define CMD_LOADQUEUE   (CP_MOTOR | 0x16)
 #define CMD_ESTOP       (CP_MOTOR | 0x17)
+#define CMD_ARM         (CP_MOTOR | 0x18)
+#define CMD_WRITEQUEUE  (CP_MOTOR | 0x19)
+#define CMD_HOMESTALL   (CP_MOTOR | 0x1A)
 
 #define SELF            (0x00)
 
 #define CTO_PING        (1000)
 #define CTO_CONFIG      (2000)
 #define CTO_STATE       (250)
+#define CTO_RETRANSMIT  (100)
+
+#define D_RETRIES       (5)
+#define D_RESYNCS       (3)
+#define D_RXQUIET       (2000)          // us without a byte in before acks can time out
+#define D_CHUNK         (512)
+#define D_BROADCASTMAX  (32)
 
 typedef struct __attribute__((packed)) {
   uint8_t magic;
@@ -54,13 +68,24 @@ typedef struct __attribute__((packed)) {
   uint8_t body_checksum;
   uint8_t target;
   uint8_t queue;
+  uint8_t seq;
   id_t id;
   uint8_t opcode;
   uint16_t length;
 } daisy_head_t;
 
+typedef struct __attribute__((packed)) {
+  id_t xfer;
+  uint16_t offset;
+  uint16_t total;
+  uint16_t crc;
+} daisy_chunk_t;
+
 #define daisy_expectlen(elen)  ({ if (len != (elen)) { seterror(ESUB_DAISY, id); return; } })
 
+// Slaves ack a frame they can't use all the same, a resend would fail the same way
+#define daisy_slaveexpectlen(elen)  ({ if (len != (elen)) { seterror(ESUB_DAISY, id); if (id != 0) daisy_ack(q, id); return; } })
+
 // In Buffer
 uint8_t B[B_SIZE] = {0};
 volatile size_t Blen = 0;
@@ -71,10 +96,36 @@ uint8_t O[B_SIZE] = {0};
 volatile size_t Olen = 0;
 #define daisy_dumpoutbox()  ({ if (Olen > 0) { Serial.write(O, Olen); Olen = 0; } })
 
-// Ack list
+// Retransmit window
 #define A_SIZE        (64)
-id_t A[A_SIZE] = {0};
+typedef struct {
+  id_t id;
+  uint8_t target;
+  uint8_t retries;
+  uint16_t offset, length;
+  unsigned long sent;
+  unsigned long wait;
+  uint32_t pending;
+} daisy_window_t;
+daisy_window_t A[A_SIZE] = {0};
 volatile size_t Alen = 0;
+uint8_t R[B_SIZE] = {0};
+volatile size_t Rlen = 0;
+
+// Sequence numbers (tx per slave on master, expected rx on slave)
+uint8_t Stx[0xFF] = {0};
+uint8_t Srx = 0;
+
+// Syncs in a row a slave left unanswered, past D_RESYNCS it is dropped until it is heard from again
+uint8_t Sfail[0xFF] = {0};
+#define daisy_dropped(target)   ((target) != SELF && Sfail[(target) - 1] > D_RESYNCS)
+
+// Tap for broadcast queue images
+#define T_SIZE        (sizeof(daisy_head_t) + sizeof(daisy_chunk_t) + D_CHUNK)
+uint8_t T[T_SIZE] = {0};
+volatile size_t Tlen = 0;
+volatile size_t Ttap = 0;
+id_t Qxfer[QS_SIZE] = {0};
 
 // TODO - make crc8
 static uint8_t daisy_checksum8(uint8_t * data, size_t length) {
@@ -90,16 +141,36 @@ static uint8_t daisy_checksum8(daisy_head_t * head) {
   return daisy_checksum8(&uhead[offsetof(daisy_head_t, body_checksum)], sizeof(daisy_head_t) - offsetof(daisy_head_t, body_checksum));
 }
 
+static uint16_t daisy_crc16(uint8_t * data, size_t length) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (uint8_t b = 0; b < 8; b++) {
+      crc = (crc & 0x8000)? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
 void daisy_init() {
   Serial.begin(D_BAUDRATE);
   Serial.flush();
   Serial.println();
 }
 
+// A frame written now starts on the wire once the UART has sent what it already holds
+static unsigned long daisy_txat() {
+  unsigned long now = micros();
+  return timesince(now, sketch.daisy.tx_us) < 1000000UL? sketch.daisy.tx_us : now;
+}
+
 static void daisy_writeoutbox() {
   if (Olen == 0) return;
+  if (Olen > state.daisy.link.outbox_max) state.daisy.link.outbox_max = Olen;
 
+  unsigned long at = daisy_txat();
   size_t wrote = Serial.write(O, Olen);
+  sketch.daisy.tx_us = at + wrote * D_BYTEUS;
   if (wrote != Olen) {
     memmove(O, &O[wrote], Olen - wrote);
     Olen -= wrote;
@@ -109,16 +180,63 @@ static void daisy_writeoutbox() {
   }
 }
 
+// A frame some slave sends of its own holds up whatever comes through behind it, go by the quickest recent lap
+static uint32_t daisy_quickest(uint32_t * laps, uint8_t * at, uint32_t lap) {
+  laps[(*at)++ % DAISY_LAPS] = lap;
+  uint32_t quickest = lap;
+  for (uint8_t i = 0; i < DAISY_LAPS; i++) {
+    if (laps[i] != 0 && laps[i] < quickest) quickest = laps[i];
+  }
+  return quickest;
+}
+
+static inline uint8_t daisy_nextseq(uint8_t seq) {
+  return seq == 0xFF? 1 : seq + 1;
+}
+
+static void daisy_tapconsume();
+
+static void daisy_forward() {
+  size_t skipped = min(Blen, Bskip);
+  if (!config.daisy.master && state.daisy.active) {
+    Serial.write(B, skipped);
+    state.daisy.link.forward_bytes += skipped;
+  }
+  if (Ttap > 0) {
+    // Keep a copy of the tapped frame as it passes
+    size_t tapped = min(skipped, (size_t)Ttap);
+    memcpy(&T[Tlen], B, tapped);
+    Tlen += tapped;
+    Ttap -= tapped;
+    if (Ttap == 0) daisy_tapconsume();
+  }
+  memmove(B, &B[skipped], Blen - skipped);
+  Bskip -= skipped;
+  Blen -= skipped;
+}
+
 static void * daisy_alloc(uint8_t target, uint8_t queue, id_t id, uint8_t opcode, size_t len) {
-  // Check if we have enough memory in buffers
-  if (len > 0xFFFF || (B_SIZE - Olen) < (sizeof(daisy_head_t) + len) || Alen >= A_SIZE) {
+  size_t fullsize = sizeof(daisy_head_t) + len;
+  bool broadcast = target == SELF && opcode == CMD_WRITEQUEUE;
+  bool reliable = config.daisy.master && id != 0 && (target != SELF || broadcast);
+
+  // Check if we have enough memory in buffers and someone to deliver to
+  if (len > 0xFFFF || (B_SIZE - Olen) < fullsize || (reliable && (Alen >= A_SIZE || (B_SIZE - Rlen) < fullsize)) || (reliable && daisy_dropped(target))) {
     if (id != 0) seterror(ESUB_DAISY, id);
     return NULL;
   }
   
-  // Add id to ack list
-  if (config.daisy.master && id != 0) {
-    A[Alen++] = id;
+  // Add to retransmit window, wait time includes draining what's ahead in the outbox
+  uint8_t seq = 0;
+  if (reliable) {
+    // Broadcasts wait for an ack from every slave
+    if (!broadcast) seq = Stx[target - 1] = daisy_nextseq(Stx[target - 1]);
+    uint32_t pending = 0;
+    for (uint8_t i = 0; broadcast && i < state.daisy.slaves && i < D_BROADCASTMAX; i++) {
+      if (!daisy_dropped(i + 1)) pending |= 1UL << i;
+    }
+    A[Alen++] = { .id = id, .target = target, .retries = 0, .offset = (uint16_t)Rlen, .length = (uint16_t)fullsize, .sent = millis(), .wait = CTO_RETRANSMIT + ((Olen + fullsize) * D_BYTEUS) / 1000 + state.daisy.ring_us / 500, .pending = pending };
+    Rlen += fullsize;
   }
 
   // Allocate and initialize packet
@@ -126,6 +244,7 @@ static void * daisy_alloc(uint8_t target, uint8_t queue, id_t id, uint8_t opcode
   packet->magic = B_MAGIC;
   packet->target = target;
   packet->queue = queue;
+  packet->seq = seq;
   packet->id = id;
   packet->opcode = opcode;
   packet->length = (uint16_t)len;
@@ -149,30 +268,94 @@ static void * daisy_pack(void * data) {
   size_t len = packet->length;
   packet->body_checksum = daisy_checksum8(udata, len);
   packet->head_checksum = daisy_checksum8(packet);
+
+  // Keep a copy for retransmission
+  if ((packet->seq != 0 || packet->opcode == CMD_WRITEQUEUE) && Alen > 0 && A[Alen - 1].id == packet->id) {
+    memcpy(&R[A[Alen - 1].offset], packet, A[Alen - 1].length);
+  }
   return packet;
 }
 
-static void daisy_masterconsume(int8_t target, uint8_t q, id_t id, uint8_t opcode, void * data, uint16_t len) {
-  if (id != 0) {
-    if (A[0] != id) {
-      // Handle Ack error
-      seterror(ESUB_DAISY, A[0]);
-
-      // Shift up the Ack list
-      size_t i = 0;
-      for (; i < Alen; i++) {
-        if (A[i] == id) break;
+static void daisy_windowremove(size_t i) {
+  // Close the gap in the retransmit buffer
+  uint16_t offset = A[i].offset, length = A[i].length;
+  memmove(&R[offset], &R[offset + length], Rlen - (offset + length));
+  Rlen -= length;
+
+  memmove(&A[i], &A[i+1], sizeof(daisy_window_t) * (Alen - i - 1));
+  Alen -= 1;
+  for (size_t j = i; j < Alen; j++) {
+    A[j].offset -= length;
+  }
+}
+
+static void daisy_windowack(id_t id, int slave) {
+  for (size_t i = 0; i < Alen; i++) {
+    if (A[i].id == id) {
+      if (A[i].pending != 0) {
+        if (slave >= 0 && slave < D_BROADCASTMAX) A[i].pending &= ~(1UL << slave);
+        if (A[i].pending != 0) return;
       }
-      memmove(A, &A[i], sizeof(id_t) * (Alen - i));
-      Alen -= i;
-      
-    } else {
-      // Ack good, pop ack from list
-      memmove(A, &A[1], sizeof(id_t) * (Alen - 1));
-      Alen -= 1;
+      daisy_windowremove(i);
+      return;
     }
   }
 
+  // Not in window, must be the ack of a duplicate
+}
+
+static void daisy_windowreset() {
+  Alen = 0;
+  Rlen = 0;
+  memset(Stx, 0, sizeof(Stx));
+  memset(Sfail, 0, sizeof(Sfail));
+}
+
+static void daisy_retransmit(unsigned long now) {
+  // An ack may be queued behind frames the slaves are still sending back, wait for a quiet line
+  if (timesince(sketch.daisy.rx_us, micros()) < D_RXQUIET) return;
+
+  for (size_t i = 0; i < Alen; i++) {
+    // Frames allocated since now was read are newer than it
+    if ((long)(now - A[i].sent) <= (long)A[i].wait) continue;
+    uint8_t target = A[i].target;
+
+    if (A[i].retries >= D_RETRIES) {
+      // Slave isn't answering, fail everything outstanding to it and resync
+      seterror(ESUB_DAISY, A[i].id);
+      state.daisy.failures += 1;
+      for (size_t j = Alen; j > i; j--) {
+        if (A[j-1].target == target) daisy_windowremove(j-1);
+      }
+      if (target != SELF && (Sfail[target - 1] += 1) <= D_RESYNCS) daisy_pack(daisy_alloc(target, 0, nextid(), CMD_SYNC, 0));
+      return;
+    }
+
+    // Go back N, resend everything outstanding to this slave in order
+    for (size_t j = i; j < Alen; j++) {
+      if (A[j].target != target) continue;
+      if ((B_SIZE - Olen) < A[j].length) return;
+      memcpy(&O[Olen], &R[A[j].offset], A[j].length);
+      Olen += A[j].length;
+      A[j].sent = now;
+      A[j].retries += 1;
+      state.daisy.retransmits += 1;
+    }
+  }
+}
+
+static void daisy_masterconsume(int8_t target, uint8_t q, id_t id, uint8_t opcode, void * data, uint16_t len) {
+  // Our own broadcasts coming back around
+  if (opcode == CMD_FIRE || opcode == CMD_WRITEQUEUE) return;
+
+  // Any frame a slave sends shows it's there, a dropped slave is readmitted
+  int slave = state.daisy.slaves + target - 1;
+  if (opcode != CMD_PING && target <= 0 && slave >= 0 && slave < 0xFF) Sfail[slave] = 0;
+
+  if (id != 0) {
+    daisy_windowack(id, slave);
+  }
+
   // Check for bad target;
   if (target > 0) {
     seterror(ESUB_DAISY, id);
@@ -187,10 +370,22 @@ static void daisy_masterconsume(int8_t target, uint8_t q, id_t id, uint8_t opcod
     }
     
     uint8_t slaves = abs(target);
+
+    // Measure ring latency from ping timestamp
+    uint32_t stamp = 0;
+    if (len == sizeof(uint32_t)) memcpy(&stamp, data, sizeof(uint32_t));
+    if (stamp != 0) {
+      uint32_t ring = daisy_quickest(sketch.daisy.laps, &sketch.daisy.lap_at, timesince(stamp, micros()));
+      uint32_t frame = (sizeof(daisy_head_t) + len) * D_BYTEUS;
+      state.daisy.ring_us = ring;
+      state.daisy.hop_us = ring > frame? (ring - frame) / slaves : 0;
+    }
+    
     if (state.daisy.slaves != slaves) {
       // New number of slaves present, reallocate states and sync
       sketch.daisy.slave = (sketch.daisy.slave == NULL)? (daisy_slave_t *)malloc(sizeof(daisy_slave_t) * slaves) : (daisy_slave_t *)realloc(sketch.daisy.slave, sizeof(daisy_slave_t) * slaves);
       memset(sketch.daisy.slave, 0, sizeof(daisy_slave_t) * slaves);
+      daisy_windowreset();
       for (uint8_t i = 1; i <= slaves; i++) {
         // Send sync to all slaves and turn wifi off if config'd
         daisy_pack(daisy_alloc(i, 0, nextid(), CMD_SYNC, 0));
@@ -215,7 +410,25 @@ static void daisy_masterconsume(int8_t target, uint8_t q, id_t id, uint8_t opcod
   switch (opcode) {
     case CMD_SYNC: {
       daisy_expectlen(sizeof(daisy_slave_t));
-      memcpy(&sketch.daisy.slave[i], data, sizeof(daisy_slave_t));
+      // Echo times are measured here, not by the slave
+      daisy_slave_t * slave = &sketch.daisy.slave[i];
+      memcpy(&slave->config, &((daisy_slave_t *)data)->config, sizeof(daisy_slaveconfig));
+      memcpy(&slave->state, &((daisy_slave_t *)data)->state, sizeof(daisy_slavestate));
+      return;
+    }
+    case CMD_ECHO: {
+      daisy_expectlen(sizeof(uint32_t));
+      uint32_t stamp = 0;
+      memcpy(&stamp, data, sizeof(uint32_t));
+      if (stamp == 0) return;
+
+      // The echo goes all the way around the ring like a ping does, what a single slave
+      // adds is the time it holds the frame to answer instead of cutting it through
+      uint32_t rtt = timesince(stamp, micros());
+      uint32_t quickest = daisy_quickest(sketch.daisy.slave[i].echo.laps, &sketch.daisy.slave[i].echo.lap_at, rtt);
+      sketch.daisy.slave[i].echo.ring_rtt_us = rtt;
+      if (rtt > sketch.daisy.slave[i].echo.ring_rtt_max_us) sketch.daisy.slave[i].echo.ring_rtt_max_us = rtt;
+      sketch.daisy.slave[i].echo.turnaround_us = quickest > state.daisy.ring_us? quickest - state.daisy.ring_us : 0;
       return;
     }
     case CMD_CONFIG: {
@@ -237,13 +450,78 @@ static void daisy_ack(uint8_t q, id_t id) {
   daisy_pack(daisy_alloc(SELF, q, id, CMD_ACK, 0));
 }
 
-static void daisy_slaveconsume(uint8_t q, id_t id, uint8_t opcode, void * data, uint16_t len) {
+static bool daisy_writechunk(uint8_t q, id_t id, void * data, uint16_t len) {
+  if (len < sizeof(daisy_chunk_t)) {
+    seterror(ESUB_DAISY, id);
+    return true;
+  }
+  daisy_chunk_t * chunk = (daisy_chunk_t *)data;
+  uint8_t * bytes = (uint8_t *)&chunk[1];
+  size_t blen = len - sizeof(daisy_chunk_t);
+  queue_t * queue = q == 0? NULL : queue_get(q);
+
+  // Corrupt chunk, stay quiet and let master resend it
+  if (daisy_crc16(bytes, blen) != chunk->crc) return false;
+
+  if (queue == NULL || chunk->total > queue->maxlen || (chunk->offset + blen) > chunk->total) {
+    seterror(ESUB_DAISY, id, queue == NULL? ETYPE_NOQUEUE : ETYPE_MEM);
+    return true;
+  }
+
+  // First chunk of a new transfer replaces the queue
+  if (chunk->offset == 0 && chunk->xfer != Qxfer[q]) {
+    Qxfer[q] = chunk->xfer;
+    queue->len = 0;
+  }
+
+  // Chunks of an older transfer or ones we already have only need the ack
+  if (chunk->xfer != Qxfer[q] || (chunk->offset + blen) <= queue->len) return true;
+
+  // Missing an earlier chunk, wait for it to be resent
+  if (chunk->offset != queue->len) return false;
+
+  memcpy(&queue->Q[queue->len], bytes, blen);
+  queue->len += blen;
+  return true;
+}
+
+static void daisy_tapconsume() {
+  daisy_head_t * head = (daisy_head_t *)T;
+  if (daisy_checksum8((uint8_t *)&head[1], head->length) != head->body_checksum) return;
+  if (daisy_writechunk(head->queue, head->id, &head[1], head->length)) daisy_ack(head->queue, head->id);
+}
+
+static bool daisy_slavesequence(uint8_t q, id_t id, uint8_t opcode, uint8_t seq) {
+  // Unsequenced frame
+  if (seq == 0) return true;
+
+  // Sync (or first frame after boot) restarts the sequence
+  if (opcode == CMD_SYNC || Srx == 0 || seq == Srx) {
+    Srx = daisy_nextseq(seq);
+    return true;
+  }
+
+  // Sequence numbers run 1 to 255, so distances are modulo 255
+  if ((Srx + 0xFF - seq) % 0xFF < 0x80) {
+    // Already executed, the ack must have been lost
+    state.daisy.link.duplicates += 1;
+    daisy_ack(q, id);
+    
+  } else {
+    // Frame ahead of sequence, drop and wait for master to go back
+    state.daisy.link.outoforder += 1;
+  }
+  return false;
+}
+
+static void daisy_slaveconsume(uint8_t q, uint8_t seq, id_t id, uint8_t opcode, void * data, uint16_t len) {
   queue_t * queue = queue_get(q);
+  if (!daisy_slavesequence(q, id, opcode, seq)) return;
   
   switch (opcode) {
     // Daisy state opcodes
     case CMD_SYNC: {
-      daisy_expectlen(0);
+      daisy_slaveexpectlen(0);
       daisy_slave_t * self = (daisy_slave_t *)daisy_alloc(SELF, q, id, CMD_SYNC, sizeof(daisy_slave_t));
       if (self != NULL) {
         memset(self, 0, sizeof(daisy_slave_t));
@@ -257,19 +535,28 @@ static void daisy_slaveconsume(uint8_t q, id_t id, uint8_t opcode, void * data,
         memcpy(&self->state.command, &state.command, sizeof(command_state));
         memcpy(&self->state.wifi, &state.wifi, sizeof(wifi_state));
         memcpy(&self->state.motor, &state.motor, sizeof(motor_state));
+        memcpy(&self->state.link, &state.daisy.link, sizeof(daisy_linkstate));
       }
       daisy_pack(self);
       break;
     }
+    case CMD_ECHO: {
+      // Bounce timestamp straight back to master
+      daisy_slaveexpectlen(sizeof(uint32_t));
+      uint8_t * echo = (uint8_t *)daisy_alloc(SELF, q, 0, CMD_ECHO, sizeof(uint32_t));
+      if (echo != NULL) memcpy(echo, data, sizeof(uint32_t));
+      daisy_pack(echo);
+      break;
+    }
     case CMD_CLEARERROR: {
-      daisy_expectlen(0);
+      daisy_slaveexpectlen(0);
       cmd_clearerror();
       clearerror();
       daisy_ack(q, id);
       break;
     }
     case CMD_WIFI: {
-      daisy_expectlen(sizeof(uint8_t));
+      daisy_slaveexpectlen(sizeof(uint8_t));
       uint8_t * enabled = (uint8_t *)data;
       wificfg_connect(enabled[0]? config.wifi.mode : M_OFF, &config.wifi);
       daisy_ack(q, id);
@@ -278,35 +565,35 @@ static void daisy_slaveconsume(uint8_t q, id_t id, uint8_t opcode, void * data,
     
     // Motor CMD opcodes
     case CMD_STOP: {
-      daisy_expectlen(sizeof(cmd_stop_t));
+      daisy_slaveexpectlen(sizeof(cmd_stop_t));
       cmd_stop_t * cmd = (cmd_stop_t *)data;
       cmd_stop(queue, id, cmd->hiz, cmd->soft);
       daisy_ack(q, id);
       break;
     }
     case CMD_RUN: {
-      daisy_expectlen(sizeof(cmd_run_t));
+      daisy_slaveexpectlen(sizeof(cmd_run_t));
       cmd_run_t * cmd = (cmd_run_t *)data;
       cmd_run(queue, id, cmd->dir, cmd->stepss);
       daisy_ack(q, id);
       break;
     }
     case CMD_STEPCLK: {
-      daisy_expectlen(sizeof(cmd_stepclk_t));
+      daisy_slaveexpectlen(sizeof(cmd_stepclk_t));
       cmd_stepclk_t * cmd = (cmd_stepclk_t *)data;
       cmd_stepclock(queue, id, cmd->dir);
       daisy_ack(q, id);
       break;
     }
     case CMD_MOVE: {
-      daisy_expectlen(sizeof(cmd_move_t));
+      daisy_slaveexpectlen(sizeof(cmd_move_t));
       cmd_move_t * cmd = (cmd_move_t *)data;
       cmd_move(queue, id, cmd->dir, cmd->microsteps);
       daisy_ack(q, id);
       break;
     }
     case CMD_GOTO: {
-      daisy_expectlen(sizeof(cmd_goto_t));
+      daisy_slaveexpectlen(sizeof(cmd_goto_t));
       cmd_goto_t * cmd = (cmd_goto_t *)data;
       if (cmd->hasdir)  cmd_goto(queue, id, cmd->pos, cmd->dir);
       else              cmd_goto(queue, id, cmd->pos);
@@ -314,54 +601,62 @@ static void daisy_slaveconsume(uint8_t q, id_t id, uint8_t opcode, void * data,
       break;
     }
     case CMD_GOUNTIL: {
-      daisy_expectlen(sizeof(cmd_gountil_t));
+      daisy_slaveexpectlen(sizeof(cmd_gountil_t));
       cmd_gountil_t * cmd = (cmd_gountil_t *)data;
       cmd_gountil(queue, id, cmd->action, cmd->dir, cmd->stepss);
       daisy_ack(q, id);
       break;
     }
+    case CMD_HOMESTALL: {
+      daisy_slaveexpectlen(sizeof(cmd_homestall_t));
+      cmd_homestall_t * cmd = (cmd_homestall_t *)data;
+      cmd_homestall(queue, id, cmd->dir, cmd->fast, cmd->slow, cmd->backoff, cmd->pos);
+      daisy_ack(q, id);
+      break;
+    }
     case CMD_RELEASESW: {
-      daisy_expectlen(sizeof(cmd_releasesw_t));
+      daisy_slaveexpectlen(sizeof(cmd_releasesw_t));
       cmd_releasesw_t * cmd = (cmd_releasesw_t *)data;
       cmd_releasesw(queue, id, cmd->action, cmd->dir);
       daisy_ack(q, id);
       break;
     }
     case CMD_GOHOME: {
-      daisy_expectlen(0);
+      daisy_slaveexpectlen(0);
       cmd_gohome(queue, id);
       daisy_ack(q, id);
       break;
     }
     case CMD_GOMARK: {
-      daisy_expectlen(0);
+      daisy_slaveexpectlen(0);
       cmd_gomark(queue, id);
       daisy_ack(q, id);
       break;
     }
     case CMD_RESETPOS: {
-      daisy_expectlen(0);
+      daisy_slaveexpectlen(0);
       cmd_resetpos(queue, id);
       daisy_ack(q, id);
       break;
     }
     case CMD_SETPOS: {
-      daisy_expectlen(sizeof(cmd_setpos_t));
+      daisy_slaveexpectlen(sizeof(cmd_setpos_t));
       cmd_setpos_t * cmd = (cmd_setpos_t *)data;
       cmd_setpos(queue, id, cmd->pos);
       daisy_ack(q, id);
       break;
     }
     case CMD_SETMARK: {
-      daisy_expectlen(sizeof(cmd_setpos_t));
+      daisy_slaveexpectlen(sizeof(cmd_setpos_t));
       cmd_setpos_t * cmd = (cmd_setpos_t *)data;
       cmd_setmark(queue, id, cmd->pos);
       daisy_ack(q, id);
       break;
     }
     case CMD_SETCONFIG: {
-      if (((const char *)data)[len-1] != 0) {
+      if (len == 0 || ((const char *)data)[len-1] != 0) {
         seterror(ESUB_DAISY, id);
+        daisy_ack(q, id);
         return;
       }
       cmd_setconfig(queue, id, (const char *)data);
@@ -369,82 +664,108 @@ static void daisy_slaveconsume(uint8_t q, id_t id, uint8_t opcode, void * data,
       break;
     }
     case CMD_WAITBUSY: {
-      daisy_expectlen(0);
+      daisy_slaveexpectlen(0);
       cmd_waitbusy(queue, id);
       daisy_ack(q, id);
       break;
     }
     case CMD_WAITRUNNING: {
-      daisy_expectlen(0);
+      daisy_slaveexpectlen(0);
       cmd_waitrunning(queue, id);
       daisy_ack(q, id);
       break;
     }
     case CMD_WAITMS: {
-      daisy_expectlen(sizeof(cmd_waitms_t));
+      daisy_slaveexpectlen(sizeof(cmd_waitms_t));
       cmd_waitms_t * cmd = (cmd_waitms_t *)data;
       cmd_waitms(queue, id, cmd->ms);
       daisy_ack(q, id);
       break;
     }
     case CMD_WAITSWITCH: {
-      daisy_expectlen(sizeof(cmd_waitsw_t));
+      daisy_slaveexpectlen(sizeof(cmd_waitsw_t));
       cmd_waitsw_t * cmd = (cmd_waitsw_t *)data;
       cmd_waitswitch(queue, id, cmd->state);
       daisy_ack(q, id);
       break;
     }
     case CMD_RUNQUEUE: {
-      daisy_expectlen(sizeof(cmd_runqueue_t));
+      daisy_slaveexpectlen(sizeof(cmd_runqueue_t));
       cmd_runqueue_t * cmd = (cmd_runqueue_t *)data;
       cmd_runqueue(queue, id, cmd->targetqueue);
       daisy_ack(q, id);
       break;
     }
     case CMD_EMPTYQUEUE: {
-      daisy_expectlen(0);
+      daisy_slaveexpectlen(0);
       cmdq_empty(queue, id);
       daisy_ack(q, id);
       break;
     }
     case CMD_COPYQUEUE: {
-      daisy_expectlen(sizeof(uint8_t));
+      daisy_slaveexpectlen(sizeof(uint8_t));
       uint8_t * src = (uint8_t *)data;
       cmdq_copy(queue, id, queue_get(src[0]));
       daisy_ack(q, id);
       break;
     }
     case CMD_SAVEQUEUE: {
-      daisy_expectlen(0);
+      daisy_slaveexpectlen(0);
       queuecfg_write(q);
       daisy_ack(q, id);
       break;
     }
     case CMD_LOADQUEUE: {
-      daisy_expectlen(0);
+      daisy_slaveexpectlen(0);
       queuecfg_read(q);
       daisy_ack(q, id);
       break;
     }
     case CMD_ESTOP: {
-      daisy_expectlen(sizeof(cmd_stop_t));
+      daisy_slaveexpectlen(sizeof(cmd_stop_t));
       cmd_stop_t * cmd = (cmd_stop_t *)data;
       cmd_estop(id, cmd->hiz, cmd->soft);
       daisy_ack(q, id);
       break;
     }
+    case CMD_WRITEQUEUE: {
+      // A chunk that wasn't written rewinds the sequence, or its resend would pass for a duplicate
+      if (daisy_writechunk(q, id, data, len))  daisy_ack(q, id);
+      else if (seq != 0)                       Srx = seq;
+      break;
+    }
+    case CMD_ARM: {
+      daisy_slaveexpectlen(sizeof(cmd_arm_t));
+      cmd_arm_t * cmd = (cmd_arm_t *)data;
+      cmd_arm(id, cmd->armqueue, cmd->delay_us);
+      daisy_ack(q, id);
+      break;
+    }
+    case CMD_REFIRE: {
+      // Still armed only if the cut through fire got lost on the way
+      daisy_slaveexpectlen(sizeof(id_t));
+      cmd_fire(*(id_t *)data, sketch.daisy.rx_us, true);
+      daisy_ack(q, id);
+      break;
+    }
   }
 }
 
 void daisy_loop(unsigned long now) {
   if (!config.daisy.enabled) return;
   //ESP.wdtFeed();
-  // Serial.read((char *)&B[Blen], B_SIZE - Blen);
-  B[Blen] = Serial.read();
-  Blen += 1;
 
-  // If no packets to parse, dump outbox
-  if (Blen == 0) {
+  // Read everything available
+  size_t available = Serial.available();
+  if (available > 0 && Blen < B_SIZE) {
+    size_t read = Serial.readBytes(&B[Blen], min(available, B_SIZE - Blen));
+    Blen += read;
+    sketch.daisy.rx_us = micros();
+    state.daisy.link.rx_bytes += read;
+  }
+
+  // If no packets to parse, dump outbox (never in the middle of a forwarded frame)
+  if (Blen == 0 && Bskip == 0) {
     daisy_writeoutbox();
   }
 
@@ -452,11 +773,7 @@ void daisy_loop(unsigned long now) {
   while (Blen > 0) {
     // Skip bytes if needed
     if (Bskip > 0) {
-      size_t skipped = min(Blen, Bskip);
-      if (!config.daisy.master && state.daisy.active) Serial.write(B, skipped);
-      memmove(B, &B[skipped], Blen - skipped);
-      Bskip -= skipped;
-      Blen -= skipped;
+      daisy_forward();
       continue;
     }
     
@@ -487,14 +804,36 @@ void daisy_loop(unsigned long now) {
 
     // Check if it's for us
     if (isvalid && !config.daisy.master && head->target != 0x01) {
-      // We're not master and the packet is not for us, skip it
+      // We're not master and the packet is not for us, cut through as soon as the header is valid
+      bool fire = head->opcode == CMD_FIRE && head->length == 0;
+      id_t fireid = head->id;
+      bool tap = head->opcode == CMD_WRITEQUEUE && (int8_t)head->target <= 0 && (sizeof(daisy_head_t) + head->length) <= T_SIZE;
       head->target -= 1;
       head->head_checksum = daisy_checksum8(head);
       Bskip = sizeof(daisy_head_t) + head->length;
+      state.daisy.link.forward_frames += 1;
+
+      // Broadcast queue images are tapped off on the way through
+      if (tap) {
+        Tlen = 0;
+        Ttap = Bskip;
+      }
+      daisy_forward();
+
+      // Measure time spent in this hop
+      if (state.daisy.active) {
+        uint32_t forward = timesince(sketch.daisy.rx_us, micros());
+        state.daisy.link.forward_us = forward;
+        if (forward > state.daisy.link.forward_max_us) state.daisy.link.forward_max_us = forward;
+      }
+
+      // Fire frames are acted on by every slave as they pass
+      if (fire) cmd_fire(fireid, sketch.daisy.rx_us, false);
       continue;
     }
     if (!isvalid) {
       // Not a valid header, shift out one byte and continue
+      state.daisy.link.parse_errors += 1;
       Bskip = 1;
       continue;
     }
@@ -505,16 +844,18 @@ void daisy_loop(unsigned long now) {
     // Validate checksum
     if (daisy_checksum8((uint8_t *)&head[1], head->length) != head->body_checksum) {
       // Bad checksum, shift out one byte and continue
+      state.daisy.link.parse_errors += 1;
       Bskip = 1;
       continue;
     }
 
     daisy_writeoutbox();
+    state.daisy.link.rx_frames += 1;
 
     // Consume packet
     {
       if (config.daisy.master)  daisy_masterconsume(head->target, head->queue, head->id, head->opcode, &head[1], head->length);
-      else                      daisy_slaveconsume(head->queue, head->id, head->opcode, &head[1], head->length);
+      else                      daisy_slaveconsume(head->queue, head->seq, head->id, head->opcode, &head[1], head->length);
     }
 
     daisy_writeoutbox();
@@ -532,14 +873,45 @@ void daisy_update(unsigned long now) {
   if (timesince(sketch.daisy.last.ping_rx, now) > CTO_PING) {
     state.daisy.active = false;
     state.daisy.slaves = 0;
+    state.daisy.ring_us = 0;
+    state.daisy.hop_us = 0;
+    memset(sketch.daisy.laps, 0, sizeof(sketch.daisy.laps));
+    daisy_windowreset();
     if (sketch.daisy.slave != NULL) {
       free(sketch.daisy.slave);
       sketch.daisy.slave = NULL;
     }
   }
+  if (config.daisy.master && Alen > 0) {
+    daisy_retransmit(now);
+  }
+  state.daisy.backlog = Alen;
+  if (Alen > state.daisy.backlog_max) state.daisy.backlog_max = Alen;
+
   if (config.daisy.master && timesince(sketch.daisy.last.ping_tx, now) > (CTO_PING / 4)) {
     sketch.daisy.last.ping_tx = now;
-    daisy_pack(daisy_alloc(SELF, 0, 0, CMD_PING, 0));
+
+    // Flush outbox first, the stamp is when the ping reaches the wire so only the ring is measured
+    daisy_writeoutbox();
+    uint8_t * ping = (uint8_t *)daisy_alloc(SELF, 0, 0, CMD_PING, sizeof(uint32_t));
+    if (ping != NULL) {
+      uint32_t stamp = (Olen == sizeof(daisy_head_t) + sizeof(uint32_t))? daisy_txat() : 0;
+      memcpy(ping, &stamp, sizeof(uint32_t));
+    }
+    daisy_pack(ping);
+    daisy_writeoutbox();
+
+    // Echo one slave per ping period for its turnaround on top of the ring time
+    if (state.daisy.slaves > 0) {
+      sketch.daisy.echo = (sketch.daisy.echo % state.daisy.slaves) + 1;
+      uint8_t * echo = (uint8_t *)daisy_alloc(sketch.daisy.echo, 0, 0, CMD_ECHO, sizeof(uint32_t));
+      if (echo != NULL) {
+        uint32_t stamp = (Olen == sizeof(daisy_head_t) + sizeof(uint32_t))? daisy_txat() : 0;
+        memcpy(echo, &stamp, sizeof(uint32_t));
+      }
+      daisy_pack(echo);
+      daisy_writeoutbox();
+    }
   }
 
   if (state.daisy.active && !config.daisy.master && timesince(sketch.daisy.last.config, now) > CTO_CONFIG) {
@@ -559,6 +931,7 @@ void daisy_update(unsigned long now) {
       memcpy(&slavestate->command, &state.command, sizeof(command_state));
       memcpy(&slavestate->wifi, &state.wifi, sizeof(wifi_state));
       memcpy(&slavestate->motor, &state.motor, sizeof(motor_state));
+      memcpy(&slavestate->link, &state.daisy.link, sizeof(daisy_linkstate));
     }
     daisy_pack(slavestate);
   }
@@ -570,10 +943,81 @@ bool daisy_clearerror(uint8_t target, id_t id) {
 
 bool daisy_wificontrol(uint8_t target, id_t id, bool enabled) {
   uint8_t * en = (uint8_t *)daisy_alloc(target, 0, id, CMD_WIFI, sizeof(uint8_t));
-  en[0] = enabled;
+  if (en != NULL) en[0] = enabled;
   return daisy_pack(en) != NULL;
 }
 
+uint32_t daisy_firedelay(uint8_t target) {
+  uint8_t slaves = state.daisy.slaves;
+  if (!config.daisy.enabled || !config.daisy.master || slaves == 0) return 0;
+
+  // Every board waits until the fire header has reached the last slave
+  if (target == 0)  return sizeof(daisy_head_t) * D_BYTEUS + (slaves - 1) * state.daisy.hop_us;
+  else              return (slaves - target) * state.daisy.hop_us;
+}
+
+bool daisy_arm(uint8_t target, id_t id, uint8_t armqueue) {
+  cmd_arm_t * cmd = (cmd_arm_t *)daisy_alloc(target, 0, id, CMD_ARM, sizeof(cmd_arm_t));
+  if (cmd != NULL) *cmd = { .armqueue = armqueue, .delay_us = daisy_firedelay(target) };
+  return daisy_pack(cmd) != NULL;
+}
+
+bool daisy_fire(id_t id) {
+  bool sent = true;
+  unsigned long when = micros();
+  if (config.daisy.enabled && config.daisy.master && state.daisy.active) {
+    // Get the outbox out of the way, the delays count from when the fire frame reaches the wire
+    daisy_writeoutbox();
+    when = daisy_txat();
+    sent = daisy_pack(daisy_alloc(SELF, 0, id, CMD_FIRE, 0)) != NULL;
+    daisy_writeoutbox();
+
+    // The cut through fire isn't acked, every slave gets a sequenced resend behind it
+    for (uint8_t target = 1; target <= state.daisy.slaves; target++) {
+      if (daisy_dropped(target)) continue;
+      id_t * fire = (id_t *)daisy_alloc(target, 0, nextid(), CMD_REFIRE, sizeof(id_t));
+      if (fire != NULL) *fire = id;
+      sent &= daisy_pack(fire) != NULL;
+    }
+    if (!sent) seterror(ESUB_DAISY, id);
+    state.daisy.fire_id = id;
+  }
+  cmd_fire(id, when, false);
+  return sent;
+}
+
+bool daisy_writequeue(uint8_t target, uint8_t q, id_t id, queue_t * src) {
+  if (src == NULL) {
+    seterror(ESUB_DAISY, id, ETYPE_NOQUEUE);
+    return false;
+  }
+
+  // Target 0 broadcasts to every slave, unless there are too many to track acks
+  if (target == 0 && state.daisy.slaves > D_BROADCASTMAX) {
+    bool success = true;
+    for (uint8_t i = 1; i <= state.daisy.slaves; i++) {
+      success &= daisy_writequeue(i, q, i == 1? id : nextid(), src);
+    }
+    return success;
+  }
+
+  // Ship the queue image in chunks, each acked once
+  size_t total = src->len, offset = 0;
+  id_t chunkid = id;
+  do {
+    size_t len = min(total - offset, (size_t)D_CHUNK);
+    daisy_chunk_t * chunk = (daisy_chunk_t *)daisy_alloc(target, q, chunkid, CMD_WRITEQUEUE, sizeof(daisy_chunk_t) + len);
+    if (chunk == NULL) return false;
+    *chunk = { .xfer = id, .offset = (uint16_t)offset, .total = (uint16_t)total, .crc = daisy_crc16(&src->Q[offset], len) };
+    memcpy(&chunk[1], &src->Q[offset], len);
+    daisy_pack(chunk);
+
+    offset += len;
+    chunkid = nextid();
+  } while (offset < total);
+  return true;
+}
+
 bool daisy_stop(uint8_t target, uint8_t q, id_t id, bool hiz, bool soft) {
   cmd_stop_t * cmd = (cmd_stop_t *)daisy_alloc(target, q, id, CMD_STOP, sizeof(cmd_stop_t));
   if (cmd != NULL) *cmd = { .hiz = hiz, .soft = soft };
@@ -616,6 +1060,12 @@ bool daisy_releasesw(uint8_t target, uint8_t q, id_t id, ps_posact action, ps_di
   return daisy_pack(cmd) != NULL;
 }
 
+bool daisy_homestall(uint8_t target, uint8_t q, id_t id, ps_direction dir, float fast, float slow, uint32_t backoff, int32_t pos) {
+  cmd_homestall_t * cmd = (cmd_homestall_t *)daisy_alloc(target, q, id, CMD_HOMESTALL, sizeof(cmd_homestall_t));
+  if (cmd != NULL) *cmd = { .dir = dir, .fast = fast, .slow = slow, .backoff = backoff, .pos = pos };
+  return daisy_pack(cmd) != NULL;
+}
+
 bool daisy_gohome(uint8_t target, uint8_t q, id_t id) {
   return daisy_pack(daisy_alloc(target, q, id, CMD_GOHOME, 0)) != NULL;
 }
@@ -679,7 +1129,7 @@ bool daisy_emptyqueue(uint8_t target, uint8_t q, id_t id) {
 
 bool daisy_copyqueue(uint8_t target, uint8_t q, id_t id, uint8_t src) {
   uint8_t * queue = (uint8_t *)daisy_alloc(target, q, id, CMD_COPYQUEUE, sizeof(uint8_t));
-  *queue = src;
+  if (queue != NULL) *queue = src;
   return daisy_pack(queue) != NULL;
 }
 
@@ -11,10 +11,23 @@
 #define ECC_PIN_SDA           (2)
 #define ECC_PIN_SCL           (5)
 #define ECC_QMAX              (1024)
-#define ECC_SIZE_RANDPOOL     (4)
+#define ECC_PMAX              (2048)    // HMAC packet arena, a full lowcom packet each way
+#define ECC_SIZE_RANDPOOL     (32)      // Words, four RAND replies
+#define ECC_RANDWATERMARK     (16)      // Start refilling below this many words, stop when full
+#define ECC_RANDWORDS         (8)
+#define ECC_WAKETYP           (1)
+#define ECC_WAKEMAX           (2)
+#define ECC_IDLESLEEP         (50)      // Sleep once the queue has been empty this long
+#define ECC_WATCHDOG          (1300)    // The device puts itself to sleep this long after a wake
+#define ECC_CHAINMAX          (400)     // Worst case for a dependent command chain
+#define ECC_RATEPERIOD        (1000)
+
+#define EPWR_ASLEEP           (0x0)
+#define EPWR_WAKING           (0x1)
+#define EPWR_AWAKE            (0x2)
+
+#define ECMD_PAD              (0x00)
 
-#define ECMD_WAKE             (0x01)
-#define ECMD_SLEEP            (0x02)
 #define ECMD_READCFG          (0x03)
 #define ECMD_CHECKCFG         (0x04)
 #define ECMD_READVERSION      (0x05)
@@ -37,7 +50,6 @@
 #define RXLEN_RAND            (0x23)
 #define RXLEN_HMAC            (0x23)
 
-#define WAIT_WAKE             (1), (2)
 #define WAIT_CHECK            (0), (0)
 #define WAIT_READ             (1), (2)
 #define WAIT_WRITE            (7), (26)
@@ -49,9 +61,28 @@
 #define WAIT_HMAC             (3), (12)
 
 uint8_t ecc_Q[ECC_QMAX] = {0};
+size_t ecc_Qhead = 0;
 size_t ecc_Qlen = 0;
+uint8_t ecc_P[ECC_PMAX] = {0};
+size_t ecc_Phead = 0;
+size_t ecc_Plen = 0;
 uint32_t ecc_randpool[ECC_SIZE_RANDPOOL] = {0};
+size_t ecc_randhead = 0;
+size_t ecc_randlen = 0;
+bool ecc_randfill = true;
+bool ecc_randpending = false;
 bool ecc_versionok = false;
+unsigned long ecc_sentus = 0;
+uint8_t ecc_power = EPWR_ASLEEP;
+unsigned long ecc_wokeat = 0;
+unsigned long ecc_active = 0;
+
+ecc_opstats_t ecc_stats[] = {
+  {"readcfg"}, {"readversion"}, {"rand"},
+  {"hmac_start"}, {"hmac_update"}, {"hmac_end"},
+  {"nonce"}, {"gendig"}, {"writeenc"},
+  {"lock"}, {"writecfg"}, {"writedata"},
+};
 
 union {
   uint8_t bytes[128];
@@ -181,6 +212,7 @@ uint16_t ecc_crc16(uint8_t * data, uint8_t len, uint8_t * crc) {
   }
   crc[0] = (uint8_t) (crc_register & 0x00FF);
   crc[1] = (uint8_t) (crc_register >> 8);
+  return crc_register;
 }
 
 inline void ecc_pack(uint8_t * data, size_t len) {
@@ -200,23 +232,105 @@ inline bool ecc_checkok(uint8_t * data, size_t len) {
   return len == 4 && data[0] == 4 && ecc_check(data, len) && data[1] == 0x0;
 }
 
-inline bool ecc_checksize(size_t s) {
-  return (ECC_QMAX - ecc_Qlen) >= s;
+static inline size_t ecc_Qtail() {
+  return (ecc_Qhead + ecc_Qlen) % ECC_QMAX;
+}
+
+// Entries never wrap. One that does not fit before the end of the buffer starts over
+// at the front, so a batch wastes less than its largest entry.
+inline bool ecc_checksize(size_t s, size_t largest) {
+  size_t tail = ecc_Qtail();
+  if (ecc_Qlen == 0) return s <= ECC_QMAX;
+  if (tail > ecc_Qhead) return s <= (ECC_QMAX - tail) || (s + largest) <= (ECC_QMAX - ecc_Qlen);
+  return s <= (ecc_Qhead - tail);
 }
 
 void * ecc_alloc(uint8_t cmd, uint8_t wait_typ, uint8_t wait_max, uint8_t rxlen, uint8_t datalen) {
-  if (!ecc_checksize(sizeof(ecc_cmd_t) + datalen)) {
+  size_t len = sizeof(ecc_cmd_t) + datalen;
+  if (!ecc_checksize(len, len)) {
     // Not enough memory in queue
     // TODO - set error
     return NULL;
   }
 
-  ecc_cmd_t * C = (ecc_cmd_t *)&ecc_Q[ecc_Qlen];
+  size_t tail = ecc_Qtail();
+  if (ecc_Qlen > 0 && tail > ecc_Qhead && (ECC_QMAX - tail) < len) {
+    // Pad out the end of the buffer, the reader skips to the front
+    if ((ECC_QMAX - tail) >= sizeof(ecc_cmd_t)) ((ecc_cmd_t *)&ecc_Q[tail])->cmd = ECMD_PAD;
+    ecc_Qlen += ECC_QMAX - tail;
+    tail = 0;
+  }
+
+  ecc_cmd_t * C = (ecc_cmd_t *)&ecc_Q[tail];
   *C = {.cmd = cmd, .wait_typ = wait_typ, .wait_max = wait_max, .rxlen = rxlen, .datalen = datalen, .started = 0};
-  ecc_Qlen += sizeof(ecc_cmd_t) + datalen;
+  ecc_Qlen += len;
+  state.service.crypto.queue_max = max(state.service.crypto.queue_max, (uint16_t)ecc_Qlen);
   return &C[1];
 }
 
+static void ecc_consume(size_t len) {
+  ecc_Qhead = (ecc_Qhead + len) % ECC_QMAX;
+  ecc_Qlen -= len;
+  if (ecc_Qlen == 0) ecc_Qhead = 0;
+}
+
+static ecc_cmd_t * ecc_front() {
+  if (ecc_Qlen > 0 && ((ECC_QMAX - ecc_Qhead) < sizeof(ecc_cmd_t) || ((ecc_cmd_t *)&ecc_Q[ecc_Qhead])->cmd == ECMD_PAD)) {
+    ecc_consume(ECC_QMAX - ecc_Qhead);
+  }
+  return ecc_Qlen > 0? (ecc_cmd_t *)&ecc_Q[ecc_Qhead] : NULL;
+}
+
+// HMAC jobs keep their packet in ecc_P until the digest comes back, the queue entries only
+// point into it. Jobs finish in queue order so the arena is a FIFO, padded like ecc_Q.
+static ecc_hmacjob_t * ecc_palloc(size_t len) {
+  size_t tail = (ecc_Phead + ecc_Plen) % ECC_PMAX;
+  if (ecc_Plen == 0) {
+    if (len > ECC_PMAX) return NULL;
+  } else if (tail > ecc_Phead) {
+    if ((ECC_PMAX - tail) < len) {
+      if (ecc_Phead < len) return NULL;
+      if ((ECC_PMAX - tail) >= sizeof(ecc_hmacjob_t)) ((ecc_hmacjob_t *)&ecc_P[tail])->len = 0;
+      ecc_Plen += ECC_PMAX - tail;
+      tail = 0;
+    }
+  } else if ((ecc_Phead - tail) < len) {
+    return NULL;
+  }
+
+  ecc_hmacjob_t * J = (ecc_hmacjob_t *)&ecc_P[tail];
+  J->len = len;
+  ecc_Plen += len;
+  state.service.crypto.arena_max = max(state.service.crypto.arena_max, (uint16_t)ecc_Plen);
+  return J;
+}
+
+static void ecc_pconsume(size_t len) {
+  ecc_Phead = (ecc_Phead + len) % ECC_PMAX;
+  ecc_Plen -= len;
+  if (ecc_Plen == 0) ecc_Phead = 0;
+}
+
+static void ecc_pfree() {
+  if (ecc_Plen > 0 && ((ECC_PMAX - ecc_Phead) < sizeof(ecc_hmacjob_t) || ((ecc_hmacjob_t *)&ecc_P[ecc_Phead])->len == 0)) {
+    ecc_pconsume(ECC_PMAX - ecc_Phead);
+  }
+  if (ecc_Plen > 0) ecc_pconsume(((ecc_hmacjob_t *)&ecc_P[ecc_Phead])->len);
+}
+
+// Copies a chunk of the digested message, which is the nonce followed by the data past dataoff
+static void ecc_hmacmsg(ecc_hmacchunk_t * H, uint8_t * dst) {
+  ecc_hmacjob_t * J = (ecc_hmacjob_t *)&ecc_P[H->job];
+  uint8_t * src = (uint8_t *)&J[1] + J->metalen + J->dataoff;
+  size_t off = H->off, len = H->len;
+  if (off < sizeof(uint32_t)) {
+    size_t n = min(len, sizeof(uint32_t) - off);
+    memcpy(dst, (uint8_t *)&J->nonce + off, n);
+    dst += n; off += n; len -= n;
+  }
+  memcpy(dst, &src[off - sizeof(uint32_t)], len);
+}
+
 size_t ecc_read(uint8_t * data, size_t len) {
   size_t r = 0;
   Wire.requestFrom(ECC_ADDR, len);
@@ -240,11 +354,6 @@ inline void ecc_writepacket(uint8_t * data, size_t len) {
 void ecc_init() {
   Wire.begin(ECC_PIN_SDA, ECC_PIN_SCL);
 
-  // Wake up
-  {
-    ecc_alloc(ECMD_WAKE, WAIT_WAKE, RXLEN_WAKE, 0);
-  }
-
   // Read config
   {
     memset(&ecc_config, 0, sizeof(ecc_config));
@@ -261,283 +370,400 @@ void ecc_init() {
     ecc_alloc(ECMD_READVERSION, WAIT_READ, RXLEN_READVERSION, 0);
   }
 
-  // Read random
-  {
-    ecc_alloc(ECMD_RAND, WAIT_RAND, RXLEN_RAND, 0);
+  // Random pool fills from ecc_loop once the config shows the device locked
+}
+
+// Commands that only run on the device's state from the command before them
+static inline bool ecc_chained(uint8_t cmd) {
+  return cmd == ECMD_HMAC_UPDATE || cmd == ECMD_HMAC_END || cmd == ECMD_SET_GENDIG || cmd == ECMD_SET_WRITEENC;
+}
+
+static inline bool ecc_local(uint8_t cmd) {
+  return cmd == ECMD_CHECKCFG || cmd == ECMD_MARK_SUCCESS;
+}
+
+static void ecc_sleep() {
+  ecc_write(0x1, NULL, 0);
+  ecc_power = EPWR_ASLEEP;
+}
+
+static void ecc_wake(unsigned long now) {
+  ecc_write(0x0, NULL, 0);
+  ecc_power = EPWR_WAKING;
+  ecc_wokeat = now;
+  state.service.crypto.wakes += 1;
+}
+
+static bool ecc_waitwake(unsigned long now) {
+  if (timesince(ecc_wokeat, now) <= ECC_WAKETYP) return false;
+
+  uint8_t reply[RXLEN_WAKE];
+  size_t bytes = ecc_read(reply, RXLEN_WAKE);
+  if (bytes == RXLEN_WAKE && ecc_check(reply, bytes)) {
+    print_packet("Wake REPLY", reply, bytes);
+    ecc_power = EPWR_AWAKE;
+    return true;
+  }
+  if (timesince(ecc_wokeat, now) > ECC_WAKEMAX) {
+    // TODO - reset i2c bus
+    print_error("Timeout waiting for wake");
+    state.service.crypto.fault = true;
   }
+  return false;
+}
 
-  // Sleep
-  {
-    ecc_alloc(ECMD_SLEEP, WAIT_CHECK, 0, 0);
+static ecc_opstats_t * ecc_opstat(uint8_t cmd) {
+  switch (cmd) {
+    case ECMD_READCFG:        return &ecc_stats[0];
+    case ECMD_READVERSION:    return &ecc_stats[1];
+    case ECMD_RAND:           return &ecc_stats[2];
+    case ECMD_HMAC_START:     return &ecc_stats[3];
+    case ECMD_HMAC_UPDATE:    return &ecc_stats[4];
+    case ECMD_HMAC_END:       return &ecc_stats[5];
+    case ECMD_SET_NONCE:      return &ecc_stats[6];
+    case ECMD_SET_GENDIG:     return &ecc_stats[7];
+    case ECMD_SET_WRITEENC:   return &ecc_stats[8];
+    case ECMD_PROV_LOCK:      return &ecc_stats[9];
+    case ECMD_PROV_WRITECFG:  return &ecc_stats[10];
+    case ECMD_PROV_WRITEDATA: return &ecc_stats[11];
+    default:                  return NULL;
   }
 }
 
-void ecc_loop(unsigned long now) {
-  // Check if queue has commands
-  if (ecc_Qlen == 0 || state.service.crypto.fault) return;
+static void ecc_record(ecc_opstats_t * S, unsigned long us) {
+  uint8_t bin = 0;
+  while (bin < (ECC_HISTBINS - 1) && us >= (1000UL << bin)) bin += 1;
+  S->count += 1;
+  S->hist[bin] += 1;
+  S->max_us = max(S->max_us, (uint32_t)us);
+}
 
-  ecc_cmd_t * C = (ecc_cmd_t *)&ecc_Q[0];
+// Returns bytes to consume once the reply is in, zero while still waiting
+static size_t ecc_receive(ecc_cmd_t * C, unsigned long now) {
   uint8_t * data = (uint8_t *)&C[1];
-  
-  // Check if receive
-  now = millis();
-  if (C->started != 0 && timesince(C->started, now) > C->wait_typ) {
-    size_t consume = sizeof(ecc_cmd_t) + C->datalen;
+  size_t consume = sizeof(ecc_cmd_t) + C->datalen;
 
-    uint8_t reply[C->rxlen];
-    size_t bytes = ecc_read(reply, C->rxlen);
-    
-    if (bytes == 0) {
-      // No bytes read, check if expired
-      if (timesince(C->started, now) > C->wait_max) {
-        // Timeout waiting for reply
-        // TODO - reset i2c bus
-        print_error("Timeout waiting for reply");
-        state.service.crypto.fault = true;
-        
-      } else {
-        // More time to wait for reply
-        consume = 0;
-      }
-      
-    } else if (bytes == C->rxlen) {
-      // All reply bytes received
-      if (ecc_check(reply, bytes)) {
-        // Checksum passed
-        switch (C->cmd) {
-          case ECMD_WAKE: {
-            print_packet("Wake REPLY", reply, C->rxlen);
-            print_check(reply, C->rxlen);
-            break;
-          }
-          case ECMD_READCFG: {
-            print_packet("ReadConfig REPLY", reply, C->rxlen);
-            print_check(reply, C->rxlen);
-            size_t off = data[0] * 0x20;
-            memcpy(&ecc_config.bytes[off], &reply[1], 32);
-            ecc_config_read += 1;
-            break;
-          }
-          case ECMD_READVERSION: {
-            print_packet("ReadVersion REPLY", reply, C->rxlen);
-            print_check(reply, C->rxlen);
-            if (strcmp((char *)&reply[1], ECC_VERSION) == 0) {
-              // Version written in slot 0 matches
-              ecc_versionok = true;
-              state.service.crypto.available = true;
-            }
-            break;
-          }
-          case ECMD_RAND: {
-            print_packet("Random REPLY", reply, C->rxlen);
-            print_check(reply, C->rxlen);
-            memcpy(ecc_randpool, &reply[1], sizeof(ecc_randpool));
-            break;
-          }
+  ecc_opstats_t * S = ecc_opstat(C->cmd);
+  uint8_t reply[C->rxlen];
+  size_t bytes = ecc_read(reply, C->rxlen);
+
+  if (bytes == 0) {
+    // No bytes read, check if expired
+    if (timesince(C->started, now) > C->wait_max) {
+      // Timeout waiting for reply
+      // TODO - reset i2c bus
+      print_error("Timeout waiting for reply");
+      state.service.crypto.timeouts += 1;
+      state.service.crypto.fault = true;
 
-          case ECMD_HMAC_START:
-          case ECMD_HMAC_UPDATE: {
-            print_packet("Hmac Start/Update REPLY", reply, C->rxlen);
-            print_check(reply, C->rxlen);
-            if (!ecc_checkok(reply, C->rxlen)) {
-              print_error("Bad reply packet");
-            }
-            break;
+    } else {
+      // More time to wait for reply
+      if (S != NULL) S->polls += 1;
+      consume = 0;
+    }
+
+  } else if (bytes == C->rxlen) {
+    // All reply bytes received
+    if (ecc_check(reply, bytes)) {
+      // Checksum passed
+      if (S != NULL) ecc_record(S, micros() - ecc_sentus);
+      switch (C->cmd) {
+        case ECMD_READCFG: {
+          print_packet("ReadConfig REPLY", reply, C->rxlen);
+          print_check(reply, C->rxlen);
+          size_t off = data[0] * 0x20;
+          memcpy(&ecc_config.bytes[off], &reply[1], 32);
+          ecc_config_read += 1;
+          break;
+        }
+        case ECMD_READVERSION: {
+          print_packet("ReadVersion REPLY", reply, C->rxlen);
+          print_check(reply, C->rxlen);
+          if (strcmp((char *)&reply[1], ECC_VERSION) == 0) {
+            // Version written in slot 0 matches
+            ecc_versionok = true;
+            state.service.crypto.available = true;
           }
-          case ECMD_HMAC_END: {
-            print_packet("Hmac End REPLY", reply, C->rxlen);
-            print_check(reply, C->rxlen);
-            print_sha("Hmac Result", &reply[1]);
-            size_t off = 1 + data[0];
-            lowcom_ecc_hmacend(&reply[1], &data[off], C->datalen - off);
-            break;
+          break;
+        }
+        case ECMD_RAND: {
+          print_packet("Random REPLY", reply, C->rxlen);
+          print_check(reply, C->rxlen);
+          for (size_t i = 0; i < ECC_RANDWORDS && ecc_randlen < ECC_SIZE_RANDPOOL; i++) {
+            memcpy(&ecc_randpool[(ecc_randhead + ecc_randlen) % ECC_SIZE_RANDPOOL], &reply[1 + i * sizeof(uint32_t)], sizeof(uint32_t));
+            ecc_randlen += 1;
+            sketch.service.crypto.rand_words += 1;
           }
+          ecc_randpending = false;
+          state.service.crypto.rand_fills += 1;
+          state.service.crypto.rand_level = ecc_randlen;
+          break;
+        }
 
-          case ECMD_SET_NONCE:
-          case ECMD_SET_GENDIG:
-          case ECMD_SET_WRITEENC: {
-            print_packet("Set WriteEnc REPLY", reply, C->rxlen);
-            print_check(reply, C->rxlen);
-            if (!ecc_checkok(reply, C->rxlen)) {
-              print_error("Bad reply packet");
-              sketch.service.crypto.mark = ECC_FAILURE;
-            }
-            break;
+        case ECMD_HMAC_START:
+        case ECMD_HMAC_UPDATE: {
+          print_packet("Hmac Start/Update REPLY", reply, C->rxlen);
+          print_check(reply, C->rxlen);
+          if (!ecc_checkok(reply, C->rxlen)) {
+            print_error("Bad reply packet");
           }
+          break;
+        }
+        case ECMD_HMAC_END: {
+          print_packet("Hmac End REPLY", reply, C->rxlen);
+          print_check(reply, C->rxlen);
+          print_sha("Hmac Result", &reply[1]);
+          ecc_hmacjob_t * J = (ecc_hmacjob_t *)&ecc_P[((ecc_hmacchunk_t *)data)->job];
+          lowcom_ecc_hmacend(&reply[1], (uint8_t *)&J[1], J->metalen + J->datalen);
+          ecc_pfree();
+          state.service.crypto.hmacs += 1;
+          break;
+        }
 
-          case ECMD_PROV_LOCK:
-          case ECMD_PROV_WRITECFG:
-          case ECMD_PROV_WRITEDATA: {
-            print_packet("Provision Lock/WriteConfig/WriteData REPLY", reply, C->rxlen);
-            print_check(reply, C->rxlen);
-            if (!ecc_checkok(reply, C->rxlen)) {
-              print_error("Bad reply packet");
-              sketch.service.crypto.mark = ECC_FAILURE;
-            }
-            break;
+        case ECMD_SET_NONCE:
+        case ECMD_SET_GENDIG:
+        case ECMD_SET_WRITEENC: {
+          print_packet("Set WriteEnc REPLY", reply, C->rxlen);
+          print_check(reply, C->rxlen);
+          if (!ecc_checkok(reply, C->rxlen)) {
+            print_error("Bad reply packet");
+            sketch.service.crypto.mark = ECC_FAILURE;
           }
+          break;
         }
 
-      } else {
-        // Bad checksum, attempt retransmit
-        print_error("Bad checksum for REPLY");
-        print_packet("REPLY packet with bad checksum", reply, C->rxlen);
-        C->started = 0;
+        case ECMD_PROV_LOCK:
+        case ECMD_PROV_WRITECFG:
+        case ECMD_PROV_WRITEDATA: {
+          print_packet("Provision Lock/WriteConfig/WriteData REPLY", reply, C->rxlen);
+          print_check(reply, C->rxlen);
+          if (!ecc_checkok(reply, C->rxlen)) {
+            print_error("Bad reply packet");
+            sketch.service.crypto.mark = ECC_FAILURE;
+          }
+          break;
+        }
       }
-      
+
     } else {
-      // Bad number of bytes received, error condition!
-      // TODO - reset i2c bus
-      state.service.crypto.fault = true;
+      // Bad checksum, attempt retransmit
+      print_error("Bad checksum for REPLY");
+      print_packet("REPLY packet with bad checksum", reply, C->rxlen);
+      if (S != NULL) S->retries += 1;
+      state.service.crypto.retries += 1;
+      C->started = 0;
+      consume = 0;
     }
 
-    if (consume > 0) {
-      memmove(&ecc_Q[0], &ecc_Q[consume], ecc_Qlen - consume);
-      ecc_Qlen -= consume;
-    }
+  } else {
+    // Bad number of bytes received, error condition!
+    // TODO - reset i2c bus
+    state.service.crypto.short_replies += 1;
+    state.service.crypto.fault = true;
   }
 
-  // Check if transmit
-  if (C->started == 0 && now != 0) {
-    size_t consume = 0;
-    
-    switch (C->cmd) {
-      case ECMD_WAKE: {
-        ecc_write(0x0, NULL, 0);
-        break;
-      }
-      case ECMD_SLEEP: {
-        ecc_write(0x1, NULL, 0);
-        consume = sizeof(ecc_cmd_t);
-        break;
-      }
-      case ECMD_READCFG: {
-        uint8_t readcfg[] = {0, 0x02, 0x80, data[0] << 3, 0x0, 0, 0};
-        ecc_writepacket(readcfg, sizeof(readcfg));
-        break;
-      }
-      case ECMD_CHECKCFG: {
-        print_config(&ecc_config.bits);
-        state.service.crypto.probed = ecc_ok();
-        state.service.crypto.available = ecc_ok() && !ecc_locked();
-        state.service.crypto.provisioned = ecc_locked();
+  return consume;
+}
+
+// Sends the command, returns bytes to consume for commands that expect no reply
+static size_t ecc_transmit(ecc_cmd_t * C) {
+  uint8_t * data = (uint8_t *)&C[1];
+  size_t consume = 0;
+
+  switch (C->cmd) {
+    case ECMD_READCFG: {
+      uint8_t readcfg[] = {0, 0x02, 0x80, data[0] << 3, 0x0, 0, 0};
+      ecc_writepacket(readcfg, sizeof(readcfg));
+      break;
+    }
+    case ECMD_CHECKCFG: {
+      print_config(&ecc_config.bits);
+      state.service.crypto.probed = ecc_ok();
+      state.service.crypto.available = ecc_ok() && !ecc_locked();
+      state.service.crypto.provisioned = ecc_locked();
+      consume = sizeof(ecc_cmd_t);
+      break;
+    }
+    case ECMD_READVERSION: {
+      // Attempt to read version only if locked
+      if (ecc_locked()) {
+        uint8_t readversion[] = {0, 0x02, 0x82, 0x00, 0x00, 0, 0};
+        ecc_writepacket(readversion, sizeof(readversion));
+      } else {
+        // Skip this command
         consume = sizeof(ecc_cmd_t);
-        break;
-      }
-      case ECMD_READVERSION: {
-        // Attempt to read version only if locked
-        if (ecc_locked()) {
-          uint8_t readversion[] = {0, 0x02, 0x82, 0x00, 0x00, 0, 0};
-          ecc_writepacket(readversion, sizeof(readversion));
-        } else {
-          // Skip this command
-          consume = sizeof(ecc_cmd_t);
-        }
-        break;
-      }
-      case ECMD_RAND: {
-        uint8_t rnd[] = {0, 0x1B, 0x0, 0x0, 0x0, 0, 0};
-        ecc_writepacket(rnd, sizeof(rnd));
-        break;
       }
+      break;
+    }
+    case ECMD_RAND: {
+      uint8_t rnd[] = {0, 0x1B, 0x0, 0x0, 0x0, 0, 0};
+      ecc_writepacket(rnd, sizeof(rnd));
+      break;
+    }
 
-      case ECMD_HMAC_START: {
-        uint8_t start[] = {0, 0x47, 0x04, 0x02, 0x00, 0, 0};
-        ecc_writepacket(start, sizeof(start));
-        break;
-      }
-      case ECMD_HMAC_UPDATE: {
-        uint8_t update[81] = {0};
-        update[1] = 0x47;
-        update[2] = 0x01;
-        update[3] = 64;
-        update[4] = 0x00;
-        memcpy(&update[5], data, 64);
-        print_packet("Hmac Update SEND", update, sizeof(update));
-        ecc_writepacket(update, sizeof(update));
-        break;
-      }
-      case ECMD_HMAC_END: {
-        uint8_t end[7 + data[0]];
-        end[0] = end[5 + data[0]] = end[6 + data[0]] = 0;
-        end[1] = 0x47;
-        end[2] = 0x05;
-        end[3] = data[0];
-        end[4] = 0x0;
-        memcpy(&end[5], &data[1], data[0]);
-        print_packet("Hmac End SEND", end, 7 + data[0]);
-        ecc_writepacket(end, 7 + data[0]);
-        break;
-      }
+    case ECMD_HMAC_START: {
+      uint8_t start[] = {0, 0x47, 0x04, 0x02, 0x00, 0, 0};
+      ecc_writepacket(start, sizeof(start));
+      break;
+    }
+    case ECMD_HMAC_UPDATE: {
+      uint8_t update[71] = {0};
+      update[1] = 0x47;
+      update[2] = 0x01;
+      update[3] = 64;
+      update[4] = 0x00;
+      ecc_hmacmsg((ecc_hmacchunk_t *)data, &update[5]);
+      print_packet("Hmac Update SEND", update, sizeof(update));
+      ecc_writepacket(update, sizeof(update));
+      break;
+    }
+    case ECMD_HMAC_END: {
+      ecc_hmacchunk_t * H = (ecc_hmacchunk_t *)data;
+      uint8_t end[7 + H->len];
+      end[0] = end[5 + H->len] = end[6 + H->len] = 0;
+      end[1] = 0x47;
+      end[2] = 0x05;
+      end[3] = H->len;
+      end[4] = 0x0;
+      ecc_hmacmsg(H, &end[5]);
+      print_packet("Hmac End SEND", end, 7 + H->len);
+      ecc_writepacket(end, 7 + H->len);
+      break;
+    }
 
-      case ECMD_SET_NONCE: {
-        uint8_t nonce[39] = {0};
-        nonce[1] = 0x16;
-        nonce[2] = 0x03;
-        nonce[3] = 0x00;
-        nonce[4] = 0x00;
-        memset(&nonce[5], 0, 32);
-        print_packet("Set Nonce SEND", nonce, sizeof(nonce));
-        ecc_writepacket(nonce, sizeof(nonce));
-        break;
-      }
-      case ECMD_SET_GENDIG: {
-        uint8_t gendig[] = {0, 0x15, 0x02, 0x01, 0x00, 0, 0};
-        print_packet("Set GenDig SEND", gendig, sizeof(gendig));
-        ecc_writepacket(gendig, sizeof(gendig));
-        break;
-      }
-      case ECMD_SET_WRITEENC: {
-        uint8_t writeenc[71] = {0};
-        writeenc[1] = 0x12;
-        writeenc[2] = 0x82;
-        writeenc[3] = 0x10;
-        writeenc[4] = 0x00;
-        memcpy(&writeenc[5], &data[0], 64);
-        print_packet("Set WriteEnc SEND", writeenc, sizeof(writeenc));
-        ecc_writepacket(writeenc, sizeof(writeenc));
-        break;
-      }
+    case ECMD_SET_NONCE: {
+      uint8_t nonce[39] = {0};
+      nonce[1] = 0x16;
+      nonce[2] = 0x03;
+      nonce[3] = 0x00;
+      nonce[4] = 0x00;
+      memset(&nonce[5], 0, 32);
+      print_packet("Set Nonce SEND", nonce, sizeof(nonce));
+      ecc_writepacket(nonce, sizeof(nonce));
+      break;
+    }
+    case ECMD_SET_GENDIG: {
+      uint8_t gendig[] = {0, 0x15, 0x02, 0x01, 0x00, 0, 0};
+      print_packet("Set GenDig SEND", gendig, sizeof(gendig));
+      ecc_writepacket(gendig, sizeof(gendig));
+      break;
+    }
+    case ECMD_SET_WRITEENC: {
+      uint8_t writeenc[71] = {0};
+      writeenc[1] = 0x12;
+      writeenc[2] = 0x82;
+      writeenc[3] = 0x10;
+      writeenc[4] = 0x00;
+      memcpy(&writeenc[5], &data[0], 64);
+      print_packet("Set WriteEnc SEND", writeenc, sizeof(writeenc));
+      ecc_writepacket(writeenc, sizeof(writeenc));
+      break;
+    }
 
-      case ECMD_PROV_LOCK: {
-        uint8_t lock[] = {0, 0x17, 0x80 | data[0], 0x0, 0x0, 0, 0};
-        ecc_writepacket(lock, sizeof(lock));
-        break;
-      }
-      case ECMD_PROV_WRITECFG: {
-        uint8_t writecfg[] = {0, 0x12, 0x00, data[0], 0x0, data[1], data[2], data[3], data[4], 0, 0};
-        print_packet("Provision WriteConfig SEND", writecfg, sizeof(writecfg));
-        ecc_writepacket(writecfg, sizeof(writecfg));
-        break;
-      }
-      case ECMD_PROV_WRITEDATA: {
-        uint8_t writedata[39] = {0};
-        writedata[1] = 0x12;
-        writedata[2] = 0x82;
-        writedata[3] = data[0] << 3;
-        writedata[4] = 0x0;
-        memcpy(&writedata[5], &data[1], 32);
-        print_packet("Provision WriteData SEND", writedata, sizeof(writedata));
-        ecc_writepacket(writedata, sizeof(writedata));
-        break;
-      }
+    case ECMD_PROV_LOCK: {
+      uint8_t lock[] = {0, 0x17, 0x80 | data[0], 0x0, 0x0, 0, 0};
+      ecc_writepacket(lock, sizeof(lock));
+      break;
+    }
+    case ECMD_PROV_WRITECFG: {
+      uint8_t writecfg[] = {0, 0x12, 0x00, data[0], 0x0, data[1], data[2], data[3], data[4], 0, 0};
+      print_packet("Provision WriteConfig SEND", writecfg, sizeof(writecfg));
+      ecc_writepacket(writecfg, sizeof(writecfg));
+      break;
+    }
+    case ECMD_PROV_WRITEDATA: {
+      uint8_t writedata[39] = {0};
+      writedata[1] = 0x12;
+      writedata[2] = 0x82;
+      writedata[3] = data[0] << 3;
+      writedata[4] = 0x0;
+      memcpy(&writedata[5], &data[1], 32);
+      print_packet("Provision WriteData SEND", writedata, sizeof(writedata));
+      ecc_writepacket(writedata, sizeof(writedata));
+      break;
+    }
 
-      case ECMD_MARK_SUCCESS: {
-        int * t = &sketch.service.crypto.mark;
-        if (*t == 0) *t = ECC_SUCCESS;
-        consume = sizeof(ecc_cmd_t);
-        break;
-      }
+    case ECMD_MARK_SUCCESS: {
+      int * t = &sketch.service.crypto.mark;
+      if (*t == 0) *t = ECC_SUCCESS;
+      consume = sizeof(ecc_cmd_t);
+      break;
+    }
+  }
+
+  return consume;
+}
+
+// Keeps one RAND in flight while the pool is refilling, HELLO never waits on it
+static void ecc_randrefill() {
+  if (ecc_randlen < ECC_RANDWATERMARK) ecc_randfill = true;
+  if (ecc_randlen > (ECC_SIZE_RANDPOOL - ECC_RANDWORDS)) ecc_randfill = false;
+  if (!ecc_randfill || ecc_randpending || !ecc_locked()) return;
+  if (ecc_alloc(ECMD_RAND, WAIT_RAND, RXLEN_RAND, 0) != NULL) ecc_randpending = true;
+}
+
+void ecc_loop(unsigned long now) {
+  now = millis();
+  if (timesince(sketch.service.crypto.rate_at, now) >= ECC_RATEPERIOD) {
+    unsigned long elapsed = timesince(sketch.service.crypto.rate_at, now);
+    state.service.crypto.hmac_rate = (float)(state.service.crypto.hmacs - sketch.service.crypto.rate_hmacs) * 1000.0 / elapsed;
+    state.service.crypto.rand_rate = (float)(sketch.service.crypto.rand_words - sketch.service.crypto.rate_rand) * 1000.0 / elapsed;
+    sketch.service.crypto.rate_at = now;
+    sketch.service.crypto.rate_hmacs = state.service.crypto.hmacs;
+    sketch.service.crypto.rate_rand = sketch.service.crypto.rand_words;
+  }
+
+  ecc_randrefill();
+
+  state.service.crypto.queue = ecc_Qlen;
+  state.service.crypto.arena = ecc_Plen;
+
+  // Finish as many commands as are ready, the next one goes out as soon as a reply is in
+  while (!state.service.crypto.fault) {
+    // Wakes and replies take milliseconds on the bus, time each step from the clock rather than the pass
+    unsigned long at = millis();
+    ecc_cmd_t * C = ecc_front();
+
+    if (C == NULL) {
+      // Idle, let the device sleep once nothing more arrives
+      if (ecc_power != EPWR_ASLEEP && timesince(ecc_active, at) > ECC_IDLESLEEP) ecc_sleep();
+      return;
+    }
+
+    if (C->started != 0) {
+      // Check if receive
+      if (timesince(C->started, at) <= C->wait_typ) return;
+      size_t consume = ecc_receive(C, at);
+      if (consume == 0) return;
+      ecc_consume(consume);
+      ecc_active = at;
+      continue;
     }
 
+    if (!ecc_local(C->cmd)) {
+      // Stay clear of the watchdog, a chain of dependent commands must finish in one wake
+      if (ecc_power == EPWR_AWAKE && !ecc_chained(C->cmd) && timesince(ecc_wokeat, at) > (ECC_WATCHDOG - ECC_CHAINMAX)) ecc_sleep();
+      if (ecc_power == EPWR_ASLEEP) ecc_wake(at);
+      if (ecc_power == EPWR_WAKING && !ecc_waitwake(at)) return;
+    }
+
+    // Transmit
+    size_t consume = ecc_transmit(C);
     C->started = millis();
+    ecc_sentus = micros();
     if (consume > 0) {
-      memmove(&ecc_Q[0], &ecc_Q[consume], ecc_Qlen - consume);
-      ecc_Qlen -= consume;
+      ecc_consume(consume);
+      ecc_active = at;
+    } else {
+      return;
     }
   }
 }
 
+const ecc_opstats_t * ecc_opstats(size_t i) {
+  return i < (sizeof(ecc_stats) / sizeof(ecc_opstats_t))? &ecc_stats[i] : NULL;
+}
+
 bool ecc_ok() {
   return ecc_config_read == 4 && (ecc_config.bits.sn_0 != 0 || ecc_config.bits.sn_1 != 0 || ecc_config.bits.sn_8 != 0);
 }
@@ -549,17 +775,24 @@ bool ecc_locked() {
 uint32_t ecc_random() {
   if (!ecc_locked()) return 0;
 
-  // Wake up device and send random command
-  if (ecc_checksize(sizeof(ecc_cmd_t) * 3)) {
-    ecc_alloc(ECMD_WAKE, WAIT_WAKE, RXLEN_WAKE, 0);
-    ecc_alloc(ECMD_RAND, WAIT_RAND, RXLEN_RAND, 0);
-    ecc_alloc(ECMD_SLEEP, WAIT_CHECK, 0, 0);
+  // Every word is handed out once, zero means no nonce to lowcom so skip it
+  uint32_t r = 0;
+  while (r == 0 && ecc_randlen > 0) {
+    r = ecc_randpool[ecc_randhead];
+    ecc_randpool[ecc_randhead] = 0;
+    ecc_randhead = (ecc_randhead + 1) % ECC_SIZE_RANDPOOL;
+    ecc_randlen -= 1;
   }
-  
-  for (size_t i = 0; i < ECC_SIZE_RANDPOOL; i++) {
-    if (ecc_randpool[i] != 0) return ecc_randpool[i];
+
+  if (r == 0) {
+    // Pool ran dry, the ESP32 RNG is good while the radio is on
+    state.service.crypto.rand_fallbacks += 1;
+    while (r == 0) r = esp_random();
   }
-  return 0;
+
+  ecc_randrefill();
+  state.service.crypto.rand_level = ecc_randlen;
+  return r;
 }
 
 bool ecc_provision(const char * master, const char * newpass) {
@@ -570,19 +803,14 @@ bool ecc_provision(const char * master, const char * newpass) {
 
   // Check overall size
   {
-    size_t total = (sizeof(ecc_cmd_t) * 2) + (sizeof(ecc_cmd_t) + 5) * 4 + (sizeof(ecc_cmd_t) + 1) + (sizeof(ecc_cmd_t) + 33) * 3 + (sizeof(ecc_cmd_t) + 1) + sizeof(ecc_cmd_t);
-    if (!ecc_checksize(total)) {
+    size_t total = (sizeof(ecc_cmd_t) + 5) * 4 + (sizeof(ecc_cmd_t) + 1) + (sizeof(ecc_cmd_t) + 33) * 3 + (sizeof(ecc_cmd_t) + 1) + sizeof(ecc_cmd_t);
+    if (!ecc_checksize(total, sizeof(ecc_cmd_t) + 33)) {
       // Error, not enough memory in queue
       // TODO - set error
       return false;
     }
   }
 
-  // Wake up device
-  {
-    ecc_alloc(ECMD_WAKE, WAIT_WAKE, RXLEN_WAKE, 0);
-  }
-
   // Handle config
   {
     if (ecc_config.bits.lockconfig == 0x55) {
@@ -649,11 +877,6 @@ bool ecc_provision(const char * master, const char * newpass) {
     }
   }
 
-  // Sleep
-  {
-    ecc_alloc(ECMD_SLEEP, WAIT_CHECK, 0, 0);
-  }
-
   // Handle success notify
   {
     sketch.service.crypto.mark = 0;
@@ -671,19 +894,14 @@ bool ecc_setpassword(const char * master, const char * newpass) {
 
   // Check overall size
   {
-    size_t total = (sizeof(ecc_cmd_t) * 2) + sizeof(ecc_cmd_t) * 2 + sizeof(ecc_cmd_t) + 64 + sizeof(ecc_cmd_t);
-    if (!ecc_checksize(total)) {
+    size_t total = sizeof(ecc_cmd_t) * 2 + sizeof(ecc_cmd_t) + 64 + sizeof(ecc_cmd_t);
+    if (!ecc_checksize(total, sizeof(ecc_cmd_t) + 64)) {
       // Error, not enough memory in queue
       // TODO - set error
       return false;
     }
   }
 
-  // Wake up device
-  {
-    ecc_alloc(ECMD_WAKE, WAIT_WAKE, RXLEN_WAKE, 0);
-  }
-
   // Handle initial setup commands
   {
     // Set up tempkey register
@@ -726,11 +944,6 @@ bool ecc_setpassword(const char * master, const char * newpass) {
     print_sha("Mac", &sm[32]);
   }
 
-  // Sleep
-  {
-    ecc_alloc(ECMD_SLEEP, WAIT_CHECK, 0, 0);
-  }
-
   // Handle success notify
   {
     sketch.service.crypto.mark = 0;
@@ -746,66 +959,51 @@ bool ecc_lowcom_hmac(uint32_t nonce, uint8_t * meta, size_t metalen, uint8_t * d
     return false;
   }
 
-  // Check overall size
+  // Check queue size, the entries only carry chunk descriptors
+  size_t msglen = sizeof(uint32_t) + datalen - dataoff;
+  if (msglen > 0xFFFF || metalen > 0xFFFF || datalen > 0xFFFF) {
+    // Error, offsets into the job are 16 bit
+    // TODO - set error
+    return false;
+  }
   {
-    size_t total = sizeof(ecc_cmd_t) * 3;
-    size_t remaining = datalen - dataoff;
-    while (remaining >= 64) {
-      total += sizeof(ecc_cmd_t) + 64;
-      remaining -= 64;
-    }
-    total += sizeof(ecc_cmd_t) + 1 + remaining + metalen + datalen;
-
-    if (!ecc_checksize(total)) {
+    size_t entry = sizeof(ecc_cmd_t) + sizeof(ecc_hmacchunk_t);
+    size_t total = sizeof(ecc_cmd_t) + (msglen / 64 + 1) * entry;
+    if (!ecc_checksize(total, entry)) {
       // Error, not enough memory in queue
       // TODO - set error
       return false;
     }
   }
 
-  // Wake up device
-  {
-    ecc_alloc(ECMD_WAKE, WAIT_WAKE, RXLEN_WAKE, 0);
+  // Copy the packet into the arena once, it stays there until the digest comes back
+  ecc_hmacjob_t * J = ecc_palloc(sizeof(ecc_hmacjob_t) + metalen + datalen);
+  if (J == NULL) {
+    // Error, not enough memory in arena
+    // TODO - set error
+    return false;
   }
+  J->nonce = nonce;
+  J->metalen = metalen;
+  J->dataoff = dataoff;
+  J->datalen = datalen;
+  memcpy(&J[1], meta, metalen);
+  memcpy((uint8_t *)&J[1] + metalen, data, datalen);
 
   // Load commands in buffer
   {
-    // Send start command
+    uint16_t job = (uint8_t *)J - ecc_P;
     ecc_alloc(ECMD_HMAC_START, WAIT_HMAC, RXLEN_OK, 0);
-  
-    // Update with 64 byte chunks
-    size_t remaining = sizeof(uint32_t) + datalen - dataoff;
-    bool nonce_wrote = false;
-    while (remaining >= 64) {
-      uint8_t * p = (uint8_t *)ecc_alloc(ECMD_HMAC_UPDATE, WAIT_HMAC, RXLEN_OK, 64);
-      if (!nonce_wrote) {
-        memcpy(&p[0], &nonce, sizeof(uint32_t));
-        memcpy(&p[sizeof(uint32_t)], &data[dataoff], 64 - sizeof(uint32_t));
-        dataoff += 64 - sizeof(uint32_t);
-        nonce_wrote = true;
-      } else {
-        memcpy(&p[0], &data[dataoff], 64);
-        dataoff += 64;
-      }
-      remaining -= 64;
-    }
-  
-    // End with remaining + all data again
-    uint8_t * e = (uint8_t *)ecc_alloc(ECMD_HMAC_END, WAIT_HMAC, RXLEN_HMAC, 1 + remaining + metalen + datalen);
-    e[0] = remaining;
-    if (!nonce_wrote) {
-      memcpy(&e[1], &nonce, sizeof(uint32_t));
-      memcpy(&e[1 + sizeof(uint32_t)], &data[dataoff], remaining - sizeof(uint32_t));
-    } else {
-      memcpy(&e[1], &data[dataoff], remaining);
+
+    // Update with 64 byte chunks, end with the remainder
+    size_t off = 0;
+    for (; (msglen - off) >= 64; off += 64) {
+      ecc_hmacchunk_t * H = (ecc_hmacchunk_t *)ecc_alloc(ECMD_HMAC_UPDATE, WAIT_HMAC, RXLEN_OK, sizeof(ecc_hmacchunk_t));
+      *H = {.job = job, .off = (uint16_t)off, .len = 64};
     }
-    memcpy(&e[1 + remaining], meta, metalen);
-    memcpy(&e[1 + remaining + metalen], data, datalen);
+    ecc_hmacchunk_t * H = (ecc_hmacchunk_t *)ecc_alloc(ECMD_HMAC_END, WAIT_HMAC, RXLEN_HMAC, sizeof(ecc_hmacchunk_t));
+    *H = {.job = job, .off = (uint16_t)off, .len = (uint8_t)(msglen - off)};
   }
 
-  // Sleep
-  {
-    ecc_alloc(ECMD_SLEEP, WAIT_CHECK, 0, 0);
-  }
+  return true;
 }
-
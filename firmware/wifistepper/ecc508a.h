@@ -15,6 +15,20 @@ typedef struct __ecc_packed {
   unsigned long started;
 } ecc_cmd_t;
 
+typedef struct __ecc_packed {
+  uint16_t len;
+  uint32_t nonce;
+  uint16_t metalen;
+  uint16_t dataoff;
+  uint16_t datalen;
+} ecc_hmacjob_t;
+
+typedef struct __ecc_packed {
+  uint16_t job;
+  uint16_t off;
+  uint8_t len;
+} ecc_hmacchunk_t;
+
 typedef struct __ecc_packed {
   uint8_t sn_0;       uint8_t sn_1;       uint8_t sn_2;       uint8_t sn_3;
   uint8_t revnum_0;   uint8_t revnum_1;   uint8_t revnum_2;   uint8_t revnum_3;
@@ -95,6 +109,18 @@ typedef struct __ecc_packed {
 #define ECC_FAILURE       (1)
 #define ECC_SUCCESS       (2)
 
+// Reply latency bins, each one double the last starting under 1ms, the last is open ended
+#define ECC_HISTBINS      (7)
+
+typedef struct {
+  const char * name;
+  uint32_t count;
+  uint32_t polls;
+  uint32_t retries;
+  uint32_t max_us;
+  uint32_t hist[ECC_HISTBINS];
+} ecc_opstats_t;
+
 void ecc_init();
 void ecc_loop(unsigned long now);
 bool ecc_ok();
@@ -103,5 +129,6 @@ uint32_t ecc_random();
 bool ecc_provision(const char * master, const char * newpass);
 bool ecc_setpassword(const char * master, const char * newpass);
 bool ecc_lowcom_hmac(uint32_t nonce, uint8_t * meta, size_t metalen, uint8_t * data, size_t dataoff, size_t datalen);
+const ecc_opstats_t * ecc_opstats(size_t i);
 
-#endif
+#endif
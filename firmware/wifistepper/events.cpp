@@ -0,0 +1,140 @@
+#include <WebServer.h>
+#include <WiFi.h>
+
+#include "wifistepper.h"
+
+extern WebServer server;
+
+#define EV_CLIENTS      (2)
+#define EV_MAXTARGETS   (16)
+#define EV_POLLMS       (50)
+#define EV_MINPERIOD    (50)
+#define EV_KEEPALIVE    (15000)
+#define EV_RETRYMS      (2000)
+#define EV_DATASIZE     (384)
+
+// Server-Sent Events, one long-lived authenticated connection per dashboard
+typedef struct {
+  WiFiClient client;
+  bool active;
+  bool fresh;
+  uint32_t period;
+  unsigned long last;
+  unsigned long sent;
+  uint32_t hash[EV_MAXTARGETS];
+} ev_client_t;
+
+static ev_client_t ev_client[EV_CLIENTS];
+
+// WebServer holds on to the client it answered and won't accept another until that one
+// closes or HTTP_MAX_CLOSE_WAIT runs out. Its client is protected, a member pointer named
+// through a subclass reaches it without another WebServer type.
+struct ev_webserver : public WebServer {
+  static WiFiClient WebServer::* current() { return &ev_webserver::_currentClient; }
+};
+
+static uint32_t ev_hash(const char * s) {
+  // FNV-1a
+  uint32_t h = 2166136261U;
+  for (; *s != 0; s++) h = (h ^ (uint8_t)*s) * 16777619U;
+  return h;
+}
+
+static size_t ev_format(char * buf, size_t len, uint8_t target, const motor_state * st) {
+  const ps_alarms * a = &st->status.alarms;
+  return snprintf(buf, len,
+    "event: state\ndata: {\"target\":%u,\"stepss\":%.2f,\"pos\":%d,\"mark\":%d,\"vin\":%.1f,\"dir\":\"%s\",\"movement\":\"%s\","
+    "\"hiz\":%s,\"busy\":%s,\"switch\":%s,\"stepclock\":%s,\"alarms\":{\"commanderror\":%s,\"overcurrent\":%s,\"undervoltage\":%s,"
+    "\"thermalshutdown\":%s,\"thermalwarning\":%s,\"stalldetect\":%s,\"switch\":%s}}\n\n",
+    target, st->stepss, st->pos, st->mark, st->vin, json_serialize(st->status.direction), json_serialize(st->status.movement),
+    st->status.hiz? "true" : "false", st->status.busy? "true" : "false", st->status.user_switch? "true" : "false", st->status.step_clock? "true" : "false",
+    a->command_error? "true" : "false", a->overcurrent? "true" : "false", a->undervoltage? "true" : "false",
+    a->thermal_shutdown? "true" : "false", a->thermal_warning? "true" : "false", a->stall_detect? "true" : "false", a->user_switch? "true" : "false");
+}
+
+static void ev_close(ev_client_t * c) {
+  c->client.stop();
+  c->active = false;
+}
+
+static bool ev_write(ev_client_t * c, const char * data, size_t len) {
+  if (c->client.write((const uint8_t *)data, len) != len) {
+    ev_close(c);
+    return false;
+  }
+  return true;
+}
+
+void events_init() {
+  server.on("/api/events", HTTP_GET, [](){
+    check_auth()
+    ev_client_t * c = NULL;
+    for (size_t i = 0; i < EV_CLIENTS; i++) {
+      if (ev_client[i].active && !ev_client[i].client.connected()) ev_close(&ev_client[i]);
+      if (!ev_client[i].active && c == NULL) c = &ev_client[i];
+    }
+    if (c == NULL) {
+      server.send(503, "text/plain", "Too many event streams.");
+      return;
+    }
+
+    // Take the socket over from WebServer, the handler returns without a response. The
+    // copy keeps the socket open, WebServer is left with nothing to wait on.
+    c->client = server.client();
+    server.*ev_webserver::current() = WiFiClient();
+    c->client.print("HTTP/1.1 200 OK\r\n"
+                    "Content-Type: text/event-stream\r\n"
+                    "Cache-Control: no-cache\r\n"
+                    "Connection: keep-alive\r\n"
+                    "Access-Control-Allow-Origin: *\r\n"
+                    "Access-Control-Allow-Credentials: true\r\n\r\n");
+    c->client.print(String("retry: ") + EV_RETRYMS + "\n\n");
+    c->active = true;
+    c->fresh = true;
+    c->period = server.hasArg("period")? max((long)server.arg("period").toInt(), (long)EV_MINPERIOD) : 0;
+    c->last = c->sent = millis();
+  });
+}
+
+void events_loop(unsigned long now) {
+  // Runs on the http task, state is only read with the core lock held
+  for (size_t i = 0; i < EV_CLIENTS; i++) {
+    ev_client_t * c = &ev_client[i];
+    if (!c->active) continue;
+    if (!c->client.connected()) {
+      ev_close(c);
+      continue;
+    }
+
+    bool periodic = c->period != 0;
+    if (!c->fresh && timesince(c->last, now) < (periodic? c->period : EV_POLLMS)) continue;
+    c->last = now;
+
+    motor_state snapshot[EV_MAXTARGETS];
+    size_t targets = 1;
+    {
+      core_locked();
+      snapshot[0] = *cmd_getstate(0);
+      if (state.daisy.active && sketch.daisy.slave != NULL) {
+        for (size_t t = 0; t < state.daisy.slaves && targets < EV_MAXTARGETS; t++) {
+          snapshot[targets++] = sketch.daisy.slave[t].state.motor;
+        }
+      }
+    }
+
+    for (size_t t = 0; t < targets && c->active; t++) {
+      char data[EV_DATASIZE];
+      size_t len = min(ev_format(data, sizeof(data), (uint8_t)t, &snapshot[t]), sizeof(data) - 1);
+      uint32_t hash = ev_hash(data);
+      if (!periodic && !c->fresh && hash == c->hash[t]) continue;
+      c->hash[t] = hash;
+      if (ev_write(c, data, len)) c->sent = now;
+    }
+    c->fresh = false;
+
+    // Comment line keeps idle streams open through proxies and detects dead peers
+    if (c->active && timesince(c->sent, now) >= EV_KEEPALIVE) {
+      if (ev_write(c, ":\n\n", 3)) c->sent = now;
+    }
+  }
+}
@@ -0,0 +1,164 @@
+#include <math.h>
+
+#include "jsonstream.h"
+
+JsonStream::JsonStream(WebServer& server) : server(server), len(0), depth(0), overflow(0), nonempty(0) { }
+
+void JsonStream::begin(int code) {
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(code, "application/json", "");
+}
+
+void JsonStream::end() {
+  flush();
+  // Zero length chunk terminates the response
+  server.sendContent("");
+}
+
+void JsonStream::flush() {
+  if (len == 0) return;
+  server.sendContent_P(buf, len);
+  len = 0;
+}
+
+size_t JsonStream::write(uint8_t c) {
+  if (len == sizeof(buf)) flush();
+  buf[len++] = (char)c;
+  return 1;
+}
+
+size_t JsonStream::write(const uint8_t * data, size_t l) {
+  size_t n = l;
+  while (l > 0) {
+    if (len == sizeof(buf)) flush();
+    size_t cpy = min(l, sizeof(buf) - len);
+    memcpy(&buf[len], data, cpy);
+    len += cpy; data += cpy; l -= cpy;
+  }
+  return n;
+}
+
+void JsonStream::string(const char * s) {
+  write('"');
+  for (; *s != 0; s++) {
+    char c = *s;
+    switch (c) {
+      case '"':   write('\\'); write('"');  break;
+      case '\\':  write('\\'); write('\\'); break;
+      case '\n':  write('\\'); write('n');  break;
+      case '\r':  write('\\'); write('r');  break;
+      case '\t':  write('\\'); write('t');  break;
+      default: {
+        if ((uint8_t)c < 0x20) {
+          char esc[7];
+          snprintf(esc, sizeof(esc), "\\u%04x", (unsigned int)c);
+          print(esc);
+        } else {
+          write((uint8_t)c);
+        }
+        break;
+      }
+    }
+  }
+  write('"');
+}
+
+void JsonStream::next(const char * key) {
+  if (depth > 0) {
+    uint16_t bit = 1 << (depth - 1);
+    if (nonempty & bit) write(',');
+    nonempty |= bit;
+  }
+  if (key != NULL) {
+    string(key);
+    write(':');
+  }
+}
+
+// Levels past JSONSTREAM_MAXDEPTH are only counted and share the last nonempty bit
+void JsonStream::open() {
+  if (depth < JSONSTREAM_MAXDEPTH) depth += 1;
+  else overflow += 1;
+  nonempty &= ~(1 << (depth - 1));
+}
+
+void JsonStream::close() {
+  if (overflow > 0) {
+    // Back in a shared level, it holds the container just closed
+    overflow -= 1;
+    nonempty |= 1 << (depth - 1);
+  } else if (depth > 0) {
+    depth -= 1;
+  }
+}
+
+void JsonStream::beginObject(const char * key) {
+  next(key);
+  write('{');
+  open();
+}
+
+void JsonStream::endObject() {
+  close();
+  write('}');
+}
+
+void JsonStream::beginArray(const char * key) {
+  next(key);
+  write('[');
+  open();
+}
+
+void JsonStream::endArray() {
+  close();
+  write(']');
+}
+
+void JsonStream::add(const char * key, const char * value) {
+  next(key);
+  if (value == NULL) print("null");
+  else string(value);
+}
+
+void JsonStream::add(const char * key, const String& value) {
+  add(key, value.c_str());
+}
+
+void JsonStream::add(const char * key, bool value) {
+  next(key);
+  print(value? "true" : "false");
+}
+
+void JsonStream::add(const char * key, int value) { add(key, (long)value); }
+void JsonStream::add(const char * key, unsigned int value) { add(key, (unsigned long)value); }
+
+void JsonStream::add(const char * key, long value) {
+  next(key);
+  print(value);
+}
+
+void JsonStream::add(const char * key, unsigned long value) {
+  next(key);
+  print(value);
+}
+
+void JsonStream::add(const char * key, float value) {
+  next(key);
+  if (isnan(value) || isinf(value)) { print("null"); return; }
+  char num[20];
+  snprintf(num, sizeof(num), "%.7g", value);
+  print(num);
+}
+
+void JsonStream::add(const char * key, double value) {
+  next(key);
+  if (isnan(value) || isinf(value)) { print("null"); return; }
+  char num[28];
+  snprintf(num, sizeof(num), "%.9g", value);
+  print(num);
+}
+
+void JsonStream::add(JsonObject& value) {
+  next(NULL);
+  value.printTo(*this);
+}
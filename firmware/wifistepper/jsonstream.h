@@ -0,0 +1,57 @@
+#ifndef __JSONSTREAM_H
+#define __JSONSTREAM_H
+
+#include <Print.h>
+#include <WebServer.h>
+#include <ArduinoJson.h>
+
+#define JSONSTREAM_CHUNK      (512)
+#define JSONSTREAM_MAXDEPTH   (16)
+#define JSONSTREAM_ENTRY      (256)
+
+// Writes a JSON document straight into a chunked HTTP response. Output is
+// staged in a fixed chunk buffer and flushed with sendContent, so the size
+// of the response is not bounded by jsonbuf and never lands on the heap.
+class JsonStream : public Print {
+  public:
+    JsonStream(WebServer& server);
+
+    void begin(int code = 200);
+    void end();
+
+    void beginObject(const char * key = NULL);
+    void endObject();
+    void beginArray(const char * key = NULL);
+    void endArray();
+
+    void add(const char * key, const char * value);
+    void add(const char * key, const String& value);
+    void add(const char * key, bool value);
+    void add(const char * key, int value);
+    void add(const char * key, unsigned int value);
+    void add(const char * key, long value);
+    void add(const char * key, unsigned long value);
+    void add(const char * key, float value);
+    void add(const char * key, double value);
+    void add(JsonObject& value);
+
+    virtual size_t write(uint8_t c);
+    virtual size_t write(const uint8_t * data, size_t len);
+    using Print::write;
+
+  private:
+    void next(const char * key);
+    void open();
+    void close();
+    void string(const char * s);
+    void flush();
+
+    WebServer& server;
+    char buf[JSONSTREAM_CHUNK];
+    size_t len;
+    uint8_t depth;
+    uint16_t overflow;
+    uint16_t nonempty;
+};
+
+#endif
@@ -79,6 +79,12 @@ typedef struct ispacked {
 #define OPCODE_SETCONFIG    (0x06)
 #define OPCODE_GETCONFIG    (0x07)
 #define OPCODE_GETSTATE     (0x08)
+#define OPCODE_ARM          (0x09)
+#define OPCODE_FIRE         (0x0A)
+#define OPCODE_GETDAISY     (0x0B)
+#define OPCODE_STCKLOAD     (0x0C)
+#define OPCODE_STCKPLAY     (0x0D)
+#define OPCODE_STCKSTOP     (0x0E)
 
 
 #define OPCODE_STOP         (0x11)
@@ -93,6 +99,7 @@ typedef struct ispacked {
 #define OPCODE_RESETPOS     (0x1A)
 #define OPCODE_SETPOS       (0x1B)
 #define OPCODE_SETMARK      (0x1C)
+#define OPCODE_HOMESTALL    (0x1D)
 
 #define OPCODE_WAITBUSY     (0x21)
 #define OPCODE_WAITRUNNING  (0x22)
@@ -354,11 +361,11 @@ static void lc_handlepacket(size_t client, uint8_t mode, uint8_t opcode, uint8_t
     case OPCODE_GETCONFIG: {
       lc_expectlen(0);
       lc_debug("CMD getconfig");
-      if (target < 0 || target > state.daisy.slaves) {
+      if (target < 0 || (!m_islocal(target) && target > state.daisy.slaves)) {
         lc_replynack(client, mode, opcode, target, queue, packetid, "Invalid target");
         return;
       }
-      motor_config * cfg = target == 0? &config.motor : &sketch.daisy.slave[target - 1].config.motor;
+      motor_config * cfg = m_islocal(target)? &config.motor : &sketch.daisy.slave[target - 1].config.motor;
       JsonObject& root = jsonbuf.createObject();
       root["mode"] = json_serialize(cfg->mode);
       root["stepsize"] = json_serialize(cfg->stepsize);
@@ -401,11 +408,11 @@ static void lc_handlepacket(size_t client, uint8_t mode, uint8_t opcode, uint8_t
     case OPCODE_GETSTATE: {
       lc_expectlen(0);
       lc_debug("CMD getstate");
-      if (target < 0 || target > state.daisy.slaves) {
+      if (target < 0 || (!m_islocal(target) && target > state.daisy.slaves)) {
         lc_replynack(client, mode, opcode, target, queue, packetid, "Invalid target");
         return;
       }
-      motor_state * st = target == 0? &state.motor : &sketch.daisy.slave[target - 1].state.motor;
+      motor_state * st = m_islocal(target)? cmd_getstate(m_device(target)) : &sketch.daisy.slave[target - 1].state.motor;
       JsonObject& root = jsonbuf.createObject();
       root["stepss"] = st->stepss;
       root["pos"] = st->pos;
@@ -431,7 +438,95 @@ static void lc_handlepacket(size_t client, uint8_t mode, uint8_t opcode, uint8_t
       jsonbuf.clear();
       break;
     }
+    case OPCODE_ARM: {
+      lc_expectlen(sizeof(uint8_t));
+      lc_debug("CMD arm", data[0]);
+      m_arm(target, id, data[0]);
+      lc_replyack(client, mode, opcode, target, queue, packetid, id);
+      break;
+    }
+    case OPCODE_FIRE: {
+      lc_expectlen(0);
+      lc_debug("CMD fire");
+      if (!daisy_fire(id)) {
+        lc_replynack(client, mode, opcode, 0, 0, packetid, "Fire not sent to every board");
+        return;
+      }
+      lc_replyack(client, mode, opcode, 0, 0, packetid, id);
+      break;
+    }
     
+    case OPCODE_GETDAISY: {
+      lc_expectlen(0);
+      lc_debug("CMD getdaisy");
+      if (target < 0 || target > state.daisy.slaves) {
+        lc_replynack(client, mode, opcode, target, queue, packetid, "Invalid target");
+        return;
+      }
+      daisy_linkstate * link = target == 0? &state.daisy.link : &sketch.daisy.slave[target - 1].state.link;
+      JsonObject& root = jsonbuf.createObject();
+      if (target == 0) {
+        root["active"] = state.daisy.active;
+        root["slaves"] = state.daisy.slaves;
+        root["ring_us"] = state.daisy.ring_us;
+        root["hop_us"] = state.daisy.hop_us;
+        root["retransmits"] = state.daisy.retransmits;
+        root["failures"] = state.daisy.failures;
+        root["backlog"] = state.daisy.backlog;
+        root["backlog_max"] = state.daisy.backlog_max;
+      } else {
+        root["ring_rtt_us"] = sketch.daisy.slave[target - 1].echo.ring_rtt_us;
+        root["ring_rtt_max_us"] = sketch.daisy.slave[target - 1].echo.ring_rtt_max_us;
+        root["turnaround_us"] = sketch.daisy.slave[target - 1].echo.turnaround_us;
+      }
+      root["forward_us"] = link->forward_us;
+      root["forward_max_us"] = link->forward_max_us;
+      root["rx_bytes"] = link->rx_bytes;
+      root["rx_frames"] = link->rx_frames;
+      root["forward_bytes"] = link->forward_bytes;
+      root["forward_frames"] = link->forward_frames;
+      root["parse_errors"] = link->parse_errors;
+      root["outbox_max"] = link->outbox_max;
+      root["duplicates"] = link->duplicates;
+      root["outoforder"] = link->outoforder;
+      JsonVariant v = root;
+      String reply = v.as<String>();
+      lc_reply(client, mode, opcode, SUBCODE_REPLY, target, queue, packetid, (uint8_t *)reply.c_str(), reply.length()+1);
+      jsonbuf.clear();
+      break;
+    }
+    case OPCODE_STCKLOAD: {
+      // Profile chunk prefixed with its offset, profiles larger than one packet are sent in pieces
+      if (len < sizeof(uint16_t) || target != 0) {
+        lc_replynack(client, mode, opcode, target, queue, packetid, "Bad profile chunk");
+        return;
+      }
+      lc_debug("CMD stckload", *(uint16_t *)data, len - sizeof(uint16_t));
+      if (!stck_load(*(uint16_t *)data, &data[sizeof(uint16_t)], len - sizeof(uint16_t))) {
+        lc_replynack(client, mode, opcode, target, queue, packetid, "Could not load profile");
+        return;
+      }
+      lc_replyack(client, mode, opcode, target, queue, packetid, id);
+      break;
+    }
+    case OPCODE_STCKPLAY: {
+      lc_expectlen(sizeof(cmd_stepclk_t));
+      cmd_stepclk_t * cmd = (cmd_stepclk_t *)data;
+      lc_debug("CMD stckplay", cmd->dir);
+      if (target != 0 || !stck_play(id, cmd->dir)) {
+        lc_replynack(client, mode, opcode, target, queue, packetid, "No valid profile or already playing");
+        return;
+      }
+      lc_replyack(client, mode, opcode, target, queue, packetid, id);
+      break;
+    }
+    case OPCODE_STCKSTOP: {
+      lc_expectlen(0);
+      lc_debug("CMD stckstop");
+      stck_stop();
+      lc_replyack(client, mode, opcode, target, queue, packetid, id);
+      break;
+    }
     case OPCODE_STOP: {
       lc_expectlen(sizeof(cmd_stop_t));
       cmd_stop_t * cmd = (cmd_stop_t *)data;
@@ -480,6 +575,14 @@ static void lc_handlepacket(size_t client, uint8_t mode, uint8_t opcode, uint8_t
       lc_replyack(client, mode, opcode, target, queue, packetid, id);
       break;
     }
+    case OPCODE_HOMESTALL: {
+      lc_expectlen(sizeof(cmd_homestall_t));
+      cmd_homestall_t * cmd = (cmd_homestall_t *)data;
+      lc_debug("CMD homestall", cmd->dir, cmd->fast);
+      m_homestall(target, queue, id, cmd->dir, cmd->fast, cmd->slow, cmd->backoff, cmd->pos);
+      lc_replyack(client, mode, opcode, target, queue, packetid, id);
+      break;
+    }
     case OPCODE_RELEASESW: {
       lc_expectlen(sizeof(cmd_releasesw_t));
       cmd_releasesw_t * cmd = (cmd_releasesw_t *)data;
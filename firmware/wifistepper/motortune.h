@@ -0,0 +1,106 @@
+#ifndef __MOTORTUNE_H
+#define __MOTORTUNE_H
+
+#include <math.h>
+#include <stdint.h>
+
+// Voltage mode parameters from motor electrical data (ST AN4144), refined by a speed sweep.
+// Speeds are full steps/s, KVALs are percent of Vs, BEMF slopes are percent of Vs per step/s.
+
+#define MT_KTMAX          (99.6)
+#define MT_SLOPEMAX       (0.3825)
+#define MT_SPEEDCOMAX     (976.5)
+
+#define MT_SWEEP_START    (50.0)
+#define MT_SWEEP_GROWTH   (1.25)
+#define MT_SWEEP_RETRIES  (4)
+#define MT_SWEEP_BOOST    (0.02)
+#define MT_MARGIN         (0.8)
+
+typedef struct {
+  float resistance;     // Ohm per phase
+  float inductance;     // mH per phase
+  float ke;             // V/Hz electrical, 0 if unknown
+  float current;        // A peak while running
+  float holdcurrent;    // A peak at standstill
+  float vs;             // V supply
+} mt_motor;
+
+typedef struct {
+  float kthold, ktrun, ktaccel, ktdecel;
+  float slopel, speedco, slopehacc, slopehdec;
+} mt_vmparams;
+
+typedef struct {
+  float speed;          // Speed under test
+  float held;           // Fastest speed that held without alarms
+  float limit;
+  float boost;          // Added to every BEMF slope after a stall
+  uint8_t retries;
+  bool done;
+} mt_sweep;
+
+static inline float mt_clamp(float v, float hi) { return v < 0? 0 : (v > hi? hi : v); }
+
+static inline mt_vmparams mt_compute(const mt_motor * m) {
+  // One electrical period is four full steps
+  float l = m->inductance / 1000.0;
+  float hold = 100.0 * m->resistance * m->holdcurrent / m->vs;
+  float run = 100.0 * m->resistance * m->current / m->vs;
+  float slopel = 100.0 * (m->ke / 4.0) / m->vs;
+  float slopeh = 100.0 * ((2.0 * M_PI * l * m->current + m->ke) / 4.0) / m->vs;
+  float speedco = l > 0? (4.0 * m->resistance) / (2.0 * M_PI * l) : MT_SPEEDCOMAX;
+
+  mt_vmparams p;
+  p.kthold = mt_clamp(hold, MT_KTMAX);
+  p.ktrun = p.ktaccel = p.ktdecel = mt_clamp(run, MT_KTMAX);
+  p.slopel = mt_clamp(slopel, MT_SLOPEMAX);
+  p.speedco = mt_clamp(speedco, MT_SPEEDCOMAX);
+  p.slopehacc = p.slopehdec = mt_clamp(slopeh, MT_SLOPEMAX);
+  return p;
+}
+
+static inline mt_vmparams mt_apply(const mt_vmparams * base, const mt_sweep * s) {
+  mt_vmparams p = *base;
+  p.slopel = mt_clamp(p.slopel + s->boost, MT_SLOPEMAX);
+  p.slopehacc = mt_clamp(p.slopehacc + s->boost, MT_SLOPEMAX);
+  p.slopehdec = mt_clamp(p.slopehdec + s->boost, MT_SLOPEMAX);
+  return p;
+}
+
+static inline void mt_sweepbegin(mt_sweep * s, float limit) {
+  s->speed = MT_SWEEP_START < limit? MT_SWEEP_START : limit;
+  s->held = 0;
+  s->limit = limit;
+  s->boost = 0;
+  s->retries = 0;
+  s->done = false;
+}
+
+// Feed back whether the last speed held, returns true if the BEMF slopes changed
+static inline bool mt_sweepresult(mt_sweep * s, bool held) {
+  if (held) {
+    s->held = s->speed;
+    s->retries = 0;
+    if (s->speed >= s->limit) s->done = true;
+    else s->speed = (s->speed * MT_SWEEP_GROWTH) < s->limit? s->speed * MT_SWEEP_GROWTH : s->limit;
+    return false;
+  }
+
+  // Stalled, give the high speed end more voltage and try the same speed again
+  if (s->retries >= MT_SWEEP_RETRIES || s->boost >= MT_SLOPEMAX) {
+    // Out of retries, keep the slopes that last held
+    s->boost = ((int)roundf(s->boost / MT_SWEEP_BOOST) - s->retries) * MT_SWEEP_BOOST;
+    s->done = true;
+    return s->retries > 0;
+  }
+  s->retries += 1;
+  s->boost += MT_SWEEP_BOOST;
+  return true;
+}
+
+static inline float mt_maxspeed(const mt_sweep * s) {
+  return s->held * MT_MARGIN;
+}
+
+#endif
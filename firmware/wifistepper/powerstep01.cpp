@@ -9,22 +9,106 @@
 #define PS_PIN_RST      (8)
 #define PS_PIN_CS       (10)
 
+#define PS_SPI_FREQ     (4000000)
+#define PS_SPI_MODE     (SPI_MODE2)
+#define PS_CSGAP_NS     (625)
+
 //#define PS_DEBUG
 
-uint8_t _ps_xferbyte(uint8_t b) {
+static uint32_t _ps_csup = 0;
+static uint32_t _ps_csgap = 0;
+
+// Devices in the SPI daisy chain, device 0 is wired to MOSI
+static uint8_t _ps_devices = 1;
+static uint8_t _ps_dev = 0;
+
+// Other tasks may sample the chip between main loop calls, a whole command or sync frame holds the bus
+static SemaphoreHandle_t _ps_mutex = NULL;
+
+void ps_lock() {
+  if (_ps_mutex != NULL) xSemaphoreTakeRecursive(_ps_mutex, portMAX_DELAY);
+}
+
+void ps_unlock() {
+  if (_ps_mutex != NULL) xSemaphoreGiveRecursive(_ps_mutex);
+}
+
+struct _ps_guard {
+  _ps_guard() { ps_lock(); }
+  ~_ps_guard() { ps_unlock(); }
+};
+#define ps_locked()   _ps_guard __ps_guard
+
+void _ps_xferframe(uint8_t * frame) {
+  // Per datasheet, must raise CS between bytes and hold for at least 625ns
+  while ((uint32_t)(ESP.getCycleCount() - _ps_csup) < _ps_csgap) {}
+
+  // SPI peripheral is configured once in ps_spiinit, one byte per device under a single CS
   digitalWrite(PS_PIN_CS, LOW);
-  SPI.beginTransaction(SPISettings(4000000, MSBFIRST, SPI_MODE2));
-  b = SPI.transfer(b);
-  SPI.endTransaction();
+  for (uint8_t i = 0; i < _ps_devices; i++) {
+    frame[i] = SPI.transfer(frame[i]);
+  }
   digitalWrite(PS_PIN_CS, HIGH);
+  _ps_csup = ESP.getCycleCount();
+}
 
-  // Per datasheet, must raise CS between bytes and hold for at least 625ns
-  delayMicroseconds(1);
+void _ps_xferdevices(ps_xferop * ops) {
+  // Shorter commands are padded out with NOPs, everything latches on the same CS edges
+  size_t len = 0;
+  for (uint8_t d = 0; d < _ps_devices; d++) len = max(len, ops[d].len);
 
-  return b;
+  uint8_t frame[PS_MAXDEVICES];
+  for (size_t b = 0; b <= len; b++) {
+    // First byte clocked out ends up in the last device
+    for (uint8_t d = 0; d < _ps_devices; d++) {
+      uint8_t * v = b == 0? &ops[d].cmd : (b <= ops[d].len? &ops[d].data[b - 1] : NULL);
+      frame[_ps_devices - 1 - d] = v != NULL? *v : CMD_NOP();
+    }
+    _ps_xferframe(frame);
+    for (uint8_t d = 0; d < _ps_devices; d++) {
+      uint8_t * v = b == 0? &ops[d].cmd : (b <= ops[d].len? &ops[d].data[b - 1] : NULL);
+      if (v != NULL) *v = frame[_ps_devices - 1 - d];
+    }
+  }
+}
+
+uint8_t _ps_xferbyte(uint8_t b) {
+  uint8_t frame[PS_MAXDEVICES] = {};
+  frame[_ps_devices - 1 - _ps_dev] = b;
+  _ps_xferframe(frame);
+  return frame[_ps_devices - 1 - _ps_dev];
+}
+
+// Write commands staged per device between ps_syncbegin and ps_syncend
+#define ps_isread(cmd)      (((cmd) & 0xE0) == CMD_GETPARAM(0) || (cmd) == CMD_GETSTATUS())
+
+static bool _ps_syncing = false;
+static uint8_t _ps_staged = 0;
+static ps_xferop _ps_stageop[PS_MAXDEVICES] = {};
+static uint8_t _ps_stagedata[PS_MAXDEVICES][3] = {};
+
+static void _ps_flush() {
+  if (_ps_staged == 0) return;
+  ps_xferop ops[PS_MAXDEVICES] = {};
+  for (uint8_t d = 0; d < _ps_devices; d++) {
+    if (_ps_staged & (1 << d)) ops[d] = _ps_stageop[d];
+  }
+  _ps_staged = 0;
+  _ps_xferdevices(ops);
 }
 
 void _ps_xfer(uint8_t cmd, uint8_t * data, size_t len) {
+  ps_locked();
+  if (_ps_syncing && !ps_isread(cmd) && len <= sizeof(_ps_stagedata[0])) {
+    // One command per device per frame, flush if this device already has one
+    if (_ps_staged & (1 << _ps_dev)) _ps_flush();
+    if (len > 0) memcpy(_ps_stagedata[_ps_dev], data, len);
+    _ps_stageop[_ps_dev] = { .cmd = cmd, .data = _ps_stagedata[_ps_dev], .len = len };
+    _ps_staged |= (1 << _ps_dev);
+    return;
+  }
+  _ps_flush();
+
   #ifdef PS_DEBUG
   {
     Serial.print("SPI Write: (");
@@ -59,24 +143,6 @@ void _ps_xfer(uint8_t cmd, uint8_t * data, size_t len) {
   #endif
 }
 
-#define _ps_mask(b)                           ((1 << (b))-1)
-
-#define _ps_setsplit16(v, b1, b2, s)          ({(b1) = (uint8_t)(((uint16_t)(v) >> (s)) & _ps_mask(16-(s))); (b2) = (uint8_t)((uint16_t)(v) & _ps_mask(s));})
-#define ps_setsplit16(v, n, s)                _ps_setsplit16((v), (n ## _U), (n ## _L), (s))
-#define ps_set16(v, b)                        _ps_setsplit16((v), (b)[0], (b)[1], 8)
-
-#define _ps_getsplit16(b1, b2, s)             ((((uint16_t)(b1) & _ps_mask(16-(s))) << (s)) | ((uint16_t)(b2) & _ps_mask(s)))
-#define ps_getsplit16(n, s)                   _ps_getsplit16((n ## _U), (n ## _L), (s))
-#define ps_get16(b)                           _ps_getsplit16((b)[0], (b)[1], 8)
-
-#define _ps_setsplit24(v, b1, b2, b3, sh, sl) ({(b1) = (uint8_t)(((uint32_t)(v) >> (sh)) & _ps_mask(24-(sh))); (b2) = (uint8_t)(((uint32_t)(v) >> (sl)) & _ps_mask((sh)-(sl))); (b3) = (uint8_t)((uint32_t)(v) & _ps_mask(sl));})
-#define ps_setsplit24(v, n, sh, sl)           _ps_setsplit24((v), (n ## _U), (n ## _M), (n ## _L), (sh), (sl))
-#define ps_set24(v, b)                        _ps_setsplit24((v), (b)[0], (b)[1], (b)[2], 16, 8)
-
-#define _ps_getsplit24(b1, b2, b3, sh, sl)    ((((uint32_t)(b1) & _ps_mask(24-(sh))) << (sh)) | (((uint32_t)(b2) & _ps_mask((sh)-(sl))) << (sl)) | ((uint32_t)(b3) & _ps_mask(sl)))
-#define ps_getsplit24(n, sh, sl)              _ps_getsplit24((n ## _U), (n ## _M), (n ## _L), (sh), (sl))
-#define ps_get24(b)                           _ps_getsplit24((b)[0], (b)[1], (b)[2], 16, 8)
-
 #define ps_xferreg(cmdname, cmd, reg)    ps_xfer((cmdname), (cmd), (uint8_t *)&(reg), sizeof(reg))
 
 #ifdef PS_DEBUG
@@ -117,14 +183,14 @@ void ps_print(const ps_stepmode_reg * r) {
 void ps_print(const ps_minspeed_reg * r) {
   Serial.println("Min Speed:");
   Serial.print("Lowspeed Optim: "); Serial.println(r->lspd_opt, BIN);
-  Serial.print("Min Speed: "); Serial.println(ps_getsplit16(r->min_speed, 8), BIN);
+  Serial.print("Min Speed: "); Serial.println(ps_get16((const uint8_t *)r) & MINSPEED_MASK, BIN);
   Serial.println();
 }
 
 void ps_print(const ps_fsspd_reg * r) {
   Serial.println("Full Speed:");
   Serial.print("Boost Mode: "); Serial.println(r->boost_mode, BIN);
-  Serial.print("FullStep Speed: "); Serial.println(ps_getsplit16(r->fs_spd, 8), BIN);
+  Serial.print("FullStep Speed: "); Serial.println(ps_get16((const uint8_t *)r) & FSSPD_MASK, BIN);
   Serial.println();
 }
 
@@ -186,14 +252,132 @@ void ps_print(const char * name, uint8_t data) {
 }
 #else
 
-#define ps_xfer(cmdname, cmd, data, len)   _ps_xfer(cmd, data, len)
+#define ps_xfer(cmdname, cmd, data, len)   ((void)(cmdname), _ps_xfer(cmd, data, len))
 #define ps_print(...)
 
 #endif
 
+// Shadow copy of the static PARAM registers, the rest change under us
+#define PS_VOLATILE     ((1UL << PARAM_ABSPOS) | (1UL << PARAM_ELPOS) | (1UL << PARAM_MARK) | (1UL << PARAM_SPEED) | (1UL << PARAM_ADCOUT) | (1UL << PARAM_STATUS))
+#define PS_REGLEN       (3)
+
+#define ps_isstatic(param)  (((param) & ~MASK_PARAM) == 0 && !(PS_VOLATILE & (1UL << (param))))
+
+typedef struct {
+  uint8_t reg[MASK_PARAM + 1][PS_REGLEN];
+  uint8_t len[MASK_PARAM + 1];
+  uint32_t valid;
+  uint32_t dirty;
+  uint32_t written;     // Sent since the last status read, the chip may have refused them
+  bool uvlo;            // Latched UVLO already seen
+} ps_shadow;
+
+static ps_shadow _ps_shadow[PS_MAXDEVICES] = {};
+static uint8_t _ps_defer = 0;      // Bitmask of devices holding writes until ps_commit()
+
+static void _ps_invalidate(uint8_t device) {
+  // Deferred writes still go out on ps_commit(), keep their values
+  ps_shadow * sh = &_ps_shadow[device];
+  sh->valid = sh->dirty;
+  sh->written = 0;
+}
+
+void _ps_getparam(const char * cmdname, uint8_t param, uint8_t * data, size_t len) {
+  ps_locked();
+  ps_shadow * sh = &_ps_shadow[_ps_dev];
+  bool shadowed = ps_isstatic(param) && len <= PS_REGLEN;
+  if (shadowed && (sh->valid & ~sh->written & (1UL << param)) && sh->len[param] == len) {
+    memcpy(data, sh->reg[param], len);
+    return;
+  }
+
+  ps_xfer(cmdname, CMD_GETPARAM(param), data, len);
+  if (shadowed) {
+    // A read back is what the chip holds, refused write or not
+    memcpy(sh->reg[param], data, len);
+    sh->len[param] = len;
+    sh->valid |= (1UL << param);
+    sh->written &= ~(1UL << param);
+  }
+}
+
+void _ps_setparam(const char * cmdname, uint8_t param, uint8_t * data, size_t len) {
+  ps_locked();
+  ps_shadow * sh = &_ps_shadow[_ps_dev];
+  if (ps_isstatic(param) && len <= PS_REGLEN) {
+    uint32_t bit = 1UL << param;
+
+    // Skip the write if the chip already holds this value
+    if ((sh->valid & ~sh->dirty & ~sh->written & bit) && sh->len[param] == len && memcmp(sh->reg[param], data, len) == 0) return;
+
+    memcpy(sh->reg[param], data, len);
+    sh->len[param] = len;
+    sh->valid |= bit;
+    if (_ps_defer & (1 << _ps_dev)) {
+      sh->dirty |= bit;
+      return;
+    }
+    sh->written |= bit;
+  }
+  ps_xfer(cmdname, CMD_SETPARAM(param), data, len);
+}
+
+#define ps_getparam(cmdname, param, data, len)  _ps_getparam((cmdname), (param), (uint8_t *)(data), (len))
+#define ps_setparam(cmdname, param, data, len)  _ps_setparam((cmdname), (param), (uint8_t *)(data), (len))
+#define ps_getreg(cmdname, param, reg)          ps_getparam((cmdname), (param), &(reg), sizeof(reg))
+#define ps_setreg(cmdname, param, reg)          ps_setparam((cmdname), (param), &(reg), sizeof(reg))
+
+void ps_defer() {
+  _ps_defer |= (1 << _ps_dev);
+}
+
+void ps_commit() {
+  ps_locked();
+  ps_shadow * sh = &_ps_shadow[_ps_dev];
+  _ps_defer &= ~(1 << _ps_dev);
+  for (uint8_t param = 0; param <= MASK_PARAM; param++) {
+    if (!(sh->dirty & (1UL << param))) continue;
+    uint8_t buf[PS_REGLEN] = {};
+    memcpy(buf, sh->reg[param], sh->len[param]);
+    ps_xfer("setparam commit", CMD_SETPARAM(param), buf, sh->len[param]);
+  }
+  sh->written |= sh->dirty;
+  sh->dirty = 0;
+}
+
+void ps_select(uint8_t device) {
+  if (device < _ps_devices) _ps_dev = device;
+}
+
+uint8_t ps_selected() {
+  return _ps_dev;
+}
+
+uint8_t ps_devices() {
+  return _ps_devices;
+}
+
+void ps_syncbegin() {
+  ps_lock();
+  _ps_syncing = _ps_devices > 1;
+}
+
+void ps_syncend() {
+  _ps_flush();
+  _ps_syncing = false;
+  ps_unlock();
+}
+
 
-void ps_spiinit() {
+void ps_spiinit(uint8_t devices) {
+  if (_ps_mutex == NULL) _ps_mutex = xSemaphoreCreateRecursiveMutex();
+  _ps_devices = constrain(devices, 1, PS_MAXDEVICES);
+  _ps_dev = 0;
   SPI.begin();
+  SPI.setFrequency(PS_SPI_FREQ);
+  SPI.setDataMode(PS_SPI_MODE);
+  SPI.setBitOrder(MSBFIRST);
+  _ps_csgap = (ESP.getCpuFreqMHz() * PS_CSGAP_NS) / 1000 + 1;
 
   pinMode(PS_PIN_RST, OUTPUT);
   pinMode(PS_PIN_CS, OUTPUT);
@@ -201,13 +385,21 @@ void ps_spiinit() {
   digitalWrite(PS_PIN_RST, LOW);
   digitalWrite(PS_PIN_RST, HIGH);
   digitalWrite(PS_PIN_CS, HIGH);
+  memset(_ps_shadow, 0, sizeof(_ps_shadow));
+  _ps_defer = 0;
 }
 
-ps_status ps_getstatus(bool clear_errors) {
-  ps_status_reg reg = {};
-  if (clear_errors)   ps_xferreg("getstatus", CMD_GETSTATUS(), reg);
-  else                ps_xferreg("getparam status", CMD_GETPARAM(PARAM_STATUS), reg);
-  ps_print(&reg);
+static ps_status _ps_decodestatus(uint8_t device, const ps_status_reg& reg) {
+  ps_shadow * sh = &_ps_shadow[device];
+
+  // Undervoltage lockout means the chip reset. The flag stays latched until GETSTATUS, only act on it once.
+  if (!reg.uvlo && !sh->uvlo) _ps_invalidate(device);
+  sh->uvlo = !reg.uvlo;
+
+  // A command error may be a refused write, drop whatever went out since the last status
+  if (reg.cmd_error) sh->valid &= ~sh->written;
+  sh->written = 0;
+
   return (ps_status){
     .direction = (ps_direction)reg.dir,
     .movement = (ps_movement)reg.mot_status,
@@ -216,11 +408,11 @@ ps_status ps_getstatus(bool clear_errors) {
     .user_switch = (bool)reg.sw_f,
     .step_clock = (bool)reg.stck_mod,
     .alarms = {
-      .command_error = reg.cmd_error,
+      .command_error = (bool)reg.cmd_error,
       .overcurrent = !reg.ocd,
       .undervoltage = !reg.uvlo,
       .thermal_shutdown = reg.th_status == TH_BRIDGESHUTDOWN || reg.th_status == TH_DEVICESHUTDOWN,
-      .user_switch = reg.sw_evn,
+      .user_switch = (bool)reg.sw_evn,
       .thermal_warning = reg.th_status == TH_WARNING,
       .stall_detect = !reg.stall_a || !reg.stall_b,
       .adc_undervoltage = !reg.uvlo_adc
@@ -228,9 +420,17 @@ ps_status ps_getstatus(bool clear_errors) {
   };
 }
 
+ps_status ps_getstatus(bool clear_errors) {
+  ps_status_reg reg = {};
+  if (clear_errors)   ps_xferreg("getstatus", CMD_GETSTATUS(), reg);
+  else                ps_getreg("getparam status", PARAM_STATUS, reg);
+  ps_print(&reg);
+  return _ps_decodestatus(_ps_dev, reg);
+}
+
 bool ps_isbusy() {
   ps_status_reg reg = {};
-  ps_xferreg("getparam status", CMD_GETPARAM(PARAM_STATUS), reg);
+  ps_getreg("getparam status", PARAM_STATUS, reg);
   return !reg.busy;
 }
 
@@ -238,7 +438,7 @@ void ps_waitbusy(ps_waitcb waitf) {
   ps_status_reg reg = {};
   while (true) {
     memset(&reg, 0, sizeof(reg));
-    ps_xferreg("getparam status", CMD_GETPARAM(PARAM_STATUS), reg);
+    ps_getreg("getparam status", PARAM_STATUS, reg);
     if (reg.busy) return;
     if (waitf != NULL) waitf();
   }
@@ -246,18 +446,19 @@ void ps_waitbusy(ps_waitcb waitf) {
 
 bool ps_isrunning() {
   ps_status_reg reg = {};
-  ps_xferreg("getparam status", CMD_GETPARAM(PARAM_STATUS), reg);
+  ps_getreg("getparam status", PARAM_STATUS, reg);
   return reg.mot_status != M_STOPPED;
 }
 
 bool ps_ishiz() {
   ps_status_reg reg = {};
-  ps_xferreg("getparam status", CMD_GETPARAM(PARAM_STATUS), reg);
+  ps_getreg("getparam status", PARAM_STATUS, reg);
   return reg.hiz? true : false;
 }
 
 void ps_reset() {
   ps_xfer("resetdevice", CMD_RESETDEVICE(), NULL, 0);
+  _ps_invalidate(_ps_dev);
 }
 
 void ps_nop() {
@@ -266,33 +467,33 @@ void ps_nop() {
 
 ps_mode ps_getmode() {
   ps_stepmode_reg reg = {};
-  ps_xferreg("getparam stepmode", CMD_GETPARAM(PARAM_STEPMODE), reg);
+  ps_getreg("getparam stepmode", PARAM_STEPMODE, reg);
   return (ps_mode)reg.cm_vm;
 }
 
 void ps_setmode(ps_mode mode) {
   ps_stepmode_reg reg = {};
-  ps_xferreg("getparam stepmode", CMD_GETPARAM(PARAM_STEPMODE), reg);
+  ps_getreg("getparam stepmode", PARAM_STEPMODE, reg);
   reg.cm_vm = mode;
-  ps_xferreg("setparam stepmode", CMD_SETPARAM(PARAM_STEPMODE), reg);
+  ps_setreg("setparam stepmode", PARAM_STEPMODE, reg);
 }
 
 ps_stepsize ps_getstepsize() {
   ps_stepmode_reg reg = {};
-  ps_xferreg("getparam stepmode", CMD_GETPARAM(PARAM_STEPMODE), reg);
+  ps_getreg("getparam stepmode", PARAM_STEPMODE, reg);
   return (ps_stepsize)reg.step_sel;
 }
 
 void ps_setstepsize(ps_stepsize stepsize) {
   ps_stepmode_reg reg = {};
-  ps_xferreg("getparam stepmode", CMD_GETPARAM(PARAM_STEPMODE), reg);
+  ps_getreg("getparam stepmode", PARAM_STEPMODE, reg);
   reg.step_sel = stepsize;
-  ps_xferreg("setparam stepmode", CMD_SETPARAM(PARAM_STEPMODE), reg);
+  ps_setreg("setparam stepmode", PARAM_STEPMODE, reg);
 }
 
 ps_syncinfo ps_getsync() {
   ps_stepmode_reg reg = {};
-  ps_xferreg("getparam stepmode", CMD_GETPARAM(PARAM_STEPMODE), reg);
+  ps_getreg("getparam stepmode", PARAM_STEPMODE, reg);
   ps_print(&reg);
   return (ps_syncinfo){
     .sync_mode = (ps_sync)reg.sync_en,
@@ -302,127 +503,122 @@ ps_syncinfo ps_getsync() {
 
 void ps_setsync(ps_sync sync, ps_stepsize stepsize) {
   ps_stepmode_reg reg = {};
-  ps_xferreg("getparam stepmode", CMD_GETPARAM(PARAM_STEPMODE), reg);
+  ps_getreg("getparam stepmode", PARAM_STEPMODE, reg);
   reg.sync_en = sync;
   reg.sync_sel = stepsize;
-  ps_xferreg("setparam stepmode", CMD_SETPARAM(PARAM_STEPMODE), reg);
+  ps_setreg("setparam stepmode", PARAM_STEPMODE, reg);
 }
 
 float ps_getmaxspeed() {
   uint8_t buf[2] = {};
-  ps_xfer("getparam maxspeed", CMD_GETPARAM(PARAM_MAXSPEED), buf, 2);
+  ps_getparam("getparam maxspeed", PARAM_MAXSPEED, buf, 2);
   uint16_t maxspeed = ps_get16(buf);
   ps_print("Max Speed", maxspeed);
-  return ((float)(maxspeed & MAXSPEED_MASK))/MAXSPEED_COEFF;
+  return ps_decode(PS_CODEC_MAXSPEED, maxspeed & MAXSPEED_MASK);
 }
 
 void ps_setmaxspeed(float steps_per_second) {
   uint8_t buf[2] = {};
-  uint16_t maxspeed = min((int)round(steps_per_second * MAXSPEED_COEFF), MAXSPEED_MASK);
-  ps_set16(maxspeed, buf);
-  ps_xfer("setparam maxspeed", CMD_SETPARAM(PARAM_MAXSPEED), buf, 2);
+  ps_set16(ps_encode(PS_CODEC_MAXSPEED, steps_per_second), buf);
+  ps_setparam("setparam maxspeed", PARAM_MAXSPEED, buf, 2);
 }
 
 ps_minspeed ps_getminspeed() {
   ps_minspeed_reg reg = {};
-  ps_xferreg("getparam minspeed", CMD_GETPARAM(PARAM_MINSPEED), reg);
+  ps_getreg("getparam minspeed", PARAM_MINSPEED, reg);
   ps_print(&reg);
   return (ps_minspeed){
-    .steps_per_sec = ((float)(ps_getsplit16(reg.min_speed, 8) & MINSPEED_MASK))/MINSPEED_COEFF,
+    .steps_per_sec = ps_decode(PS_CODEC_MINSPEED, ps_get16((uint8_t *)&reg) & MINSPEED_MASK),
     .lowspeed_optim = (bool)reg.lspd_opt
   };
 }
 
 void ps_setminspeed(float steps_per_second, bool lowspeed_optim) {
   ps_minspeed_reg reg = {};
-  uint16_t steps_per_sec = min((int)round(steps_per_second * MINSPEED_COEFF), MINSPEED_MASK);
-  ps_setsplit16(steps_per_second, reg.min_speed, 8);
-  reg.lspd_opt = lowspeed_optim? 0x1 : 0x0;
-  ps_xferreg("setparam minspeed", CMD_SETPARAM(PARAM_MINSPEED), reg);
+  uint16_t minspeed = ps_encode(PS_CODEC_MINSPEED, steps_per_second) | (lowspeed_optim? MINSPEED_LSPDOPT : 0);
+  ps_set16(minspeed, (uint8_t *)&reg);
+  ps_setreg("setparam minspeed", PARAM_MINSPEED, reg);
 }
 
 ps_fullstepspeed ps_getfullstepspeed() {
   ps_fsspd_reg reg = {};
-  ps_xferreg("getparam fsspd", CMD_GETPARAM(PARAM_FSSPD), reg);
+  ps_getreg("getparam fsspd", PARAM_FSSPD, reg);
   ps_print(&reg);
   return (ps_fullstepspeed){
-    .steps_per_sec = ((float)(ps_getsplit16(reg.fs_spd, 8) & FSSPD_MASK) + FSSPD_OFFSET)/FSSPD_COEFF,
+    .steps_per_sec = ps_decode(PS_CODEC_FSSPD, ps_get16((uint8_t *)&reg) & FSSPD_MASK),
     .boost_mode = (bool)reg.boost_mode
   };
 }
 
 void ps_setfullstepspeed(float steps_per_sec, bool boost_mode) {
   ps_fsspd_reg reg = {};
-  uint16_t fs_spd = min((int)round(steps_per_sec * FSSPD_COEFF - FSSPD_OFFSET), FSSPD_MASK);
-  ps_setsplit16(fs_spd, reg.fs_spd, 8);
-  reg.boost_mode = boost_mode? 0x1 : 0x0;
-  ps_xferreg("setparam fsspd", CMD_SETPARAM(PARAM_FSSPD), reg);
+  uint16_t fsspd = ps_encode(PS_CODEC_FSSPD, steps_per_sec) | (boost_mode? FSSPD_BOOST : 0);
+  ps_set16(fsspd, (uint8_t *)&reg);
+  ps_setreg("setparam fsspd", PARAM_FSSPD, reg);
 }
 
 float ps_getaccel() {
   uint8_t buf[2] = {};
-  ps_xfer("getparam acc", CMD_GETPARAM(PARAM_ACC), buf, 2);
+  ps_getparam("getparam acc", PARAM_ACC, buf, 2);
   uint16_t acc = ps_get16(buf);
   ps_print("Acc", acc);
-  return ((float)(acc & ACC_MASK))/ACC_COEFF;
+  return ps_decode(PS_CODEC_ACC, acc & ACC_MASK);
 }
 
 void ps_setaccel(float steps_per_sec_2) {
   uint8_t buf[2] = {};
-  uint16_t acc = min((int)round(steps_per_sec_2 * ACC_COEFF), ACC_MASK);
-  ps_set16(acc, buf);
-  ps_xfer("setparam acc", CMD_SETPARAM(PARAM_ACC), buf, 2);
+  ps_set16(ps_encode(PS_CODEC_ACC, steps_per_sec_2), buf);
+  ps_setparam("setparam acc", PARAM_ACC, buf, 2);
 }
 
 float ps_getdecel() {
   uint8_t buf[2] = {};
-  ps_xfer("getparam dec", CMD_GETPARAM(PARAM_DEC), buf, 2);
+  ps_getparam("getparam dec", PARAM_DEC, buf, 2);
   uint16_t dec = ps_get16(buf);
   ps_print("Dec", dec);
-  return ((float)(dec & DEC_MASK)) / DEC_COEFF;
+  return ps_decode(PS_CODEC_DEC, dec & DEC_MASK);
 }
 
 void ps_setdecel(float steps_per_sec_2) {
   uint8_t buf[2] = {};
-  uint16_t dec = min((int)round(steps_per_sec_2 * DEC_COEFF), DEC_MASK);
-  ps_set16(dec, buf);
-  ps_xfer("setparam dec", CMD_SETPARAM(PARAM_DEC), buf, 2);
+  ps_set16(ps_encode(PS_CODEC_DEC, steps_per_sec_2), buf);
+  ps_setparam("setparam dec", PARAM_DEC, buf, 2);
 }
 
 ps_slewrate ps_getslewrate() {
   ps_gatecfg1_reg reg = {};
-  ps_xferreg("getparam gatecfg1", CMD_GETPARAM(PARAM_GATECFG1), reg);
+  ps_getreg("getparam gatecfg1", PARAM_GATECFG1, reg);
   ps_print(&reg);
   return (ps_slewrate)reg.slew;
 }
 
 void ps_setslewrate(ps_slewrate slew) {
   ps_gatecfg1_reg reg = {};
-  ps_xferreg("getparam gatecfg1", CMD_GETPARAM(PARAM_GATECFG1), reg);
+  ps_getreg("getparam gatecfg1", PARAM_GATECFG1, reg);
   reg.slew = slew;
-  ps_xferreg("setparam gatecfg1", CMD_SETPARAM(PARAM_GATECFG1), reg);
+  ps_setreg("setparam gatecfg1", PARAM_GATECFG1, reg);
 }
 
 ps_ocd ps_getocd() {
   uint8_t ocdth = 0;
   ps_config_reg reg = {};
-  ps_xfer("getparam ocdth", CMD_GETPARAM(PARAM_OCDTH), &ocdth, 1);
-  ps_xferreg("getparam config", CMD_GETPARAM(PARAM_CONFIG), reg);
+  ps_getparam("getparam ocdth", PARAM_OCDTH, &ocdth, 1);
+  ps_getreg("getparam config", PARAM_CONFIG, reg);
   ps_print("OCD Th", ocdth);
   ps_print("OCD En", reg.com.oc_sd);
   return (ps_ocd){
-    .millivolts = ((float)(ocdth & OCDTH_MASK)) / OCDTH_COEFF,
-    .shutdown = reg.com.oc_sd
+    .millivolts = ps_decode(PS_CODEC_OCDTH, ocdth & OCDTH_MASK),
+    .shutdown = (bool)reg.com.oc_sd
   };
 }
 
 void ps_setocd(float millivolts, bool shutdown) {
-  uint8_t ocdth = min((int)round(millivolts * OCDTH_COEFF), OCDTH_MASK);
+  uint8_t ocdth = ps_encode(PS_CODEC_OCDTH, millivolts);
   ps_config_reg reg = {};
-  ps_xfer("setparam ocdth", CMD_SETPARAM(PARAM_OCDTH), &ocdth, 1);
-  ps_xferreg("getparam config", CMD_GETPARAM(PARAM_CONFIG), reg);
+  ps_setparam("setparam ocdth", PARAM_OCDTH, &ocdth, 1);
+  ps_getreg("getparam config", PARAM_CONFIG, reg);
   reg.com.oc_sd = shutdown? 0x1 : 0x0;
-  ps_xferreg("setparam config", CMD_SETPARAM(PARAM_CONFIG), reg);
+  ps_setreg("setparam config", PARAM_CONFIG, reg);
 }
 
 float ps_getclockfreq(ps_clocksel clock) {
@@ -450,30 +646,30 @@ float ps_getclockfreq(ps_clocksel clock) {
 
 ps_clocksel ps_getclocksel() {
   ps_config_reg reg = {};
-  ps_xferreg("getparam config", CMD_GETPARAM(PARAM_CONFIG), reg);
+  ps_getreg("getparam config", PARAM_CONFIG, reg);
   ps_print(&reg);
   return (ps_clocksel)reg.com.clk_sel;
 }
 
 void ps_setclocksel(const ps_clocksel clock) {
   ps_config_reg reg = {};
-  ps_xferreg("getparam config", CMD_GETPARAM(PARAM_CONFIG), reg);
+  ps_getreg("getparam config", PARAM_CONFIG, reg);
   reg.com.clk_sel = clock;
-  ps_xferreg("setparam config", CMD_SETPARAM(PARAM_CONFIG), reg);
+  ps_setreg("setparam config", PARAM_CONFIG, reg);
 }
 
 ps_swmode ps_getswmode() {
   ps_config_reg reg = {};
-  ps_xferreg("getparam config", CMD_GETPARAM(PARAM_CONFIG), reg);
+  ps_getreg("getparam config", PARAM_CONFIG, reg);
   ps_print(&reg);
   return (ps_swmode)reg.com.sw_mode;
 }
 
 void ps_setswmode(const ps_swmode swmode) {
   ps_config_reg reg = {};
-  ps_xferreg("getparam config", CMD_GETPARAM(PARAM_CONFIG), reg);
+  ps_getreg("getparam config", PARAM_CONFIG, reg);
   reg.com.sw_mode = swmode;
-  ps_xferreg("setparam config", CMD_SETPARAM(PARAM_CONFIG), reg);
+  ps_setreg("setparam config", PARAM_CONFIG, reg);
 }
 
 #define LEN_PWMFREQ_DIVS    8
@@ -481,19 +677,30 @@ void ps_setswmode(const ps_swmode swmode) {
 float pwmfreq_divs[LEN_PWMFREQ_DIVS] = {1, 2, 3, 4, 5, 6, 7, 7};
 float pwmfreq_muls[LEN_PWMFREQ_MULS] = {0.625, 0.75, 0.875, 1, 1.25, 1.5, 1.75, 2};
 
+// mul / div for every F_PWM_INT, F_PWM_DEC pair
+#define __PWMFREQ_RATIOS(d)   {0.625f/(d), 0.75f/(d), 0.875f/(d), 1.0f/(d), 1.25f/(d), 1.5f/(d), 1.75f/(d), 2.0f/(d)}
+static constexpr float pwmfreq_ratios[LEN_PWMFREQ_DIVS][LEN_PWMFREQ_MULS] = {
+  __PWMFREQ_RATIOS(1), __PWMFREQ_RATIOS(2), __PWMFREQ_RATIOS(3), __PWMFREQ_RATIOS(4),
+  __PWMFREQ_RATIOS(5), __PWMFREQ_RATIOS(6), __PWMFREQ_RATIOS(7), __PWMFREQ_RATIOS(7)
+};
+
 float ps_vm_coeffs2pwmfreq(ps_clocksel clock, ps_vm_pwmfreq * coeffs) {
   return (ps_getclockfreq(clock) * pwmfreq_muls[coeffs->mul]) / (512.0 * pwmfreq_divs[coeffs->div]);
 }
 
 ps_vm_pwmfreq ps_vm_pwmfreq2coeffs(ps_clocksel clock, float pwmfreq) {
   ps_vm_pwmfreq coeffs = {.div = 0, .mul = 0};
+  float clockfreq = ps_getclockfreq(clock);
+  if (clockfreq == 0) return coeffs;
+
+  // Search in ratio space, one scale up front instead of a divide per candidate
+  float target = pwmfreq * 512.0f / clockfreq;
   float best = FLT_MAX;
-  for (size_t d = 0; d < LEN_PWMFREQ_DIVS; d++) {
-    for (size_t m = 0; m < LEN_PWMFREQ_MULS; m++) {
-      ps_vm_pwmfreq check = {.div = d, .mul = m};
-      float result = abs(ps_vm_coeffs2pwmfreq(clock, &check) - pwmfreq);
+  for (uint8_t d = 0; d < LEN_PWMFREQ_DIVS; d++) {
+    for (uint8_t m = 0; m < LEN_PWMFREQ_MULS; m++) {
+      float result = fabsf(pwmfreq_ratios[d][m] - target);
       if (result < best) {
-        coeffs = check;
+        coeffs = (ps_vm_pwmfreq){.div = d, .mul = m};
         best = result;
       }
     }
@@ -503,7 +710,7 @@ ps_vm_pwmfreq ps_vm_pwmfreq2coeffs(ps_clocksel clock, float pwmfreq) {
 
 ps_vm_pwmfreq ps_vm_getpwmfreq() {
   ps_config_reg reg = {};
-  ps_xferreg("getparam config", CMD_GETPARAM(PARAM_CONFIG), reg);
+  ps_getreg("getparam config", PARAM_CONFIG, reg);
   ps_print(&reg);
   return (ps_vm_pwmfreq){
     .div = reg.vm.f_pwm_int,
@@ -513,25 +720,25 @@ ps_vm_pwmfreq ps_vm_getpwmfreq() {
 
 void ps_vm_setpwmfreq(ps_vm_pwmfreq * coeffs) {
   ps_config_reg reg = {};
-  ps_xferreg("getparam config", CMD_GETPARAM(PARAM_CONFIG), reg);
+  ps_getreg("getparam config", PARAM_CONFIG, reg);
   reg.vm.f_pwm_int = coeffs->div;
   reg.vm.f_pwm_dec = coeffs->mul;
-  ps_xferreg("setparam config", CMD_SETPARAM(PARAM_CONFIG), reg);
+  ps_setreg("setparam config", PARAM_CONFIG, reg);
 }
 
 ps_alarms ps_getalarmconfig() {
   ps_alarms_reg reg = {};
-  ps_xferreg("getparam alarmen", CMD_GETPARAM(PARAM_ALARMEN), reg);
+  ps_getreg("getparam alarmen", PARAM_ALARMEN, reg);
   ps_print(&reg);
   return (ps_alarms){
-    .command_error = reg.command_error,
-    .overcurrent = reg.overcurrent,
-    .undervoltage = reg.undervoltage,
-    .thermal_shutdown = reg.thermal_shutdown,
-    .user_switch = reg.user_switch,
-    .thermal_warning = reg.thermal_warning,
-    .stall_detect = reg.stall_detect,
-    .adc_undervoltage = reg.adc_undervoltage
+    .command_error = (bool)reg.command_error,
+    .overcurrent = (bool)reg.overcurrent,
+    .undervoltage = (bool)reg.undervoltage,
+    .thermal_shutdown = (bool)reg.thermal_shutdown,
+    .user_switch = (bool)reg.user_switch,
+    .thermal_warning = (bool)reg.thermal_warning,
+    .stall_detect = (bool)reg.stall_detect,
+    .adc_undervoltage = (bool)reg.adc_undervoltage
   };
 }
 
@@ -541,27 +748,27 @@ void ps_setalarmconfig(const ps_alarms * alarms) {
 
 void ps_setalarmconfig(bool command_error, bool overcurrent, bool undervoltage, bool thermal_shutdown, bool user_switch, bool thermal_warning, bool stall_detect, bool adc_undervoltage) {
   ps_alarms_reg reg = {
-    .overcurrent = overcurrent? 0x1 : 0x0,
-    .thermal_shutdown = thermal_shutdown? 0x1 : 0x0,
-    .thermal_warning = thermal_warning? 0x1 : 0x0,
-    .undervoltage = undervoltage? 0x1 : 0x0,
-    .adc_undervoltage = adc_undervoltage? 0x1 : 0x0,
-    .stall_detect = stall_detect? 0x1 : 0x0,
-    .user_switch = user_switch? 0x1 : 0x0,
-    .command_error = command_error? 0x1 : 0x0,
+    .overcurrent = (uint8_t)(overcurrent? 0x1 : 0x0),
+    .thermal_shutdown = (uint8_t)(thermal_shutdown? 0x1 : 0x0),
+    .thermal_warning = (uint8_t)(thermal_warning? 0x1 : 0x0),
+    .undervoltage = (uint8_t)(undervoltage? 0x1 : 0x0),
+    .adc_undervoltage = (uint8_t)(adc_undervoltage? 0x1 : 0x0),
+    .stall_detect = (uint8_t)(stall_detect? 0x1 : 0x0),
+    .user_switch = (uint8_t)(user_switch? 0x1 : 0x0),
+    .command_error = (uint8_t)(command_error? 0x1 : 0x0),
   };
-  ps_xferreg("setparam alarmen", CMD_SETPARAM(PARAM_ALARMEN), reg);
+  ps_setreg("setparam alarmen", PARAM_ALARMEN, reg);
 }
 
 ps_alarms ps_getalarms() {
   ps_status_reg reg = {};
-  ps_xferreg("getparam status", CMD_GETPARAM(PARAM_STATUS), reg);
+  ps_getreg("getparam status", PARAM_STATUS, reg);
   return (ps_alarms){
-    .command_error = reg.cmd_error,
+    .command_error = (bool)reg.cmd_error,
     .overcurrent = !reg.ocd,
     .undervoltage = !reg.uvlo,
     .thermal_shutdown = reg.th_status == TH_BRIDGESHUTDOWN || reg.th_status == TH_DEVICESHUTDOWN,
-    .user_switch = reg.sw_evn,
+    .user_switch = (bool)reg.sw_evn,
     .thermal_warning = reg.th_status == TH_WARNING,
     .stall_detect = !reg.stall_a || !reg.stall_b,
     .adc_undervoltage = !reg.uvlo_adc
@@ -570,156 +777,154 @@ ps_alarms ps_getalarms() {
 
 ps_ktvals ps_getktvals(ps_mode mode) {
   uint8_t kthold = 0, ktrun = 0, ktacc = 0, ktdec = 0;
-  ps_xfer("getparam ktvalhold", CMD_GETPARAM(PARAM_KTVALHOLD), &kthold, 1);
-  ps_xfer("getparam ktvalrun", CMD_GETPARAM(PARAM_KTVALRUN), &ktrun, 1);
-  ps_xfer("getparam ktvalacc", CMD_GETPARAM(PARAM_KTVALACC), &ktacc, 1);
-  ps_xfer("getparam ktvaldec", CMD_GETPARAM(PARAM_KTVALDEC), &ktdec, 1);
+  ps_getparam("getparam ktvalhold", PARAM_KTVALHOLD, &kthold, 1);
+  ps_getparam("getparam ktvalrun", PARAM_KTVALRUN, &ktrun, 1);
+  ps_getparam("getparam ktvalacc", PARAM_KTVALACC, &ktacc, 1);
+  ps_getparam("getparam ktvaldec", PARAM_KTVALDEC, &ktdec, 1);
+  float scale = mode == MODE_VOLTAGE? 1.0f : 2.0f;
   return (ps_ktvals){
-    .hold = (float)kthold * KTVALS_COEFF * (mode == MODE_VOLTAGE? 1.0 : 2.0),
-    .run = (float)ktrun * KTVALS_COEFF * (mode == MODE_VOLTAGE? 1.0 : 2.0),
-    .accel = (float)ktacc * KTVALS_COEFF * (mode == MODE_VOLTAGE? 1.0 : 2.0),
-    .decel = (float)ktdec * KTVALS_COEFF * (mode == MODE_VOLTAGE? 1.0 : 2.0)
+    .hold = ps_decode(PS_CODEC_KTVAL, kthold) * scale,
+    .run = ps_decode(PS_CODEC_KTVAL, ktrun) * scale,
+    .accel = ps_decode(PS_CODEC_KTVAL, ktacc) * scale,
+    .decel = ps_decode(PS_CODEC_KTVAL, ktdec) * scale
   };
 }
 
 void ps_setktvals(ps_mode mode, float hold, float run, float accel, float decel) {
-  uint8_t kthold = (uint8_t)(round(constrain(hold, 0.0, 1.0) * (1.0 / KTVALS_COEFF) * (mode == MODE_VOLTAGE? 1.0 : 0.5)));
-  uint8_t ktrun = (uint8_t)(round(constrain(run, 0.0, 1.0) * (1.0 / KTVALS_COEFF) * (mode == MODE_VOLTAGE? 1.0 : 0.5)));
-  uint8_t ktacc = (uint8_t)(round(constrain(accel, 0.0, 1.0) * (1.0 / KTVALS_COEFF) * (mode == MODE_VOLTAGE? 1.0 : 0.5)));
-  uint8_t ktdec = (uint8_t)(round(constrain(decel, 0.0, 1.0) * (1.0 / KTVALS_COEFF) * (mode == MODE_VOLTAGE? 1.0 : 0.5)));
-  ps_xfer("setparam ktvalhold", CMD_SETPARAM(PARAM_KTVALHOLD), &kthold, 1);
-  ps_xfer("setparam ktvalrun", CMD_SETPARAM(PARAM_KTVALRUN), &ktrun, 1);
-  ps_xfer("setparam ktvalacc", CMD_SETPARAM(PARAM_KTVALACC), &ktacc, 1);
-  ps_xfer("setparam ktvaldec", CMD_SETPARAM(PARAM_KTVALDEC), &ktdec, 1);
+  // Current mode full scale is half the register range
+  float scale = mode == MODE_VOLTAGE? 1.0f : 0.5f;
+  uint8_t kthold = ps_encode(PS_CODEC_KTVAL, constrain(hold, 0.0f, 1.0f) * scale);
+  uint8_t ktrun = ps_encode(PS_CODEC_KTVAL, constrain(run, 0.0f, 1.0f) * scale);
+  uint8_t ktacc = ps_encode(PS_CODEC_KTVAL, constrain(accel, 0.0f, 1.0f) * scale);
+  uint8_t ktdec = ps_encode(PS_CODEC_KTVAL, constrain(decel, 0.0f, 1.0f) * scale);
+  ps_setparam("setparam ktvalhold", PARAM_KTVALHOLD, &kthold, 1);
+  ps_setparam("setparam ktvalrun", PARAM_KTVALRUN, &ktrun, 1);
+  ps_setparam("setparam ktvalacc", PARAM_KTVALACC, &ktacc, 1);
+  ps_setparam("setparam ktvaldec", PARAM_KTVALDEC, &ktdec, 1);
 }
 
 ps_vm_bemf ps_vm_getbemf() {
   uint8_t buf[2] = {};
   uint8_t stslp = 0, fnslpacc = 0, fnslpdec = 0;
-  ps_xfer("getparam stslp", CMD_GETPARAM(PARAM_STSLP), &stslp, 1);
-  ps_xfer("getparam intspeed", CMD_GETPARAM(PARAM_INTSPEED), buf, 2);
-  ps_xfer("getparam fnslpacc", CMD_GETPARAM(PARAM_FNSLPACC), &fnslpacc, 1);
-  ps_xfer("getparam fnslpdec", CMD_GETPARAM(PARAM_FNSLPDEC), &fnslpdec, 1);
+  ps_getparam("getparam stslp", PARAM_STSLP, &stslp, 1);
+  ps_getparam("getparam intspeed", PARAM_INTSPEED, buf, 2);
+  ps_getparam("getparam fnslpacc", PARAM_FNSLPACC, &fnslpacc, 1);
+  ps_getparam("getparam fnslpdec", PARAM_FNSLPDEC, &fnslpdec, 1);
   uint16_t intspeed = ps_get16(buf);
   return (ps_vm_bemf){
-    .slopel = ((float)stslp) * BEMFSLOPE_COEFF,
-    .speedco = ((float)(intspeed & BEMFSPEEDCO_MASK)) * BEMFSPEEDCO_COEFF,
-    .slopehacc = ((float)fnslpacc) * BEMFSLOPE_COEFF,
-    .slopehdec = ((float)fnslpdec) * BEMFSLOPE_COEFF
+    .slopel = ps_decode(PS_CODEC_BEMFSLOPE, stslp),
+    .speedco = ps_decode(PS_CODEC_BEMFSPEEDCO, intspeed & BEMFSPEEDCO_MASK),
+    .slopehacc = ps_decode(PS_CODEC_BEMFSLOPE, fnslpacc),
+    .slopehdec = ps_decode(PS_CODEC_BEMFSLOPE, fnslpdec)
   };
 }
 
 void ps_vm_setbemf(float slopel, float speedco, float slopehacc, float slopehdec) {
   uint8_t buf[2] = {};
-  uint8_t stslp = min((int)round(slopel / BEMFSLOPE_COEFF), BEMFSLOPE_MASK);
-  uint16_t intspeed = min((int)round(speedco / BEMFSPEEDCO_COEFF), BEMFSPEEDCO_MASK);
-  uint8_t fnslpacc = min((int)round(slopehacc / BEMFSLOPE_COEFF), BEMFSLOPE_MASK);
-  uint8_t fnslpdec = min((int)round(slopehdec / BEMFSLOPE_COEFF), BEMFSLOPE_MASK);
+  uint8_t stslp = ps_encode(PS_CODEC_BEMFSLOPE, slopel);
+  uint16_t intspeed = ps_encode(PS_CODEC_BEMFSPEEDCO, speedco);
+  uint8_t fnslpacc = ps_encode(PS_CODEC_BEMFSLOPE, slopehacc);
+  uint8_t fnslpdec = ps_encode(PS_CODEC_BEMFSLOPE, slopehdec);
   ps_set16(intspeed, buf);
-  ps_xfer("setparam stslp", CMD_SETPARAM(PARAM_STSLP), &stslp, 1);
-  ps_xfer("setparam intspeed", CMD_SETPARAM(PARAM_INTSPEED), buf, 2);
-  ps_xfer("setparam fnslpacc", CMD_SETPARAM(PARAM_FNSLPACC), &fnslpacc, 1);
-  ps_xfer("setparam fnslpdec", CMD_SETPARAM(PARAM_FNSLPDEC), &fnslpdec, 1);
+  ps_setparam("setparam stslp", PARAM_STSLP, &stslp, 1);
+  ps_setparam("setparam intspeed", PARAM_INTSPEED, buf, 2);
+  ps_setparam("setparam fnslpacc", PARAM_FNSLPACC, &fnslpacc, 1);
+  ps_setparam("setparam fnslpdec", PARAM_FNSLPDEC, &fnslpdec, 1);
 }
 
 float ps_vm_getstall() {
   uint8_t stallth = 0;
-  ps_xfer("getparam stallth", CMD_GETPARAM(PARAM_STALLTH), &stallth, 1);
-  return ((float)(stallth & STALL_MASK) * STALL_COEFF) + STALL_OFFSET;
+  ps_getparam("getparam stallth", PARAM_STALLTH, &stallth, 1);
+  return ps_decode(PS_CODEC_STALL, stallth & STALL_MASK);
 }
 
 void ps_vm_setstall(float millivolts) {
-  if (millivolts < STALL_OFFSET) millivolts = STALL_OFFSET;
-  uint8_t stallth = min((int)round((millivolts - STALL_OFFSET) / STALL_COEFF), STALL_MASK);
-  ps_xfer("setparam stallth", CMD_SETPARAM(PARAM_STALLTH), &stallth, 1);
+  uint8_t stallth = ps_encode(PS_CODEC_STALL, millivolts);
+  ps_setparam("setparam stallth", PARAM_STALLTH, &stallth, 1);
 }
 
 bool ps_vm_getvscomp() {
   ps_config_reg reg = {};
-  ps_xferreg("getparam config", CMD_GETPARAM(PARAM_CONFIG), reg);
+  ps_getreg("getparam config", PARAM_CONFIG, reg);
   return (bool)reg.vm.en_vscomp;
 }
 
 void ps_vm_setvscomp(bool voltage_compensation) {
   ps_config_reg reg = {};
-  ps_xferreg("getparam config", CMD_GETPARAM(PARAM_CONFIG), reg);
+  ps_getreg("getparam config", PARAM_CONFIG, reg);
   reg.vm.en_vscomp = voltage_compensation? 0x1 : 0x0;
-  ps_xferreg("setparam config", CMD_SETPARAM(PARAM_CONFIG), reg);
+  ps_setreg("setparam config", PARAM_CONFIG, reg);
 }
 
 ps_cm_ctrltimes ps_cm_getctrltimes() {
   uint8_t tonmin = 0, toffmin = 0;
   ps_tfast_reg reg = {};
-  ps_xfer("getparam tonmin", CMD_GETPARAM(PARAM_TONMIN), &tonmin, 1);
-  ps_xfer("getparam toffmin", CMD_GETPARAM(PARAM_TOFFMIN), &toffmin, 1);
-  ps_xferreg("getparam tfast", CMD_GETPARAM(PARAM_TFAST), reg);
+  ps_getparam("getparam tonmin", PARAM_TONMIN, &tonmin, 1);
+  ps_getparam("getparam toffmin", PARAM_TOFFMIN, &toffmin, 1);
+  ps_getreg("getparam tfast", PARAM_TFAST, reg);
   ps_print(&reg);
   return (ps_cm_ctrltimes){
-    .min_on_us = ((float)(tonmin & MINCTRL_MASK) * MINCTRL_COEFF) + MINCTRL_OFFSET,
-    .min_off_us = ((float)(toffmin & MINCTRL_MASK) * MINCTRL_COEFF) + MINCTRL_OFFSET,
-    .fast_off_us = ((float)(reg.toff_fast & TFAST_MASK) * TFAST_COEFF) + TFAST_OFFSET,
-    .fast_step_us = ((float)(reg.fast_step & TFAST_MASK) * TFAST_COEFF) + TFAST_OFFSET
+    .min_on_us = ps_decode(PS_CODEC_MINCTRL, tonmin & MINCTRL_MASK),
+    .min_off_us = ps_decode(PS_CODEC_MINCTRL, toffmin & MINCTRL_MASK),
+    .fast_off_us = ps_decode(PS_CODEC_TFAST, reg.toff_fast & TFAST_MASK),
+    .fast_step_us = ps_decode(PS_CODEC_TFAST, reg.fast_step & TFAST_MASK)
   };
 }
 
 void ps_cm_setctrltimes(float min_on_us, float min_off_us, float fast_off_us, float fast_step_us) {
-  if (min_on_us < MINCTRL_OFFSET) min_on_us = MINCTRL_OFFSET;
-  if (min_off_us < MINCTRL_OFFSET) min_off_us = MINCTRL_OFFSET;
-  if (fast_off_us < TFAST_OFFSET) fast_off_us = TFAST_OFFSET;
-  if (fast_step_us < TFAST_OFFSET) fast_step_us = TFAST_OFFSET;
   ps_tfast_reg reg = {};
-  uint8_t tonmin = min((int)round((min_on_us - MINCTRL_OFFSET) / MINCTRL_COEFF), MINCTRL_MASK);
-  uint8_t toffmin = min((int)round((min_off_us - MINCTRL_OFFSET) / MINCTRL_COEFF), MINCTRL_MASK);
-  reg.toff_fast = min((int)round((fast_off_us - TFAST_OFFSET) / TFAST_COEFF), TFAST_MASK);
-  reg.fast_step = min((int)round((fast_step_us - TFAST_OFFSET) / TFAST_COEFF), TFAST_MASK);
-  ps_xfer("setparam tonmin", CMD_SETPARAM(PARAM_TONMIN), &tonmin, 1);
-  ps_xfer("setparam toffmin", CMD_SETPARAM(PARAM_TOFFMIN), &toffmin, 1);
-  ps_xferreg("setparam tfast", CMD_SETPARAM(PARAM_TFAST), reg);
+  uint8_t tonmin = ps_encode(PS_CODEC_MINCTRL, min_on_us);
+  uint8_t toffmin = ps_encode(PS_CODEC_MINCTRL, min_off_us);
+  reg.toff_fast = ps_encode(PS_CODEC_TFAST, fast_off_us);
+  reg.fast_step = ps_encode(PS_CODEC_TFAST, fast_step_us);
+  ps_setparam("setparam tonmin", PARAM_TONMIN, &tonmin, 1);
+  ps_setparam("setparam toffmin", PARAM_TOFFMIN, &toffmin, 1);
+  ps_setreg("setparam tfast", PARAM_TFAST, reg);
 }
 
 bool ps_cm_getpredict() {
   ps_config_reg reg = {};
-  ps_xferreg("getparam config", CMD_GETPARAM(PARAM_CONFIG), reg);
+  ps_getreg("getparam config", PARAM_CONFIG, reg);
   return (bool)reg.cm.pred_en;
 }
 
 void ps_cm_setpredict(bool enable_predict) {
   ps_config_reg reg = {};
-  ps_xferreg("getparam config", CMD_GETPARAM(PARAM_CONFIG), reg);
+  ps_getreg("getparam config", PARAM_CONFIG, reg);
   reg.cm.pred_en = enable_predict? 0x1 : 0x0;
-  ps_xferreg("setparam config", CMD_SETPARAM(PARAM_CONFIG), reg);
+  ps_setreg("setparam config", PARAM_CONFIG, reg);
 }
 
 float ps_cm_getswitchperiod() {
   ps_config_reg reg = {};
-  ps_xferreg("getparam config", CMD_GETPARAM(PARAM_CONFIG), reg);
-  return (float)reg.cm.tsw / CM_TSW_COEFF;
+  ps_getreg("getparam config", PARAM_CONFIG, reg);
+  return ps_decode(PS_CODEC_TSW, reg.cm.tsw);
 }
 
 void ps_cm_setswitchperiod(float period_us) {
   ps_config_reg reg = {};
-  uint8_t tsw = min((int)round(period_us * CM_TSW_COEFF), CM_TSW_MASK);
-  ps_xferreg("getparam config", CMD_GETPARAM(PARAM_CONFIG), reg);
+  uint8_t tsw = ps_encode(PS_CODEC_TSW, period_us);
+  ps_getreg("getparam config", PARAM_CONFIG, reg);
   reg.cm.tsw = tsw;
-  ps_xferreg("setparam config", CMD_SETPARAM(PARAM_CONFIG), reg);
+  ps_setreg("setparam config", PARAM_CONFIG, reg);
 }
 
 bool ps_cm_gettqreg() {
   ps_config_reg reg = {};
-  ps_xferreg("getparam config", CMD_GETPARAM(PARAM_CONFIG), reg);
+  ps_getreg("getparam config", PARAM_CONFIG, reg);
   return (bool)reg.cm.en_tqreg;
 }
 
 void ps_cm_settqreg(bool current_from_adc) {
   ps_config_reg reg = {};
-  ps_xferreg("getparam config", CMD_GETPARAM(PARAM_CONFIG), reg);
+  ps_getreg("getparam config", PARAM_CONFIG, reg);
   reg.cm.en_tqreg = current_from_adc? 0x1 : 0x0;
-  ps_xferreg("setparam config", CMD_SETPARAM(PARAM_CONFIG), reg);
+  ps_setreg("setparam config", PARAM_CONFIG, reg);
 }
 
 int ps_readadc() {
   uint8_t adc = 0;
-  ps_xfer("getparam adcout", CMD_GETPARAM(PARAM_ADCOUT), &adc, 1);
+  ps_getparam("getparam adcout", PARAM_ADCOUT, &adc, 1);
   ps_print("Adc", adc);
   return (int)adc;
 }
@@ -757,14 +962,14 @@ static inline int32_t ps_xferpos(int32_t pos, uint8_t * buf) {
 
 int32_t ps_getpos() {
   uint8_t buf[3] = {};
-  ps_xfer("getparam abspos", CMD_GETPARAM(PARAM_ABSPOS), buf, 3);
+  ps_getparam("getparam abspos", PARAM_ABSPOS, buf, 3);
   return ps_xferpos(0, buf);
 }
 
 void ps_setpos(int32_t pos) {
   uint8_t buf[3] = {};
   ps_xferpos(pos, buf);
-  ps_xfer("setparam abspos", CMD_SETPARAM(PARAM_ABSPOS), buf, 3);
+  ps_setparam("setparam abspos", PARAM_ABSPOS, buf, 3);
 }
 
 void ps_resetpos() {
@@ -777,14 +982,14 @@ void ps_gohome() {
 
 int32_t ps_getmark() {
   uint8_t buf[3] = {};
-  ps_xfer("getparam mark", CMD_GETPARAM(PARAM_MARK), buf, 3);
+  ps_getparam("getparam mark", PARAM_MARK, buf, 3);
   return ps_xferpos(0, buf);
 }
 
 void ps_setmark(int32_t mark) {
   uint8_t buf[3] = {};
   ps_xferpos(mark, buf);
-  ps_xfer("setparam mark", CMD_SETPARAM(PARAM_MARK), buf, 3);
+  ps_setparam("setparam mark", PARAM_MARK, buf, 3);
 }
 
 void ps_gomark() {
@@ -805,14 +1010,13 @@ void ps_goto(int32_t pos, ps_direction dir) {
 
 float ps_getspeed() {
   uint8_t buf[3] = {};
-  ps_xfer("getparam speed", CMD_GETPARAM(PARAM_SPEED), buf, 3);
-  return (float)ps_get24(buf) * SPEED_COEFF;
+  ps_getparam("getparam speed", PARAM_SPEED, buf, 3);
+  return ps_decode(PS_CODEC_SPEED, ps_get24(buf) & SPEED_MASK);
 }
 
 void ps_run(ps_direction dir, float stepss) {
-  uint32_t spd = (uint32_t)round(constrain(stepss, 0.0, SPEED_MAX) / SPEED_COEFF);
   uint8_t buf[3] = {};
-  ps_set24(spd, buf);
+  ps_set24(ps_encode(PS_CODEC_SPEED, stepss), buf);
   ps_xfer("run", CMD_RUN(dir), buf, 3);
 }
 
@@ -821,12 +1025,105 @@ void ps_stepclock(ps_direction dir) {
 }
 
 void ps_gountil(ps_posact act, ps_direction dir, float speed) {
-  uint32_t spd = (uint32_t)round(constrain(speed, 0.0, SPEED_MAX) / SPEED_COEFF);
   uint8_t buf[3] = {};
-  ps_set24(spd, buf);
+  ps_set24(ps_encode(PS_CODEC_SPEED, speed), buf);
   ps_xfer("gountil", CMD_GOUNTIL(act, dir), buf, 3);
 }
 
 void ps_releasesw(ps_posact act, ps_direction dir) {
   ps_xfer("releasesw", CMD_RELEASESW(act, dir), NULL, 0);
 }
+
+static void _ps_readdevices(uint8_t mask, uint8_t param, uint8_t * data, size_t len) {
+  // Every device in mask reads the same register in the same frames, the rest get NOPs
+  ps_xferop ops[PS_MAXDEVICES] = {};
+  for (uint8_t d = 0; d < _ps_devices; d++) {
+    if (mask & (1 << d)) ops[d] = { .cmd = (uint8_t)CMD_GETPARAM(param), .data = &data[d * len], .len = len };
+  }
+  _ps_xferdevices(ops);
+}
+
+static void _ps_snapshot(uint8_t mask, ps_snapshot * snaps, bool withmark) {
+  ps_locked();
+  _ps_flush();
+
+  ps_status_reg status[PS_MAXDEVICES] = {};
+  uint8_t speed[PS_MAXDEVICES][3] = {}, abspos[PS_MAXDEVICES][3] = {}, mark[PS_MAXDEVICES][3] = {}, adc[PS_MAXDEVICES] = {};
+  _ps_readdevices(mask, PARAM_STATUS, (uint8_t *)status, sizeof(ps_status_reg));
+  _ps_readdevices(mask, PARAM_SPEED, speed[0], 3);
+  _ps_readdevices(mask, PARAM_ABSPOS, abspos[0], 3);
+  if (withmark) _ps_readdevices(mask, PARAM_MARK, mark[0], 3);
+  _ps_readdevices(mask, PARAM_ADCOUT, adc, 1);
+
+  for (uint8_t d = 0; d < _ps_devices; d++) {
+    if (!(mask & (1 << d))) continue;
+    snaps[d] = (ps_snapshot){
+      .status = _ps_decodestatus(d, status[d]),
+      .stepss = ps_decode(PS_CODEC_SPEED, ps_get24(speed[d]) & SPEED_MASK),
+      .pos = ps_xferpos(0, abspos[d]),
+      .mark = ps_xferpos(0, mark[d]),
+      .adc = (int)adc[d]
+    };
+  }
+}
+
+ps_snapshot ps_getsnapshot(bool mark) {
+  ps_snapshot snaps[PS_MAXDEVICES];
+  _ps_snapshot(1 << _ps_dev, snaps, mark);
+  return snaps[_ps_dev];
+}
+
+void ps_getsnapshots(ps_snapshot * snaps) {
+  _ps_snapshot((1 << _ps_devices) - 1, snaps, true);
+}
+
+void ps_getstatuses(ps_status * status) {
+  ps_locked();
+  _ps_flush();
+
+  ps_status_reg reg[PS_MAXDEVICES] = {};
+  _ps_readdevices((1 << _ps_devices) - 1, PARAM_STATUS, (uint8_t *)reg, sizeof(ps_status_reg));
+  for (uint8_t d = 0; d < _ps_devices; d++) status[d] = _ps_decodestatus(d, reg[d]);
+}
+
+#ifdef PS_BENCH
+#define PS_BENCH_ITER   (1000)
+
+static uint8_t _ps_xferbyte_legacy(uint8_t b) {
+  digitalWrite(PS_PIN_CS, LOW);
+  SPI.beginTransaction(SPISettings(PS_SPI_FREQ, MSBFIRST, PS_SPI_MODE));
+  b = SPI.transfer(b);
+  SPI.endTransaction();
+  digitalWrite(PS_PIN_CS, HIGH);
+  delayMicroseconds(1);
+  return b;
+}
+
+void ps_bench() {
+  uint8_t buf[3] = {};
+
+  // Per byte transactions, as the driver used to do it
+  unsigned long start = micros();
+  for (size_t i = 0; i < PS_BENCH_ITER; i++) {
+    _ps_xferbyte_legacy(CMD_GETPARAM(PARAM_ABSPOS));
+    for (size_t b = 0; b < sizeof(buf); b++) buf[b] = _ps_xferbyte_legacy(0);
+  }
+  float legacy = (float)(micros() - start) / PS_BENCH_ITER;
+
+  start = micros();
+  for (size_t i = 0; i < PS_BENCH_ITER; i++) {
+    ps_getparam("getparam abspos", PARAM_ABSPOS, buf, sizeof(buf));
+  }
+  float direct = (float)(micros() - start) / PS_BENCH_ITER;
+
+  // Same 17 frames as five getters, the chain variant reads every device in them
+  ps_snapshot snaps[PS_MAXDEVICES];
+  start = micros();
+  for (size_t i = 0; i < PS_BENCH_ITER; i++) {
+    ps_getsnapshots(snaps);
+  }
+  float snapshot = (float)(micros() - start) / PS_BENCH_ITER;
+
+  Serial.printf("PS bench: getparam abspos %.2fus legacy, %.2fus now; snapshot of %u devices %.2fus\n", legacy, direct, ps_devices(), snapshot);
+}
+#endif
@@ -259,7 +259,27 @@ void ps_releasesw(ps_posact act, ps_direction dir);
 
 
 
-void ps_spiinit();
+#define PS_MAXDEVICES   (4)
+
+void ps_spiinit(uint8_t devices =1);
+
+// Devices sharing CS in SPI daisy chain mode, all ps_* calls go to the selected device
+void ps_select(uint8_t device);
+uint8_t ps_selected();
+uint8_t ps_devices();
+
+// Write commands between begin and end go out in one frame and latch together
+void ps_syncbegin();
+void ps_syncend();
+
+// Bus lock for callers outside the main loop, recursive and already taken per command
+void ps_lock();
+void ps_unlock();
+
+//#define PS_BENCH
+#ifdef PS_BENCH
+void ps_bench();
+#endif
 
 
 
@@ -271,7 +291,27 @@ void ps_waitbusy(ps_waitcb waitf =NULL);
 bool ps_isrunning();
 bool ps_ishiz();
 
+// Status, speed, position, mark and adc under one bus lock. A device still costs 17 frames,
+// but the whole chain is read in the same 17 frames by ps_getsnapshots. Leaving out the
+// mark saves 4 of them, it reads back as 0.
+typedef struct {
+  ps_status status;
+  float stepss;
+  int32_t pos;
+  int32_t mark;
+  int adc;
+} ps_snapshot;
+ps_snapshot ps_getsnapshot(bool mark =true);
+void ps_getsnapshots(ps_snapshot * snaps);
+
+// Status of every device in the chain in 3 frames
+void ps_getstatuses(ps_status * status);
+
 void ps_reset();
 void ps_nop();
 
+// Hold static register writes to the selected device until its commit, only changed registers get written
+void ps_defer();
+void ps_commit();
+
 #endif
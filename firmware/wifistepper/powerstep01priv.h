@@ -37,6 +37,12 @@
 
 #define CMDSIZE(b)              ((b) + 1)
 
+typedef struct {
+  uint8_t cmd;
+  uint8_t * data;
+  size_t len;
+} ps_xferop;
+
 #define PARAM_ABSPOS            (0x01)
 #define PARAM_ELPOS             (0x02)
 #define PARAM_MARK              (0x03)
@@ -92,6 +98,7 @@ typedef struct __ps_packed {
 /* REG SPEED */
 #define SPEED_COEFF       (0.015)
 #define SPEED_MAX         (15625.0)
+#define SPEED_MASK        (0x000FFFFF)
 
 /* REG ACC */
 #define ACC_COEFF         (0.137438)
@@ -116,6 +123,7 @@ typedef struct __ps_packed {
 
 #define MINSPEED_COEFF    (4.194304)
 #define MINSPEED_MASK     (0x0FFF)
+#define MINSPEED_LSPDOPT  (0x1000)
 
 /* REG OCDTH */
 #define OCDTH_COEFF       (0.032)
@@ -133,6 +141,7 @@ typedef struct __ps_packed {
 #define FSSPD_COEFF       (0.065536)
 #define FSSPD_OFFSET      (0.5)
 #define FSSPD_MASK        (0x03FF)
+#define FSSPD_BOOST       (0x0400)
 
 /* REG STEPMODE */
 typedef struct __ps_packed {
@@ -270,4 +279,79 @@ typedef struct __ps_packed {
 /* CMD MOVE */
 #define MOVE_MASK         (0x003FFFFF)
 
-#endif
+/* Register byte order, big endian on the wire */
+static inline uint16_t ps_get16(const uint8_t * b) { return ((uint16_t)b[0] << 8) | (uint16_t)b[1]; }
+static inline void ps_set16(uint16_t v, uint8_t * b) { b[0] = (uint8_t)(v >> 8); b[1] = (uint8_t)v; }
+static inline uint32_t ps_get24(const uint8_t * b) { return ((uint32_t)b[0] << 16) | ((uint32_t)b[1] << 8) | (uint32_t)b[2]; }
+static inline void ps_set24(uint32_t v, uint8_t * b) { b[0] = (uint8_t)(v >> 16); b[1] = (uint8_t)(v >> 8); b[2] = (uint8_t)v; }
+
+/* Register codecs */
+// counts = round(units * coeff - offset), saturating to [0, mask]. Everything
+// but the input scaling is worked out at compile time, so the runtime encode
+// is one float scale and an integer multiply instead of double math.
+typedef struct {
+  double coeff;       // counts per unit
+  double offset;      // counts
+  uint32_t mask;
+  float vmax;         // inputs from here on saturate
+  float scale;        // 2^qin, inputs become Q(qin) integers
+  uint8_t shift;      // qin + qc
+  uint64_t c;         // coeff in Q(qc)
+  int64_t bias;       // rounding less offset in Q(qin + qc)
+  float inv;          // units per count
+  float foffset;
+} ps_codec;
+
+#define __PS_QIN_MAX    (30)
+
+constexpr uint8_t __ps_bits(uint32_t mask) { return mask == 0? 0 : 1 + __ps_bits(mask >> 1); }
+constexpr uint8_t __ps_qin(double vmax, uint8_t q) { return (q < __PS_QIN_MAX && vmax * (double)(1ULL << (q + 1)) < 2147483648.0)? __ps_qin(vmax, q + 1) : q; }
+
+constexpr ps_codec __ps_codec(double coeff, double offset, uint32_t mask, double vmax, uint8_t qin, uint8_t qc) {
+  return { coeff, offset, mask, (float)vmax, (float)(1ULL << qin), (uint8_t)(qin + qc), (uint64_t)(coeff * (double)(1ULL << qc) + 0.5), (int64_t)((0.5 - offset) * (double)(1ULL << (qin + qc))), (float)(1.0 / coeff), (float)offset };
+}
+
+constexpr ps_codec __ps_codec(double coeff, double offset, uint32_t mask, double vmax, uint8_t qin) {
+  // Keep (mask + 1) << (qin + qc) clear of the 64 bit product
+  return __ps_codec(coeff, offset, mask, vmax, qin, 61 - qin - __ps_bits(mask));
+}
+
+constexpr ps_codec ps_codec_make(double coeff, double offset, uint32_t mask) {
+  return __ps_codec(coeff, offset, mask, ((double)mask - 0.5 + offset) / coeff, __ps_qin(((double)mask - 0.5 + offset) / coeff, 0));
+}
+
+constexpr uint32_t __ps_constround(uint32_t mask, double n) { return n < 1.0? 0 : (n >= (double)mask? mask : (uint32_t)n); }
+constexpr uint32_t ps_constencode(const ps_codec& c, double v) { return __ps_constround(c.mask, v * c.coeff - c.offset + 0.5); }
+
+static inline uint32_t ps_encode(const ps_codec& c, float v) {
+  if (!(v > 0.0f)) return 0;
+  if (v >= c.vmax) return c.mask;
+  uint64_t x = (uint32_t)(v * c.scale);
+  int64_t n = (int64_t)(x * c.c) + c.bias;
+  return n < 0? 0 : min((uint32_t)(n >> c.shift), c.mask);
+}
+
+static inline float ps_decode(const ps_codec& c, uint32_t counts) {
+  return ((float)counts + c.foffset) * c.inv;
+}
+
+static constexpr ps_codec PS_CODEC_SPEED        = ps_codec_make(1.0 / SPEED_COEFF, 0.0, (uint32_t)(SPEED_MAX / SPEED_COEFF + 0.5));
+static constexpr ps_codec PS_CODEC_ACC          = ps_codec_make(ACC_COEFF, 0.0, ACC_MASK);
+static constexpr ps_codec PS_CODEC_DEC          = ps_codec_make(DEC_COEFF, 0.0, DEC_MASK);
+static constexpr ps_codec PS_CODEC_MAXSPEED     = ps_codec_make(MAXSPEED_COEFF, 0.0, MAXSPEED_MASK);
+static constexpr ps_codec PS_CODEC_MINSPEED     = ps_codec_make(MINSPEED_COEFF, 0.0, MINSPEED_MASK);
+static constexpr ps_codec PS_CODEC_FSSPD        = ps_codec_make(FSSPD_COEFF, FSSPD_OFFSET, FSSPD_MASK);
+static constexpr ps_codec PS_CODEC_OCDTH        = ps_codec_make(OCDTH_COEFF, 0.0, OCDTH_MASK);
+static constexpr ps_codec PS_CODEC_KTVAL        = ps_codec_make(1.0 / KTVALS_COEFF, 0.0, 0xFF);
+static constexpr ps_codec PS_CODEC_BEMFSLOPE    = ps_codec_make(1.0 / BEMFSLOPE_COEFF, 0.0, BEMFSLOPE_MASK);
+static constexpr ps_codec PS_CODEC_BEMFSPEEDCO  = ps_codec_make(1.0 / BEMFSPEEDCO_COEFF, 0.0, BEMFSPEEDCO_MASK);
+static constexpr ps_codec PS_CODEC_STALL        = ps_codec_make(1.0 / STALL_COEFF, STALL_OFFSET / STALL_COEFF, STALL_MASK);
+static constexpr ps_codec PS_CODEC_MINCTRL      = ps_codec_make(1.0 / MINCTRL_COEFF, MINCTRL_OFFSET / MINCTRL_COEFF, MINCTRL_MASK);
+static constexpr ps_codec PS_CODEC_TFAST        = ps_codec_make(1.0 / TFAST_COEFF, TFAST_OFFSET / TFAST_COEFF, TFAST_MASK);
+static constexpr ps_codec PS_CODEC_TSW          = ps_codec_make(CM_TSW_COEFF, 0.0, CM_TSW_MASK);
+
+static_assert(ps_constencode(PS_CODEC_MAXSPEED, 1000.0) == 66, "maxspeed encoding");
+static_assert(ps_constencode(PS_CODEC_FSSPD, 602.0) == 39, "fsspd encoding");
+static_assert(ps_constencode(PS_CODEC_STALL, 10.0) == 0 && ps_constencode(PS_CODEC_STALL, 1000.0) == 31, "stall encoding");
+
+#endif
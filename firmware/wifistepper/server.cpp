@@ -5,6 +5,7 @@
 
 #include "wifistepper.h"
 #include "ecc508a.h"
+#include "jsonstream.h"
 
 #include <wps/wps.h>
 
@@ -20,11 +21,11 @@ extern volatile bool flag_reboot;
   int target = 0; \
   if (server.hasArg("target")) { \
     target = server.arg("target").toInt(); \
-    if (target != 0 && (!config.daisy.enabled || !config.daisy.master || !state.daisy.active)) { \
+    if (!m_islocal(target) && (!config.daisy.enabled || !config.daisy.master || !state.daisy.active)) { \
       server.send(200, "application/json", json_error("failed to set target")); \
       return; \
     } \
-    if (target < 0 || target > state.daisy.slaves) { \
+    if (target < 0 || (!m_islocal(target) && target > state.daisy.slaves)) { \
       server.send(200, "application/json", json_error("invalid target")); \
       return; \
     } \
@@ -44,25 +45,74 @@ static String json_okid(id_t id) {
   return String("{\"status\":\"ok\",\"id\":") + id + "}";
 }
 
+#define BATCH_MAXSIZE     (1024)
+#define BATCH_MAXRESULTS  (128)         // BATCH_MAXSIZE of the smallest (8 byte) records
+#define CRYPTO_SETTIMEOUT (500)
+
+typedef struct {
+  id_t id;
+  const char * error;
+} batch_result_t;
+
+// Results are collected under the core lock and sent after it is released
+static void batch_send(const batch_result_t * results, size_t count) {
+  JsonStream js(server);
+  js.begin();
+  js.beginObject();
+  js.beginArray("results");
+  for (size_t i = 0; i < count; i++) {
+    js.beginObject();
+    if (results[i].id != 0) js.add("id", results[i].id);
+    else                    js.add("error", results[i].error);
+    js.endObject();
+  }
+  js.endArray();
+  js.add("status", "ok");
+  js.endObject();
+  js.end();
+}
+
+static int parse_hexnibble(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static int parse_hex(const String& s, uint8_t * out, size_t maxlen) {
+  if ((s.length() % 2) != 0 || (s.length() / 2) > maxlen) return -1;
+  for (size_t i = 0; i < s.length() / 2; i++) {
+    int hi = parse_hexnibble(s[2*i]), lo = parse_hexnibble(s[2*i+1]);
+    if (hi < 0 || lo < 0) return -1;
+    out[i] = (hi << 4) | lo;
+  }
+  return s.length() / 2;
+}
+
 
 void api_initwifi() {
   server.on("/api/wifi/scan", HTTP_GET, [](){
     add_headers()
-    check_auth()
+    {
+      check_auth()
+    }
+    // Scanning takes seconds, don't hold the core lock for it
     int n = WiFi.scanNetworks();
-    JsonObject& root = jsonbuf.createObject();
-    JsonArray& networks = root.createNestedArray("networks");
+    JsonStream js(server);
+    js.begin();
+    js.beginObject();
+    js.beginArray("networks");
     for (int i = 0; i < n; ++i) {
-      JsonObject& network = jsonbuf.createObject();
-      network["ssid"] = WiFi.SSID(i);
-      network["rssi"] = WiFi.RSSI(i);
-      network["encryption"] = WiFi.encryptionType(i) != WPS_WIFI_AUTH_OPEN;
-      networks.add(network);
+      js.beginObject();
+      js.add("ssid", WiFi.SSID(i));
+      js.add("rssi", WiFi.RSSI(i));
+      js.add("encryption", WiFi.encryptionType(i) != WPS_WIFI_AUTH_OPEN);
+      js.endObject();
     }
-    root["status"] = "ok";
-    JsonVariant v = root;
-    server.send(200, "application/json", v.as<String>());
-    jsonbuf.clear();
+    js.endArray();
+    js.add("status", "ok");
+    js.endObject();
+    js.end();
   });
   server.on("/api/wifi/get", HTTP_GET, [](){
     add_headers()
@@ -191,10 +241,48 @@ void api_initservice() {
     JsonObject& root = jsonbuf.createObject();
     root["lowcom_clients"] = state.service.lowcom.clients;
     root["mqtt_connected"] = state.service.mqtt.connected;
+    JsonObject& crypto = root.createNestedObject("crypto");
+    crypto["queue"] = state.service.crypto.queue;
+    crypto["queue_max"] = state.service.crypto.queue_max;
+    crypto["arena"] = state.service.crypto.arena;
+    crypto["arena_max"] = state.service.crypto.arena_max;
+    crypto["retries"] = state.service.crypto.retries;
+    crypto["short_replies"] = state.service.crypto.short_replies;
+    crypto["timeouts"] = state.service.crypto.timeouts;
+    JsonArray& ops = crypto.createNestedArray("ops");
+    const ecc_opstats_t * S;
+    for (size_t i = 0; (S = ecc_opstats(i)) != NULL; i++) {
+      if (S->count == 0 && S->retries == 0) continue;
+      JsonObject& op = ops.createNestedObject();
+      op["op"] = S->name;
+      op["count"] = S->count;
+      op["polls"] = S->polls;
+      op["retries"] = S->retries;
+      op["max_us"] = S->max_us;
+      JsonArray& hist = op.createNestedArray("hist_ms");
+      for (size_t b = 0; b < ECC_HISTBINS; b++) hist.add(S->hist[b]);
+    }
+    JsonObject& http = root.createNestedObject("http");
+    http["handlers"] = state.service.http.handlers;
+    http["hold_us"] = state.service.http.hold_us;
+    http["hold_max_us"] = state.service.http.hold_max_us;
+    JsonObject& loop = root.createNestedObject("loop");
+    loop["last_us"] = state.service.loop.last_us;
+    loop["avg_us"] = state.service.loop.avg_us;
+    loop["max_us"] = state.service.loop.max_us;
+    loop["slow"] = state.service.loop.slow;
     root["status"] = "ok";
+    if (server.hasArg("reset") && server.arg("reset") == "true") {
+      // Starts a new measurement window for the worst case figures
+      state.service.http.hold_max_us = 0;
+      state.service.loop.max_us = 0;
+      state.service.loop.slow = 0;
+    }
     JsonVariant v = root;
-    server.send(200, "application/json", v.as<String>());
+    String body = v.as<String>();
     jsonbuf.clear();
+    core_release();
+    server.send(200, "application/json", body);
   });
   server.on("/api/service/streamprotocol", HTTP_GET, [](){
     add_headers()
@@ -224,6 +312,63 @@ void api_initdaisy() {
     root["master"] = config.daisy.master;
     if (config.daisy.master) {
       root["slaves"] = state.daisy.slaves;
+      root["ring_us"] = state.daisy.ring_us;
+      root["hop_us"] = state.daisy.hop_us;
+      root["retransmits"] = state.daisy.retransmits;
+      root["failures"] = state.daisy.failures;
+      root["backlog"] = state.daisy.backlog;
+      root["backlog_max"] = state.daisy.backlog_max;
+      root["rx_bytes"] = state.daisy.link.rx_bytes;
+      root["rx_frames"] = state.daisy.link.rx_frames;
+      root["parse_errors"] = state.daisy.link.parse_errors;
+      root["outbox_max"] = state.daisy.link.outbox_max;
+      JsonArray& rtt = root.createNestedArray("ring_rtt_us");
+      JsonArray& rttmax = root.createNestedArray("ring_rtt_max_us");
+      JsonArray& turnaround = root.createNestedArray("turnaround_us");
+      JsonArray& forward = root.createNestedArray("forward_us");
+      JsonArray& forwardbytes = root.createNestedArray("forward_bytes");
+      JsonArray& forwardframes = root.createNestedArray("forward_frames");
+      JsonArray& parseerrors = root.createNestedArray("slave_parse_errors");
+      JsonArray& outboxmax = root.createNestedArray("slave_outbox_max");
+      JsonArray& firelate = root.createNestedArray("fire_late_us");
+      JsonArray& firesmissed = root.createNestedArray("fires_missed");
+
+      // Skew only across boards that started on time on the last fire sent
+      id_t fire = state.daisy.fire_id;
+      uint32_t latemin = UINT32_MAX, latemax = 0;
+      if (fire != 0 && state.daisy.link.fire_id == fire) latemin = latemax = state.daisy.link.fire_late_us;
+      for (uint8_t i = 0; i < state.daisy.slaves; i++) {
+        daisy_linkstate * link = &sketch.daisy.slave[i].state.link;
+        rtt.add(sketch.daisy.slave[i].echo.ring_rtt_us);
+        rttmax.add(sketch.daisy.slave[i].echo.ring_rtt_max_us);
+        turnaround.add(sketch.daisy.slave[i].echo.turnaround_us);
+        forward.add(link->forward_us);
+        forwardbytes.add(link->forward_bytes);
+        forwardframes.add(link->forward_frames);
+        parseerrors.add(link->parse_errors);
+        outboxmax.add(link->outbox_max);
+        firelate.add(link->fire_late_us);
+        firesmissed.add(link->fires_missed);
+        if (fire == 0 || link->fire_id != fire) continue;
+        latemin = min(latemin, link->fire_late_us);
+        latemax = max(latemax, link->fire_late_us);
+      }
+      root["fire_id"] = fire;
+      if (latemin <= latemax) root["fire_skew_us"] = latemax - latemin;
+    } else {
+      root["forward_us"] = state.daisy.link.forward_us;
+      root["forward_max_us"] = state.daisy.link.forward_max_us;
+      root["fire_late_us"] = state.daisy.link.fire_late_us;
+      root["fire_id"] = state.daisy.link.fire_id;
+      root["fires_missed"] = state.daisy.link.fires_missed;
+      root["duplicates"] = state.daisy.link.duplicates;
+      root["outoforder"] = state.daisy.link.outoforder;
+      root["rx_bytes"] = state.daisy.link.rx_bytes;
+      root["rx_frames"] = state.daisy.link.rx_frames;
+      root["forward_bytes"] = state.daisy.link.forward_bytes;
+      root["forward_frames"] = state.daisy.link.forward_frames;
+      root["parse_errors"] = state.daisy.link.parse_errors;
+      root["outbox_max"] = state.daisy.link.outbox_max;
     }
     root["slavewifioff"] = config.daisy.slavewifioff;
     root["status"] = "ok";
@@ -241,6 +386,35 @@ void api_initdaisy() {
     flag_reboot = true;
     server.send(200, "application/json", json_ok());
   });
+  server.on("/api/daisy/queue/write", HTTP_GET, [](){
+    add_headers()
+    check_auth()
+    get_target()
+    get_queue()
+    if (!config.daisy.enabled || !config.daisy.master || !state.daisy.active) {
+      server.send(200, "application/json", json_error("daisy not active"));
+      return;
+    }
+    if (queue == 0) {
+      server.send(200, "application/json", json_error("cannot write queue 0"));
+      return;
+    }
+    if (!server.hasArg("sourcequeue")) {
+      server.send(200, "application/json", json_error("sourcequeue arg must be specified"));
+      return;
+    }
+    queue_t * src = queue_get(server.arg("sourcequeue").toInt());
+    if (src == NULL) {
+      server.send(200, "application/json", json_error("invalid sourcequeue"));
+      return;
+    }
+    id_t id = nextid();
+    if (!daisy_writequeue(target, queue, id, src)) {
+      server.send(200, "application/json", json_error("queue not sent to every board"));
+      return;
+    }
+    server.send(200, "application/json", json_okid(id));
+  });
   server.on("/api/daisy/wificontrol", HTTP_GET, [](){
     add_headers()
     check_auth()
@@ -278,45 +452,47 @@ void api_initmotor() {
     add_headers()
     check_auth()
     get_target()
-    motor_config * cfg = target == 0? &config.motor : &sketch.daisy.slave[target - 1].config.motor;
-    JsonObject& root = jsonbuf.createObject();
-    if (server.hasArg("target")) root["target"] = target;
-    root["mode"] = json_serialize(cfg->mode);
-    root["stepsize"] = json_serialize(cfg->stepsize);
-    root["ocd"] = cfg->ocd;
-    root["ocdshutdown"] = cfg->ocdshutdown;
-    root["maxspeed"] = cfg->maxspeed;
-    root["minspeed"] = cfg->minspeed;
-    root["accel"] = cfg->accel;
-    root["decel"] = cfg->decel;
-    root["fsspeed"] = cfg->fsspeed;
-    root["fsboost"] = cfg->fsboost;
-    root["cm_kthold"] = cfg->cm.kthold;
-    root["cm_ktrun"] = cfg->cm.ktrun;
-    root["cm_ktaccel"] = cfg->cm.ktaccel;
-    root["cm_ktdecel"] = cfg->cm.ktdecel;
-    root["cm_switchperiod"] = cfg->cm.switchperiod;
-    root["cm_predict"] = cfg->cm.predict;
-    root["cm_minon"] = cfg->cm.minon;
-    root["cm_minoff"] = cfg->cm.minoff;
-    root["cm_fastoff"] = cfg->cm.fastoff;
-    root["cm_faststep"] = cfg->cm.faststep;
-    root["vm_kthold"] = cfg->vm.kthold;
-    root["vm_ktrun"] = cfg->vm.ktrun;
-    root["vm_ktaccel"] = cfg->vm.ktaccel;
-    root["vm_ktdecel"] = cfg->vm.ktdecel;
-    root["vm_pwmfreq"] = cfg->vm.pwmfreq;
-    root["vm_stall"] = cfg->vm.stall;
-    root["vm_volt_comp"] = cfg->vm.volt_comp;
-    root["vm_bemf_slopel"] = cfg->vm.bemf_slopel;
-    root["vm_bemf_speedco"] = cfg->vm.bemf_speedco;
-    root["vm_bemf_slopehacc"] = cfg->vm.bemf_slopehacc;
-    root["vm_bemf_slopehdec"] = cfg->vm.bemf_slopehdec;
-    root["reverse"] = cfg->reverse;
-    root["status"] = "ok";
-    JsonVariant v = root;
-    server.send(200, "application/json", v.as<String>());
-    jsonbuf.clear();
+    motor_config cfg = m_islocal(target)? config.motor : sketch.daisy.slave[target - 1].config.motor;
+    core_release();
+    JsonStream js(server);
+    js.begin();
+    js.beginObject();
+    if (server.hasArg("target")) js.add("target", target);
+    js.add("mode", json_serialize(cfg.mode));
+    js.add("stepsize", json_serialize(cfg.stepsize));
+    js.add("ocd", cfg.ocd);
+    js.add("ocdshutdown", cfg.ocdshutdown);
+    js.add("maxspeed", cfg.maxspeed);
+    js.add("minspeed", cfg.minspeed);
+    js.add("accel", cfg.accel);
+    js.add("decel", cfg.decel);
+    js.add("fsspeed", cfg.fsspeed);
+    js.add("fsboost", cfg.fsboost);
+    js.add("cm_kthold", cfg.cm.kthold);
+    js.add("cm_ktrun", cfg.cm.ktrun);
+    js.add("cm_ktaccel", cfg.cm.ktaccel);
+    js.add("cm_ktdecel", cfg.cm.ktdecel);
+    js.add("cm_switchperiod", cfg.cm.switchperiod);
+    js.add("cm_predict", cfg.cm.predict);
+    js.add("cm_minon", cfg.cm.minon);
+    js.add("cm_minoff", cfg.cm.minoff);
+    js.add("cm_fastoff", cfg.cm.fastoff);
+    js.add("cm_faststep", cfg.cm.faststep);
+    js.add("vm_kthold", cfg.vm.kthold);
+    js.add("vm_ktrun", cfg.vm.ktrun);
+    js.add("vm_ktaccel", cfg.vm.ktaccel);
+    js.add("vm_ktdecel", cfg.vm.ktdecel);
+    js.add("vm_pwmfreq", cfg.vm.pwmfreq);
+    js.add("vm_stall", cfg.vm.stall);
+    js.add("vm_volt_comp", cfg.vm.volt_comp);
+    js.add("vm_bemf_slopel", cfg.vm.bemf_slopel);
+    js.add("vm_bemf_speedco", cfg.vm.bemf_speedco);
+    js.add("vm_bemf_slopehacc", cfg.vm.bemf_slopehacc);
+    js.add("vm_bemf_slopehdec", cfg.vm.bemf_slopehdec);
+    js.add("reverse", cfg.reverse);
+    js.add("status", "ok");
+    js.endObject();
+    js.end();
   });
   server.on("/api/motor/set", HTTP_GET, [](){
     add_headers()
@@ -367,31 +543,36 @@ void api_initmotor() {
     add_headers()
     check_auth()
     get_target()
-    motor_state * st = target == 0? &state.motor : &sketch.daisy.slave[target - 1].state.motor;
-    JsonObject& root = jsonbuf.createObject();
-    if (server.hasArg("target")) root["target"] = target;
-    root["stepss"] = st->stepss;
-    root["pos"] = st->pos;
-    root["mark"] = st->mark;
-    root["vin"] = st->vin;
-    root["dir"] = json_serialize(st->status.direction);
-    root["movement"] = json_serialize(st->status.movement);
-    root["hiz"] = st->status.hiz;
-    root["busy"] = st->status.busy;
-    root["switch"] = st->status.user_switch;
-    root["stepclock"] = st->status.step_clock;
-    JsonObject& alarms = root.createNestedObject("alarms");
-    alarms["commanderror"] = st->status.alarms.command_error;
-    alarms["overcurrent"] = st->status.alarms.overcurrent;
-    alarms["undervoltage"] = st->status.alarms.undervoltage;
-    alarms["thermalshutdown"] = st->status.alarms.thermal_shutdown;
-    alarms["thermalwarning"] = st->status.alarms.thermal_warning;
-    alarms["stalldetect"] = st->status.alarms.stall_detect;
-    alarms["switch"] = st->status.alarms.user_switch;
-    root["status"] = "ok";
-    JsonVariant v = root;
-    server.send(200, "application/json", v.as<String>());
-    jsonbuf.clear();
+    motor_state st = m_islocal(target)? *cmd_getstate(m_device(target)) : sketch.daisy.slave[target - 1].state.motor;
+    core_release();
+    JsonStream js(server);
+    js.begin();
+    js.beginObject();
+    if (server.hasArg("target")) js.add("target", target);
+    js.add("stepss", st.stepss);
+    js.add("pos", st.pos);
+    js.add("mark", st.mark);
+    js.add("vin", st.vin);
+    js.add("dir", json_serialize(st.status.direction));
+    js.add("movement", json_serialize(st.status.movement));
+    js.add("hiz", st.status.hiz);
+    js.add("busy", st.status.busy);
+    js.add("switch", st.status.user_switch);
+    js.add("stepclock", st.status.step_clock);
+    js.add("sample_ms", st.sample_ms);
+    js.add("sample_hz", st.sample_hz);
+    js.beginObject("alarms");
+    js.add("commanderror", st.status.alarms.command_error);
+    js.add("overcurrent", st.status.alarms.overcurrent);
+    js.add("undervoltage", st.status.alarms.undervoltage);
+    js.add("thermalshutdown", st.status.alarms.thermal_shutdown);
+    js.add("thermalwarning", st.status.alarms.thermal_warning);
+    js.add("stalldetect", st.status.alarms.stall_detect);
+    js.add("switch", st.status.alarms.user_switch);
+    js.endObject();
+    js.add("status", "ok");
+    js.endObject();
+    js.end();
   });
   server.on("/api/motor/pos/reset", HTTP_GET, [](){
     add_headers()
@@ -460,6 +641,28 @@ void api_initmotor() {
     m_goto(target, queue, id, pos, server.hasArg("dir"), dir);
     server.send(200, "application/json", json_okid(id));
   });
+  server.on("/api/motor/home/stall", HTTP_GET, [](){
+    add_headers()
+    check_auth()
+    get_target()
+    get_queue()
+    if (!server.hasArg("dir") || !server.hasArg("fast") || !server.hasArg("slow")) {
+      server.send(200, "application/json", json_error("dir, fast, slow args must be specified"));
+      return;
+    }
+    ps_direction dir = parse_direction(server.arg("dir"), REV);
+    float fast = server.arg("fast").toFloat();
+    float slow = server.arg("slow").toFloat();
+    uint32_t backoff = server.hasArg("backoff")? server.arg("backoff").toInt() : 0;
+    int32_t pos = server.hasArg("pos")? server.arg("pos").toInt() : 0;
+    if (fast <= 0 || slow <= 0 || slow > fast) {
+      server.send(200, "application/json", json_error("speeds must be positive with slow below fast"));
+      return;
+    }
+    id_t id = nextid();
+    m_homestall(target, queue, id, dir, fast, slow, backoff, pos);
+    server.send(200, "application/json", json_okid(id));
+  });
   server.on("/api/motor/stepclock", HTTP_GET, [](){
     add_headers()
     check_auth()
@@ -474,6 +677,194 @@ void api_initmotor() {
     m_stepclock(target, queue, id, dir);
     server.send(200, "application/json", json_okid(id));
   });
+  server.on("/api/motor/stepclock/load", HTTP_POST, [](){
+    add_headers()
+    check_auth()
+    if (!server.hasArg("data")) {
+      server.send(200, "application/json", json_error("data arg must be specified"));
+      return;
+    }
+    uint8_t data[512];
+    int len = parse_hex(server.arg("data"), data, sizeof(data));
+    if (len < 0) {
+      server.send(200, "application/json", json_error("data must be hex, 512 bytes max per call"));
+      return;
+    }
+    size_t offset = server.hasArg("offset")? server.arg("offset").toInt() : 0;
+    if (!stck_load(offset, data, len)) {
+      server.send(200, "application/json", json_error("could not load profile"));
+      return;
+    }
+    server.send(200, "application/json", json_ok());
+  });
+  server.on("/api/motor/stepclock/play", HTTP_GET, [](){
+    add_headers()
+    check_auth()
+    if (!server.hasArg("dir")) {
+      server.send(200, "application/json", json_error("direction arg must be specified"));
+      return;
+    }
+    ps_direction dir = parse_direction(server.arg("dir"), FWD);
+    id_t id = nextid();
+    if (!stck_play(id, dir)) {
+      server.send(200, "application/json", json_error("no valid profile or already playing"));
+      return;
+    }
+    server.send(200, "application/json", json_okid(id));
+  });
+  server.on("/api/motor/stepclock/stop", HTTP_GET, [](){
+    add_headers()
+    check_auth()
+    stck_stop();
+    server.send(200, "application/json", json_ok());
+  });
+  server.on("/api/motor/stepclock/state", HTTP_GET, [](){
+    add_headers()
+    check_auth()
+    JsonObject& root = jsonbuf.createObject();
+    root["loaded"] = state.stepclock.loaded;
+    root["pending"] = state.stepclock.pending;
+    root["running"] = state.stepclock.running;
+    root["id"] = state.stepclock.id;
+    root["segments"] = state.stepclock.segments;
+    root["total"] = state.stepclock.total;
+    root["steps"] = state.stepclock.steps;
+    root["chunks"] = state.stepclock.chunks;
+    root["duration_ms"] = state.stepclock.duration_ms;
+    root["status"] = "ok";
+    JsonVariant v = root;
+    server.send(200, "application/json", v.as<String>());
+    jsonbuf.clear();
+  });
+  server.on("/api/motor/tune/start", HTTP_GET, [](){
+    add_headers()
+    check_auth()
+    if (!server.hasArg("resistance") || !server.hasArg("inductance") || !server.hasArg("current")) {
+      server.send(200, "application/json", json_error("resistance, inductance and current args must be specified"));
+      return;
+    }
+    float resistance = server.arg("resistance").toFloat();
+    float inductance = server.arg("inductance").toFloat();
+    float ke = server.hasArg("ke")? server.arg("ke").toFloat() : 0;
+    float current = server.arg("current").toFloat();
+    float holdcurrent = server.hasArg("holdcurrent")? server.arg("holdcurrent").toFloat() : current / 2.0;
+    float vs = server.hasArg("vs")? server.arg("vs").toFloat() : 0;
+    float limit = server.hasArg("limit")? server.arg("limit").toFloat() : config.motor.maxspeed;
+    bool save = server.hasArg("save")? server.arg("save") == "true" : false;
+    id_t id = nextid();
+    if (!tune_start(id, resistance, inductance, ke, current, holdcurrent, vs, limit, save)) {
+      server.send(200, "application/json", json_error("tuning needs voltage mode, a stopped motor and valid motor data"));
+      return;
+    }
+    server.send(200, "application/json", json_okid(id));
+  });
+  server.on("/api/motor/tune/stop", HTTP_GET, [](){
+    add_headers()
+    check_auth()
+    tune_stop(true);
+    server.send(200, "application/json", json_ok());
+  });
+  server.on("/api/motor/tune/state", HTTP_GET, [](){
+    add_headers()
+    check_auth()
+    JsonObject& root = jsonbuf.createObject();
+    root["running"] = state.tune.phase != TUNE_IDLE;
+    root["done"] = state.tune.done;
+    root["id"] = state.tune.id;
+    root["trials"] = state.tune.trials;
+    root["speed"] = state.tune.speed;
+    root["held"] = state.tune.held;
+    root["boost"] = state.tune.boost;
+    root["maxspeed"] = state.tune.maxspeed;
+    JsonObject& params = root.createNestedObject("vm");
+    params["kthold"] = state.tune.kthold;
+    params["ktrun"] = state.tune.ktrun;
+    params["bemf_slopel"] = state.tune.slopel;
+    params["bemf_speedco"] = state.tune.speedco;
+    params["bemf_slopeh"] = state.tune.slopeh;
+    root["status"] = "ok";
+    JsonVariant v = root;
+    server.send(200, "application/json", v.as<String>());
+    jsonbuf.clear();
+  });
+  server.on("/api/motor/capture/start", HTTP_GET, [](){
+    add_headers()
+    check_auth()
+    get_target()
+    if (!m_islocal(target)) {
+      server.send(200, "application/json", json_error("capture only runs on local devices"));
+      return;
+    }
+    uint16_t rate_hz = server.hasArg("rate_hz")? server.arg("rate_hz").toInt() : 1000;
+    uint16_t decimate = server.hasArg("decimate")? server.arg("decimate").toInt() : 1;
+    uint8_t trigger = parse_trigger(server.arg("trigger"), CAP_TRIG_NOW);
+    uint16_t samples = server.hasArg("samples")? server.arg("samples").toInt() : 0;
+    uint16_t pretrigger = server.hasArg("pretrigger")? server.arg("pretrigger").toInt() : 0;
+    if (!cap_start(m_device(target), rate_hz, decimate, trigger, samples, pretrigger)) {
+      server.send(200, "application/json", json_error("invalid capture settings"));
+      return;
+    }
+    server.send(200, "application/json", json_ok());
+  });
+  server.on("/api/motor/capture/stop", HTTP_GET, [](){
+    add_headers()
+    check_auth()
+    cap_stop();
+    server.send(200, "application/json", json_ok());
+  });
+  server.on("/api/motor/capture/state", HTTP_GET, [](){
+    add_headers()
+    check_auth()
+    JsonObject& root = jsonbuf.createObject();
+    root["armed"] = state.capture.armed;
+    root["triggered"] = state.capture.triggered;
+    root["done"] = state.capture.done;
+    root["device"] = state.capture.device;
+    root["trigger"] = json_serialize_trigger(state.capture.trigger);
+    root["rate_hz"] = state.capture.rate_hz;
+    root["decimate"] = state.capture.decimate;
+    root["pretrigger"] = state.capture.pretrigger;
+    root["count"] = state.capture.count;
+    root["samplesize"] = cap_samplesize();
+    root["trigger_us"] = state.capture.trigger_us;
+    root["overruns"] = state.capture.overruns;
+    root["sample_us"] = state.capture.sample_us;
+    root["lock_max_us"] = state.capture.lock_max_us;
+    root["status"] = "ok";
+    JsonVariant v = root;
+    server.send(200, "application/json", v.as<String>());
+    jsonbuf.clear();
+  });
+  server.on("/api/motor/capture/read", HTTP_GET, [](){
+    add_headers()
+    check_auth()
+    if (state.capture.armed) {
+      server.send(200, "application/json", json_error("capture still running"));
+      return;
+    }
+
+    // Packed little endian samples, oldest first, streamed in chunks
+    size_t offset = server.hasArg("offset")? server.arg("offset").toInt() : 0;
+    size_t count = state.capture.count > offset? state.capture.count - offset : 0;
+    if (server.hasArg("count")) count = min(count, (size_t)server.arg("count").toInt());
+    core_release();
+    server.setContentLength(count * cap_samplesize());
+    server.send(200, "application/octet-stream", "");
+
+    uint8_t buf[1024];
+    while (count > 0) {
+      // Lock per chunk only, the socket write runs unlocked
+      size_t n = 0;
+      {
+        core_locked();
+        if (!state.capture.armed) n = cap_read(offset, buf, min(count, sizeof(buf) / cap_samplesize()));
+      }
+      if (n == 0) break;
+      server.sendContent_P((const char *)buf, n * cap_samplesize());
+      offset += n;
+      count -= n;
+    }
+  });
   server.on("/api/motor/stop", HTTP_GET, [](){
     add_headers()
     check_auth()
@@ -539,13 +930,21 @@ void api_initmotor() {
       server.send(200, "application/json", json_error("invalid argument. target must not be set."));
       return;
     }
-    JsonObject& root = jsonbuf.createObject();
-    JsonArray& arr = root.createNestedArray("queue");
-    cmdq_write(arr, queue_get(queue));
-    root["status"] = "ok";
-    JsonVariant v = root;
-    server.send(200, "application/json", v.as<String>());
-    jsonbuf.clear();
+    // Serialize from a copy, the queue keeps running while the response goes out
+    uint8_t data[QS_MAXLEN];
+    queue_t * q = queue_get(queue);
+    queue_t copy = { .len = min(q->len, sizeof(data)), .maxlen = sizeof(data), .Q = data };
+    memcpy(data, q->Q, copy.len);
+    core_release();
+    JsonStream js(server);
+    js.begin();
+    js.beginObject();
+    js.beginArray("queue");
+    cmdq_write(js, &copy);
+    js.endArray();
+    js.add("status", "ok");
+    js.endObject();
+    js.end();
   });
   server.on("/api/motor/queue/add", HTTP_POST, [](){
     add_headers()
@@ -618,6 +1017,29 @@ void api_initmotor() {
     m_copyqueue(target, queue, id, sourcequeue);
     server.send(200, "application/json", json_okid(id));
   });
+  server.on("/api/motor/arm", HTTP_GET, [](){
+    add_headers()
+    check_auth()
+    get_target()
+    if (!server.hasArg("armqueue")) {
+      server.send(200, "application/json", json_error("armqueue arg must be specified"));
+      return;
+    }
+    int armqueue = server.arg("armqueue").toInt();
+    id_t id = nextid();
+    m_arm(target, id, armqueue);
+    server.send(200, "application/json", json_okid(id));
+  });
+  server.on("/api/motor/fire", HTTP_GET, [](){
+    add_headers()
+    check_auth()
+    id_t id = nextid();
+    if (!daisy_fire(id)) {
+      server.send(200, "application/json", json_error("fire not sent to every board"));
+      return;
+    }
+    server.send(200, "application/json", json_okid(id));
+  });
   server.on("/api/motor/estop", HTTP_GET, [](){
     add_headers()
     check_auth()
@@ -628,6 +1050,48 @@ void api_initmotor() {
     m_estop(target, id, hiz, soft);
     server.send(200, "application/json", json_okid(id));
   });
+  server.on("/api/batch", HTTP_POST, [](){
+    add_headers()
+    check_auth()
+    String body = server.arg("plain");
+    body.trim();
+    batch_result_t results[BATCH_MAXRESULTS];
+    size_t count = 0;
+    if (body.startsWith("[")) {
+      JsonArray& arr = jsonbuf.parseArray(body);
+      if (!arr.success() || arr.size() > BATCH_MAXRESULTS) {
+        jsonbuf.clear();
+        server.send(200, "application/json", json_error("invalid batch"));
+        return;
+      }
+      for (auto value : arr) {
+        batch_result_t * r = &results[count++];
+        r->error = NULL;
+        r->id = cmdq_batch(value.as<JsonObject>(), &r->error);
+      }
+      jsonbuf.clear();
+
+    } else {
+      // Packed records, hex encoded since the plain arg can't carry NUL bytes
+      uint8_t data[BATCH_MAXSIZE];
+      int len = parse_hex(body, data, BATCH_MAXSIZE);
+      if (len < 0) {
+        server.send(200, "application/json", json_error("invalid batch"));
+        return;
+      }
+      size_t index = 0;
+      while (index < len && count < BATCH_MAXRESULTS) {
+        batch_result_t * r = &results[count++];
+        r->error = NULL;
+        r->id = 0;
+        size_t consume = cmdq_batch(&data[index], len - index, &r->id, &r->error);
+        if (consume == 0) break;
+        index += consume;
+      }
+    }
+    core_release();
+    batch_send(results, count);
+  });
 }
 
 void api_init() {
@@ -688,6 +1152,13 @@ void api_init() {
     obj["probed"] = state.service.crypto.probed;
     obj["available"] = !state.service.crypto.fault && state.service.crypto.available;
     obj["provisioned"] = state.service.crypto.provisioned;
+    obj["wakes"] = state.service.crypto.wakes;
+    obj["hmacs"] = state.service.crypto.hmacs;
+    obj["hmac_rate"] = state.service.crypto.hmac_rate;
+    obj["rand_level"] = state.service.crypto.rand_level;
+    obj["rand_fills"] = state.service.crypto.rand_fills;
+    obj["rand_fallbacks"] = state.service.crypto.rand_fallbacks;
+    obj["rand_rate"] = state.service.crypto.rand_rate;
     obj["status"] = "ok";
     JsonVariant v = obj;
     server.send(200, "application/json", v.as<String>());
@@ -713,16 +1184,17 @@ void api_init() {
       return;
     }
 
-    // Loop waiting for crypto
-    for (size_t i = 0; i < 500; i++) {
-      yield();
-//      ESP.wdtFeed();
-      ecc_loop(millis());
+    // The main loop runs the crypto commands, wait for them without holding the lock
+    core_release();
+    int mark = 0;
+    for (unsigned long start = millis(); mark == 0 && timesince(start, millis()) < CRYPTO_SETTIMEOUT; ) {
       delay(1);
+      core_locked();
+      mark = sketch.service.crypto.mark;
     }
 
     // Send response
-    if (sketch.service.crypto.mark != ECC_SUCCESS) {
+    if (mark != ECC_SUCCESS) {
       server.send(200, "application/json", json_error("Crypto configuration failed. (Check master key)"));
     } else {
       server.send(200, "application/json", json_ok());
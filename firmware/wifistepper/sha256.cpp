@@ -25,19 +25,58 @@ uint8_t sha256InitState[] PROGMEM = {
   0x19,0xcd,0xe0,0x5b  // H7
 };
 
+#ifdef SHA256_HW
+
+void Sha256Class::init(void) {
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts(&ctx, 0);
+  byteCount = 0;
+}
+
+void Sha256Class::update(const uint8_t* data, size_t len) {
+  byteCount += len;
+  mbedtls_sha256_update(&ctx, data, len);
+}
+
+size_t Sha256Class::write(uint8_t data) {
+  update(&data, 1);
+  return 1;
+}
+
+uint8_t* Sha256Class::result(void) {
+  mbedtls_sha256_finish(&ctx, state.b);
+  mbedtls_sha256_free(&ctx);
+  return state.b;
+}
+
+#else
+
 void Sha256Class::init(void) {
   memcpy_P(state.b,sha256InitState,32);
   byteCount = 0;
   bufferOffset = 0;
 }
 
-uint32_t Sha256Class::ror32(uint32_t number, uint8_t bits) {
-  return ((number << (32-bits)) | (number >> bits));
-}
+#define ROR32(x,n)  (((x) >> (n)) | ((x) << (32-(n))))
+#define SIG0(x)     (ROR32(x,2) ^ ROR32(x,13) ^ ROR32(x,22))
+#define SIG1(x)     (ROR32(x,6) ^ ROR32(x,11) ^ ROR32(x,25))
+#define GAM0(x)     (ROR32(x,7) ^ ROR32(x,18) ^ ((x) >> 3))
+#define GAM1(x)     (ROR32(x,17) ^ ROR32(x,19) ^ ((x) >> 10))
+
+// Message schedule kept in place in the 16 word buffer
+#define W(i)        (buffer.w[(i)&15])
+#define SCHED(i)    (W(i) += GAM1(W((i)-2)) + W((i)-7) + GAM0(W((i)-15)))
+
+// One round without shuffling the working variables, callers rotate the names instead
+#define ROUND(a,b,c,d,e,f,g,h,i,w) { \
+    uint32_t t1 = h + SIG1(e) + (g ^ (e & (g ^ f))) + pgm_read_dword(sha256K+(i)) + (w); \
+    d += t1; \
+    h = t1 + SIG0(a) + ((b & c) | (a & (b | c))); \
+  }
 
 void Sha256Class::hashBlock() {
   uint8_t i;
-  uint32_t a,b,c,d,e,f,g,h,t1,t2;
+  uint32_t a,b,c,d,e,f,g,h;
 
   a=state.w[0];
   b=state.w[1];
@@ -47,25 +86,28 @@ void Sha256Class::hashBlock() {
   f=state.w[5];
   g=state.w[6];
   h=state.w[7];
-  
-  for (i=0; i<64; i++) {
-    if (i>=16) {
-      t1 = buffer.w[i&15] + buffer.w[(i-7)&15];
-      t2 = buffer.w[(i-2)&15];
-      t1 += ror32(t2,17) ^ ror32(t2,19) ^ (t2>>10);
-      t2 = buffer.w[(i-15)&15];
-      t1 += ror32(t2,7) ^ ror32(t2,18) ^ (t2>>3);
-      buffer.w[i&15] = t1;
-    }
-    t1 = h;
-    t1 += ror32(e,6) ^ ror32(e,11) ^ ror32(e,25); // ∑1(e)
-    t1 += g ^ (e & (g ^ f)); // Ch(e,f,g)
-    t1 += pgm_read_dword(sha256K+i); // Ki
-    t1 += buffer.w[i&15]; // Wi
-    t2 = ror32(a,2) ^ ror32(a,13) ^ ror32(a,22); // ∑0(a)
-    t2 += ((b & c) | (a & (b | c))); // Maj(a,b,c)
-    h=g; g=f; f=e; e=d+t1; d=c; c=b; b=a; a=t1+t2;
+
+  for (i=0; i<16; i+=8) {
+    ROUND(a,b,c,d,e,f,g,h,i+0,W(i+0));
+    ROUND(h,a,b,c,d,e,f,g,i+1,W(i+1));
+    ROUND(g,h,a,b,c,d,e,f,i+2,W(i+2));
+    ROUND(f,g,h,a,b,c,d,e,i+3,W(i+3));
+    ROUND(e,f,g,h,a,b,c,d,i+4,W(i+4));
+    ROUND(d,e,f,g,h,a,b,c,i+5,W(i+5));
+    ROUND(c,d,e,f,g,h,a,b,i+6,W(i+6));
+    ROUND(b,c,d,e,f,g,h,a,i+7,W(i+7));
   }
+  for (; i<64; i+=8) {
+    ROUND(a,b,c,d,e,f,g,h,i+0,SCHED(i+0));
+    ROUND(h,a,b,c,d,e,f,g,i+1,SCHED(i+1));
+    ROUND(g,h,a,b,c,d,e,f,i+2,SCHED(i+2));
+    ROUND(f,g,h,a,b,c,d,e,i+3,SCHED(i+3));
+    ROUND(e,f,g,h,a,b,c,d,i+4,SCHED(i+4));
+    ROUND(d,e,f,g,h,a,b,c,i+5,SCHED(i+5));
+    ROUND(c,d,e,f,g,h,a,b,i+6,SCHED(i+6));
+    ROUND(b,c,d,e,f,g,h,a,i+7,SCHED(i+7));
+  }
+
   state.w[0] += a;
   state.w[1] += b;
   state.w[2] += c;
@@ -91,6 +133,30 @@ size_t Sha256Class::write(uint8_t data) {
   return 1;
 }
 
+void Sha256Class::update(const uint8_t* data, size_t len) {
+  byteCount += len;
+
+  // Finish a partial block first
+  while (bufferOffset != 0 && len > 0) {
+    addUncounted(*data++);
+    len--;
+  }
+
+  // Whole blocks load a word at a time
+  for (; len >= BUFFER_SIZE; data += BUFFER_SIZE, len -= BUFFER_SIZE) {
+    for (uint8_t i=0; i<BUFFER_SIZE/4; i++) {
+      const uint8_t * p = &data[i*4];
+      buffer.w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+    hashBlock();
+  }
+
+  while (len > 0) {
+    addUncounted(*data++);
+    len--;
+  }
+}
+
 void Sha256Class::pad() {
   // Implement SHA-256 padding (fips180-2 §5.1.1)
 
@@ -129,6 +195,13 @@ uint8_t* Sha256Class::result(void) {
   return state.b;
 }
 
+#endif
+
+size_t Sha256Class::write(const uint8_t* data, size_t len) {
+  update(data, len);
+  return len;
+}
+
 #define HMAC_IPAD 0x36
 #define HMAC_OPAD 0x5c
 
@@ -164,4 +237,4 @@ uint8_t* Sha256Class::resultHmac(void) {
   for (i=0; i<HASH_LENGTH; i++) write(innerHash[i]);
   return result();
 }
-Sha256Class Sha256;
+Sha256Class Sha256;
@@ -4,6 +4,13 @@
 #include <inttypes.h>
 #include "Print.h"
 
+// Hash through mbedtls, which uses the ESP32 SHA accelerator when the core enables it
+//#define SHA256_HW
+
+#ifdef SHA256_HW
+#include "mbedtls/sha256.h"
+#endif
+
 #define HASH_LENGTH 32
 #define BLOCK_LENGTH 64
 
@@ -23,20 +30,24 @@ class Sha256Class : public Print
     void initHmac(const uint8_t* secret, int secretLength);
     uint8_t* result(void);
     uint8_t* resultHmac(void);
+    void update(const uint8_t* data, size_t len);
     virtual size_t write(uint8_t);
+    virtual size_t write(const uint8_t* data, size_t len);
     using Print::write;
   private:
     void pad();
     void addUncounted(uint8_t data);
     void hashBlock();
-    uint32_t ror32(uint32_t number, uint8_t bits);
     _buffer buffer;
     uint8_t bufferOffset;
     _state state;
     uint32_t byteCount;
     uint8_t keyBuffer[BLOCK_LENGTH];
     uint8_t innerHash[HASH_LENGTH];
+#ifdef SHA256_HW
+    mbedtls_sha256_context ctx;
+#endif
 };
 extern Sha256Class Sha256;
 
-#endif
+#endif
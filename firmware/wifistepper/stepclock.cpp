@@ -0,0 +1,238 @@
+#include <Arduino.h>
+#include <driver/rmt.h>
+
+#include "wifistepper.h"
+
+//#define STCK_DEBUG
+
+// Step clock profile player. The RMT peripheral clocks STCK straight out of item
+// memory, a task only expands the compact profile into items a chunk at a time.
+
+#define STCK_CHANNEL    (RMT_CHANNEL_0)
+#define STCK_MEMBLOCKS  (4)             // 256 items of RMT memory, ISR refills every 128 steps
+#define STCK_CLKDIV     (8)             // 80MHz APB -> 100ns tick
+#define STCK_TICKNS     (100)
+#define STCK_DURMAX     (32767)
+#define STCK_PULSE      (10)            // 1us high, datasheet minimum is well under that
+#define STCK_MAXPAD     (15)            // Idle items after a step, bounds the slowest step
+#define STCK_MINPERIOD  (2 * STCK_PULSE)
+#define STCK_MAXPERIOD  (STCK_PULSE + (1 + 2 * STCK_MAXPAD) * STCK_DURMAX)
+#define STCK_CHUNK      (256)
+// Every chunk is a fresh rmt_write_items, the channel restarts and loses about this many ticks.
+// The gap is trimmed from the last idle time of a chunk, but only when that idle time is
+// over 2 * STCK_CHAINGAP. Below 60us periods each 256 step chunk boundary runs ~30us late.
+#define STCK_CHAINGAP   (300)
+#define STCK_WAITTICKS  (pdMS_TO_TICKS(10))
+#define STCK_TASKPRIO   (2)
+#define STCK_TASKSTACK  (2048)
+
+#define STCK_MAGIC      (0x4B435453)    // "STCK"
+#define STCK_VERSION    (1)
+#define STCK_MAXLEN     (4096)
+
+#define STO_ENTER       (1000)
+
+typedef struct ispacked {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t segments;
+  uint32_t tick_ns;
+} stck_header_t;
+
+// Period is in 1/256 ticks and moves by dperiod after each step
+typedef struct ispacked {
+  uint32_t period;
+  int32_t dperiod;
+  uint32_t steps;
+} stck_segment_t;
+
+static uint8_t stck_buf[STCK_MAXLEN];
+static size_t stck_len = 0;
+static rmt_item32_t stck_items[2][STCK_CHUNK];
+static TaskHandle_t stck_task = NULL;
+static volatile bool stck_abort = false;
+
+static struct {
+  uint16_t segment;
+  uint32_t step;
+  int64_t period;
+} stck_cursor;
+
+#ifdef STCK_DEBUG
+#define stck_debug(...)   Serial.printf(__VA_ARGS__)
+#else
+#define stck_debug(...)
+#endif
+
+static inline const stck_header_t * stck_header() { return (const stck_header_t *)stck_buf; }
+static inline const stck_segment_t * stck_segment(uint16_t i) { return &((const stck_segment_t *)&stck_header()[1])[i]; }
+
+static bool stck_validate() {
+  const stck_header_t * h = stck_header();
+  if (stck_len < sizeof(stck_header_t) || h->magic != STCK_MAGIC || h->version != STCK_VERSION || h->tick_ns != STCK_TICKNS) return false;
+  if (h->segments == 0 || stck_len != sizeof(stck_header_t) + h->segments * sizeof(stck_segment_t)) return false;
+
+  uint32_t total = 0;
+  uint64_t ticks = 0;
+  for (uint16_t i = 0; i < h->segments; i++) {
+    const stck_segment_t * s = stck_segment(i);
+    int64_t first = s->period, last = first + (int64_t)s->dperiod * (s->steps - 1);
+    if (s->steps == 0 || (total + s->steps) < total) return false;
+    if (first < ((int64_t)STCK_MINPERIOD << 8) || first > ((int64_t)STCK_MAXPERIOD << 8)) return false;
+    if (last < ((int64_t)STCK_MINPERIOD << 8) || last > ((int64_t)STCK_MAXPERIOD << 8)) return false;
+    total += s->steps;
+    ticks += (uint64_t)((first + last) / 2) * s->steps >> 8;
+  }
+
+  state.stepclock.segments = h->segments;
+  state.stepclock.total = total;
+  state.stepclock.duration_ms = ticks * STCK_TICKNS / 1000000ULL;
+  return true;
+}
+
+// Expand steps into RMT items until the chunk is full, every step is whole within a chunk
+static size_t stck_fill(rmt_item32_t * items, size_t max) {
+  size_t n = 0;
+  while (!stck_abort && stck_cursor.segment < state.stepclock.segments) {
+    const stck_segment_t * s = stck_segment(stck_cursor.segment);
+    if (stck_cursor.step == s->steps) {
+      stck_cursor.segment += 1;
+      stck_cursor.step = 0;
+      if (stck_cursor.segment < state.stepclock.segments) stck_cursor.period = stck_segment(stck_cursor.segment)->period;
+      continue;
+    }
+
+    // Spread the low time evenly over one or more idle halves so none exceeds the 15 bit duration
+    uint32_t low = (uint32_t)(stck_cursor.period >> 8) - STCK_PULSE;
+    uint32_t pad = low > STCK_DURMAX? (low - STCK_DURMAX + 2 * STCK_DURMAX - 1) / (2 * STCK_DURMAX) : 0;
+    if ((n + 1 + pad) > max) break;
+
+    uint32_t halves = 1 + 2 * pad, part = low / halves, extra = low - part * halves;
+    for (uint32_t h = 0; h < halves; h++) {
+      uint32_t d = part + (h < extra? 1 : 0);
+      if (h == 0) {
+        items[n].level0 = 1;
+        items[n].duration0 = STCK_PULSE;
+        items[n].level1 = 0;
+        items[n].duration1 = d;
+        n += 1;
+      } else if (h & 1) {
+        items[n].level0 = 0;
+        items[n].duration0 = d;
+      } else {
+        items[n].level1 = 0;
+        items[n].duration1 = d;
+        n += 1;
+      }
+    }
+
+    stck_cursor.period += s->dperiod;
+    stck_cursor.step += 1;
+    state.stepclock.steps += 1;
+  }
+
+  if (n > 0 && items[n-1].duration1 > 2 * STCK_CHAINGAP) items[n-1].duration1 -= STCK_CHAINGAP;
+  return n;
+}
+
+static void stck_run(void * arg) {
+  uint8_t b = 0;
+  while (!stck_abort) {
+    size_t n = stck_fill(stck_items[b], STCK_CHUNK);
+    if (n == 0) break;
+
+    // Wait for the previous chunk in slices, stck_stop() halts the channel mid chunk
+    while (rmt_wait_tx_done(STCK_CHANNEL, STCK_WAITTICKS) != ESP_OK && !stck_abort);
+    if (stck_abort) break;
+
+    rmt_write_items(STCK_CHANNEL, stck_items[b], n, false);
+    state.stepclock.chunks += 1;
+    b ^= 1;
+  }
+
+  while (!stck_abort && rmt_wait_tx_done(STCK_CHANNEL, STCK_WAITTICKS) != ESP_OK);
+  if (stck_abort) {
+    // Covers a chunk started just after stck_stop(). A stopped channel never raises the
+    // tx end interrupt that releases the driver, so reinstall it for the next profile.
+    rmt_tx_stop(STCK_CHANNEL);
+    rmt_driver_uninstall(STCK_CHANNEL);
+    rmt_driver_install(STCK_CHANNEL, 0, 0);
+  }
+
+  stck_debug("STCK done (%u steps)\n", state.stepclock.steps);
+  state.stepclock.running = false;
+  stck_task = NULL;
+  vTaskDelete(NULL);
+}
+
+void stck_init() {
+  rmt_config_t cfg;
+  memset(&cfg, 0, sizeof(rmt_config_t));
+  cfg.rmt_mode = RMT_MODE_TX;
+  cfg.channel = STCK_CHANNEL;
+  cfg.gpio_num = (gpio_num_t)STCK_PIN;
+  cfg.mem_block_num = STCK_MEMBLOCKS;
+  cfg.clk_div = STCK_CLKDIV;
+  cfg.tx_config.loop_en = false;
+  cfg.tx_config.carrier_en = false;
+  cfg.tx_config.idle_output_en = true;
+  cfg.tx_config.idle_level = RMT_IDLE_LEVEL_LOW;
+  rmt_config(&cfg);
+  rmt_driver_install(STCK_CHANNEL, 0, 0);
+}
+
+bool stck_load(size_t offset, const uint8_t * data, size_t len) {
+  if (state.stepclock.pending || state.stepclock.running) return false;
+  if (offset > stck_len || (offset + len) > STCK_MAXLEN) return false;
+
+  // Writing at zero starts a new profile, later writes append
+  memcpy(&stck_buf[offset], data, len);
+  stck_len = offset + len;
+  state.stepclock.loaded = stck_validate();
+  return true;
+}
+
+bool stck_play(id_t id, ps_direction dir) {
+  if (!state.stepclock.loaded || state.stepclock.pending || state.stepclock.running) return false;
+
+  // Let the queue put the driver into step-clock mode, pulses start once status shows it
+  if (!cmd_stepclock(Q0, id, dir)) return false;
+  state.stepclock.pending = true;
+  state.stepclock.id = id;
+  sketch.stepclock.requested = millis();
+  return true;
+}
+
+void stck_stop() {
+  state.stepclock.pending = false;
+  if (state.stepclock.running) {
+    // Halt the chunk already in RMT memory too, it holds up to 256 steps
+    stck_abort = true;
+    rmt_tx_stop(STCK_CHANNEL);
+  }
+}
+
+void stck_loop(unsigned long now) {
+  if (state.stepclock.pending) {
+    if (state.motor.status.step_clock) {
+      state.stepclock.pending = false;
+      state.stepclock.running = true;
+      state.stepclock.steps = 0;
+      state.stepclock.chunks = 0;
+      stck_cursor.segment = 0;
+      stck_cursor.step = 0;
+      stck_cursor.period = stck_segment(0)->period;
+      stck_abort = false;
+      stck_debug("STCK start (%u steps, %u ms)\n", state.stepclock.total, state.stepclock.duration_ms);
+      xTaskCreatePinnedToCore(stck_run, "stck", STCK_TASKSTACK, NULL, STCK_TASKPRIO, &stck_task, 1);
+
+    } else if (timesince(sketch.stepclock.requested, now) > STO_ENTER) {
+      state.stepclock.pending = false;
+      seterror(ESUB_MOTOR, state.stepclock.id, ETYPE_MSG);
+    }
+
+  } else if (state.stepclock.running && !state.motor.status.step_clock) {
+    // Another motion command took the driver out of step-clock mode
+    stck_stop();
+  }
+}
@@ -0,0 +1,201 @@
+#include <Arduino.h>
+
+#include "wifistepper.h"
+#include "motortune.h"
+
+//#define TUNE_DEBUG
+
+// Voltage mode auto tuning. KVAL and BEMF compensation start from the motor's electrical
+// data, then a speed sweep on Q0 adds slope wherever the motor stalls. Every register change
+// goes through motorcfg_push from HiZ, which INT_SPEED, ST_SLP and FN_SLP require.
+
+#define TTO_DWELL       (500)
+#define TTO_SETTLE      (1000)
+#define TTO_STOP        (5000)
+
+static mt_motor tune_motor;
+static mt_vmparams tune_base;
+static mt_sweep tune_sweep;
+static motor_config tune_saved;
+static bool tune_save = false;
+static bool tune_abort = false;
+static bool tune_waithiz = false;
+
+#ifdef TUNE_DEBUG
+#define tune_debug(...)   Serial.printf(__VA_ARGS__)
+#else
+#define tune_debug(...)
+#endif
+
+static void tune_setconfig(motor_config * cfg, const mt_vmparams * p) {
+  cfg->vm.kthold = p->kthold;
+  cfg->vm.ktrun = p->ktrun;
+  cfg->vm.ktaccel = p->ktaccel;
+  cfg->vm.ktdecel = p->ktdecel;
+  cfg->vm.bemf_slopel = p->slopel;
+  cfg->vm.bemf_speedco = p->speedco;
+  cfg->vm.bemf_slopehacc = p->slopehacc;
+  cfg->vm.bemf_slopehdec = p->slopehdec;
+}
+
+static void tune_publish(const mt_vmparams * p) {
+  state.tune.speed = tune_sweep.speed;
+  state.tune.held = tune_sweep.held;
+  state.tune.boost = tune_sweep.boost;
+  state.tune.kthold = p->kthold;
+  state.tune.ktrun = p->ktrun;
+  state.tune.slopel = p->slopel;
+  state.tune.speedco = p->speedco;
+  state.tune.slopeh = p->slopehacc;
+}
+
+static void tune_phase(uint8_t phase, unsigned long now) {
+  state.tune.phase = phase;
+  sketch.tune.at = now;
+}
+
+static void tune_hiz(unsigned long now) {
+  cmd_stop(Q0, state.tune.id, true, true);
+  tune_phase(TUNE_FINISH, now);
+}
+
+static void tune_fail(unsigned long now) {
+  tune_debug("TUNE failed in phase %u\n", state.tune.phase);
+  seterror(ESUB_MOTOR, state.tune.id, ETYPE_MSG);
+  tune_abort = true;
+  tune_hiz(now);
+}
+
+bool tune_start(id_t id, float resistance, float inductance, float ke, float current, float holdcurrent, float vs, float limit, bool save) {
+  if (state.tune.phase != TUNE_IDLE || config.motor.mode != MODE_VOLTAGE) return false;
+  if (state.motor.status.busy || state.motor.status.movement != M_STOPPED) return false;
+  if (vs <= 0) vs = state.motor.vin;
+  if (resistance <= 0 || inductance < 0 || ke < 0 || current <= 0 || holdcurrent < 0 || vs <= 0 || limit <= MT_SWEEP_START) return false;
+
+  mt_motor m = { .resistance = resistance, .inductance = inductance, .ke = ke, .current = current, .holdcurrent = holdcurrent, .vs = vs };
+  tune_motor = m;
+  tune_base = mt_compute(&tune_motor);
+  mt_sweepbegin(&tune_sweep, limit);
+  tune_publish(&tune_base);
+  memcpy(&tune_saved, &config.motor, sizeof(motor_config));
+  tune_save = save;
+  tune_abort = false;
+  tune_waithiz = false;
+
+  state.tune.id = id;
+  state.tune.trials = 0;
+  state.tune.maxspeed = 0;
+  state.tune.done = false;
+  cmdq_empty(Q0, id);
+  cmd_stop(Q0, id, true, true);
+  tune_phase(TUNE_PUSH, millis());
+  tune_debug("TUNE start (kt %.2f%%, slopel %.4f, speedco %.1f, slopeh %.4f)\n", tune_base.ktrun, tune_base.slopel, tune_base.speedco, tune_base.slopehacc);
+  return true;
+}
+
+void tune_stop(bool hiz) {
+  if (state.tune.phase == TUNE_IDLE || tune_abort) return;
+  tune_abort = true;
+  cmdq_empty(Q0, state.tune.id);
+  if (hiz) {
+    tune_hiz(millis());
+  } else {
+    // Leave the motor as the caller stopped it, the old config goes back in at the next HiZ
+    tune_waithiz = true;
+    tune_phase(TUNE_FINISH, millis());
+  }
+}
+
+void tune_loop(unsigned long now) {
+  const ps_status * st = &state.motor.status;
+  unsigned long elapsed = timesince(sketch.tune.at, now);
+
+  switch (state.tune.phase) {
+    case TUNE_IDLE:
+      break;
+
+    case TUNE_PUSH: {
+      // Slope registers only take writes in HiZ
+      if (!st->hiz) {
+        if (elapsed > TTO_STOP) tune_fail(now);
+        break;
+      }
+      mt_vmparams p = mt_apply(&tune_base, &tune_sweep);
+      tune_setconfig(&config.motor, &p);
+      config.motor.maxspeed = tune_sweep.limit;
+      motorcfg_push(&config.motor);
+      tune_publish(&p);
+    }
+    // Fall through - start the next trial on the pushed config
+
+    case TUNE_RUN:
+      cmd_clearerror();
+      cmd_run(Q0, state.tune.id, FWD, tune_sweep.speed);
+      state.tune.trials += 1;
+      tune_debug("TUNE trial %u at %.0f steps/s (boost %.4f)\n", state.tune.trials, tune_sweep.speed, tune_sweep.boost);
+      tune_phase(TUNE_ACCEL, now);
+      break;
+
+    case TUNE_ACCEL: {
+      // Give up on reaching speed after the ramp time plus settling, that counts as a stall
+      float ramp = tune_sweep.speed / max(config.motor.accel, 1.0f) * 1000.0;
+      bool stalled = st->alarms.stall_detect || st->alarms.overcurrent;
+      if (st->movement == M_CONSTSPEED || stalled) tune_phase(TUNE_DWELL, now);
+      else if (elapsed > (ramp + TTO_SETTLE)) tune_phase(TUNE_DWELL, now - TTO_DWELL);
+      break;
+    }
+
+    case TUNE_DWELL: {
+      if (elapsed < TTO_DWELL) break;
+      bool held = st->movement == M_CONSTSPEED && !st->alarms.stall_detect && !st->alarms.overcurrent;
+      bool changed = mt_sweepresult(&tune_sweep, held);
+      tune_debug("TUNE %s at %.0f steps/s\n", held? "held" : "stalled", st->stepss);
+      mt_vmparams p = mt_apply(&tune_base, &tune_sweep);
+      tune_publish(&p);
+      if (tune_sweep.done) {
+        tune_hiz(now);
+      } else {
+        cmd_stop(Q0, state.tune.id, changed, true);
+        tune_phase(changed? TUNE_PUSH : TUNE_STOP, now);
+      }
+      break;
+    }
+
+    case TUNE_STOP:
+      if (st->busy || st->movement != M_STOPPED) {
+        if (elapsed > TTO_STOP) tune_fail(now);
+        break;
+      }
+      tune_phase(TUNE_RUN, now);
+      break;
+
+    case TUNE_FINISH: {
+      if (!st->hiz) {
+        if (elapsed > TTO_STOP && !tune_waithiz) {
+          tune_abort = true;
+          tune_phase(TUNE_IDLE, now);
+          seterror(ESUB_MOTOR, state.tune.id, ETYPE_MSG);
+        }
+        break;
+      }
+
+      if (tune_abort || tune_sweep.held == 0) {
+        // Put back what was running before
+        memcpy(&config.motor, &tune_saved, sizeof(motor_config));
+        motorcfg_push(&config.motor);
+      } else {
+        mt_vmparams p = mt_apply(&tune_base, &tune_sweep);
+        tune_setconfig(&config.motor, &p);
+        config.motor.maxspeed = mt_maxspeed(&tune_sweep);
+        motorcfg_push(&config.motor);
+        if (tune_save) motorcfg_write(&config.motor);
+        tune_publish(&p);
+        state.tune.maxspeed = config.motor.maxspeed;
+        state.tune.done = true;
+        tune_debug("TUNE done, maxspeed %.0f steps/s after %u trials\n", state.tune.maxspeed, state.tune.trials);
+      }
+      tune_phase(TUNE_IDLE, now);
+      break;
+    }
+  }
+}
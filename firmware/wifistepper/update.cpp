@@ -211,7 +211,13 @@ size_t update_handlechunk(uint8_t * data, size_t length) {
             u->iserror = true;
             return 0;
           }
+          File md5fp = SPIFFS.open(String(datafile->filename) + FNAME_MD5SUFFIX, "w");
+          if (md5fp) {
+            md5fp.print(datafile->md5);
+            md5fp.close();
+          }
           update_files.push_back(String(datafile->filename));
+          update_files.push_back(String(datafile->filename) + FNAME_MD5SUFFIX);
           up_print("Updated file: ", datafile->filename);
           u->ontype = 0;
           u->preamblelen = u->length = 0;
@@ -253,6 +259,7 @@ void update_init() {
     flag_reboot = true;
     //if (sketch.update.preamble) free(sketch.update.preamble);
   }, []() {
+    core_locked();
     if (config.service.auth.enabled && !server.authenticate(config.service.auth.username, config.service.auth.password)) {
       return;
     }
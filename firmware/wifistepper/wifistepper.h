@@ -5,6 +5,8 @@
 
 #include "powerstep01.h"
 
+class JsonStream;
+
 #define PRODUCT           "Wi-Fi Stepper"
 #define MODEL             "wsx100"
 #define BRANCH            "stable"
@@ -17,6 +19,8 @@
 #define MOTOR_RSENSE      (0.0675)
 #define MOTOR_ADCCOEFF    (2.65625)
 #define MOTOR_CLOCK       (CLK_INT16)
+#define MOTOR_DEVICES     (1)
+#define STCK_PIN          (4)       // powerSTEP01 STCK, needs a bodge wire on wsx100
 
 #define FILE_MAXSIZE      (768)
 #define FNAME_WIFICFG     "/wificfg.json"
@@ -24,6 +28,7 @@
 #define FNAME_DAISYCFG    "/daisycfg.json"
 #define FNAME_MOTORCFG    "/motorcfg.json"
 #define FNAME_QUEUECFG    "/queue%dcfg.json"
+#define FNAME_MD5SUFFIX   ".md5"
 
 #define PORT_HTTP         (80)
 #define PORT_HTTPWS       (81)
@@ -50,6 +55,7 @@ typedef struct {
 } queue_t;
 
 #define QS_SIZE       (16)
+#define QS_MAXLEN     (1024)          // Largest queue (Q0)
 #define Q0            (&queue[0])
 
 extern queue_t queue[QS_SIZE];
@@ -68,7 +74,22 @@ unsigned long timesince(unsigned long t1, unsigned long t2);
   server.sendHeader("Access-Control-Allow-Methods", "GET, POST"); \
   server.sendHeader("Access-Control-Allow-Headers", "Authorization, application/json");
 
+// HTTP handlers run on their own task, the core lock serializes them with the main loop
+void core_lock();
+void core_unlock();
+
+struct _core_guard {
+  bool held;
+  _core_guard() : held(true) { core_lock(); }
+  ~_core_guard() { release(); }
+  void release() { if (held) { held = false; core_unlock(); } }
+};
+#define core_locked()   _core_guard __core_guard
+// Drops the lock taken by core_locked()/check_auth() early, handlers copy what they send first
+#define core_release()  __core_guard.release()
+
 #define check_auth() \
+  core_locked(); \
   if (config.service.auth.enabled && !server.authenticate(config.service.auth.username, config.service.auth.password)) { \
     return server.requestAuthentication(); \
   }
@@ -252,12 +273,62 @@ typedef struct {
     bool probed;
     bool available;
     bool provisioned;
+    uint32_t wakes;
+    uint32_t hmacs;
+    float hmac_rate;
+    uint32_t retries;
+    uint32_t short_replies;
+    uint32_t timeouts;
+    uint16_t queue;
+    uint16_t queue_max;
+    uint16_t arena;
+    uint16_t arena_max;
+    uint16_t rand_level;
+    uint32_t rand_fills;
+    uint32_t rand_fallbacks;
+    float rand_rate;
   } crypto;
+  struct {
+    uint32_t handlers;
+    uint32_t hold_us;
+    uint32_t hold_max_us;
+  } http;
+  struct {
+    uint32_t last_us;
+    uint32_t avg_us;
+    uint32_t max_us;
+    uint32_t slow;
+  } loop;
 } service_state;
 
+typedef struct ispacked {
+  uint32_t forward_us;
+  uint32_t forward_max_us;
+  uint32_t duplicates;
+  uint32_t outoforder;
+  uint32_t fires;
+  uint32_t fire_late_us;
+  id_t fire_id;
+  uint32_t fires_missed;
+  uint32_t rx_bytes;
+  uint32_t rx_frames;
+  uint32_t forward_bytes;
+  uint32_t forward_frames;
+  uint32_t parse_errors;
+  uint16_t outbox_max;
+} daisy_linkstate;
+
 typedef struct {
   bool active;
   uint8_t slaves;
+  uint32_t ring_us;
+  uint32_t hop_us;
+  uint32_t retransmits;
+  uint32_t failures;
+  uint16_t backlog;
+  uint16_t backlog_max;
+  id_t fire_id;
+  daisy_linkstate link;
 } daisy_state;
 
 typedef struct ispacked {
@@ -266,8 +337,67 @@ typedef struct ispacked {
   int pos;
   int mark;
   float vin;
+  uint16_t sample_ms;
+  float sample_hz;
 } motor_state;
 
+typedef struct {
+  bool loaded;
+  bool pending;
+  bool running;
+  id_t id;
+  uint16_t segments;
+  uint32_t total;
+  uint32_t steps;
+  uint32_t chunks;
+  uint32_t duration_ms;
+} stepclock_state;
+
+#define CAP_TRIG_NOW      (0x0)
+#define CAP_TRIG_COMMAND  (0x1)
+#define CAP_TRIG_MOVE     (0x2)
+#define CAP_TRIG_ALARM    (0x3)
+
+typedef struct {
+  bool armed;
+  bool triggered;
+  bool done;
+  uint8_t device;
+  uint8_t trigger;
+  uint16_t rate_hz;
+  uint16_t decimate;
+  uint16_t pretrigger;
+  uint16_t count;
+  uint32_t trigger_us;
+  uint32_t overruns;
+  uint32_t sample_us;
+  uint32_t lock_max_us;
+} capture_state;
+
+#define TUNE_IDLE         (0x0)
+#define TUNE_PUSH         (0x1)
+#define TUNE_RUN          (0x2)
+#define TUNE_ACCEL        (0x3)
+#define TUNE_DWELL        (0x4)
+#define TUNE_STOP         (0x5)
+#define TUNE_FINISH       (0x6)
+
+typedef struct {
+  uint8_t phase;
+  bool done;
+  id_t id;
+  uint16_t trials;
+  float speed;
+  float held;
+  float boost;
+  float maxspeed;
+  float kthold;
+  float ktrun;
+  float slopel;
+  float speedco;
+  float slopeh;
+} tune_state;
+
 typedef struct {
   error_state error;
   command_state command;
@@ -275,6 +405,9 @@ typedef struct {
   service_state service;
   daisy_state daisy;
   motor_state motor;
+  stepclock_state stepclock;
+  capture_state capture;
+  tune_state tune;
 } state_t;
 
 typedef struct {
@@ -293,6 +426,10 @@ typedef struct {
   } lowcom;
   struct {
     int mark;
+    unsigned long rate_at;
+    uint32_t rate_hmacs;
+    uint32_t rand_words;
+    uint32_t rate_rand;
   } crypto;
   struct {
     struct {
@@ -316,15 +453,30 @@ typedef struct ispacked {
   command_state command;
   wifi_state wifi;
   motor_state motor;
+  daisy_linkstate link;
 } daisy_slavestate;
 
+#define DAISY_LAPS        (4)         // Ring timings go by the quickest of this many laps
+
 typedef struct {
   daisy_slaveconfig config;
   daisy_slavestate state;
+  struct {
+    uint32_t ring_rtt_us;
+    uint32_t ring_rtt_max_us;
+    uint32_t turnaround_us;
+    uint32_t laps[DAISY_LAPS];
+    uint8_t lap_at;
+  } echo;
 } daisy_slave_t;
 
 typedef struct {
   daisy_slave_t * slave;
+  unsigned long rx_us;
+  unsigned long tx_us;        // When the UART is done sending what's been written
+  uint32_t laps[DAISY_LAPS];
+  uint8_t lap_at;
+  uint8_t echo;
   struct {
     unsigned long ping_rx;
     unsigned long ping_tx;
@@ -347,15 +499,37 @@ typedef struct {
   struct {
     unsigned int status;
     unsigned int state;
+    unsigned int samplerate;
   } last;
+  unsigned int samples;
+  struct {
+    bool armed;
+    bool pending;
+    uint8_t queue;
+    id_t id;
+    uint32_t delay_us;
+    id_t fire;
+    bool resent;
+    unsigned long at;
+  } arm;
 } motor_sketch;
 
+typedef struct {
+  unsigned long requested;
+} stepclock_sketch;
+
+typedef struct {
+  unsigned long at;
+} tune_sketch;
+
 typedef struct {
   wifi_sketch wifi;
   service_sketch service;
   daisy_sketch daisy;
   update_sketch update;
   motor_sketch motor;
+  stepclock_sketch stepclock;
+  tune_sketch tune;
 } sketch_t;
 
 
@@ -363,6 +537,7 @@ typedef struct {
 typedef struct ispacked {
   id_t id;
   uint8_t opcode;
+  uint8_t device;
 } cmd_head_t;
 
 typedef struct ispacked {
@@ -401,6 +576,14 @@ typedef struct ispacked {
   ps_direction dir;
 } cmd_releasesw_t;
 
+typedef struct ispacked {
+  ps_direction dir;
+  float fast;
+  float slow;
+  uint32_t backoff;
+  int32_t pos;
+} cmd_homestall_t;
+
 typedef struct ispacked {
   int32_t pos;
 } cmd_setpos_t;
@@ -417,6 +600,11 @@ typedef struct ispacked {
   uint8_t targetqueue;
 } cmd_runqueue_t;
 
+typedef struct ispacked {
+  uint8_t armqueue;
+  uint32_t delay_us;
+} cmd_arm_t;
+
 
 void cmd_init();
 void cmd_loop(unsigned long now);
@@ -424,8 +612,12 @@ void cmd_update(unsigned long now);
 
 // Commands for local Queue
 //bool cmd_nop(queue_t * q, id_t id);
+void cmd_device(uint8_t device);
+motor_state * cmd_getstate(uint8_t device);
 bool cmd_estop(id_t id, bool hiz, bool soft);
 void cmd_clearerror();
+bool cmd_arm(id_t id, uint8_t armqueue, uint32_t delay_us);
+bool cmd_fire(id_t fire, unsigned long when, bool resent);
 bool cmd_runqueue(queue_t * q, id_t id, uint8_t targetqueue);
 bool cmd_stop(queue_t * q, id_t id, bool hiz, bool soft);
 bool cmd_run(queue_t * q, id_t id, ps_direction dir, float stepss);
@@ -434,6 +626,7 @@ bool cmd_move(queue_t * q, id_t id, ps_direction dir, uint32_t microsteps);
 bool cmd_goto(queue_t * q, id_t id, int32_t pos, bool hasdir = false, ps_direction dir = FWD);
 bool cmd_gountil(queue_t * q, id_t id, ps_posact action, ps_direction dir, float stepss);
 bool cmd_releasesw(queue_t * q, id_t id, ps_posact action, ps_direction dir);
+bool cmd_homestall(queue_t * q, id_t id, ps_direction dir, float fast, float slow, uint32_t backoff, int32_t pos);
 bool cmd_gohome(queue_t * q, id_t id);
 bool cmd_gomark(queue_t * q, id_t id);
 bool cmd_resetpos(queue_t * q, id_t id);
@@ -449,6 +642,9 @@ void cmdq_read(JsonArray& arr, uint8_t target, uint8_t queue);
 void cmdq_read(JsonArray& arr, uint8_t target);
 void cmdq_read(JsonArray& arr);
 void cmdq_write(JsonArray& arr, queue_t * queue);
+void cmdq_write(JsonStream& js, queue_t * queue);
+id_t cmdq_batch(JsonObject& entry, const char ** error);
+size_t cmdq_batch(const uint8_t * data, size_t len, id_t * id, const char ** error);
 bool cmdq_empty(queue_t * q, id_t id);
 bool cmdq_copy(queue_t * q, id_t id, queue_t * sourcequeue);
 
@@ -461,6 +657,11 @@ void daisy_update(unsigned long now);
 bool daisy_clearerror(uint8_t target, id_t id);
 bool daisy_wificontrol(uint8_t target, id_t id, bool enabled);
 
+// Synchronized start
+uint32_t daisy_firedelay(uint8_t target);
+bool daisy_arm(uint8_t target, id_t id, uint8_t armqueue);
+bool daisy_fire(id_t id);
+
 // Remote queue commands
 bool daisy_stop(uint8_t target, uint8_t q, id_t id, bool hiz, bool soft);
 bool daisy_run(uint8_t target, uint8_t q, id_t id, ps_direction dir, float stepss);
@@ -469,6 +670,7 @@ bool daisy_move(uint8_t target, uint8_t q, id_t id, ps_direction dir, uint32_t m
 bool daisy_goto(uint8_t target, uint8_t q, id_t id, int32_t pos, bool hasdir = false, ps_direction dir = FWD);
 bool daisy_gountil(uint8_t target, uint8_t q, id_t id, ps_posact action, ps_direction dir, float stepss);
 bool daisy_releasesw(uint8_t target, uint8_t q, id_t id, ps_posact action, ps_direction dir);
+bool daisy_homestall(uint8_t target, uint8_t q, id_t id, ps_direction dir, float fast, float slow, uint32_t backoff, int32_t pos);
 bool daisy_gohome(uint8_t target, uint8_t q, id_t id);
 bool daisy_gomark(uint8_t target, uint8_t q, id_t id);
 bool daisy_resetpos(uint8_t target, uint8_t q, id_t id);
@@ -485,9 +687,26 @@ bool daisy_emptyqueue(uint8_t target, uint8_t q, id_t id);
 bool daisy_copyqueue(uint8_t target, uint8_t q, id_t id, uint8_t sourcequeue);
 bool daisy_savequeue(uint8_t target, uint8_t q, id_t id);
 bool daisy_loadqueue(uint8_t target, uint8_t q, id_t id);
+bool daisy_writequeue(uint8_t target, uint8_t q, id_t id, queue_t * src);
 bool daisy_estop(uint8_t target, id_t id, bool hiz, bool soft);
 
 
+void stck_init();
+void stck_loop(unsigned long now);
+bool stck_load(size_t offset, const uint8_t * data, size_t len);
+bool stck_play(id_t id, ps_direction dir);
+void stck_stop();
+
+void cap_init();
+bool cap_start(uint8_t device, uint16_t rate_hz, uint16_t decimate, uint8_t trigger, uint16_t samples, uint16_t pretrigger);
+void cap_stop();
+size_t cap_samplesize();
+size_t cap_read(size_t offset, uint8_t * out, size_t count);
+
+bool tune_start(id_t id, float resistance, float inductance, float ke, float current, float holdcurrent, float vs, float limit, bool save);
+void tune_stop(bool hiz);
+void tune_loop(unsigned long now);
+
 void lowcom_init();
 void lowcom_loop(unsigned long now);
 void lowcom_update(unsigned long now);
@@ -519,36 +738,45 @@ void motorcfg_push(motor_config * const cfg);
 
 void api_init();
 void websocket_init();
+void events_init();
+void events_loop(unsigned long now);
 void update_init();
 
 void mqtt_init();
 void mqtt_loop(unsigned long looptime);
 
 // Mux Functions
-static inline bool m_estop(uint8_t target, id_t id, bool hiz, bool soft) { if (target == 0) { return cmd_estop(id, hiz, soft); } else { return daisy_estop(target, id, hiz, soft); } }
-static inline bool m_clearerror(uint8_t target, id_t id) { if (target == 0) { clearerror(); return true; } else { return daisy_clearerror(target, id); } }
-static inline bool m_setconfig(uint8_t target, uint8_t q, id_t id, const char * data) { if (target == 0) { return cmd_setconfig(queue_get(q), id, data); } else { return daisy_setconfig(target, q, id, data); } }
-static inline bool m_stop(uint8_t target, uint8_t q, id_t id, bool hiz, bool soft) { if (target == 0) { return cmd_stop(queue_get(q), id, hiz, soft); } else { return daisy_stop(target, q, id, hiz, soft); } }
-static inline bool m_run(uint8_t target, uint8_t q, id_t id, ps_direction dir, float stepss) { if (target == 0) { return cmd_run(queue_get(q), id, dir, stepss); } else { return daisy_run(target, q, id, dir, stepss); } }
-static inline bool m_stepclock(uint8_t target, uint8_t q, id_t id, ps_direction dir) { if (target == 0) { return cmd_stepclock(queue_get(q), id, dir); } else { return daisy_stepclock(target, q, id, dir); } }
-static inline bool m_move(uint8_t target, uint8_t q, id_t id, ps_direction dir, uint32_t microsteps) { if (target == 0) { return cmd_move(queue_get(q), id, dir, microsteps); } else { return daisy_move(target, q, id, dir, microsteps); } }
-static inline bool m_goto(uint8_t target, uint8_t q, id_t id, int32_t pos, bool hasdir = false, ps_direction dir = FWD) { if (target == 0) { return cmd_goto(queue_get(q), id, pos, hasdir, dir); } else { return daisy_goto(target, q, id, pos, hasdir, dir); } }
-static inline bool m_gountil(uint8_t target, uint8_t q, id_t id, ps_posact action, ps_direction dir, float stepss) { if (target == 0) { return cmd_gountil(queue_get(q), id, action, dir, stepss); } else { return daisy_gountil(target, q, id, action, dir, stepss); } }
-static inline bool m_releasesw(uint8_t target, uint8_t q, id_t id, ps_posact action, ps_direction dir) { if (target == 0) { return cmd_releasesw(queue_get(q), id, action, dir); } else { return daisy_releasesw(target, q, id, action, dir); } }
-static inline bool m_gohome(uint8_t target, uint8_t q, id_t id) { if (target == 0) { return cmd_gohome(queue_get(q), id); } else { return daisy_gohome(target, q, id); } }
-static inline bool m_gomark(uint8_t target, uint8_t q, id_t id) { if (target == 0) { return cmd_gomark(queue_get(q), id); } else { return daisy_gomark(target, q, id); } }
-static inline bool m_resetpos(uint8_t target, uint8_t q, id_t id) { if (target == 0) { return cmd_resetpos(queue_get(q), id); } else { return daisy_resetpos(target, q, id); } }
-static inline bool m_setpos(uint8_t target, uint8_t q, id_t id, int32_t pos) { if (target == 0) { return cmd_setpos(queue_get(q), id, pos); } else { return daisy_setpos(target, q, id, pos); } }
-static inline bool m_setmark(uint8_t target, uint8_t q, id_t id, int32_t mark) { if (target == 0) { return cmd_setmark(queue_get(q), id, mark); } else { return daisy_setmark(target, q, id, mark); } }
-static inline bool m_waitbusy(uint8_t target, uint8_t q, id_t id) { if (target == 0) { return cmd_waitbusy(queue_get(q), id); } else { return daisy_waitbusy(target, q, id); } }
-static inline bool m_waitrunning(uint8_t target, uint8_t q, id_t id) { if (target == 0) { return cmd_waitrunning(queue_get(q), id); } else { return daisy_waitrunning(target, q, id); } }
-static inline bool m_waitms(uint8_t target, uint8_t q, id_t id, uint32_t ms) { if (target == 0) { return cmd_waitms(queue_get(q), id, ms); } else { return daisy_waitms(target, q, id, ms); } }
-static inline bool m_waitswitch(uint8_t target, uint8_t q, id_t id, bool state) { if (target == 0) { return cmd_waitswitch(queue_get(q), id, state); } else { return daisy_waitswitch(target, q, id, state); } }
-static inline bool m_runqueue(uint8_t target, uint8_t q, id_t id, uint8_t targetqueue) { if (target == 0) { return cmd_runqueue(queue_get(q), id, targetqueue); } else { return daisy_runqueue(target, q, id, targetqueue); } }
-static inline bool m_emptyqueue(uint8_t target, uint8_t q, id_t id) { if (target == 0) { return cmdq_empty(queue_get(q), id); } else { return daisy_emptyqueue(target, q, id); } }
-static inline bool m_savequeue(uint8_t target, uint8_t q, id_t id) { if (target == 0) { return queuecfg_write(q); } else { return daisy_savequeue(target, q, id); } }
-static inline bool m_loadqueue(uint8_t target, uint8_t q, id_t id) { if (target == 0) { return queuecfg_read(q); } else { return daisy_loadqueue(target, q, id); } }
-static inline bool m_copyqueue(uint8_t target, uint8_t q, id_t id, uint8_t sourcequeue) { if (target == 0) { return cmdq_copy(queue_get(q), id, queue_get(sourcequeue)); } else { return daisy_copyqueue(target, q, id, sourcequeue); } }
+// Extra local devices on the powerSTEP01 SPI daisy chain take the top target numbers, 255 is device 1
+#define m_islocal(target)       ((target) == 0 || ((target) > (0xFF - (MOTOR_DEVICES - 1)) && (target) <= 0xFF))
+#define m_device(target)        ((target) == 0? 0 : (uint8_t)(0x100 - (target)))
+#define m_target(device)        ((device) == 0? 0 : (uint8_t)(0x100 - (device)))
+#define m_local(target, call)   ({ cmd_device(m_device(target)); bool _r = (call); cmd_device(0); _r; })
+static inline bool m_estop(uint8_t target, id_t id, bool hiz, bool soft) { if (m_islocal(target)) { return cmd_estop(id, hiz, soft); } else { return daisy_estop(target, id, hiz, soft); } }
+static inline bool m_clearerror(uint8_t target, id_t id) { if (m_islocal(target)) { clearerror(); return true; } else { return daisy_clearerror(target, id); } }
+static inline bool m_setconfig(uint8_t target, uint8_t q, id_t id, const char * data) { if (m_islocal(target)) { return cmd_setconfig(queue_get(q), id, data); } else { return daisy_setconfig(target, q, id, data); } }
+static inline bool m_stop(uint8_t target, uint8_t q, id_t id, bool hiz, bool soft) { if (m_islocal(target)) { return m_local(target, cmd_stop(queue_get(q), id, hiz, soft)); } else { return daisy_stop(target, q, id, hiz, soft); } }
+static inline bool m_run(uint8_t target, uint8_t q, id_t id, ps_direction dir, float stepss) { if (m_islocal(target)) { return m_local(target, cmd_run(queue_get(q), id, dir, stepss)); } else { return daisy_run(target, q, id, dir, stepss); } }
+static inline bool m_stepclock(uint8_t target, uint8_t q, id_t id, ps_direction dir) { if (m_islocal(target)) { return m_local(target, cmd_stepclock(queue_get(q), id, dir)); } else { return daisy_stepclock(target, q, id, dir); } }
+static inline bool m_move(uint8_t target, uint8_t q, id_t id, ps_direction dir, uint32_t microsteps) { if (m_islocal(target)) { return m_local(target, cmd_move(queue_get(q), id, dir, microsteps)); } else { return daisy_move(target, q, id, dir, microsteps); } }
+static inline bool m_goto(uint8_t target, uint8_t q, id_t id, int32_t pos, bool hasdir = false, ps_direction dir = FWD) { if (m_islocal(target)) { return m_local(target, cmd_goto(queue_get(q), id, pos, hasdir, dir)); } else { return daisy_goto(target, q, id, pos, hasdir, dir); } }
+static inline bool m_gountil(uint8_t target, uint8_t q, id_t id, ps_posact action, ps_direction dir, float stepss) { if (m_islocal(target)) { return m_local(target, cmd_gountil(queue_get(q), id, action, dir, stepss)); } else { return daisy_gountil(target, q, id, action, dir, stepss); } }
+static inline bool m_releasesw(uint8_t target, uint8_t q, id_t id, ps_posact action, ps_direction dir) { if (m_islocal(target)) { return m_local(target, cmd_releasesw(queue_get(q), id, action, dir)); } else { return daisy_releasesw(target, q, id, action, dir); } }
+static inline bool m_homestall(uint8_t target, uint8_t q, id_t id, ps_direction dir, float fast, float slow, uint32_t backoff, int32_t pos) { if (m_islocal(target)) { return m_local(target, cmd_homestall(queue_get(q), id, dir, fast, slow, backoff, pos)); } else { return daisy_homestall(target, q, id, dir, fast, slow, backoff, pos); } }
+static inline bool m_gohome(uint8_t target, uint8_t q, id_t id) { if (m_islocal(target)) { return m_local(target, cmd_gohome(queue_get(q), id)); } else { return daisy_gohome(target, q, id); } }
+static inline bool m_gomark(uint8_t target, uint8_t q, id_t id) { if (m_islocal(target)) { return m_local(target, cmd_gomark(queue_get(q), id)); } else { return daisy_gomark(target, q, id); } }
+static inline bool m_resetpos(uint8_t target, uint8_t q, id_t id) { if (m_islocal(target)) { return m_local(target, cmd_resetpos(queue_get(q), id)); } else { return daisy_resetpos(target, q, id); } }
+static inline bool m_setpos(uint8_t target, uint8_t q, id_t id, int32_t pos) { if (m_islocal(target)) { return m_local(target, cmd_setpos(queue_get(q), id, pos)); } else { return daisy_setpos(target, q, id, pos); } }
+static inline bool m_setmark(uint8_t target, uint8_t q, id_t id, int32_t mark) { if (m_islocal(target)) { return m_local(target, cmd_setmark(queue_get(q), id, mark)); } else { return daisy_setmark(target, q, id, mark); } }
+static inline bool m_waitbusy(uint8_t target, uint8_t q, id_t id) { if (m_islocal(target)) { return m_local(target, cmd_waitbusy(queue_get(q), id)); } else { return daisy_waitbusy(target, q, id); } }
+static inline bool m_waitrunning(uint8_t target, uint8_t q, id_t id) { if (m_islocal(target)) { return m_local(target, cmd_waitrunning(queue_get(q), id)); } else { return daisy_waitrunning(target, q, id); } }
+static inline bool m_waitms(uint8_t target, uint8_t q, id_t id, uint32_t ms) { if (m_islocal(target)) { return cmd_waitms(queue_get(q), id, ms); } else { return daisy_waitms(target, q, id, ms); } }
+static inline bool m_waitswitch(uint8_t target, uint8_t q, id_t id, bool state) { if (m_islocal(target)) { return m_local(target, cmd_waitswitch(queue_get(q), id, state)); } else { return daisy_waitswitch(target, q, id, state); } }
+static inline bool m_runqueue(uint8_t target, uint8_t q, id_t id, uint8_t targetqueue) { if (m_islocal(target)) { return cmd_runqueue(queue_get(q), id, targetqueue); } else { return daisy_runqueue(target, q, id, targetqueue); } }
+static inline bool m_emptyqueue(uint8_t target, uint8_t q, id_t id) { if (m_islocal(target)) { return cmdq_empty(queue_get(q), id); } else { return daisy_emptyqueue(target, q, id); } }
+static inline bool m_savequeue(uint8_t target, uint8_t q, id_t id) { if (m_islocal(target)) { return queuecfg_write(q); } else { return daisy_savequeue(target, q, id); } }
+static inline bool m_loadqueue(uint8_t target, uint8_t q, id_t id) { if (m_islocal(target)) { return queuecfg_read(q); } else { return daisy_loadqueue(target, q, id); } }
+static inline bool m_arm(uint8_t target, id_t id, uint8_t armqueue) { if (m_islocal(target)) { return cmd_arm(id, armqueue, daisy_firedelay(0)); } else { return daisy_arm(target, id, armqueue); } }
+static inline bool m_copyqueue(uint8_t target, uint8_t q, id_t id, uint8_t sourcequeue) { if (m_islocal(target)) { return cmdq_copy(queue_get(q), id, queue_get(sourcequeue)); } else { return daisy_copyqueue(target, q, id, sourcequeue); } }
 
 
 // Utility functions
@@ -610,6 +838,14 @@ static inline ps_posact parse_action(const String& s, ps_posact d) {
   else                      return d;
 }
 
+static inline uint8_t parse_trigger(const String& s, uint8_t d) {
+  if (s == "now")           return CAP_TRIG_NOW;
+  else if (s == "command")  return CAP_TRIG_COMMAND;
+  else if (s == "move")     return CAP_TRIG_MOVE;
+  else if (s == "alarm")    return CAP_TRIG_ALARM;
+  else                      return d;
+}
+
 // JSON functions
 static inline const char * json_serialize(wifi_mode m) {
   switch (m) {
@@ -668,4 +904,14 @@ static inline const char * json_serialize(ps_movement m) {
   }
 }
 
+static inline const char * json_serialize_trigger(uint8_t t) {
+  switch (t) {
+    case CAP_TRIG_NOW:      return "now";
+    case CAP_TRIG_COMMAND:  return "command";
+    case CAP_TRIG_MOVE:     return "move";
+    case CAP_TRIG_ALARM:    return "alarm";
+    default:                return "";
+  }
+}
+
 #endif
@@ -4,6 +4,7 @@
 
 #include <ESPmDNS.h>
 #include <ArduinoOTA.h>
+#include <MD5Builder.h>
 
 #include <stdint.h>
 
@@ -20,6 +21,15 @@
 #define TYPE_JS       "application/javascript"
 #define TYPE_PNG      "image/png"
 
+// Asset URLs carry no version, an update only shows through revalidating the ETag
+#define CACHE_PAGE    "no-cache"
+#define CACHE_ASSET   "public, no-cache"
+
+#define HTTP_TASKSTACK  (8192)
+#define HTTP_TASKPRIO   (1)
+#define HTTP_TASKCORE   (0)
+#define LOOP_SLOWUS     (100000)
+
 #define WTO_REVERTAP  (5 * 60 * 1000)
 #define WTO_CONNECT   (1000)
 #define WTO_RSSI      (1000)
@@ -35,6 +45,13 @@ StaticJsonBuffer<2560> jsonbuf;
 volatile bool flag_reboot = false;
 volatile bool flag_wifiled = false;
 
+static SemaphoreHandle_t core_mutex = NULL;
+static TaskHandle_t http_task = NULL;
+static volatile bool core_waiting = false;
+static uint8_t core_depth = 0;
+static unsigned long core_at = 0;
+static unsigned long loop_at = 0;
+
 config_t config = {
   .wifi = {
     //.mode = M_STATION,
@@ -492,6 +509,7 @@ void motorcfg_pull(motor_config * cfg) {
 }
 
 void motorcfg_push(motor_config * cfg) {
+  ps_defer();
   ps_setsync(SYNC_BUSY);
   ps_setmode(cfg->mode);
   ps_setstepsize(cfg->stepsize);
@@ -523,6 +541,7 @@ void motorcfg_push(motor_config * cfg) {
   ps_setclocksel(MOTOR_CLOCK);
   
   ps_setalarmconfig(true, true, true, true);
+  ps_commit();
 
   // Clear errors at end of push
   cmd_clearerror();
@@ -569,8 +588,54 @@ void motorcfg_write(motor_config * cfg) {
   jsonbuf.clear();
 }
 
-void static_serve(String contenttype, String path) {
-  check_auth()
+static bool static_md5(const String& path, char * md5) {
+  // Sidecar written by the updater from the hash packed at image build time
+  File fp = SPIFFS.open(path + FNAME_MD5SUFFIX, "r");
+  if (fp) {
+    size_t len = fp.readBytes(md5, 32);
+    fp.close();
+    md5[len] = 0;
+    if (len == 32) return true;
+  }
+
+  // No sidecar (factory image), hash the file once and keep the result
+  fp = SPIFFS.open(path, "r");
+  if (!fp) return false;
+  MD5Builder builder;
+  builder.begin();
+  builder.addStream(fp, fp.size());
+  fp.close();
+  builder.calculate();
+  builder.getChars(md5);
+
+  fp = SPIFFS.open(path + FNAME_MD5SUFFIX, "w");
+  if (fp) {
+    fp.print(md5);
+    fp.close();
+  }
+  return true;
+}
+
+void static_serve(String contenttype, String path, const char * cache) {
+  {
+    check_auth()
+  }
+
+  // Files stream from SPIFFS without holding the core lock
+  char md5[33] = {0};
+  if (!static_md5(path, md5)) {
+    server.send(404, "text/plain", "File not found.");
+    return;
+  }
+
+  String etag = String("\"") + md5 + "\"";
+  server.sendHeader("ETag", etag);
+  server.sendHeader("Cache-Control", cache);
+  if (server.hasHeader("If-None-Match") && server.header("If-None-Match").indexOf(md5) >= 0) {
+    server.send(304, contenttype, "");
+    return;
+  }
+
   File fp = SPIFFS.open(path, "r");
   if (fp) {
     server.streamFile(fp, contenttype);
@@ -581,6 +646,9 @@ void static_serve(String contenttype, String path) {
 }
 
 void static_init() {
+  const char * headers[] = { "If-None-Match" };
+  server.collectHeaders(headers, sizeof(headers) / sizeof(headers[0]));
+
   server.on("/", [](){
     check_auth()
     String path = config.wifi.mode == M_ACCESSPOINT && memcmp(config.wifi.accesspoint.ssid, "wsx100-", 7) == 0? "/settings" : "/quickstart";
@@ -588,27 +656,63 @@ void static_init() {
     server.send(302, "text/plain", String("Redirect to ") + path);
   });
   
-  server.on("/quickstart", [](){ static_serve(TYPE_HTML, "/quickstart.html.gz"); });
-  server.on("/dashboard", [](){ static_serve(TYPE_HTML, "/dashboard.html.gz"); });
-  server.on("/settings", [](){ static_serve(TYPE_HTML, "/settings.html.gz"); });
-  server.on("/documentation", [](){ static_serve(TYPE_HTML, "/documentation.html.gz"); });
-  server.on("/troubleshoot", [](){ static_serve(TYPE_HTML, "/troubleshoot.html.gz"); });
-  server.on("/about", [](){ static_serve(TYPE_HTML, "/about.html.gz"); });
+  server.on("/quickstart", [](){ static_serve(TYPE_HTML, "/quickstart.html.gz", CACHE_PAGE); });
+  server.on("/dashboard", [](){ static_serve(TYPE_HTML, "/dashboard.html.gz", CACHE_PAGE); });
+  server.on("/settings", [](){ static_serve(TYPE_HTML, "/settings.html.gz", CACHE_PAGE); });
+  server.on("/documentation", [](){ static_serve(TYPE_HTML, "/documentation.html.gz", CACHE_PAGE); });
+  server.on("/troubleshoot", [](){ static_serve(TYPE_HTML, "/troubleshoot.html.gz", CACHE_PAGE); });
+  server.on("/about", [](){ static_serve(TYPE_HTML, "/about.html.gz", CACHE_PAGE); });
   
-  server.on("/js/axios.min.js", [](){ static_serve(TYPE_JS, "/js/axios.min.js.gz"); });
-  server.on("/js/clipboard.min.js", [](){ static_serve(TYPE_JS, "/js/clipboard.min.js.gz"); });
-  server.on("/js/prism.min.js", [](){ static_serve(TYPE_JS, "/js/prism.min.js.gz"); });
-  server.on("/js/vue.min.js", [](){ static_serve(TYPE_JS, "/js/vue.min.js.gz"); });
-  server.on("/js/vue-cookies.min.js", [](){ static_serve(TYPE_JS, "/js/vue-cookies.min.js.gz"); });
+  server.on("/js/axios.min.js", [](){ static_serve(TYPE_JS, "/js/axios.min.js.gz", CACHE_ASSET); });
+  server.on("/js/clipboard.min.js", [](){ static_serve(TYPE_JS, "/js/clipboard.min.js.gz", CACHE_ASSET); });
+  server.on("/js/prism.min.js", [](){ static_serve(TYPE_JS, "/js/prism.min.js.gz", CACHE_ASSET); });
+  server.on("/js/vue.min.js", [](){ static_serve(TYPE_JS, "/js/vue.min.js.gz", CACHE_ASSET); });
+  server.on("/js/vue-cookies.min.js", [](){ static_serve(TYPE_JS, "/js/vue-cookies.min.js.gz", CACHE_ASSET); });
 }
 
 
+void core_lock() {
+  if (core_mutex == NULL) return;
+  if (xSemaphoreTakeRecursive(core_mutex, 0) != pdTRUE) {
+    core_waiting = true;
+    xSemaphoreTakeRecursive(core_mutex, portMAX_DELAY);
+    core_waiting = false;
+  }
+  if (core_depth++ == 0) core_at = micros();
+}
+
+void core_unlock() {
+  if (core_mutex == NULL) return;
+  if (--core_depth == 0 && xTaskGetCurrentTaskHandle() == http_task) {
+    uint32_t held = micros() - core_at;
+    state.service.http.handlers += 1;
+    state.service.http.hold_us = held;
+    state.service.http.hold_max_us = max(state.service.http.hold_max_us, held);
+  }
+  xSemaphoreGiveRecursive(core_mutex);
+}
+
+static void http_run(void * arg) {
+  while (true) {
+    // One request per pass, handlers take the core lock in check_auth()
+    if (state.wifi.mode != M_OFF && config.service.http.enabled) {
+      server.handleClient();
+      events_loop(millis());
+    }
+    delay(1);
+  }
+}
+
 void setup() {
+  core_mutex = xSemaphoreCreateRecursiveMutex();
+
   // Initialize early subsystems
   {
     cmd_init();
     daisy_init();
     ecc_init();
+    stck_init();
+    cap_init();
 
     // Get wifi info from ESP
     state.wifi.chipid = ESP.getEfuseMac();
@@ -704,16 +808,21 @@ void setup() {
     }
 
     api_init();
+    events_init();
     static_init();
     //update_init();
     server.begin();
+    xTaskCreatePinnedToCore(http_run, "http", HTTP_TASKSTACK, NULL, HTTP_TASKPRIO, &http_task, HTTP_TASKCORE);
     websocket_init();
     mqtt_init();
   }
 
   // Initialize SPI and Stepper Motor config
   {
-    ps_spiinit();
+    ps_spiinit(MOTOR_DEVICES);
+#ifdef PS_BENCH
+    ps_bench();
+#endif
 
     // Read motor config
     File fp = SPIFFS.open(FNAME_MOTORCFG, "r");
@@ -741,8 +850,23 @@ void setup() {
   }
 }
 
-#define HANDLE_LOOPS()     ({ yield(); lowcom_loop(now); daisy_loop(now); ecc_loop(now); cmd_loop(now); yield(); })
+#define HANDLE_LOOPS()     ({ yield(); lowcom_loop(now); daisy_loop(now); ecc_loop(now); cmd_loop(now); stck_loop(now); tune_loop(now); yield(); })
 void loop() {
+  // Hand the core to a waiting HTTP handler between iterations. It runs on the other core
+  // and clears core_waiting once it owns the lock, a delay(1) here cost a whole tick.
+  while (core_waiting) taskYIELD();
+  core_locked();
+
+  unsigned long at = micros();
+  if (loop_at != 0) {
+    uint32_t gap = at - loop_at;
+    state.service.loop.last_us = gap;
+    state.service.loop.avg_us += ((int32_t)gap - (int32_t)state.service.loop.avg_us) / 16;
+    state.service.loop.max_us = max(state.service.loop.max_us, gap);
+    if (gap > LOOP_SLOWUS) state.service.loop.slow += 1;
+  }
+  loop_at = at;
+
   unsigned long now = millis();
 
   HANDLE_LOOPS();
@@ -756,11 +880,10 @@ void loop() {
       // Websockets aren't supported under auth, client must use http
       websocket.loop();
     }
-    server.handleClient();
   }
 
 #ifdef MAINLOOP_DEBUG
-  if ((millis() - now) > 100) Serial.printf("Mainloop warn after http: %lu\n", millis() - now);
+  if ((millis() - now) > 100) Serial.printf("Mainloop warn after websocket: %lu\n", millis() - now);
 #endif
 
   HANDLE_LOOPS();
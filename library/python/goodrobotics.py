@@ -52,6 +52,12 @@ class _ComCommon:
     _OPCODE_SETCONFIG = (0x06)
     _OPCODE_GETCONFIG = (0x07)
     _OPCODE_GETSTATE = (0x08)
+    _OPCODE_ARM = (0x09)
+    _OPCODE_FIRE = (0x0A)
+    _OPCODE_GETDAISY = (0x0B)
+    _OPCODE_STCKLOAD = (0x0C)
+    _OPCODE_STCKPLAY = (0x0D)
+    _OPCODE_STCKSTOP = (0x0E)
 
     _OPCODE_STOP = (0x11)
     _OPCODE_RUN = (0x12)
@@ -65,6 +71,7 @@ class _ComCommon:
     _OPCODE_RESETPOS = (0x1A)
     _OPCODE_SETPOS = (0x1B)
     _OPCODE_SETMARK = (0x1C)
+    _OPCODE_HOMESTALL = (0x1D)
 
     _OPCODE_WAITBUSY = (0x21)
     _OPCODE_WAITRUNNING = (0x22)
@@ -255,6 +262,31 @@ class _ComCommon:
         self._checkconnected()
         return self._waitreply(self._send(self._OPCODE_GETSTATE, self._SUBCODE_CMD, target, 0), self._SUBCODE_REPLY).rstrip('\x00')
 
+    def cmd_arm(self, target, armqueue):
+        self._checkconnected()
+        return self._waitreply(self._send(self._OPCODE_ARM, self._SUBCODE_CMD, target, 0, struct.pack('<B', armqueue)), self._SUBCODE_ACK)
+
+    def cmd_fire(self):
+        self._checkconnected()
+        return self._waitreply(self._send(self._OPCODE_FIRE, self._SUBCODE_CMD, 0, 0), self._SUBCODE_ACK)
+
+    def cmd_getdaisy(self, target):
+        self._checkconnected()
+        return self._waitreply(self._send(self._OPCODE_GETDAISY, self._SUBCODE_CMD, target, 0), self._SUBCODE_REPLY).rstrip('\x00')
+
+    def cmd_stckload(self, offset, data):
+        self._checkconnected()
+        return self._waitreply(self._send(self._OPCODE_STCKLOAD, self._SUBCODE_CMD, 0, 0, struct.pack('<H', offset) + data), self._SUBCODE_ACK)
+
+    def cmd_stckplay(self, dir):
+        self._checkconnected()
+        b_dir = 0x01 if dir else 0x00
+        return self._waitreply(self._send(self._OPCODE_STCKPLAY, self._SUBCODE_CMD, 0, 0, struct.pack('<B', b_dir)), self._SUBCODE_ACK)
+
+    def cmd_stckstop(self):
+        self._checkconnected()
+        return self._waitreply(self._send(self._OPCODE_STCKSTOP, self._SUBCODE_CMD, 0, 0), self._SUBCODE_ACK)
+
     def cmd_stop(self, target, queue, hiz, soft):
         self._checkconnected()
         b_hiz = 0x01 if hiz else 0x00
@@ -288,6 +320,11 @@ class _ComCommon:
         b_dir = 0x01 if dir else 0x00
         return self._waitreply(self._send(self._OPCODE_GOUNTIL, self._SUBCODE_CMD, target, queue, struct.pack('<BBf', b_action, b_dir, stepss)), self._SUBCODE_ACK)
     
+    def cmd_homestall(self, target, queue, dir, fast, slow, backoff, pos):
+        self._checkconnected()
+        b_dir = 0x01 if dir else 0x00
+        return self._waitreply(self._send(self._OPCODE_HOMESTALL, self._SUBCODE_CMD, target, queue, struct.pack('<BffIi', b_dir, fast, slow, backoff, pos)), self._SUBCODE_ACK)
+
     def cmd_releasesw(self, target, queue, action, dir):
         self._checkconnected()
         b_action = 0x01 if action else 0x00
@@ -484,6 +521,15 @@ class WifiStepper:
     def hiz(self, target = None):
         return self.getstate(target).get('hiz', None)
 
+    def arm(self, armqueue, target = None):
+        return self.__comm.cmd_arm(self._target(target), armqueue)
+
+    def fire(self):
+        return self.__comm.cmd_fire()
+
+    def getdaisy(self, target = None):
+        return json.loads(self.__comm.cmd_getdaisy(self._target(target)), object_hook=_ascii_encode_dict)
+
     def stop(self, hiz = True, soft = True, target = None, queue = 0):
         return self.__comm.cmd_stop(self._target(target), queue, hiz, soft)
 
@@ -493,6 +539,17 @@ class WifiStepper:
     def stepclock(self, dir, target = None, queue = 0):
         return self.__comm.cmd_stepclock(self._target(target), queue, dir)
 
+    def loadprofile(self, profile, chunk = 512):
+        # Compiled step clock profile, see stepprofile.py
+        for offset in range(0, len(profile), chunk):
+            self.__comm.cmd_stckload(offset, profile[offset:offset+chunk])
+
+    def playprofile(self, dir):
+        return self.__comm.cmd_stckplay(dir)
+
+    def stopprofile(self):
+        return self.__comm.cmd_stckstop()
+
     def move(self, dir, microsteps, target = None, queue = 0):
         return self.__comm.cmd_move(self._target(target), queue, dir, microsteps)
 
@@ -502,6 +559,9 @@ class WifiStepper:
     def gountil(self, action, dir, stepss, target = None, queue = 0):
         return self.__comm.cmd_gountil(self._target(target), queue, action, dir, stepss)
 
+    def homestall(self, dir, fast, slow, backoff = 0, pos = 0, target = None, queue = 0):
+        return self.__comm.cmd_homestall(self._target(target), queue, dir, fast, slow, backoff, pos)
+
     def releasesw(self, action, dir, target = None, queue = 0):
         return self.__comm.cmd_releasesw(self._target(target), queue, action, dir)
 
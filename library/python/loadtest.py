@@ -0,0 +1,82 @@
+#!/usr/bin/env python
+# Concurrent HTTP load against a Wi-Fi Stepper while watching main loop latency.
+#
+# Worker threads request the given endpoints back to back. The firmware reports the
+# longest gap between main loop iterations and the longest core lock hold of an HTTP
+# handler in /api/service/state, the window is reset before the run starts.
+
+import threading
+import time
+import json
+import base64
+
+try:
+    from urllib.request import Request, urlopen
+except ImportError:
+    from urllib2 import Request, urlopen
+
+DEFAULT_PATHS = ['/api/motor/state', '/api/motor/get', '/api/motor/queue/get', '/api/motor/capture/read?count=512', '/']
+
+class LoadTest:
+    def __init__(self, host, username=None, password=None, timeout=5.0):
+        self.host = host
+        self.timeout = timeout
+        self.auth = None
+        if username is not None:
+            self.auth = 'Basic ' + base64.b64encode(('%s:%s' % (username, password)).encode('utf-8')).decode('ascii')
+        self.lock = threading.Lock()
+        self.requests = 0
+        self.failures = 0
+        self.bytes = 0
+
+    def _get(self, path):
+        req = Request('http://%s%s' % (self.host, path))
+        if self.auth is not None: req.add_header('Authorization', self.auth)
+        return urlopen(req, timeout=self.timeout).read()
+
+    def state(self, reset=False):
+        return json.loads(self._get('/api/service/state' + ('?reset=true' if reset else '')).decode('utf-8'))
+
+    def _worker(self, paths, until):
+        i = 0
+        while time.time() < until:
+            try:
+                n = len(self._get(paths[i % len(paths)]))
+                with self.lock:
+                    self.requests += 1
+                    self.bytes += n
+            except Exception:
+                with self.lock: self.failures += 1
+            i += 1
+
+    def run(self, paths=DEFAULT_PATHS, clients=4, duration=30.0):
+        self.state(reset=True)
+        until = time.time() + duration
+        workers = [threading.Thread(target=self._worker, args=(paths[c:] + paths[:c], until)) for c in range(clients)]
+        for w in workers: w.start()
+        while time.time() < until:
+            time.sleep(1.0)
+            s = self.state()
+            print("  loop last %6dus avg %6dus max %6dus slow %4d, http hold max %6dus" % (
+                s['loop']['last_us'], s['loop']['avg_us'], s['loop']['max_us'], s['loop']['slow'], s['http']['hold_max_us']))
+        for w in workers: w.join()
+        return self.state()
+
+
+if __name__ == '__main__':
+    import argparse
+
+    parser = argparse.ArgumentParser(description='Measure main loop latency under concurrent HTTP load')
+    parser.add_argument('--host', default='wsx100.local')
+    parser.add_argument('--username', help='http auth username, if auth is enabled')
+    parser.add_argument('--password', help='http auth password')
+    parser.add_argument('--clients', type=int, default=4, help='concurrent connections')
+    parser.add_argument('--duration', type=float, default=30.0, help='seconds')
+    parser.add_argument('paths', nargs='*', default=DEFAULT_PATHS, help='endpoints to request')
+    args = parser.parse_args()
+
+    t = LoadTest(args.host, args.username, args.password)
+    s = t.run(args.paths, args.clients, args.duration)
+    print("%d requests (%d failed), %.1f req/s, %.1f KB/s" % (t.requests, t.failures, t.requests / args.duration, t.bytes / args.duration / 1024.0))
+    print("worst main loop gap %dus, %d loops over the slow threshold, longest http lock hold %dus" % (
+        s['loop']['max_us'], s['loop']['slow'], s['http']['hold_max_us']))
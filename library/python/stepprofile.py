@@ -0,0 +1,169 @@
+#!/usr/bin/env python
+# Compiles motion profiles into the Wi-Fi Stepper step clock format.
+#
+# The firmware plays a list of segments, each a run of steps whose period changes
+# linearly from one step to the next. Profiles are given here either as absolute
+# step times or as a velocity curve and fit into as few segments as the tolerance allows.
+
+import struct
+import math
+
+MAGIC = 0x4B435453      # "STCK"
+VERSION = 1
+TICK_NS = 100
+PULSE = 10
+MINPERIOD = 2 * PULSE
+MAXPERIOD = PULSE + 31 * 32767
+MAXLEN = 4096
+
+_HEADER = '<IHHI'
+_SEGMENT = '<IiI'
+
+class ProfileError(Exception):
+    def __init__(self, message): self.message = message
+    def __str__(self): return str(self.message)
+
+
+def periods_from_times(times):
+    # Step times in seconds (first step at times[0]) -> one period per step in ticks.
+    # The last step has no successor to measure against, it repeats the period before it.
+    if len(times) < 2:
+        raise ProfileError("Profile needs at least two steps")
+    ticks = 1e9 / TICK_NS
+    periods = [(times[i+1] - times[i]) * ticks for i in range(len(times) - 1)]
+    return periods + [periods[-1]]
+
+def times_from_velocity(velocity, duration, dt = 1e-4):
+    # Integrate a velocity function (steps/s of time in s) and emit a time at each whole step
+    times = [0.0]
+    pos, t = 0.0, 0.0
+    while t < duration:
+        v0, v1 = abs(velocity(t)), abs(velocity(min(t + dt, duration)))
+        h = min(dt, duration - t)
+        step = (v0 + v1) / 2.0 * h
+        while pos + step >= len(times):
+            # Linear interpolation inside the integration step
+            frac = (len(times) - pos) / step
+            times.append(t + frac * h)
+        pos += step
+        t += h
+    return times
+
+def trapezoid(steps, maxspeed, accel, decel = None):
+    # Step times for a trapezoidal (or triangular) move
+    decel = accel if decel is None else decel
+    da = maxspeed ** 2 / (2.0 * accel)
+    dd = maxspeed ** 2 / (2.0 * decel)
+    if da + dd > steps:
+        da = steps * decel / (accel + decel)
+        dd = steps - da
+        maxspeed = math.sqrt(2.0 * accel * da)
+    ta = maxspeed / accel
+    tc = (steps - da - dd) / maxspeed
+    def at(s):
+        if s <= da: return math.sqrt(2.0 * s / accel)
+        if s <= steps - dd: return ta + (s - da) / maxspeed
+        r = steps - s
+        return ta + tc + maxspeed / decel - math.sqrt(2.0 * r / decel)
+    # Start half a step in so the first period is finite
+    return [at(0.5 + i) for i in range(steps)]
+
+def scurve(steps, maxspeed, accel, jerk):
+    # Jerk limited move, velocity is integrated numerically
+    tj = accel / jerk
+    va = accel * tj
+    if va > maxspeed:
+        tj = math.sqrt(maxspeed / jerk)
+        accel = jerk * tj
+    ta = maxspeed / accel - tj
+    tramp = 2 * tj + ta
+    dramp = maxspeed * tramp / 2.0
+    if 2 * dramp > steps:
+        return scurve(steps, maxspeed * math.sqrt(steps / (2.0 * dramp)) * 0.98, accel, jerk)
+    tc = (steps - 2 * dramp) / maxspeed
+    total = 2 * tramp + tc
+    def ramp(t):
+        if t < tj: return jerk * t * t / 2.0
+        if t < tj + ta: return jerk * tj * tj / 2.0 + accel * (t - tj)
+        r = tramp - t
+        return maxspeed - jerk * r * r / 2.0
+    def velocity(t):
+        if t < tramp: return ramp(t)
+        if t < tramp + tc: return maxspeed
+        return ramp(max(0.0, total - t))
+    times = times_from_velocity(velocity, total)
+    return times[:steps]
+
+def _slope(periods, i, n):
+    return (periods[i + n - 1] - periods[i]) / (n - 1) if n > 1 else 0.0
+
+def _fits(periods, i, n, tolerance):
+    d = _slope(periods, i, n)
+    return all(abs(periods[i] + d * k - periods[i + k]) <= tolerance for k in range(n))
+
+def fit(periods, tolerance = 0.5):
+    # Greedy piecewise linear fit, every step stays within tolerance ticks of its target.
+    # Segment length grows by doubling then gets bisected, so long cruises stay cheap.
+    segments = []
+    i = 0
+    while i < len(periods):
+        left = len(periods) - i
+        good, bad = 1, None
+        while bad is None:
+            n = min(good * 2, left)
+            if n == good: break
+            if _fits(periods, i, n, tolerance): good = n
+            else: bad = n
+        while bad is not None and bad - good > 1:
+            n = (good + bad) // 2
+            if _fits(periods, i, n, tolerance): good = n
+            else: bad = n
+        segments.append((periods[i], _slope(periods, i, good), good))
+        i += good
+    return segments
+
+def pack(segments):
+    out = struct.pack(_HEADER, MAGIC, VERSION, len(segments), TICK_NS)
+    for first, d, n in segments:
+        period, dperiod = int(round(first * 256)), int(round(d * 256))
+        for p in (period, period + dperiod * (n - 1)):
+            if p < (MINPERIOD << 8) or p > (MAXPERIOD << 8):
+                raise ProfileError("Step period out of range (%.1f us)" % (p / 256.0 * TICK_NS / 1000.0))
+        out += struct.pack(_SEGMENT, period, dperiod, n)
+    if len(out) > MAXLEN:
+        raise ProfileError("Profile too large (%d bytes, %d segments), raise the tolerance" % (len(out), len(segments)))
+    return out
+
+def check(segments, steps):
+    total = sum(n for _, _, n in segments)
+    if total != steps:
+        raise ProfileError("Segments play %d steps, profile has %d" % (total, steps))
+    return segments
+
+def compile(times, tolerance = 0.5):
+    return pack(check(fit(periods_from_times(times), tolerance), len(times)))
+
+
+if __name__ == '__main__':
+    import argparse
+    import binascii
+
+    parser = argparse.ArgumentParser(description='Compile a step clock profile')
+    parser.add_argument('--steps', type=int, required=True, help='microsteps to move')
+    parser.add_argument('--maxspeed', type=float, required=True, help='microsteps/s')
+    parser.add_argument('--accel', type=float, required=True, help='microsteps/s^2')
+    parser.add_argument('--jerk', type=float, help='microsteps/s^3, gives an s-curve instead of a trapezoid')
+    parser.add_argument('--tolerance', type=float, default=0.5, help='allowed period error in 100ns ticks')
+    parser.add_argument('--out', help='write the binary profile here, otherwise print hex')
+    args = parser.parse_args()
+
+    times = scurve(args.steps, args.maxspeed, args.accel, args.jerk) if args.jerk else trapezoid(args.steps, args.maxspeed, args.accel)
+    if len(times) != args.steps:
+        raise ProfileError("Profile has %d steps, %d requested" % (len(times), args.steps))
+    segments = check(fit(periods_from_times(times), args.tolerance), args.steps)
+    profile = pack(segments)
+    print("%d steps, %.3f s, %d segments, %d bytes" % (args.steps, times[-1] - times[0], len(segments), len(profile)))
+    if args.out:
+        with open(args.out, 'wb') as f: f.write(profile)
+    else:
+        print(binascii.hexlify(profile).decode('ascii'))